@@ -21,40 +21,15 @@ Cyclenpo_HandleTypeDef Cyclenpo = { .Slave_add = 0x02 };
 int Process_complete=1;
 int send_ready=0;
 
-MntDataType mntBData[20]=
-{
-		{"Vtotal1","V",0.0},//1
-		{"Itotal1","A",0.0},//2
-		{"SOC1","N",0.0},//3
-		{"SOH1","N",0.0},//4
-		{"MaxVcell1","V",0.0},//5
-		{"Tmax1","C",0.0},//6
-		{"Tmos1","C",0.0},//7
-		{"PrtCode1","A",0.0},//8
-		{"WarCode1","A",0.0},//9
-		{"Vtotal2","V",0.0},//1
-		{"Itotal2","A",0.0},//2
-		{"SOC2","N",0.0},//3
-		{"SOH2","N",0.0},//4
-		{"MaxVcell2","V",0.0},//5
-		{"Tmax2","C",0.0},//6
-		{"Tmos2","C",0.0},//7
-		{"PrtCode2","A",0.0},//8
-		{"WarCode2","A",0.0}//9
-};
 
 
 int BP3_To_HMI_sendWriteReq(void);
+static void Cyclenpo_UpdateSignals(EnuSignalGroup group, EnuSignalId base);
 
 
 void BP3_cyclenpo_realtime_read(void)
 {
 
-		registerToDatabase("Batt12",
-				mntBData,
-				18);
-
-
 	RString[0]=0x11;
 	RString[1]=0x04;
 	RString[2]=0x10;
@@ -95,10 +70,6 @@ void Cyclenpo_realtime_Process(char *str,int Len)
 		{
 		case 0x04:
 		{
-			Database_Type* mDb=getMntDatabase();
-				MntDataType* mData = mDb[3].mData;
-
-
 			Cyclenpo.Vtotal           = ((str[3]  << 8) | str[4])*0.01;			//Volt
 			Cyclenpo.CurrentTotal     = ((str[5]  << 8) | str[6])*0.01;			//A
 			Cyclenpo.SOC              = (str[7]  << 8) | str[8];				//%
@@ -163,28 +134,12 @@ void Cyclenpo_realtime_Process(char *str,int Len)
 			}
 			if(str[0]==0x11)
 			{
-			mData[0     ].value  = Cyclenpo.Vtotal;
-					mData[1   ].value  = Cyclenpo.CurrentTotal;
-					mData[2   ].value  = Cyclenpo.SOC;
-					mData[3     ].value  = Cyclenpo.SOH;
-					mData[4     ].value  = Cyclenpo.Max_V_cell;
-					mData[5     ].value  = Cyclenpo.T_max;
-					mData[6     ].value  = Cyclenpo.T_MOS;
-					mData[7    ].value  = Cyclenpo.Protection_code;
-					mData[8    ].value  = Cyclenpo.Warning_code;
+				Cyclenpo_UpdateSignals(SIG_GROUP_BP1, SIG_BP1_VTOTAL);
 			}
 			if(str[0]==0x12)
-				{
-				mData[9     ].value  = Cyclenpo.Vtotal;
-						mData[10   ].value  = Cyclenpo.CurrentTotal;
-						mData[11   ].value  = Cyclenpo.SOC;
-						mData[12    ].value  = Cyclenpo.SOH;
-						mData[13     ].value  = Cyclenpo.Max_V_cell;
-						mData[14     ].value  = Cyclenpo.T_max;
-						mData[15     ].value  = Cyclenpo.T_MOS;
-						mData[16    ].value  = Cyclenpo.Protection_code;
-						mData[17   ].value  = Cyclenpo.Warning_code;
-				}
+			{
+				Cyclenpo_UpdateSignals(SIG_GROUP_BP2, SIG_BP2_VTOTAL);
+			}
 
 		}
 		break;
@@ -194,6 +149,22 @@ void Cyclenpo_realtime_Process(char *str,int Len)
 	}
 }
 
+/* Publish the pack values as one block, base is the Vtotal signal of the pack */
+static void Cyclenpo_UpdateSignals(EnuSignalGroup group, EnuSignalId base)
+{
+	signal_db_begin(group);
+	signal_db_set(base, Cyclenpo.Vtotal);
+	signal_db_set(base + (SIG_BP1_ITOTAL    - SIG_BP1_VTOTAL), Cyclenpo.CurrentTotal);
+	signal_db_set(base + (SIG_BP1_SOC       - SIG_BP1_VTOTAL), Cyclenpo.SOC);
+	signal_db_set(base + (SIG_BP1_SOH       - SIG_BP1_VTOTAL), Cyclenpo.SOH);
+	signal_db_set(base + (SIG_BP1_MAX_VCELL - SIG_BP1_VTOTAL), Cyclenpo.Max_V_cell);
+	signal_db_set(base + (SIG_BP1_TMAX      - SIG_BP1_VTOTAL), Cyclenpo.T_max);
+	signal_db_set(base + (SIG_BP1_TMOS      - SIG_BP1_VTOTAL), Cyclenpo.T_MOS);
+	signal_db_set(base + (SIG_BP1_PRT_CODE  - SIG_BP1_VTOTAL), Cyclenpo.Protection_code);
+	signal_db_set(base + (SIG_BP1_WAR_CODE  - SIG_BP1_VTOTAL), Cyclenpo.Warning_code);
+	signal_db_end(group);
+}
+
 void Cyclenpo_batprtctn_Process(char *str,int Len)
 {
 
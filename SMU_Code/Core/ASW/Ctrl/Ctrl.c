@@ -47,6 +47,7 @@
 #include "S1_INV.h"
 #include "smu.h"
 #include "BP1_Batt.h"
+#include "alarm_engine.h"
 
 /*!
  **************************************************************************************************
@@ -205,9 +206,7 @@ static void Ctrl_SetOutputs(void) {
  */
 static void Ctrl_OutputRoutine(void) {
 	// Main logic routine
-	Database_Type* mDb = getMntDatabase();
-
-	if ((DEADBAT == 0) && !((int) mDb[1].mData[S1_MNT_InvState].value == 3) && !((int) mDb[2].mData[S2_MNT_State].value == 3)) {
+	if ((DEADBAT == 0) && !((int) signal_db_get(SIG_S1_INV_STATE) == 3) && !((int) signal_db_get(SIG_S2_STATE) == 3)) {
 		if ((MODESEL == 0)||(MODESEL == 2)) {
 			if (GENOFF == 0) {
 				if (INVcommand == 1) {
@@ -272,8 +271,7 @@ static void Ctrl_OutputRoutine(void) {
  **************************************************************************************************
  */
 static void Ctrl_CheckConditions(void)
-{  Database_Type* mDb = getMntDatabase();
-
+{
 static int countssroff = 0, countssron = 0;
 static int countgenoff = 0, countgenon = 0;
 if ((SSR_ON & 0x01) == 1) {
@@ -331,12 +329,7 @@ GENOFF = _memoryMap[37];
  */
 void Ctrl_GeneralControl(void)
 {
-	Database_Type* mDb = getMntDatabase();
-
-	MntDataType* mData = mDb[1].mData;
-	float f32BattPower=S2_CH_GetBattPower();
 	float f32TempRef = (float) _memoryMap[30] / 10;
-	u16 u16DeadBattState=(u16)mDb[1].mData[S1_MNT_InvState].value;
 	RefDataType *rData=getRefData();
 	if(rData[INV_LOAD_RLY_INDEX].value == 2)
 	{
@@ -350,8 +343,7 @@ void Ctrl_GeneralControl(void)
 
 
 
-	mData = mDb[0].mData;
-	mData[SMU_MNT_TEMPE].value=getTemp();
+	signal_db_set(SIG_SMU_TEMPE,getTemp());
 	_memoryMap[236] = (int) (getTemp() * 10);
 	BatteryPack1.Vblock = (float) _memoryMap[35] / 100;
 	BatteryPack1.Tblock = _memoryMap[36];
@@ -401,19 +393,20 @@ void Ctrl_GeneralControl(void)
 	//System status update - = discharge
 
 
-	if ((f32BattPower > BATT_POWER_LOW_HYST) && (f32BattPower < BATT_POWER_HIGH_HYST)) {
-		U16BattState = BATT_STATE_IDLE;
-		LED_COLOR = LED_SOLID_GREEN;
-	} //Idle
-	else if (f32BattPower > BATT_POWER_HIGH_HYST) {
+	/* Power thresholds and the dead battery state are alarm engine rules */
+	if (1 == alarm_engine_active(ALARM_BATT_CHARGING)) {
 		U16BattState = BATT_STATE_CHARGING;
 		LED_COLOR = LED_BLINK_GREEN;
 	} //charge
-	else if (f32BattPower < BATT_POWER_LOW_HYST) {
+	else if (1 == alarm_engine_active(ALARM_BATT_DISCHARGING)) {
 		U16BattState = BATT_STATE_DISCHARGING;
 		LED_COLOR = LED_SOLID_GREEN;
 	} //Discharge
-	if (u16DeadBattState  == BATTERY_DEAD) {
+	else {
+		U16BattState = BATT_STATE_IDLE;
+		LED_COLOR = LED_SOLID_GREEN;
+	} //Idle
+	if (1 == alarm_engine_active(ALARM_BATT_DEAD)) {
 		U16BattState = BATT_STATE_DEAD_RCOVERY;
 		LED_COLOR = LED_BLINK_RED;
 	} //Dead batt recovery
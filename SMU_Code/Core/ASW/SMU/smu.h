@@ -15,14 +15,8 @@
 //#define SMU_ID 0x00
 
 
-typedef enum{
-        SMU_MNT_LIVE=0,
-	SMU_MNT_TEMPE,       /*0*/
-        SMU_MNT_DATA_Size
-}SMU_MntEnumType;
 
 
-void SMU_Database_Init(void);
 void SMU_Slaves_Database_Init(void);
 
 #endif /* ASW_S2_CH_S2_CH_H_ */
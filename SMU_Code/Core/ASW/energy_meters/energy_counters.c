@@ -0,0 +1,343 @@
+/**
+ * @file energy_counters.c
+ * @brief Import/export energy counters implementation
+ *
+ * The counters are written only from the energy meter handler. Checkpoints
+ * cross to the memory manager through a copy: the handler fills gSaveImage
+ * and raises gSavePending, energy_counters_service() hands the copy to the
+ * key/value store and clears the flag, and the handler does not touch the
+ * copy while the flag is set.
+ *
+ * @date 2025-10-31
+ * @author Allayar Moazami
+ */
+#include "energy_counters.h"
+#include "energy_meter_hal.h"
+#include "signal_db.h"
+#include "kv_store.h"
+#include "dbg.h"
+#include "main.h"
+#include <stdio.h>
+#include <string.h>
+
+/* ========================================================================
+ * Constants
+ * ======================================================================== */
+
+/** @brief Counter value at which a counter wraps to zero */
+#define ENERGY_COUNTER_ROLLOVER (ENERGY_COUNTER_ROLLOVER_KWH * ENERGY_COUNTER_PER_KWH)
+
+/** @brief Bytes stored under one key: the import and export counter of a pair */
+#define ENERGY_COUNTER_PAIR_SIZE (2U * sizeof(uint64_t))
+
+/** @brief Size of temporary string buffer for formatting */
+#define TEMP_STRING_SIZE 96
+
+/* ========================================================================
+ * Static Variables
+ * ======================================================================== */
+
+/** @brief Counters in uWs */
+static uint64_t gCounter[ENERGY_METER_CHANNELS][ENERGY_QUANTITY_COUNT];
+
+/** @brief Checkpoint copy waiting for energy_counters_service() */
+static uint64_t gSaveImage[ENERGY_METER_CHANNELS][ENERGY_QUANTITY_COUNT];
+
+/** @brief gSaveImage holds a checkpoint not yet handed to the store */
+static volatile u8 gSavePending = 0;
+
+/** @brief Checkpoint at the next update regardless of the interval */
+static u8 gSaveNow = 0;
+
+/** @brief Tick of the last checkpoint */
+static u32 gLastSave = 0;
+
+/** @brief Tick of the last signal publish */
+static u32 gLastPublish = 0;
+
+/** @brief Previous sweep, the baseline of the next interval */
+static StuEnergyMeterSnapshot gPrevious;
+
+/** @brief gPrevious is valid */
+static u8 gBaseValid = 0;
+
+/** @brief Counter reset requested from the command line */
+static volatile u8 gResetRequest = 0;
+
+/** @brief Power trapezoids not yet booked, in 0.5 uWs, so no rounding is lost */
+static int64_t gHalfUws[ENERGY_METER_CHANNELS][2];
+
+/** @brief Power intervals cut to ENERGY_COUNTER_MAX_GAP */
+static u32 gGapCount = 0;
+
+/** @brief Checkpoints handed to the store */
+static u32 gSaveCount = 0;
+
+/* ========================================================================
+ * Static Helper Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Add energy to a counter, wrapping at the rollover reading
+ * @param[in,out] counter Counter
+ * @param[in]     amount  Energy in uWs, not negative
+ */
+static void energy_counters_add(uint64_t *counter, uint64_t amount)
+{
+    *counter += amount % ENERGY_COUNTER_ROLLOVER;
+    if (*counter >= ENERGY_COUNTER_ROLLOVER) {
+        *counter -= ENERGY_COUNTER_ROLLOVER;
+    }
+}
+
+/**
+ * @brief Book a signed energy flow on the import or export counter
+ * @param[in] channel Channel index (0 or 1)
+ * @param[in] quantity ENERGY_ACTIVE_IMPORT or ENERGY_REACTIVE_IMPORT
+ * @param[in] amount  Energy in uWs, negative for export
+ */
+static void energy_counters_flow(u8 channel, EnuEnergyQuantity quantity, int64_t amount)
+{
+    if (amount >= 0) {
+        energy_counters_add(&gCounter[channel][quantity], (uint64_t)amount);
+    } else {
+        energy_counters_add(&gCounter[channel][quantity + 1], (uint64_t)(-amount));
+    }
+}
+
+#if !ENERGY_COUNTER_FROM_REGISTERS
+/**
+ * @brief Round a power to whole mW
+ * @param[in] power Power in W or var
+ * @return Power in mW or mvar
+ */
+static int32_t energy_counters_milli(f32 power)
+{
+    return (int32_t)(power * 1000.0f + ((power >= 0.0f) ? 0.5f : -0.5f));
+}
+
+/**
+ * @brief Book the trapezoid of a power over one interval
+ * @param[in] channel  Channel index (0 or 1)
+ * @param[in] quantity ENERGY_ACTIVE_IMPORT or ENERGY_REACTIVE_IMPORT
+ * @param[in] now      Power at the end of the interval in W or var
+ * @param[in] prev     Power at the start of the interval in W or var
+ * @param[in] dt       Interval in ms
+ */
+static void energy_counters_trapezoid(u8 channel, EnuEnergyQuantity quantity, f32 now, f32 prev, u32 dt)
+{
+    int64_t *half = &gHalfUws[channel][quantity / 2U];
+    int64_t whole;
+
+    /* (mW + mW) x ms is twice the energy in uWs, the odd half waits */
+    *half += ((int64_t)energy_counters_milli(now) + energy_counters_milli(prev)) * (int64_t)dt;
+    whole = *half / 2;
+    *half -= whole * 2;
+    energy_counters_flow(channel, quantity, whole);
+}
+#endif
+
+/**
+ * @brief Publish all counters as kWh / kvarh signals
+ */
+static void energy_counters_publish(void)
+{
+    u8 id = SIG_EM1_EP_IMP;
+
+    signal_db_begin(SIG_GROUP_EM);
+    for (u8 ch = 0; ch < ENERGY_METER_CHANNELS; ch++) {
+        for (u8 q = 0; q < ENERGY_QUANTITY_COUNT; q++) {
+            /* Whole Wh first, the float only carries the reading */
+            signal_db_set((EnuSignalId)id++, (f32)(gCounter[ch][q] / ENERGY_COUNTER_PER_WH) / 1000.0f);
+        }
+    }
+    signal_db_end(SIG_GROUP_EM);
+}
+
+/* ========================================================================
+ * Public Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Restore the counters from the flash key/value store
+ */
+void energy_counters_init(void)
+{
+    for (u8 ch = 0; ch < ENERGY_METER_CHANNELS; ch++) {
+        for (u8 pair = 0; pair < 2U; pair++) {
+            uint64_t *counter = &gCounter[ch][pair * 2U];
+
+            if (ENERGY_COUNTER_PAIR_SIZE != kv_store_get(KV_KEY_ENERGY(ch * 2U + pair), counter,
+                                                         ENERGY_COUNTER_PAIR_SIZE)) {
+                counter[0] = 0;
+                counter[1] = 0;
+            }
+            counter[0] %= ENERGY_COUNTER_ROLLOVER;
+            counter[1] %= ENERGY_COUNTER_ROLLOVER;
+        }
+    }
+    gLastSave = HAL_GetTick();
+}
+
+/**
+ * @brief Drop the integration and register baseline
+ */
+void energy_counters_restart(void)
+{
+    gBaseValid = 0;
+}
+
+/**
+ * @brief Accumulate one completed sweep
+ *
+ * @param[in] snapshot Sweep just completed
+ */
+void energy_counters_update(const StuEnergyMeterSnapshot *snapshot)
+{
+#if !ENERGY_COUNTER_FROM_REGISTERS
+    u32 dt = snapshot->tick - gPrevious.tick;
+#endif
+
+    if (1U == gResetRequest) {
+        memset(gCounter, 0, sizeof(gCounter));
+        memset(gHalfUws, 0, sizeof(gHalfUws));
+        gResetRequest = 0;
+        gSaveNow = 1;
+    }
+
+    if (1U == gBaseValid) {
+#if !ENERGY_COUNTER_FROM_REGISTERS
+        /* The power in between is unknown, assume it held for a bounded time */
+        if (dt > ENERGY_COUNTER_MAX_GAP) {
+            dt = ENERGY_COUNTER_MAX_GAP;
+            gGapCount++;
+        }
+#endif
+        for (u8 ch = 0; ch < ENERGY_METER_CHANNELS; ch++) {
+            const StuEnergyMeterChannel *now = &snapshot->ch[ch];
+            const StuEnergyMeterChannel *prev = &gPrevious.ch[ch];
+#if ENERGY_COUNTER_FROM_REGISTERS
+            /* Signed difference, so a register wrapping through zero adds up */
+            energy_counters_flow(ch, ENERGY_ACTIVE_IMPORT,
+                                 (int64_t)(int32_t)(now->activeEnergy - prev->activeEnergy) * STPM34_ENERGY_LSB_UWS);
+            energy_counters_flow(ch, ENERGY_REACTIVE_IMPORT,
+                                 (int64_t)(int32_t)(now->reactiveEnergy - prev->reactiveEnergy) * STPM34_ENERGY_LSB_UWS);
+#else
+            energy_counters_trapezoid(ch, ENERGY_ACTIVE_IMPORT, now->activePower, prev->activePower, dt);
+            energy_counters_trapezoid(ch, ENERGY_REACTIVE_IMPORT, now->reactivePower, prev->reactivePower, dt);
+#endif
+        }
+    }
+    gPrevious = *snapshot;
+    gBaseValid = 1;
+
+    if ((snapshot->tick - gLastPublish) >= ENERGY_COUNTER_PUBLISH_MS || 1U == gSaveNow) {
+        gLastPublish = snapshot->tick;
+        energy_counters_publish();
+    }
+
+    if (0U == gSavePending &&
+        (1U == gSaveNow || (snapshot->tick - gLastSave) >= ENERGY_COUNTER_SAVE_MS)) {
+        memcpy(gSaveImage, gCounter, sizeof(gSaveImage));
+        gLastSave = snapshot->tick;
+        gSaveNow = 0;
+        gSavePending = 1;
+    }
+}
+
+/**
+ * @brief Hand a prepared checkpoint to the flash key/value store
+ */
+void energy_counters_service(void)
+{
+    if (0U == gSavePending) {
+        return;
+    }
+    for (u8 ch = 0; ch < ENERGY_METER_CHANNELS; ch++) {
+        for (u8 pair = 0; pair < 2U; pair++) {
+            if (0U == kv_store_set(KV_KEY_ENERGY(ch * 2U + pair), &gSaveImage[ch][pair * 2U],
+                                   ENERGY_COUNTER_PAIR_SIZE)) {
+                TransmitDebug(">> Energy checkpoint rejected\r");
+            }
+        }
+    }
+    gSaveCount++;
+    gSavePending = 0;
+}
+
+/**
+ * @brief Read one counter
+ *
+ * @param[in] channel  Channel number (1 or 2)
+ * @param[in] quantity EnuEnergyQuantity
+ *
+ * @return Counter in uWs, 0 for an invalid channel or quantity
+ */
+uint64_t energy_counters_get(u8 channel, EnuEnergyQuantity quantity)
+{
+    if (channel < 1U || channel > ENERGY_METER_CHANNELS || quantity >= ENERGY_QUANTITY_COUNT) {
+        return 0;
+    }
+    return gCounter[channel - 1U][quantity];
+}
+
+/**
+ * @brief Command line interface for the energy counters
+ *
+ * @param[in,out] str Command string
+ *
+ * @return 1 while lines remain, 0 when done
+ */
+u8 energy_counters_cmd(char *str)
+{
+    static u8 line = 0;
+    char tempStr[TEMP_STRING_SIZE];
+
+    if (0U == line && NULL != strstr(str, "reset")) {
+        gResetRequest = 1;
+        TransmitCMDResponse("\r>Energy counters reset\r");
+        return 0;
+    }
+
+    /* One channel per call */
+    if (line < ENERGY_METER_CHANNELS) {
+        u8 id = SIG_EM1_EP_IMP + (line * ENERGY_QUANTITY_COUNT);
+
+        snprintf(tempStr, sizeof(tempStr), "\r>EM%u P+:%.3f P-:%.3f kWh Q+:%.3f Q-:%.3f kvarh\r",
+                 line + 1U, signal_db_get((EnuSignalId)id), signal_db_get((EnuSignalId)(id + 1U)),
+                 signal_db_get((EnuSignalId)(id + 2U)), signal_db_get((EnuSignalId)(id + 3U)));
+        TransmitCMDResponse(tempStr);
+        line++;
+        return 1;
+    }
+    line = 0;
+    snprintf(tempStr, sizeof(tempStr), "\r>Energy from %s, gaps:%lu checkpoints:%lu\r",
+             (0 != ENERGY_COUNTER_FROM_REGISTERS) ? "registers" : "power",
+             (unsigned long)gGapCount, (unsigned long)gSaveCount);
+    TransmitCMDResponse(tempStr);
+    return 0;
+}
+
+/**
+ * @brief Display help information for energy commands
+ *
+ * @return 1 while help lines remain, 0 when done
+ */
+u8 energy_counters_cmd_help(void)
+{
+    static u8 state = 0;
+    u8 returnValue = 1;
+
+    switch (state) {
+    case 0:
+        TransmitCMDResponse("     energy                 -> (Returns the energy counters) \r");
+        state = 1;
+        break;
+    case 1:
+        TransmitCMDResponse("     energy reset           -> (Clears the energy counters) \r");
+        state = 0;
+        returnValue = 0;
+        break;
+    }
+    return returnValue;
+}
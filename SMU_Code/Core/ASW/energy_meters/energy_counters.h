@@ -0,0 +1,137 @@
+/**
+ * @file energy_counters.h
+ * @brief Import/export energy counters of the STPM34 channels
+ *
+ * Every channel has four counters: imported and exported active energy and
+ * imported and exported reactive energy. They are 64-bit fixed point in
+ * uWs (1 kWh = 3.6e12), fed from every completed STPM34 sweep either by
+ * integrating the measured power over the sweep interval (trapezoidal) or,
+ * with ENERGY_COUNTER_FROM_REGISTERS, from the change of the cumulative
+ * energy registers of the chip. A positive flow counts as import, a
+ * negative one as export.
+ *
+ * All integration is integer: the power is taken in mW and multiplied by
+ * the interval in ms (mW x ms = uWs), the register change is multiplied
+ * by the whole uWs of one LSB. Only the published signals are scaled.
+ *
+ * Like a mechanical register, a counter wraps to zero at
+ * ENERGY_COUNTER_ROLLOVER_KWH. The register change is booked whatever
+ * the time between two sweeps, since the chip kept counting. When
+ * integrating power, an interval longer than ENERGY_COUNTER_MAX_GAP
+ * (meter not answering) is integrated over ENERGY_COUNTER_MAX_GAP only
+ * and counted as a gap. A restart of the chip drops the baseline, so a
+ * cleared energy register is not taken for a huge step.
+ *
+ * The counters are checkpointed to the internal flash key/value store every
+ * ENERGY_COUNTER_SAVE_MS and right after a reset; at start-up they continue
+ * from the last checkpoint. They are published as kWh / kvarh signals once
+ * per second, so the totals do not depend on the server integrating the
+ * sparse telemetry samples.
+ *
+ * @date 2025-10-31
+ * @author Allayar Moazami
+ */
+#ifndef H_ENERGY_COUNTERS
+#define H_ENERGY_COUNTERS
+
+#include "platform.h"
+#include "energy_meters.h"
+
+/** @brief Take energy from the STPM34 energy registers instead of integrating power */
+#ifndef ENERGY_COUNTER_FROM_REGISTERS
+#define ENERGY_COUNTER_FROM_REGISTERS 0
+#endif
+
+/** @brief Counter units per kWh, the counters count uWs */
+#define ENERGY_COUNTER_PER_KWH 3600000000000ULL
+
+/** @brief Counter units per Wh */
+#define ENERGY_COUNTER_PER_WH 3600000000ULL
+
+/** @brief Counters wrap to zero at this reading */
+#define ENERGY_COUNTER_ROLLOVER_KWH 1000000ULL
+
+/** @brief Longest sweep interval in ms the power is integrated over */
+#define ENERGY_COUNTER_MAX_GAP 1000U
+
+/** @brief Checkpoint interval in ms, at most this much energy is lost on power failure */
+#define ENERGY_COUNTER_SAVE_MS 900000UL
+
+/** @brief Signal publish interval in ms */
+#define ENERGY_COUNTER_PUBLISH_MS 1000U
+
+/**
+ * @enum EnuEnergyQuantity
+ * @brief Counters of one channel
+ */
+typedef enum EnuEnergyQuantityEnum
+{
+    ENERGY_ACTIVE_IMPORT = 0,   /**< Imported active energy */
+    ENERGY_ACTIVE_EXPORT,       /**< Exported active energy */
+    ENERGY_REACTIVE_IMPORT,     /**< Imported reactive energy */
+    ENERGY_REACTIVE_EXPORT,     /**< Exported reactive energy */
+    ENERGY_QUANTITY_COUNT       /**< Number of counters per channel */
+} EnuEnergyQuantity;
+
+/**
+ * @brief Restore the counters from the flash key/value store
+ *
+ * Called once at start-up after kv_store_init(). Missing keys start at 0.
+ */
+void energy_counters_init(void);
+
+/**
+ * @brief Drop the integration and register baseline
+ *
+ * Called by the energy meter handler whenever the chip is initialized
+ * again; the next sweep only sets the baseline.
+ */
+void energy_counters_restart(void);
+
+/**
+ * @brief Accumulate one completed sweep
+ *
+ * Called by the energy meter handler, the only writer of the counters.
+ * Also publishes the signals and prepares the checkpoints.
+ *
+ * @param[in] snapshot Sweep just completed
+ */
+void energy_counters_update(const StuEnergyMeterSnapshot *snapshot);
+
+/**
+ * @brief Hand a prepared checkpoint to the flash key/value store
+ *
+ * Called periodically from RTE_MNT_MNG, the context of kv_store_service().
+ */
+void energy_counters_service(void);
+
+/**
+ * @brief Read one counter
+ *
+ * @param[in] channel  Channel number (1 or 2)
+ * @param[in] quantity EnuEnergyQuantity
+ *
+ * @return Counter in uWs, 0 for an invalid channel or quantity
+ */
+uint64_t energy_counters_get(u8 channel, EnuEnergyQuantity quantity);
+
+/**
+ * @brief Command line interface for the energy counters
+ *
+ * "energy" prints the counters of both channels, "energy reset" clears
+ * them and writes a checkpoint.
+ *
+ * @param[in,out] str Command string
+ *
+ * @return 1 while lines remain, 0 when done
+ */
+u8 energy_counters_cmd(char *str);
+
+/**
+ * @brief Display help information for energy commands
+ *
+ * @return 1 while help lines remain, 0 when done
+ */
+u8 energy_counters_cmd_help(void);
+
+#endif /* H_ENERGY_COUNTERS */
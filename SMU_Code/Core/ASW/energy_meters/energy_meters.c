@@ -10,17 +10,36 @@
  */
 
 #include "energy_meters.h"
+#include "energy_counters.h"
+#include "power_quality.h"
 #include "crc.h"
 #include "energy_meter_hal.h"
 #include "energy_meter_dll.h"
+#include "dbg.h"
+#include "main.h"
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+/* ========================================================================
+ * Private Constants
+ * ======================================================================== */
+
+/** @brief Size of temporary string buffer for formatting */
+#define TEMP_STRING_SIZE 160
+
+/** @brief Attempts of one init step before the init starts over */
+#define ENERGY_METER_INIT_RETRIES 3U
+
+/** @brief Consecutive sweep timeouts before the chip is initialized again */
+#define ENERGY_METER_TIMEOUT_RESTART 3U
+
 /* ========================================================================
  * Private Variables
  * ======================================================================== */
 
-/** @brief Timeout counter for energy meter operations */
-static u32 gEnergyMeterTimeout = 0;
+/** @brief Transaction on the link, ENERGY_METER_DLL_NO_XFER if none */
+static u8 gXfer = ENERGY_METER_DLL_NO_XFER;
 
 /** @brief Last received data from STPM34 */
 static u32 gLastReadValue = 0;
@@ -28,12 +47,6 @@ static u32 gLastReadValue = 0;
 /** @brief Current register address being read/written */
 static u8 gCurrentRegister = 0;
 
-/** @brief Previous register address (for delayed response protocol) */
-static u8 gPreviousRegister = 0xFF;
-
-/** @brief Flag indicating if we should store response data (delayed response handling) */
-static u8 gStoreResponseData = 0;
-
 /** @brief Timeout occurrence counter (for diagnostics) */
 static u32 gTimeoutCount = 0;
 
@@ -46,6 +59,21 @@ static u8 gChipInitialized = 0;
 /** @brief CRC error counter (for diagnostics) */
 static u32 gCrcErrorCount = 0;
 
+/** @brief Sweeps dropped for a bad or missing frame (for diagnostics) */
+static u32 gSweepDropCount = 0;
+
+/** @brief Init restarts after a failed step or repeated sweep timeouts (for diagnostics) */
+static u32 gRestartCount = 0;
+
+/** @brief Failed attempts of the current init step */
+static u8 gStepRetry = 0;
+
+/** @brief Software resets sent since the init started, odd ones go at the fast rate */
+static u8 gResetAttempt = 0;
+
+/** @brief Sweep timeouts in a row */
+static u8 gTimeoutRun = 0;
+
 /** @brief Successful transaction counter (for diagnostics) */
 static u32 gSuccessCount = 0;
 
@@ -55,35 +83,52 @@ static float gVoltageCal = 1.0f;
 /** @brief Current calibration factor (multiplier for current readings) */
 static float gCurrentCal = 1.0f;
 
-/** @brief Cached channel 1 active power (in Watts) */
-static float gCh1ActivePower = 0.0f;
-
-/** @brief Cached channel 1 reactive power (in VAR) */
-static float gCh1ReactivePower = 0.0f;
-
-/** @brief Cached channel 1 RMS voltage (in Volts) */
-static float gCh1RmsVoltage = 0.0f;
-
-/** @brief Cached channel 1 RMS current (in mA) */
-static float gCh1RmsCurrent = 0.0f;
-
-/** @brief Cached channel 2 active power (in Watts) */
-static float gCh2ActivePower = 0.0f;
-
-/** @brief Cached channel 2 reactive power (in VAR) */
-static float gCh2ReactivePower = 0.0f;
-
-/** @brief Cached channel 2 RMS voltage (in Volts) */
-static float gCh2RmsVoltage = 0.0f;
-
-/** @brief Cached channel 2 RMS current (in mA) */
-static float gCh2RmsCurrent = 0.0f;
+/** @brief Registers read by one sweep, both channels */
+static const u8 gSweepRegister[] = {
+	STPM34_REG_CH1_ACTIVE_POWER,
+	STPM34_REG_CH1_REACTIVE_POWER,
+	STPM34_REG_CH1_APPARENT_RMS,
+	STPM34_REG_CH2_ACTIVE_POWER,
+	STPM34_REG_CH2_REACTIVE_POWER,
+	STPM34_REG_CH2_APPARENT_RMS,
+	STPM34_REG_CH1_CURRENT_RMS,
+	STPM34_REG_CH1_VOLTAGE_RMS,
+	STPM34_REG_CH2_CURRENT_RMS,
+	STPM34_REG_CH2_VOLTAGE_RMS,
+	STPM34_REG_LINE_PERIOD,
+#if ENERGY_COUNTER_FROM_REGISTERS
+	STPM34_REG_CH1_ACTIVE_ENERGY,
+	STPM34_REG_CH1_REACTIVE_ENERGY,
+	STPM34_REG_CH2_ACTIVE_ENERGY,
+	STPM34_REG_CH2_REACTIVE_ENERGY,
+#endif
+};
+
+/** @brief Number of registers read by one sweep */
+#define ENERGY_METER_SWEEP_REGS (sizeof(gSweepRegister) / sizeof(gSweepRegister[0]))
+
+/** @brief Frames of one sweep: one read per register, then the latch */
+static u8 gSweepFrames[(ENERGY_METER_SWEEP_REGS + 1U) * STPM34_FRAME_SIZE];
+
+/** @brief Snapshot being decoded from the running sweep */
+static StuEnergyMeterSnapshot gSweep;
+
+/** @brief Snapshot of the last completed sweep */
+static StuEnergyMeterSnapshot gSnapshot;
+
+/** @brief Link requested by energy_meters_set_link() */
+static EnuEnergyMeterLink gLinkRequested = ENERGY_METER_LINK_DEFAULT;
+
+/** @brief A link change is pending */
+static volatile u8 gLinkChange = 0;
+
+/** @brief Sweep timing */
+static StuEnergyMeterSweepStats gSweepStats;
 
 /* ========================================================================
  * Static Function Prototypes
  * ======================================================================== */
 
-static u8 energy_meters_send_read_req(u8 addr);
 static u8 energy_meters_send_write_req(u8 addr, u32 value);
 static EnuEnergyMeterStatus energy_meters_process_response(void);
 static u32 energy_meters_parse_response(u8 *rxBuf);
@@ -91,7 +136,13 @@ static int32_t energy_meters_convert_to_signed(u32 rawValue);
 static float energy_meters_convert_voltage(u32 rawValue);
 static float energy_meters_convert_current(u32 rawValue);
 static float energy_meters_convert_power(u32 rawValue);
+static float energy_meters_convert_frequency(u32 period);
 static void energy_meters_update_cached_values(u8 regAddr, u32 rawValue);
+static void energy_meters_build_frame(u8 *frame, u8 readAddr, u8 writeAddr, u16 data);
+static void energy_meters_build_sweep(void);
+static EnuEnergyMeterStatus energy_meters_process_sweep(void);
+static void energy_meters_time_sweep(u32 cycles, u32 tick);
+static EnuEnrgyMeterState energy_meters_step_failed(EnuEnrgyMeterState retry);
 
 /* ========================================================================
  * Public Function Implementations
@@ -106,19 +157,56 @@ static void energy_meters_update_cached_values(u8 regAddr, u32 rawValue);
  * Initialization sequence:
  * 1. Hardware init (UART, GPIO)
  * 2. Software reset chip
- * 3. Write all configuration registers
+ * 3. Write all configuration registers, switching to ENERGY_METER_BAUD_FAST
+ *    with US_REG2
  * 4. Latch data
- * 5. Read data registers continuously
+ * 5. Sweep the measurement registers continuously
+ *
+ * Every init step must be answered with a valid frame before the next one
+ * is sent. A step is tried ENERGY_METER_INIT_RETRIES times, then the init
+ * starts over at ENERGY_METER_BAUD_DEFAULT; a failed US_REG2 write starts
+ * over at once, the chip may already run at the new rate. A chip that is
+ * still at the fast rate misses a reset sent at the default rate, so every
+ * other reset is sent at ENERGY_METER_BAUD_FAST. ENERGY_METER_TIMEOUT_RESTART
+ * sweep timeouts in a row also start the init over.
+ *
+ * A sweep is one DMA transaction: a read frame per register of
+ * gSweepRegister followed by a latch frame, sent back to back. The STPM34
+ * answers every frame with the register requested by the frame before, so
+ * response k carries register k-1 and the latch frame flushes out the last
+ * one while freezing the data for the next sweep. A completed sweep queues
+ * the next one before it is decoded, so the link never waits for the
+ * decoder and a new snapshot is published every call.
+ *
+ * Transactions run asynchronously in the DLL, which also times them out;
+ * every state only submits or polls and never waits.
  */
 void energy_meters_handler(void) {
 	static EnuEnrgyMeterState state = ENU_EM_INIT;
 	EnuEnergyMeterStatus status;
 
+	if (gLinkChange) {
+		/* Start over on the new link */
+		gLinkChange = 0;
+		energy_meter_dll_transaction_end(gXfer);
+		gXfer = ENERGY_METER_DLL_NO_XFER;
+		energy_meter_dll_set_link(gLinkRequested);
+		gChipInitialized = 0;
+		state = ENU_EM_INIT;
+	}
+
 	switch (state) {
 	case ENU_EM_INIT:
-		/* Initialize hardware (UART, GPIO, DMA) */
+		/* Initialize hardware (UART, GPIO, DMA), the UART starts at the default rate */
 		energy_meters_hal_init();
 		energy_meter_dll_receive_init();
+		energy_counters_restart();
+		power_quality_restart();
+		gChipInitialized = 0;
+		gConfigComplete = 0;
+		gStepRetry = 0;
+		gResetAttempt = 0;
+		gTimeoutRun = 0;
 
 		/* Start initialization sequence with chip reset */
 		state = ENU_EM_RESET_CHIP_TX;
@@ -135,6 +223,10 @@ void energy_meters_handler(void) {
         /* Start with Channel 1 Active Power register */
         gCurrentRegister = STPM34_REG_CH1_ACTIVE_POWER;
 
+		/* The reset frame goes at the rate the chip may still be running at */
+		energy_meter_dll_set_baud(((gResetAttempt++ & 1U) != 0U) ?
+				ENERGY_METER_BAUD_FAST : ENERGY_METER_BAUD_DEFAULT);
+
 		/* Note: sampleCode reads 0x05 while writing DSP_CR3 during reset */
 		u8 txBuf[STPM34_FRAME_SIZE];
 		txBuf[0] = 0x05; /* Read address 0x05 */
@@ -142,9 +234,7 @@ void energy_meters_handler(void) {
 		txBuf[2] = dsp_cr3_value & 0xFF; /* Data LOW */
 		txBuf[3] = (dsp_cr3_value >> 8) & 0xFF; /* Data HIGH */
 		txBuf[4] = crc_stpm3x(txBuf, 4); /* CRC */
-		energy_meter_dll_transaction_send(txBuf, STPM34_FRAME_SIZE);
-
-		gEnergyMeterTimeout = 0;
+		gXfer = energy_meter_dll_transaction_send(txBuf, STPM34_FRAME_SIZE);
 		state = ENU_EM_RESET_CHIP_RX;
 	}
 		break;
@@ -153,14 +243,15 @@ void energy_meters_handler(void) {
 		/* Wait for reset confirmation */
 		status = energy_meters_process_response();
 
-		if (status == ENU_EM_STATUS_SUCCESS
-				|| status == ENU_EM_STATUS_TIMEOUT) {
-			/* End transaction - deselect chip (CS goes HIGH) */
-			energy_meter_dll_transaction_end();
-
-			/* Reset complete - start writing configuration registers */
+		if (status == ENU_EM_STATUS_SUCCESS) {
+			/* Reset complete, the chip is back at the default rate */
+			energy_meter_dll_set_baud(ENERGY_METER_BAUD_DEFAULT);
+			gStepRetry = 0;
 			gCurrentRegister = 0x00; /* Start from DSP_CR1 */
 			state = ENU_EM_WRITE_CONFIG_TX;
+		} else if (status != ENU_EM_STATUS_IDLE) {
+			/* Try the other rate, the chip state is unknown */
+			state = energy_meters_step_failed(ENU_EM_RESET_CHIP_TX);
 		}
 		break;
 
@@ -184,7 +275,7 @@ void energy_meters_handler(void) {
 			reg_value = STPM34_US_REG1_DEFAULT; /* CRC enabled */
 			break;
 		case STPM34_REG_US_REG2:
-			reg_value = STPM34_US_REG2_DEFAULT; /* Baud rate */
+			reg_value = STPM34_US_REG2_FAST; /* Baud rate */
 			break;
 		default:
 			reg_value = 0; /* Other registers use default 0 */
@@ -198,9 +289,7 @@ void energy_meters_handler(void) {
 		txBuf[2] = reg_value & 0xFF; /* Data LOW */
 		txBuf[3] = (reg_value >> 8) & 0xFF; /* Data HIGH */
 		txBuf[4] = crc_stpm3x(txBuf, 4); /* CRC */
-		energy_meter_dll_transaction_send(txBuf, STPM34_FRAME_SIZE);
-
-		gEnergyMeterTimeout = 0;
+		gXfer = energy_meter_dll_transaction_send(txBuf, STPM34_FRAME_SIZE);
 		state = ENU_EM_WRITE_CONFIG_RX;
 	}
 		break;
@@ -209,10 +298,19 @@ void energy_meters_handler(void) {
 		/* Wait for write confirmation */
 		status = energy_meters_process_response();
 
-		if (status == ENU_EM_STATUS_SUCCESS
-				|| status == ENU_EM_STATUS_TIMEOUT) {
-			/* End transaction - deselect chip (CS goes HIGH) */
-			energy_meter_dll_transaction_end();
+		if (status != ENU_EM_STATUS_IDLE && status != ENU_EM_STATUS_SUCCESS) {
+			if (gCurrentRegister == STPM34_REG_US_REG2) {
+				/* The rate of the chip is unknown now */
+				gStepRetry = ENERGY_METER_INIT_RETRIES;
+			}
+			state = energy_meters_step_failed(ENU_EM_WRITE_CONFIG_TX);
+		} else if (status == ENU_EM_STATUS_SUCCESS) {
+			gStepRetry = 0;
+
+			/* The chip uses the new baud rate from the next frame on */
+			if (gCurrentRegister == STPM34_REG_US_REG2) {
+				energy_meter_dll_set_baud(ENERGY_METER_BAUD_FAST);
+			}
 
 			/* Move to next configuration register */
 			gCurrentRegister += 2; /* STPM34 uses 16-bit addressing */
@@ -242,9 +340,7 @@ void energy_meters_handler(void) {
 		txBuf[2] = dsp_cr3_value & 0xFF; /* Data LOW */
 		txBuf[3] = (dsp_cr3_value >> 8) & 0xFF; /* Data HIGH */
 		txBuf[4] = crc_stpm3x(txBuf, 4); /* CRC */
-		energy_meter_dll_transaction_send(txBuf, STPM34_FRAME_SIZE);
-
-		gEnergyMeterTimeout = 0;
+		gXfer = energy_meter_dll_transaction_send(txBuf, STPM34_FRAME_SIZE);
 		state = ENU_EM_LATCH_DATA_RX;
 	}
 		break;
@@ -253,127 +349,47 @@ void energy_meters_handler(void) {
 		/* Wait for latch confirmation */
 		status = energy_meters_process_response();
 
-		if (status == ENU_EM_STATUS_SUCCESS
-				|| status == ENU_EM_STATUS_TIMEOUT) {
-			/* End transaction - deselect chip (CS goes HIGH) */
-			energy_meter_dll_transaction_end();
-
-			/* Data latched - now we can start reading */
-			gCurrentRegister = STPM34_DATA_REGS_START;
-			gPreviousRegister = 0xFF; /* Reset previous register tracking */
-			gStoreResponseData = 0; /* First read is dummy (delayed response) */
+		if (status == ENU_EM_STATUS_SUCCESS) {
+			/* Data latched - now we can start sweeping */
+			gStepRetry = 0;
+			energy_meters_build_sweep();
 			gChipInitialized = 1;
 			state = ENU_EM_SEND_READ_REQ;
+		} else if (status != ENU_EM_STATUS_IDLE) {
+			state = energy_meters_step_failed(ENU_EM_LATCH_DATA_TX);
 		}
 		break;
 
 	case ENU_EM_SEND_READ_REQ:
-		/* Send read request for data register */
-		energy_meters_send_read_req(gCurrentRegister);
-		gEnergyMeterTimeout = 0;
+		/* Stream all read frames and the latch of the next sweep */
+		gXfer = energy_meter_dll_transaction_stream(gSweepFrames, sizeof(gSweepFrames));
 		state = ENU_EM_WAIT_FOR_RESPONSE;
 		break;
 
 	case ENU_EM_WAIT_FOR_RESPONSE:
-		/* Process response from STPM34 */
-		status = energy_meters_process_response();
+		/* Decode the sweep once all responses are in */
+		status = energy_meters_process_sweep();
 
 		if (status == ENU_EM_STATUS_SUCCESS) {
-			/* End transaction - deselect chip (CS goes HIGH) */
-			energy_meter_dll_transaction_end();
-
-            /* NOTE: Due to STPM34 delayed response protocol, the received data
-             * is from the PREVIOUS read command, not the current one.
-             * First read after latch returns dummy/garbage data. */
-
-			if (gStoreResponseData
-					&& gPreviousRegister >= STPM34_DATA_REGS_START) {
-				/* Store response to PREVIOUS register address */
-				/* TODO: Add data storage array when needed (currently only tracking last value) */
-				/* regData[gPreviousRegister] = gLastReadValue; */
-			}
-
-			/* Update tracking for next iteration */
-			gPreviousRegister = gCurrentRegister;
-			gStoreResponseData = 1; /* After first read, start storing data */
-
-			/* Move to next register */
-			gCurrentRegister += 2; /* Increment by 2 (16-bit addressing) */
-
-			if (gCurrentRegister > STPM34_DATA_REGS_END) {
-				/* All registers read - latch new data and restart */
-				state = ENU_EM_LATCH_DATA_TX;
+			/* The next sweep is already on the link */
+			gTimeoutRun = 0;
+			energy_counters_update(&gSnapshot);
+			power_quality_update(&gSnapshot);
+		} else if (status == ENU_EM_STATUS_CRC_ERROR) {
+			/* Sweep dropped, the next one is already on the link */
+			gTimeoutRun = 0;
+		} else if (status == ENU_EM_STATUS_TIMEOUT) {
+			if (++gTimeoutRun >= ENERGY_METER_TIMEOUT_RESTART) {
+				/* Chip reset or lost the rate: configure it again */
+				gRestartCount++;
+				state = ENU_EM_INIT;
 			} else {
-				/* Read next register */
-				state = ENU_EM_SEND_READ_REQ;
+				/* The latch frame may not have arrived - latch again */
+				state = ENU_EM_LATCH_DATA_TX;
 			}
-		} else if (status == ENU_EM_STATUS_TIMEOUT) {
-			/* End transaction on timeout - deselect chip (CS goes HIGH) */
-			energy_meter_dll_transaction_end();
-
-			/* Update tracking even on timeout */
-			gPreviousRegister = gCurrentRegister;
-			gStoreResponseData = 1;
-
-            /* Timeout - skip this register and continue */
-            gCurrentRegister += 2;
-
-            if (gCurrentRegister > STPM34_DATA_REGS_END)
-            {
-                state = ENU_EM_LATCH_DATA_TX;
-            }
-            else
-            {
-
-
-
-                state = ENU_EM_SEND_READ_REQ;
-
-                /* Valid response received - update cached values */
-                energy_meters_update_cached_values(gCurrentRegister, gLastReadValue);
-
-                /* Cycle through measurement registers:
-                 * CH1: Active Power -> Reactive Power -> Voltage -> Current
-                 * CH2: Active Power -> Reactive Power -> Voltage -> Current
-                 */
-                switch (gCurrentRegister)
-                {
-                    case STPM34_REG_CH1_ACTIVE_POWER:
-                        gCurrentRegister = STPM34_REG_CH1_REACTIVE_POWER;
-                        break;
-                    case STPM34_REG_CH1_REACTIVE_POWER:
-                        gCurrentRegister = STPM34_REG_CH1_VOLTAGE_RMS;
-                        break;
-                    case STPM34_REG_CH1_VOLTAGE_RMS:
-                        gCurrentRegister = STPM34_REG_CH1_CURRENT_RMS;
-                        break;
-                    case STPM34_REG_CH1_CURRENT_RMS:
-                        gCurrentRegister = STPM34_REG_CH2_ACTIVE_POWER;
-                        break;
-                    case STPM34_REG_CH2_ACTIVE_POWER:
-                        gCurrentRegister = STPM34_REG_CH2_REACTIVE_POWER;
-                        break;
-                    case STPM34_REG_CH2_REACTIVE_POWER:
-                        gCurrentRegister = STPM34_REG_CH2_VOLTAGE_RMS;
-                        break;
-                    case STPM34_REG_CH2_VOLTAGE_RMS:
-                        gCurrentRegister = STPM34_REG_CH2_CURRENT_RMS;
-                        break;
-                    case STPM34_REG_CH2_CURRENT_RMS:
-                        /* Wrap back to start */
-                        gCurrentRegister = STPM34_REG_CH1_ACTIVE_POWER;
-                        break;
-                    default:
-                        /* Unknown register - reset to start */
-                        gCurrentRegister = STPM34_REG_CH1_ACTIVE_POWER;
-                        break;
-                }
-
-                state = ENU_EM_SEND_READ_REQ;
-            }
-        }
-        /* else ENU_EM_STATUS_IDLE or CRC_ERROR - keep waiting */
-        break;
+		}
+		/* else ENU_EM_STATUS_IDLE - keep waiting */
+		break;
 
 	case ENU_EM_IDLE:
 		/* Idle state - wait for next cycle */
@@ -395,7 +411,7 @@ void energy_meters_handler(void) {
  * @param[out] value Pointer to store read value from previous transaction (can be NULL)
  * @return 1 if successful, 0 if failed
  *
- * @note This is a blocking function that manages chip select automatically
+ * @note The frame is queued and not waited for; chip select is handled by the DLL
  * @note For periodic register reading, use energy_meters_handler() state machine instead
  */
 u8 energy_meters_read_register(u8 addr, u32 *value) {
@@ -411,11 +427,9 @@ u8 energy_meters_read_register(u8 addr, u32 *value) {
 	/* Calculate CRC for the frame */
 	txBuf[4] = crc_stpm3x(txBuf, 4);
 
-	/* Send frame via DLL (chip select handled by DLL) */
-	energy_meter_dll_transaction_send(txBuf, STPM34_FRAME_SIZE);
+	/* Queue frame via DLL (chip select handled by DLL), the slot frees itself when done */
+	energy_meter_dll_transaction_end(energy_meter_dll_transaction_send(txBuf, STPM34_FRAME_SIZE));
 
-	/* Note: Should wait for response and call energy_meter_dll_transaction_end() */
-	/* For now, transaction end should be called by the caller after waiting */
 	/* Typically this function is not used - the state machine handles communication */
 
 	/* Value will be available in next transaction */
@@ -482,6 +496,9 @@ void energy_meters_reset_statistics(void) {
 	gSuccessCount = 0;
 	gTimeoutCount = 0;
 	gCrcErrorCount = 0;
+	gSweepDropCount = 0;
+	gRestartCount = 0;
+	memset(&gSweepStats, 0, sizeof(gSweepStats));
 }
 
 /**
@@ -501,32 +518,18 @@ u8 energy_meters_is_initialized(void) {
  * ======================================================================== */
 
 /**
- * @brief Send read request to STPM34
- *
- * Builds read command frame and sends via DLL layer.
- * STPM34 protocol uses TWO addresses per frame: read addr and write addr.
- *
- * @param[in] addr Register address to read
- * @return Always returns 1
+ * @brief Handle a failed init step
  *
- * @note Frame format: [ReadAddr][WriteAddr=0xFF][DataLow=0xFF][DataHigh=0xFF][CRC]
+ * @param[in] retry State that sends the step again
+ * @return retry while attempts are left, ENU_EM_INIT otherwise
  */
-static u8 energy_meters_send_read_req(u8 addr) {
-	u8 txBuf[STPM34_FRAME_SIZE];
-
-	/* Build read command frame - STPM34 two-address format */
-	txBuf[0] = addr; /* Read address */
-	txBuf[1] = 0xFF; /* Write address (0xFF = no write) */
-	txBuf[2] = 0xFF; /* Write data LOW byte (dummy) */
-	txBuf[3] = 0xFF; /* Write data HIGH byte (dummy) */
-
-	/* Calculate and add CRC */
-	txBuf[4] = crc_stpm3x(txBuf, 4);
-
-	/* Send via DLL (chip select handled by DLL) */
-	energy_meter_dll_transaction_send(txBuf, STPM34_FRAME_SIZE);
-
-	return 1;
+static EnuEnrgyMeterState energy_meters_step_failed(EnuEnrgyMeterState retry)
+{
+    if (++gStepRetry < ENERGY_METER_INIT_RETRIES) {
+        return retry;
+    }
+    gRestartCount++;
+    return ENU_EM_INIT;
 }
 
 /**
@@ -540,7 +543,7 @@ static u8 energy_meters_send_read_req(u8 addr) {
  * @return Always returns 1
  *
  * @note Frame format: [ReadAddr=0xFF][WriteAddr][DataLow][DataHigh][CRC]
- * @note Caller should call energy_meter_dll_transaction_end() after write completes
+ * @note The write is queued and not waited for
  */
 static u8 energy_meters_send_write_req(u8 addr, u32 value) {
 	u8 txBuf[STPM34_FRAME_SIZE];
@@ -554,8 +557,8 @@ static u8 energy_meters_send_write_req(u8 addr, u32 value) {
 	/* Calculate and add CRC */
 	txBuf[4] = crc_stpm3x(txBuf, 4);
 
-	/* Send via DLL (chip select handled by DLL) */
-	energy_meter_dll_transaction_send(txBuf, STPM34_FRAME_SIZE);
+	/* Queue via DLL (chip select handled by DLL), the slot frees itself when done */
+	energy_meter_dll_transaction_end(energy_meter_dll_transaction_send(txBuf, STPM34_FRAME_SIZE));
 
 	return 1;
 }
@@ -563,24 +566,28 @@ static u8 energy_meters_send_write_req(u8 addr, u32 value) {
 /**
  * @brief Process response from STPM34
  *
- * Checks for received data via DLL, validates CRC, and extracts value.
- * Implements proper timeout mechanism with diagnostic counters.
+ * Polls the transaction on the link, validates the CRC of its response and
+ * extracts the value. The DLL times the transaction out; a finished
+ * transaction is ended here.
  *
  * @return EnuEnergyMeterStatus indicating the result:
  *         - ENU_EM_STATUS_SUCCESS: Valid response received
- *         - ENU_EM_STATUS_TIMEOUT: Timeout occurred
+ *         - ENU_EM_STATUS_TIMEOUT: Timeout or link error
  *         - ENU_EM_STATUS_CRC_ERROR: Data received but CRC invalid
  *         - ENU_EM_STATUS_IDLE: Still waiting for response
  */
 static EnuEnergyMeterStatus energy_meters_process_response(void) {
-	EnuEnergyMeterStatus status = ENU_EM_STATUS_IDLE;
-	u16 bytesReceived;
+	EnuEnergyMeterStatus status;
 
-	/* Check for received data */
-	bytesReceived = energy_meter_dll_receive();
+	switch (energy_meter_dll_poll(gXfer)) {
+	case ENU_EM_XFER_QUEUED:
+	case ENU_EM_XFER_ACTIVE:
+		/* Still on the link */
+		return ENU_EM_STATUS_IDLE;
 
-	if (bytesReceived >= STPM34_FRAME_SIZE) {
-		u8 *rxBuf = energy_meter_dll_get_rx_buffer();
+	case ENU_EM_XFER_DONE:
+	{
+		u8 *rxBuf = energy_meter_dll_get_rx_buffer(gXfer);
 
 		/* Verify CRC */
 		u8 receivedCrc = rxBuf[4];
@@ -590,9 +597,6 @@ static EnuEnergyMeterStatus energy_meters_process_response(void) {
 			/* Valid response received - parse and store the 24-bit value */
 			gLastReadValue = energy_meters_parse_response(rxBuf);
 
-			/* Reset timeout counter */
-			gEnergyMeterTimeout = 0;
-
 			/* Increment success counter */
 			gSuccessCount++;
 
@@ -601,23 +605,20 @@ static EnuEnergyMeterStatus energy_meters_process_response(void) {
 			/* CRC validation failed */
 			gCrcErrorCount++;
 			status = ENU_EM_STATUS_CRC_ERROR;
-
-			/* Continue incrementing timeout for CRC errors */
-			gEnergyMeterTimeout++;
 		}
-	} else {
-		/* No data received yet - increment timeout counter */
-		gEnergyMeterTimeout++;
 	}
+		break;
 
-	/* Check if timeout reached */
-	if (gEnergyMeterTimeout > ENERGY_METER_TIMEOUT) {
-		/* Timeout occurred */
-		gEnergyMeterTimeout = 0;
+	default:
+		/* Timed out, link error or never queued */
 		gTimeoutCount++;
 		status = ENU_EM_STATUS_TIMEOUT;
+		break;
 	}
 
+	energy_meter_dll_transaction_end(gXfer);
+	gXfer = ENERGY_METER_DLL_NO_XFER;
+
 	return status;
 }
 
@@ -725,51 +726,100 @@ static float energy_meters_convert_power(u32 rawValue)
     return power_W;
 }
 
+/**
+ * @brief Convert a raw line period to Hz
+ *
+ * @param[in] period Line period field of one channel
+ * @return Line frequency in Hz, 0 if no period was measured
+ */
+static float energy_meters_convert_frequency(u32 period)
+{
+    if (period == 0) {
+        return 0.0f;
+    }
+    return 1000000.0f / ((float)period * STPM34_PERIOD_LSB_US);
+}
+
 /**
  * @brief Update cached measurement values based on register address
  *
- * This function is called when a successful register read occurs.
+ * This function is called for every valid response of a sweep.
  * It converts the raw value to engineering units and stores it in
- * the appropriate cached variable for later retrieval.
+ * the snapshot being decoded.
  *
  * @param[in] regAddr Register address that was read
  * @param[in] rawValue Raw 24-bit value from the register
  */
 static void energy_meters_update_cached_values(u8 regAddr, u32 rawValue)
 {
+    StuEnergyMeterChannel *ch1 = &gSweep.ch[0];
+    StuEnergyMeterChannel *ch2 = &gSweep.ch[1];
+
     switch (regAddr)
     {
         case STPM34_REG_CH1_ACTIVE_POWER:
-            gCh1ActivePower = energy_meters_convert_power(rawValue);
+            ch1->activePower = energy_meters_convert_power(rawValue);
             break;
 
         case STPM34_REG_CH1_REACTIVE_POWER:
-            gCh1ReactivePower = energy_meters_convert_power(rawValue);
+            ch1->reactivePower = energy_meters_convert_power(rawValue);
+            break;
+
+        case STPM34_REG_CH1_APPARENT_RMS:
+            ch1->apparentPower = energy_meters_convert_power(rawValue);
             break;
 
         case STPM34_REG_CH1_VOLTAGE_RMS:
-            gCh1RmsVoltage = energy_meters_convert_voltage(rawValue);
+            ch1->rmsVoltage = energy_meters_convert_voltage(rawValue);
             break;
 
         case STPM34_REG_CH1_CURRENT_RMS:
-            gCh1RmsCurrent = energy_meters_convert_current(rawValue);
+            ch1->rmsCurrent = energy_meters_convert_current(rawValue);
             break;
 
         case STPM34_REG_CH2_ACTIVE_POWER:
-            gCh2ActivePower = energy_meters_convert_power(rawValue);
+            ch2->activePower = energy_meters_convert_power(rawValue);
             break;
 
         case STPM34_REG_CH2_REACTIVE_POWER:
-            gCh2ReactivePower = energy_meters_convert_power(rawValue);
+            ch2->reactivePower = energy_meters_convert_power(rawValue);
+            break;
+
+        case STPM34_REG_CH2_APPARENT_RMS:
+            ch2->apparentPower = energy_meters_convert_power(rawValue);
             break;
 
         case STPM34_REG_CH2_VOLTAGE_RMS:
-            gCh2RmsVoltage = energy_meters_convert_voltage(rawValue);
+            ch2->rmsVoltage = energy_meters_convert_voltage(rawValue);
             break;
 
         case STPM34_REG_CH2_CURRENT_RMS:
-            gCh2RmsCurrent = energy_meters_convert_current(rawValue);
+            ch2->rmsCurrent = energy_meters_convert_current(rawValue);
+            break;
+
+        case STPM34_REG_LINE_PERIOD:
+            ch1->frequency = energy_meters_convert_frequency(rawValue & STPM34_PERIOD_MASK);
+            ch2->frequency = energy_meters_convert_frequency(
+                    (rawValue >> STPM34_PERIOD_CH2_SHIFT) & STPM34_PERIOD_MASK);
+            break;
+
+#if ENERGY_COUNTER_FROM_REGISTERS
+        case STPM34_REG_CH1_ACTIVE_ENERGY:
+            ch1->activeEnergy = rawValue;
+            break;
+
+        case STPM34_REG_CH1_REACTIVE_ENERGY:
+            ch1->reactiveEnergy = rawValue;
+            break;
+
+        case STPM34_REG_CH2_ACTIVE_ENERGY:
+            ch2->activeEnergy = rawValue;
+            break;
+
+        case STPM34_REG_CH2_REACTIVE_ENERGY:
+            ch2->reactiveEnergy = rawValue;
             break;
+#endif
 
         default:
             /* Unknown register - do nothing */
@@ -777,6 +827,154 @@ static void energy_meters_update_cached_values(u8 regAddr, u32 rawValue)
     }
 }
 
+/**
+ * @brief Build one STPM34 frame
+ *
+ * @param[out] frame Destination, STPM34_FRAME_SIZE bytes
+ * @param[in] readAddr Register to read, 0xFF for none
+ * @param[in] writeAddr Register to write, 0xFF for none
+ * @param[in] data 16-bit value to write
+ *
+ * @note Frame format: [ReadAddr][WriteAddr][DataLow][DataHigh][CRC]
+ */
+static void energy_meters_build_frame(u8 *frame, u8 readAddr, u8 writeAddr, u16 data)
+{
+    frame[0] = readAddr;
+    frame[1] = writeAddr;
+    frame[2] = data & 0xFF;
+    frame[3] = (data >> 8) & 0xFF;
+    frame[4] = crc_stpm3x(frame, 4);
+}
+
+/**
+ * @brief Build the frames of one sweep
+ *
+ * The frames never change, so they are built once after initialization.
+ */
+static void energy_meters_build_sweep(void)
+{
+    u32 dsp_cr3_value = STPM34_DSP_CR3_DEFAULT |
+            STPM34_DSP_CR3_SW_LATCH1 |
+            STPM34_DSP_CR3_SW_LATCH2;
+    u8 i;
+
+    for (i = 0; i < ENERGY_METER_SWEEP_REGS; i++) {
+        energy_meters_build_frame(&gSweepFrames[i * STPM34_FRAME_SIZE],
+                gSweepRegister[i], 0xFF, 0xFFFF);
+    }
+
+    /* Latch frame, its response carries the last register */
+    energy_meters_build_frame(&gSweepFrames[i * STPM34_FRAME_SIZE],
+            0xFF, STPM34_REG_DSP_CR3, (u16)dsp_cr3_value);
+}
+
+/**
+ * @brief Process the responses of one sweep
+ *
+ * Response 0 answers the latch frame of the previous sweep and carries no
+ * data; response k carries gSweepRegister[k - 1]. A sweep with a frame
+ * failing its CRC or missing is dropped: the previous snapshot stays, so a
+ * published snapshot always holds one latch. A complete sweep is published
+ * as the new snapshot, stamped with its completion time.
+ *
+ * The next sweep is queued before this one is decoded; it becomes the
+ * transaction on the link.
+ *
+ * @return ENU_EM_STATUS_SUCCESS once the sweep is published,
+ *         ENU_EM_STATUS_CRC_ERROR if the sweep was dropped,
+ *         ENU_EM_STATUS_TIMEOUT if it did not complete in time,
+ *         ENU_EM_STATUS_IDLE while still waiting
+ */
+static EnuEnergyMeterStatus energy_meters_process_sweep(void)
+{
+    EnuEnergyMeterXferState xferState = energy_meter_dll_poll(gXfer);
+    u8 done = gXfer;
+    u8 bad = 0;
+    u8 *rxBuf;
+    u8 *frame;
+
+    if (xferState == ENU_EM_XFER_QUEUED || xferState == ENU_EM_XFER_ACTIVE) {
+        return ENU_EM_STATUS_IDLE;
+    }
+
+    if (xferState != ENU_EM_XFER_DONE) {
+        /* Timed out or link error */
+        energy_meter_dll_transaction_end(done);
+        gXfer = ENERGY_METER_DLL_NO_XFER;
+        gTimeoutCount++;
+        return ENU_EM_STATUS_TIMEOUT;
+    }
+
+    /* Data is latched already - keep the link busy while decoding */
+    gXfer = energy_meter_dll_transaction_stream(gSweepFrames, sizeof(gSweepFrames));
+
+    rxBuf = energy_meter_dll_get_rx_buffer(done);
+    if (energy_meter_dll_get_rx_count(done) < sizeof(gSweepFrames)) {
+        bad = 1;
+    }
+
+    for (u8 i = 1; i <= ENERGY_METER_SWEEP_REGS && bad == 0; i++) {
+        frame = &rxBuf[i * STPM34_FRAME_SIZE];
+
+        if (frame[4] == crc_stpm3x(frame, 4)) {
+            gLastReadValue = energy_meters_parse_response(frame);
+            energy_meters_update_cached_values(gSweepRegister[i - 1], gLastReadValue);
+            gSuccessCount++;
+        } else {
+            gCrcErrorCount++;
+            bad = 1;
+        }
+    }
+
+    if (bad != 0) {
+        /* Values of two latches must not mix: drop the whole sweep */
+        gSweepDropCount++;
+        gSweep = gSnapshot;
+        energy_meter_dll_transaction_end(done);
+        return ENU_EM_STATUS_CRC_ERROR;
+    }
+
+    gSweep.sweeps = gSnapshot.sweeps + 1U;
+    gSweep.tick = energy_meter_dll_get_done_tick(done);
+    energy_meters_time_sweep(energy_meter_dll_get_wire_cycles(done), gSweep.tick);
+    gSnapshot = gSweep;
+
+    energy_meter_dll_transaction_end(done);
+
+    return ENU_EM_STATUS_SUCCESS;
+}
+
+/**
+ * @brief Book the timing of a completed sweep
+ *
+ * @param[in] cycles Link time of the sweep in CPU cycles, 0 if not measured
+ * @param[in] tick   HAL tick at which the sweep completed
+ */
+static void energy_meters_time_sweep(u32 cycles, u32 tick)
+{
+    /* The first sweep after start-up or a restart has no predecessor */
+    if (gSnapshot.sweeps != 0) {
+        gSweepStats.period = tick - gSnapshot.tick;
+        if (gSweepStats.period > gSweepStats.periodMax) {
+            gSweepStats.periodMax = gSweepStats.period;
+        }
+    }
+
+    if (cycles == 0) {
+        return;
+    }
+
+    gSweepStats.last = cycles;
+    if (gSweepStats.count == 0 || cycles < gSweepStats.min) {
+        gSweepStats.min = cycles;
+    }
+    if (cycles > gSweepStats.max) {
+        gSweepStats.max = cycles;
+    }
+    gSweepStats.total += cycles;
+    gSweepStats.count++;
+}
+
 /**
  * @brief Set calibration factors for voltage and current measurements
  *
@@ -800,7 +998,7 @@ void energy_meters_set_calibration(float voltage_cal, float current_cal)
  *
  * Returns the most recently measured active power value for the
  * specified channel. Values are automatically updated by the
- * energy_meters_handler() state machine.
+ * energy_meters_handler() sweeps.
  *
  * @param[in] channel Channel number (1 or 2)
  * @return Active power in Watts (W), or 0.0 if channel invalid
@@ -809,10 +1007,8 @@ void energy_meters_set_calibration(float voltage_cal, float current_cal)
  */
 float energy_meters_read_active_power(u8 channel)
 {
-    if (channel == 1) {
-        return gCh1ActivePower;
-    } else if (channel == 2) {
-        return gCh2ActivePower;
+    if (channel == 1 || channel == 2) {
+        return gSnapshot.ch[channel - 1].activePower;
     }
     return 0.0f;
 }
@@ -822,7 +1018,7 @@ float energy_meters_read_active_power(u8 channel)
  *
  * Returns the most recently measured reactive power value for the
  * specified channel. Values are automatically updated by the
- * energy_meters_handler() state machine.
+ * energy_meters_handler() sweeps.
  *
  * @param[in] channel Channel number (1 or 2)
  * @return Reactive power in VAR, or 0.0 if channel invalid
@@ -831,10 +1027,8 @@ float energy_meters_read_active_power(u8 channel)
  */
 float energy_meters_read_reactive_power(u8 channel)
 {
-    if (channel == 1) {
-        return gCh1ReactivePower;
-    } else if (channel == 2) {
-        return gCh2ReactivePower;
+    if (channel == 1 || channel == 2) {
+        return gSnapshot.ch[channel - 1].reactivePower;
     }
     return 0.0f;
 }
@@ -844,7 +1038,7 @@ float energy_meters_read_reactive_power(u8 channel)
  *
  * Returns the most recently measured RMS current value for the
  * specified channel. Values are automatically updated by the
- * energy_meters_handler() state machine.
+ * energy_meters_handler() sweeps.
  *
  * @param[in] channel Channel number (1 or 2)
  * @return RMS current in milliamps (mA), or 0.0 if channel invalid
@@ -853,10 +1047,8 @@ float energy_meters_read_reactive_power(u8 channel)
  */
 float energy_meters_read_rms_current(u8 channel)
 {
-    if (channel == 1) {
-        return gCh1RmsCurrent;
-    } else if (channel == 2) {
-        return gCh2RmsCurrent;
+    if (channel == 1 || channel == 2) {
+        return gSnapshot.ch[channel - 1].rmsCurrent;
     }
     return 0.0f;
 }
@@ -866,7 +1058,7 @@ float energy_meters_read_rms_current(u8 channel)
  *
  * Returns the most recently measured RMS voltage value for the
  * specified channel. Values are automatically updated by the
- * energy_meters_handler() state machine.
+ * energy_meters_handler() sweeps.
  *
  * @param[in] channel Channel number (1 or 2)
  * @return RMS voltage in Volts (V), or 0.0 if channel invalid
@@ -875,10 +1067,125 @@ float energy_meters_read_rms_current(u8 channel)
  */
 float energy_meters_read_rms_voltage(u8 channel)
 {
-    if (channel == 1) {
-        return gCh1RmsVoltage;
-    } else if (channel == 2) {
-        return gCh2RmsVoltage;
+    if (channel == 1 || channel == 2) {
+        return gSnapshot.ch[channel - 1].rmsVoltage;
     }
     return 0.0f;
 }
+
+/**
+ * @brief Copy the latest channel snapshot
+ *
+ * All values of a snapshot come from the same latch of the chip.
+ *
+ * @param[out] snapshot Destination
+ */
+void energy_meters_get_snapshot(StuEnergyMeterSnapshot *snapshot)
+{
+    if (snapshot != NULL) {
+        *snapshot = gSnapshot;
+    }
+}
+
+/**
+ * @brief Select the link to the STPM34
+ *
+ * The handler switches on its next call and initializes the chip again.
+ *
+ * @param[in] link ENU_EM_LINK_UART or ENU_EM_LINK_SPI
+ */
+void energy_meters_set_link(EnuEnergyMeterLink link)
+{
+    gLinkRequested = link;
+    gLinkChange = 1;
+}
+
+/**
+ * @brief Get the sweep timing
+ *
+ * @param[out] stats Copy of the timing
+ */
+void energy_meters_get_sweep_stats(StuEnergyMeterSweepStats *stats)
+{
+    if (stats != NULL) {
+        *stats = gSweepStats;
+    }
+}
+
+/**
+ * @brief Command line interface for the STPM34 link
+ *
+ * @param[in,out] str Command string
+ *
+ * @return 1 while lines remain, 0 when done
+ */
+u8 energy_meters_cmd(char *str)
+{
+    static u8 line = 0;
+    char tempStr[TEMP_STRING_SIZE];
+    u32 cyclesPerUs = SystemCoreClock / 1000000U;
+    StuEnergyMeterDllStats dll;
+
+    if (line == 0 && strstr(str, "reset") != NULL) {
+        energy_meters_reset_statistics();
+        TransmitCMDResponse("\r>STPM34 statistics reset\r");
+        return 0;
+    }
+
+    switch (line) {
+    case 0:
+        snprintf(tempStr, sizeof(tempStr), "\r>STPM34 %s init:%u restarts:%lu sweeps:%lu dropped:%lu frames ok:%lu crc:%lu timeouts:%lu\r",
+                 (energy_meter_dll_get_link() == ENU_EM_LINK_SPI) ? "SPI" : "UART", gChipInitialized,
+                 (unsigned long)gRestartCount, (unsigned long)gSnapshot.sweeps, (unsigned long)gSweepDropCount,
+                 (unsigned long)gSuccessCount, (unsigned long)gCrcErrorCount, (unsigned long)gTimeoutCount);
+        break;
+
+    case 1:
+        /* Link time of one sweep, then the rate the handler achieves */
+        snprintf(tempStr, sizeof(tempStr), "\r>Sweep us last:%lu min:%lu mean:%lu max:%lu n:%lu period ms:%lu max:%lu\r",
+                 (unsigned long)(gSweepStats.last / cyclesPerUs), (unsigned long)(gSweepStats.min / cyclesPerUs),
+                 (unsigned long)((gSweepStats.count != 0) ?
+                         (gSweepStats.total / gSweepStats.count) / cyclesPerUs : 0U),
+                 (unsigned long)(gSweepStats.max / cyclesPerUs), (unsigned long)gSweepStats.count,
+                 (unsigned long)gSweepStats.period, (unsigned long)gSweepStats.periodMax);
+        break;
+
+    default:
+        energy_meter_dll_get_stats(&dll);
+        snprintf(tempStr, sizeof(tempStr), "\r>Link xfer:%lu ok:%lu tmo:%lu err:%lu rej:%lu line:%lu stray:%lu\r",
+                 (unsigned long)dll.submitted, (unsigned long)dll.completed, (unsigned long)dll.timeouts,
+                 (unsigned long)dll.errors, (unsigned long)dll.rejected, (unsigned long)dll.linkErrors,
+                 (unsigned long)dll.strayBytes);
+        TransmitCMDResponse(tempStr);
+        line = 0;
+        return 0;
+    }
+
+    TransmitCMDResponse(tempStr);
+    line++;
+    return 1;
+}
+
+/**
+ * @brief Display help information for the STPM34 command
+ *
+ * @return 1 while help lines remain, 0 when done
+ */
+u8 energy_meters_cmd_help(void)
+{
+    static u8 state = 0;
+    u8 returnValue = 1;
+
+    switch (state) {
+    case 0:
+        TransmitCMDResponse("     stpm                   -> (Returns the STPM34 link and sweep timing) \r");
+        state = 1;
+        break;
+    case 1:
+        TransmitCMDResponse("     stpm reset             -> (Clears the STPM34 statistics) \r");
+        state = 0;
+        returnValue = 0;
+        break;
+    }
+    return returnValue;
+}
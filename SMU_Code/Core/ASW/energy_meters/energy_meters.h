@@ -12,13 +12,14 @@
 #define ASW_ENERGY_METERS_ENERGY_METERS_H_
 
 #include "platform.h"
+#include "energy_meter_dll.h"
 
 /* ========================================================================
  * Constants
  * ======================================================================== */
 
-/** @brief Timeout for energy meter operations (in handler cycles) */
-#define ENERGY_METER_TIMEOUT 100
+/** @brief Measurement channels of the STPM34 */
+#define ENERGY_METER_CHANNELS 2U
 
 /* ========================================================================
  * Type Definitions
@@ -36,8 +37,8 @@ typedef enum {
     ENU_EM_WRITE_CONFIG_RX,     /**< Wait for config write confirmation */
     ENU_EM_LATCH_DATA_TX,       /**< Send data latch command */
     ENU_EM_LATCH_DATA_RX,       /**< Wait for latch confirmation */
-    ENU_EM_SEND_READ_REQ,       /**< Send read request state */
-    ENU_EM_WAIT_FOR_RESPONSE,   /**< Wait for response state */
+    ENU_EM_SEND_READ_REQ,       /**< Stream the read frames of one sweep */
+    ENU_EM_WAIT_FOR_RESPONSE,   /**< Wait for the responses of the sweep */
     ENU_EM_IDLE,                /**< Idle state after successful read */
     ENU_EM_STOP                 /**< Stop/error state */
 } EnuEnrgyMeterState;
@@ -53,6 +54,45 @@ typedef enum {
     ENU_EM_STATUS_CRC_ERROR         /**< CRC validation failed */
 } EnuEnergyMeterStatus;
 
+/**
+ * @struct StuEnergyMeterChannel
+ * @brief Measurements of one channel
+ */
+typedef struct {
+    float activePower;          /**< Active power (W) */
+    float reactivePower;        /**< Reactive power (VAR) */
+    float apparentPower;        /**< Apparent RMS power (VA) */
+    float rmsVoltage;           /**< RMS voltage (V) */
+    float rmsCurrent;           /**< RMS current (mA) */
+    float frequency;            /**< Line frequency (Hz), 0 without a valid period */
+    u32 activeEnergy;           /**< Raw active energy register, with ENERGY_COUNTER_FROM_REGISTERS */
+    u32 reactiveEnergy;         /**< Raw reactive energy register, with ENERGY_COUNTER_FROM_REGISTERS */
+} StuEnergyMeterChannel;
+
+/**
+ * @struct StuEnergyMeterSnapshot
+ * @brief Both channels decoded from one latch
+ */
+typedef struct {
+    StuEnergyMeterChannel ch[ENERGY_METER_CHANNELS];    /**< Channel 1 and 2 */
+    u32 sweeps;                 /**< Completed sweeps, changes with every new snapshot */
+    u32 tick;                   /**< HAL tick when the sweep completed */
+} StuEnergyMeterSnapshot;
+
+/**
+ * @struct StuEnergyMeterSweepStats
+ * @brief Sweep timing since start-up or the last statistics reset
+ */
+typedef struct {
+    u32 count;                  /**< Sweeps timed */
+    u32 last;                   /**< Link time of the last sweep in CPU cycles */
+    u32 min;                    /**< Shortest link time in CPU cycles */
+    u32 max;                    /**< Longest link time in CPU cycles */
+    uint64_t total;             /**< Sum of the link times, for the mean */
+    u32 period;                 /**< ms between the last two completed sweeps */
+    u32 periodMax;              /**< Longest ms between two completed sweeps */
+} StuEnergyMeterSweepStats;
+
 /* ========================================================================
  * Function Prototypes
  * ======================================================================== */
@@ -142,6 +182,52 @@ float energy_meters_read_rms_current(u8 channel);
  */
 float energy_meters_read_rms_voltage(u8 channel);
 
+/**
+ * @brief Copy the latest channel snapshot
+ *
+ * All values of a snapshot come from the same latch of the chip.
+ *
+ * @param[out] snapshot Destination
+ */
+void energy_meters_get_snapshot(StuEnergyMeterSnapshot *snapshot);
+
+/**
+ * @brief Select the link to the STPM34 at runtime
+ *
+ * The handler stops the current link on its next call and initializes the
+ * chip again over the new one. The STPM34 itself picks UART or SPI from
+ * the SCS level at power-up, so the link must match the board.
+ *
+ * @param[in] link ENU_EM_LINK_UART or ENU_EM_LINK_SPI
+ */
+void energy_meters_set_link(EnuEnergyMeterLink link);
+
+/**
+ * @brief Get the sweep timing
+ *
+ * @param[out] stats Copy of the timing
+ */
+void energy_meters_get_sweep_stats(StuEnergyMeterSweepStats *stats);
+
+/**
+ * @brief Command line interface for the STPM34 link
+ *
+ * "stpm" prints the link, sweep timing and error counters, "stpm reset"
+ * clears them.
+ *
+ * @param[in,out] str Command string
+ *
+ * @return 1 while lines remain, 0 when done
+ */
+u8 energy_meters_cmd(char *str);
+
+/**
+ * @brief Display help information for the STPM34 command
+ *
+ * @return 1 while help lines remain, 0 when done
+ */
+u8 energy_meters_cmd_help(void);
+
 /**
  * @brief Set calibration factors for voltage and current
  *
@@ -0,0 +1,557 @@
+/**
+ * @file power_quality.c
+ * @brief Power quality analytics implementation
+ *
+ * All state is written only from the energy meter handler. The command
+ * runs from the same scheduler context, so it reads the results directly.
+ *
+ * @date 2025-11-03
+ * @author Allayar Moazami
+ */
+#include "power_quality.h"
+#include "signal_db.h"
+#include "dbg.h"
+#include "main.h"
+#include <stdio.h>
+#include <string.h>
+
+/* ========================================================================
+ * Constants
+ * ======================================================================== */
+
+/** @brief Sag start in V */
+#define PQ_SAG_START        (PQ_NOMINAL_VOLTAGE * PQ_SAG_PCT / 100.0f)
+
+/** @brief Sag and interruption end in V */
+#define PQ_SAG_END          (PQ_NOMINAL_VOLTAGE * (PQ_SAG_PCT + PQ_HYSTERESIS_PCT) / 100.0f)
+
+/** @brief Swell start in V */
+#define PQ_SWELL_START      (PQ_NOMINAL_VOLTAGE * PQ_SWELL_PCT / 100.0f)
+
+/** @brief Swell end in V */
+#define PQ_SWELL_END        (PQ_NOMINAL_VOLTAGE * (PQ_SWELL_PCT - PQ_HYSTERESIS_PCT) / 100.0f)
+
+/** @brief Interruption start in V */
+#define PQ_INTERRUPTION_START (PQ_NOMINAL_VOLTAGE * PQ_INTERRUPTION_PCT / 100.0f)
+
+/** @brief Size of temporary string buffer for formatting */
+#define TEMP_STRING_SIZE 112
+
+/* ========================================================================
+ * Types
+ * ======================================================================== */
+
+/**
+ * @struct StuPqAcc
+ * @brief Running sums of one channel over a window
+ */
+typedef struct StuPqAccStruct
+{
+    f32 vSum;
+    f32 vMin;
+    f32 vMax;
+    f32 iSum;
+    f32 pSum;
+    f32 qSum;
+    f32 sSum;
+    f32 fSum;
+    f32 fMin;
+    f32 fMax;
+    u16 count;                  /**< Samples in the sums */
+    u16 fCount;                 /**< Samples with a measured frequency */
+} StuPqAcc;
+
+/**
+ * @struct StuPqDetector
+ * @brief Event detection state of one channel
+ */
+typedef struct StuPqDetectorStruct
+{
+    u8 event;                   /**< EnuPqEvent running, PQ_EVENT_NONE if none */
+    u32 start;                  /**< Tick of the first sweep of the running event */
+    f32 extreme;                /**< Extreme voltage of the running event */
+    u32 holdUntil[PQ_EVENT_TYPES]; /**< Tick until which each PQstate bit stays set */
+} StuPqDetector;
+
+/* ========================================================================
+ * Static Variables
+ * ======================================================================== */
+
+/** @brief Second being collected */
+static StuPqAcc gSecondAcc[ENERGY_METER_CHANNELS];
+
+/** @brief Minute being collected, merged from closed seconds */
+static StuPqAcc gMinuteAcc[ENERGY_METER_CHANNELS];
+
+/** @brief Last closed second */
+static StuPqStats gSecond[ENERGY_METER_CHANNELS];
+
+/** @brief Last closed minute */
+static StuPqStats gMinute[ENERGY_METER_CHANNELS];
+
+/** @brief Tick at which the running second started */
+static u32 gSecondStart = 0;
+
+/** @brief Seconds merged into the running minute */
+static u8 gSeconds = 0;
+
+/** @brief gSecondStart is valid */
+static u8 gWindowValid = 0;
+
+/** @brief Event detection per channel */
+static StuPqDetector gDetector[ENERGY_METER_CHANNELS] = {
+    { .event = PQ_EVENT_NONE },
+    { .event = PQ_EVENT_NONE }
+};
+
+/** @brief Finished events per channel and type */
+static u32 gEventCount[ENERGY_METER_CHANNELS][PQ_EVENT_TYPES];
+
+/** @brief Last finished events, ring */
+static StuPqEventRecord gEventLog[PQ_EVENT_LOG_SIZE];
+
+/** @brief Events written to gEventLog since start-up */
+static u32 gEventLogCount = 0;
+
+/** @brief Published PQstate */
+static u32 gState = 0;
+
+/** @brief Name of each event type on the command port */
+static const char *const gEventName[PQ_EVENT_TYPES] = { "sag", "swell", "interruption" };
+
+/* ========================================================================
+ * Static Helper Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Empty an accumulator
+ * @param[out] acc Accumulator
+ */
+static void power_quality_acc_clear(StuPqAcc *acc)
+{
+    memset(acc, 0, sizeof(*acc));
+}
+
+/**
+ * @brief Merge an accumulator into another
+ * @param[in,out] dst Accumulator receiving the samples
+ * @param[in]     src Accumulator with the samples to add
+ */
+static void power_quality_acc_merge(StuPqAcc *dst, const StuPqAcc *src)
+{
+    if (0U == src->count) {
+        return;
+    }
+    if (0U == dst->count || src->vMin < dst->vMin) {
+        dst->vMin = src->vMin;
+    }
+    if (0U == dst->count || src->vMax > dst->vMax) {
+        dst->vMax = src->vMax;
+    }
+    if (0U != src->fCount) {
+        if (0U == dst->fCount || src->fMin < dst->fMin) {
+            dst->fMin = src->fMin;
+        }
+        if (0U == dst->fCount || src->fMax > dst->fMax) {
+            dst->fMax = src->fMax;
+        }
+    }
+    dst->vSum += src->vSum;
+    dst->iSum += src->iSum;
+    dst->pSum += src->pSum;
+    dst->qSum += src->qSum;
+    dst->sSum += src->sSum;
+    dst->fSum += src->fSum;
+    dst->count += src->count;
+    dst->fCount += src->fCount;
+}
+
+/**
+ * @brief Add the sample of one channel to a second accumulator
+ * @param[in,out] acc     Accumulator
+ * @param[in]     channel Channel values of the sweep
+ */
+static void power_quality_acc_add(StuPqAcc *acc, const StuEnergyMeterChannel *channel)
+{
+    StuPqAcc sample;
+    f32 v = channel->rmsVoltage;
+    f32 i = channel->rmsCurrent / 1000.0f;
+
+    sample.vSum = v;
+    sample.vMin = v;
+    sample.vMax = v;
+    sample.iSum = i;
+    sample.pSum = channel->activePower;
+    sample.qSum = channel->reactivePower;
+    sample.sSum = v * i;
+    sample.fSum = channel->frequency;
+    sample.fMin = channel->frequency;
+    sample.fMax = channel->frequency;
+    sample.count = 1;
+    sample.fCount = (channel->frequency > 0.0f) ? 1U : 0U;
+    if (0U == sample.fCount) {
+        sample.fSum = 0.0f;
+    }
+    power_quality_acc_merge(acc, &sample);
+}
+
+/**
+ * @brief Reduce an accumulator to window statistics
+ * @param[out] stats Statistics
+ * @param[in]  acc   Accumulator of the closed window
+ */
+static void power_quality_acc_stats(StuPqStats *stats, const StuPqAcc *acc)
+{
+    f32 n = (f32)acc->count;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->samples = acc->count;
+    if (0U == acc->count) {
+        return;
+    }
+    stats->vMean = acc->vSum / n;
+    stats->vMin = acc->vMin;
+    stats->vMax = acc->vMax;
+    stats->iMean = acc->iSum / n;
+    stats->p = acc->pSum / n;
+    stats->q = acc->qSum / n;
+    stats->s = acc->sSum / n;
+
+    /* Energy weighted, so a light-load sweep does not swing the window */
+    if (stats->s >= PQ_MIN_APPARENT) {
+        stats->pf = acc->pSum / acc->sSum;
+        if (stats->pf > 1.0f) {
+            stats->pf = 1.0f;
+        } else if (stats->pf < -1.0f) {
+            stats->pf = -1.0f;
+        }
+    }
+    if (0U != acc->fCount) {
+        stats->fMean = acc->fSum / (f32)acc->fCount;
+        stats->fMin = acc->fMin;
+        stats->fMax = acc->fMax;
+    }
+}
+
+/**
+ * @brief Close a running event and log it
+ * @param[in] channel Channel index (0 or 1)
+ * @param[in] now     Tick of the sweep that ended the event
+ */
+static void power_quality_event_end(u8 channel, u32 now)
+{
+    StuPqDetector *det = &gDetector[channel];
+    StuPqEventRecord *record = &gEventLog[gEventLogCount % PQ_EVENT_LOG_SIZE];
+
+    record->start = det->start;
+    record->duration = now - det->start;
+    record->extreme = det->extreme;
+    record->channel = channel;
+    record->type = det->event;
+    gEventLogCount++;
+    gEventCount[channel][det->event]++;
+
+    det->holdUntil[det->event] = now + PQ_EVENT_HOLD_MS;
+    det->event = PQ_EVENT_NONE;
+}
+
+/**
+ * @brief Start an event, or turn a running sag into an interruption
+ * @param[in] channel Channel index (0 or 1)
+ * @param[in] event   EnuPqEvent
+ * @param[in] v       RMS voltage of the sweep
+ * @param[in] now     Tick of the sweep
+ */
+static void power_quality_event_start(u8 channel, u8 event, f32 v, u32 now)
+{
+    StuPqDetector *det = &gDetector[channel];
+
+    if (PQ_EVENT_SAG == det->event && PQ_EVENT_INTERRUPTION == event) {
+        /* Same dip, it only got deeper: keep the start */
+        det->holdUntil[PQ_EVENT_SAG] = now + PQ_EVENT_HOLD_MS;
+        det->event = event;
+        return;
+    }
+    det->event = event;
+    det->start = now;
+    det->extreme = v;
+}
+
+/**
+ * @brief Classify the RMS voltage of one sweep
+ * @param[in] channel Channel index (0 or 1)
+ * @param[in] v       RMS voltage of the sweep
+ * @param[in] now     Tick of the sweep
+ */
+static void power_quality_detect(u8 channel, f32 v, u32 now)
+{
+    StuPqDetector *det = &gDetector[channel];
+
+    switch (det->event) {
+    case PQ_EVENT_NONE:
+        if (v < PQ_INTERRUPTION_START) {
+            power_quality_event_start(channel, PQ_EVENT_INTERRUPTION, v, now);
+        } else if (v < PQ_SAG_START) {
+            power_quality_event_start(channel, PQ_EVENT_SAG, v, now);
+        } else if (v > PQ_SWELL_START) {
+            power_quality_event_start(channel, PQ_EVENT_SWELL, v, now);
+        }
+        break;
+
+    case PQ_EVENT_SAG:
+    case PQ_EVENT_INTERRUPTION:
+        if (v < det->extreme) {
+            det->extreme = v;
+        }
+        if (v >= PQ_SAG_END) {
+            power_quality_event_end(channel, now);
+            /* Straight from a dip into a swell */
+            if (v > PQ_SWELL_START) {
+                power_quality_event_start(channel, PQ_EVENT_SWELL, v, now);
+            }
+        } else if (PQ_EVENT_SAG == det->event && v < PQ_INTERRUPTION_START) {
+            power_quality_event_start(channel, PQ_EVENT_INTERRUPTION, v, now);
+        }
+        break;
+
+    case PQ_EVENT_SWELL:
+        if (v > det->extreme) {
+            det->extreme = v;
+        }
+        if (v <= PQ_SWELL_END) {
+            power_quality_event_end(channel, now);
+            if (v < PQ_SAG_START) {
+                power_quality_event_start(channel, (v < PQ_INTERRUPTION_START) ?
+                                          PQ_EVENT_INTERRUPTION : PQ_EVENT_SAG, v, now);
+            }
+        }
+        break;
+    }
+}
+
+/**
+ * @brief Build the PQstate bit mask
+ * @param[in] now Current tick
+ * @return Bits of the running and the held events
+ */
+static u32 power_quality_build_state(u32 now)
+{
+    u32 state = 0;
+
+    for (u8 ch = 0; ch < ENERGY_METER_CHANNELS; ch++) {
+        const StuPqDetector *det = &gDetector[ch];
+
+        for (u8 e = 0; e < PQ_EVENT_TYPES; e++) {
+            if (det->event == e || (int32_t)(det->holdUntil[e] - now) > 0) {
+                state |= PQ_STATE_BIT(ch, e);
+            }
+        }
+    }
+    return state;
+}
+
+/**
+ * @brief Close the running second and publish it
+ */
+static void power_quality_close_second(void)
+{
+    f32 freq = 0.0f;
+
+    for (u8 ch = 0; ch < ENERGY_METER_CHANNELS; ch++) {
+        power_quality_acc_stats(&gSecond[ch], &gSecondAcc[ch]);
+        power_quality_acc_merge(&gMinuteAcc[ch], &gSecondAcc[ch]);
+        power_quality_acc_clear(&gSecondAcc[ch]);
+    }
+
+    /* One supply frequency, from the first connected channel measuring it */
+    for (u8 ch = 0; ch < ENERGY_METER_CHANNELS; ch++) {
+        if (0U != (PQ_CHANNEL_MASK & (1U << ch)) && gSecond[ch].fMean > 0.0f) {
+            freq = gSecond[ch].fMean;
+            break;
+        }
+    }
+
+    signal_db_begin(SIG_GROUP_PQ);
+    signal_db_set(SIG_PQ1_VRMS, gSecond[0].vMean);
+    signal_db_set(SIG_PQ1_S, gSecond[0].s);
+    signal_db_set(SIG_PQ1_PF, gSecond[0].pf);
+    signal_db_set(SIG_PQ2_VRMS, gSecond[1].vMean);
+    signal_db_set(SIG_PQ2_S, gSecond[1].s);
+    signal_db_set(SIG_PQ2_PF, gSecond[1].pf);
+    signal_db_set(SIG_PQ_FREQ, freq);
+    signal_db_end(SIG_GROUP_PQ);
+
+    if (++gSeconds >= PQ_MINUTE_SECONDS) {
+        for (u8 ch = 0; ch < ENERGY_METER_CHANNELS; ch++) {
+            power_quality_acc_stats(&gMinute[ch], &gMinuteAcc[ch]);
+            power_quality_acc_clear(&gMinuteAcc[ch]);
+        }
+        gSeconds = 0;
+    }
+}
+
+/* ========================================================================
+ * Public Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Drop the running windows
+ */
+void power_quality_restart(void)
+{
+    memset(gSecondAcc, 0, sizeof(gSecondAcc));
+    memset(gMinuteAcc, 0, sizeof(gMinuteAcc));
+    gSeconds = 0;
+    gWindowValid = 0;
+}
+
+/**
+ * @brief Process one completed sweep
+ *
+ * @param[in] snapshot Sweep just completed
+ */
+void power_quality_update(const StuEnergyMeterSnapshot *snapshot)
+{
+    u32 now = snapshot->tick;
+    u32 state;
+
+    if (0U == gWindowValid) {
+        gSecondStart = now;
+        gWindowValid = 1;
+    }
+
+    for (u8 ch = 0; ch < ENERGY_METER_CHANNELS; ch++) {
+        power_quality_acc_add(&gSecondAcc[ch], &snapshot->ch[ch]);
+        if (0U != (PQ_CHANNEL_MASK & (1U << ch))) {
+            power_quality_detect(ch, snapshot->ch[ch].rmsVoltage, now);
+        }
+    }
+
+    /* Events are published at once, not with the second */
+    state = power_quality_build_state(now);
+    if (state != gState || 0U == signal_db_quality(SIG_PQ_STATE)) {
+        gState = state;
+        signal_db_set(SIG_PQ_STATE, (f32)state);
+    }
+
+    if ((now - gSecondStart) >= PQ_SECOND_MS) {
+        gSecondStart += PQ_SECOND_MS;
+        /* After a long gap the window restarts instead of catching up */
+        if ((now - gSecondStart) >= PQ_SECOND_MS) {
+            gSecondStart = now;
+        }
+        power_quality_close_second();
+    }
+}
+
+/**
+ * @brief Get the statistics of the last closed second
+ *
+ * @param[in]  channel Channel number (1 or 2)
+ * @param[out] stats   Statistics
+ *
+ * @return 1 if the channel is valid
+ */
+u8 power_quality_second(u8 channel, StuPqStats *stats)
+{
+    if (channel < 1U || channel > ENERGY_METER_CHANNELS || NULL == stats) {
+        return 0;
+    }
+    *stats = gSecond[channel - 1U];
+    return 1;
+}
+
+/**
+ * @brief Get the statistics of the last closed minute
+ *
+ * @param[in]  channel Channel number (1 or 2)
+ * @param[out] stats   Statistics
+ *
+ * @return 1 if the channel is valid
+ */
+u8 power_quality_minute(u8 channel, StuPqStats *stats)
+{
+    if (channel < 1U || channel > ENERGY_METER_CHANNELS || NULL == stats) {
+        return 0;
+    }
+    *stats = gMinute[channel - 1U];
+    return 1;
+}
+
+/**
+ * @brief Get the current event state
+ *
+ * @return PQstate bit mask
+ */
+u32 power_quality_state(void)
+{
+    return gState;
+}
+
+/**
+ * @brief Command line interface for the power quality stage
+ *
+ * @param[in,out] str Command string
+ *
+ * @return 1 while lines remain, 0 when done
+ */
+u8 power_quality_cmd(char *str)
+{
+    static u8 line = 0;
+    char tempStr[TEMP_STRING_SIZE];
+    u8 lines = ENERGY_METER_CHANNELS * 2U;
+    u32 logged = (gEventLogCount < PQ_EVENT_LOG_SIZE) ? gEventLogCount : PQ_EVENT_LOG_SIZE;
+
+    (void)str;
+
+    if (line < lines) {
+        /* Two lines per channel: the minute, then its event counters */
+        u8 ch = line / 2U;
+        const StuPqStats *m = &gMinute[ch];
+
+        if (0U == (line % 2U)) {
+            snprintf(tempStr, sizeof(tempStr),
+                     "\r>EM%u 1min V:%.1f/%.1f/%.1f I:%.2f P:%.0f Q:%.0f S:%.0f PF:%.3f F:%.2f n:%u\r",
+                     ch + 1U, m->vMin, m->vMean, m->vMax, m->iMean, m->p, m->q, m->s, m->pf,
+                     m->fMean, m->samples);
+        } else {
+            snprintf(tempStr, sizeof(tempStr), "\r>EM%u events sag:%lu swell:%lu interruption:%lu%s\r",
+                     ch + 1U, (unsigned long)gEventCount[ch][PQ_EVENT_SAG],
+                     (unsigned long)gEventCount[ch][PQ_EVENT_SWELL],
+                     (unsigned long)gEventCount[ch][PQ_EVENT_INTERRUPTION],
+                     (PQ_EVENT_NONE != gDetector[ch].event) ? " (running)" : "");
+        }
+        TransmitCMDResponse(tempStr);
+        line++;
+        return 1;
+    }
+
+    /* Then the logged events, newest first */
+    if ((u32)(line - lines) < logged) {
+        const StuPqEventRecord *e = &gEventLog[(gEventLogCount - 1U - (line - lines)) % PQ_EVENT_LOG_SIZE];
+
+        snprintf(tempStr, sizeof(tempStr), "\r>EM%u %s %lu ms, %.1f V, %lu s ago\r",
+                 e->channel + 1U, gEventName[e->type], (unsigned long)e->duration, e->extreme,
+                 (unsigned long)((HAL_GetTick() - e->start) / 1000U));
+        TransmitCMDResponse(tempStr);
+        line++;
+        return 1;
+    }
+
+    line = 0;
+    snprintf(tempStr, sizeof(tempStr), "\r>PQstate:0x%02lX nominal:%.0f V\r",
+             (unsigned long)gState, PQ_NOMINAL_VOLTAGE);
+    TransmitCMDResponse(tempStr);
+    return 0;
+}
+
+/**
+ * @brief Display help information for the power quality command
+ *
+ * @return 1 while help lines remain, 0 when done
+ */
+u8 power_quality_cmd_help(void)
+{
+    TransmitCMDResponse("     pq                     -> (Returns the power quality minute and events) \r");
+    return 0;
+}
@@ -0,0 +1,190 @@
+/**
+ * @file power_quality.h
+ * @brief Power quality analytics of the STPM34 channels
+ *
+ * Every completed STPM34 sweep feeds one sample per channel: RMS voltage
+ * and current, active and reactive power and the line frequency. From them
+ * the stage derives the apparent power S = Vrms x Irms and the power
+ * factor P / S, and accumulates both channels into a one-second and a
+ * one-minute window (count, sum, min, max). Nothing is buffered per
+ * sample; a closed second is merged into the running minute, so memory is
+ * fixed and the work per sweep is constant.
+ *
+ * Voltage events follow the IEC 61000-4-30 classification against
+ * PQ_NOMINAL_VOLTAGE, with PQ_HYSTERESIS_PCT between start and end: a sag
+ * below PQ_SAG_PCT, a swell above PQ_SWELL_PCT and an interruption below
+ * PQ_INTERRUPTION_PCT (a sag that deepens that far becomes one). Detection
+ * runs on every sweep, so an event is resolved to one sweep interval. A
+ * finished event is counted and kept with its duration and extreme voltage
+ * in a small log.
+ *
+ * Each closed second is published as signals (RMS voltage, apparent power
+ * and power factor per channel, line frequency), whose log window min/max/
+ * mean come from the signal registry. The event state of both channels is
+ * published as the PQstate bit mask; every bit stays set for at least
+ * PQ_EVENT_HOLD_MS, so the alarm engine sees even a one-sweep event and
+ * reports it as an "ALM" event.
+ *
+ * @date 2025-11-03
+ * @author Allayar Moazami
+ */
+#ifndef H_POWER_QUALITY
+#define H_POWER_QUALITY
+
+#include "platform.h"
+#include "energy_meters.h"
+
+/** @brief Declared supply voltage in V */
+#ifndef PQ_NOMINAL_VOLTAGE
+#define PQ_NOMINAL_VOLTAGE 230.0f
+#endif
+
+/** @brief Channels with a voltage input connected, bit 0 is channel 1 */
+#ifndef PQ_CHANNEL_MASK
+#define PQ_CHANNEL_MASK 0x03U
+#endif
+
+/** @brief Sag start in percent of the nominal voltage */
+#define PQ_SAG_PCT 90.0f
+
+/** @brief Swell start in percent of the nominal voltage */
+#define PQ_SWELL_PCT 110.0f
+
+/** @brief Interruption start in percent of the nominal voltage */
+#define PQ_INTERRUPTION_PCT 5.0f
+
+/** @brief Hysteresis between event start and end in percent of the nominal voltage */
+#define PQ_HYSTERESIS_PCT 2.0f
+
+/** @brief Apparent power in VA below which the power factor is not defined */
+#define PQ_MIN_APPARENT 1.0f
+
+/** @brief Short window in ms */
+#define PQ_SECOND_MS 1000U
+
+/** @brief Short windows per long window */
+#define PQ_MINUTE_SECONDS 60U
+
+/** @brief Minimum time in ms an event bit stays set in PQstate */
+#define PQ_EVENT_HOLD_MS 2000U
+
+/** @brief Finished events kept for the command port */
+#define PQ_EVENT_LOG_SIZE 8U
+
+/**
+ * @enum EnuPqEvent
+ * @brief Voltage event types, also the bit position in PQstate
+ */
+typedef enum EnuPqEventEnum
+{
+    PQ_EVENT_SAG = 0,           /**< Voltage below PQ_SAG_PCT */
+    PQ_EVENT_SWELL,             /**< Voltage above PQ_SWELL_PCT */
+    PQ_EVENT_INTERRUPTION,      /**< Voltage below PQ_INTERRUPTION_PCT */
+    PQ_EVENT_TYPES,             /**< Number of event types */
+    PQ_EVENT_NONE = PQ_EVENT_TYPES  /**< No event running */
+} EnuPqEvent;
+
+/** @brief PQstate bits of one channel, channel 2 starts at bit 4 */
+#define PQ_STATE_BITS_PER_CHANNEL 4U
+
+/** @brief PQstate bit of an event type on a channel (0 or 1) */
+#define PQ_STATE_BIT(channel, event) (1UL << ((channel) * PQ_STATE_BITS_PER_CHANNEL + (event)))
+
+/**
+ * @struct StuPqStats
+ * @brief Statistics of one channel over a closed window
+ */
+typedef struct StuPqStatsStruct
+{
+    f32 vMean;                  /**< Mean RMS voltage in V */
+    f32 vMin;                   /**< Lowest RMS voltage in V */
+    f32 vMax;                   /**< Highest RMS voltage in V */
+    f32 iMean;                  /**< Mean RMS current in A */
+    f32 p;                      /**< Mean active power in W */
+    f32 q;                      /**< Mean reactive power in var */
+    f32 s;                      /**< Mean apparent power in VA */
+    f32 pf;                     /**< Power factor of the window, sum P / sum S, 0 if not defined */
+    f32 fMean;                  /**< Mean line frequency in Hz, 0 if not measured */
+    f32 fMin;                   /**< Lowest line frequency in Hz */
+    f32 fMax;                   /**< Highest line frequency in Hz */
+    u16 samples;                /**< Sweeps in the window, 0 if none */
+} StuPqStats;
+
+/**
+ * @struct StuPqEventRecord
+ * @brief One finished voltage event
+ */
+typedef struct StuPqEventRecordStruct
+{
+    u32 start;                  /**< HAL tick of the first sweep of the event */
+    u32 duration;               /**< Duration in ms */
+    f32 extreme;                /**< Lowest voltage of a sag or interruption, highest of a swell */
+    u8 channel;                 /**< Channel index (0 or 1) */
+    u8 type;                    /**< EnuPqEvent */
+} StuPqEventRecord;
+
+/**
+ * @brief Drop the running windows
+ *
+ * Called by the energy meter handler whenever the chip is initialized
+ * again; running events continue with the next sweep.
+ */
+void power_quality_restart(void);
+
+/**
+ * @brief Process one completed sweep
+ *
+ * Called by the energy meter handler after every sweep. Publishes the
+ * signals of a closed second and the event state.
+ *
+ * @param[in] snapshot Sweep just completed
+ */
+void power_quality_update(const StuEnergyMeterSnapshot *snapshot);
+
+/**
+ * @brief Get the statistics of the last closed second
+ *
+ * @param[in]  channel Channel number (1 or 2)
+ * @param[out] stats   Statistics, samples is 0 before the first second
+ *
+ * @return 1 if the channel is valid
+ */
+u8 power_quality_second(u8 channel, StuPqStats *stats);
+
+/**
+ * @brief Get the statistics of the last closed minute
+ *
+ * @param[in]  channel Channel number (1 or 2)
+ * @param[out] stats   Statistics, samples is 0 before the first minute
+ *
+ * @return 1 if the channel is valid
+ */
+u8 power_quality_minute(u8 channel, StuPqStats *stats);
+
+/**
+ * @brief Get the current event state
+ *
+ * @return PQstate bit mask, see PQ_STATE_BIT()
+ */
+u32 power_quality_state(void);
+
+/**
+ * @brief Command line interface for the power quality stage
+ *
+ * "pq" prints the last minute of both channels, the event counters and
+ * the event log.
+ *
+ * @param[in,out] str Command string
+ *
+ * @return 1 while lines remain, 0 when done
+ */
+u8 power_quality_cmd(char *str);
+
+/**
+ * @brief Display help information for the power quality command
+ *
+ * @return 1 while help lines remain, 0 when done
+ */
+u8 power_quality_cmd_help(void);
+
+#endif /* H_POWER_QUALITY */
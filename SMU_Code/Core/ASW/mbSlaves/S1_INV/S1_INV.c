@@ -53,6 +53,7 @@
 #include "WebInstanceReport.h"
 #include "inv_mbmdl_cstm1.h"
 #include "inv_fault_recorder.h"
+#include "dbg.h"
 
 
 
@@ -72,42 +73,19 @@ static StuCstmModel1 gArStuRef[ENU_REF_AR_SIZE];
 
 static int gInvTimeout=0;
 
-static u8 tempTest[250];
+static u8 tempTest[256];
 u16 gIndexBuffer=0;
 u8 gFaultRecorderFag=0;
+static u16 gFrRowRegs=0;
+static u16 gFrBlockRegs=0;
+static u8 gFrBlockDone=0;
+static u8 gMntFresh=0;
 
 float tempDummy[50];
 
 S1_INV s1Inv;
 MB_Slave_Struct s1Node;
 
-//To report this data to web
-MntDataType s1MntData[S1_MNT_DATA_Size]=
-{
-		{"VDC","V",0.0},  //0
-		{"Iinv1","A",0.0},//1
-		{"Iinv2","A",0.0},//2
-		{"VO1","V",0.0},  //3  /*Dash Board 1*/
-		{"VO2","V",0.0},  //4  /*Dash Board 2*/
-		{"VG1","V",0.0},  //5
-		{"VG2","V",0.0},  //6
-		{"FRQI","Hz",0.0},//7
-		{"SSRS","N",0.0},//8  /*Dash Board 3*/
-		{"FCODE","N",0.0},//9 /*Dash Board 7*/
-		{"FTRIG","N",0.0},//10
-		{"Tempinv","C",0.0},//11
-		{"InvState","N",0.0},//12
-		{"Inv1REFID","N",0.0}//12
-};
-// To get these data from web
-MntDataType s1RefData[S1_MNT_DATA_Size]=
-{
-		{"S1_V1","V",0.0},  //0
-		{"S1_V2","A",0.0},//1
-		{"S1_V3","A",0.0},//2
-		{"S1_V4","V",0.0},  //3
-		{"S1_V5","V",0.0},  //4
-};
 /*!
  **************************************************************************************************
  *
@@ -124,6 +102,7 @@ static int S1_INV_sendReadReq();
 static int S1_INV_sendWriteReq();
 static void cstm_mdl1_init(void);
 static u16 s1_inverter_read_fault_recorder(void);
+static void s1_inverter_store_fault_recorder(const char *res);
 static void s1_inverter_timeout_check(void);
 static void s1_inverter_timeout_reset(void);
 
@@ -154,29 +133,6 @@ void S1_INV_registerToMbNode(void)
 	MB_Manager_RegisterSlave(s1Node);
 
 }
-/*!
- **************************************************************************************************
- *
- *  @fn         void S1_INV_Database_Init()
- *
- *  @par
- *
- *  @param      None.
- *
- *  @return     None.
- *
- *  @par        Design Info
- *              WCET            : Enter Worst Case Execution Time heres
- *              Sync/Async      : sync
- *
- **************************************************************************************************
- */
-void S1_INV_Database_Init()
-{
-	registerToDatabase("S1_INV",
-			s1MntData,
-			S1_MNT_DATA_Size);
-}
 /*!
  **************************************************************************************************
  *
@@ -204,8 +160,20 @@ int  S1_INV_MbMng(void)
 	if((gSnapStatus&0xf000)!=0 && temp==0 && gFaultRecorderFag==0)
 	{
 		TransmitCMDResponse("\r\n> **********  SMU Started Reading Recorded Data From Inverter ********* \r\n");
+		/* Row length is latched, the live status word keeps changing during the capture */
+		gFrRowRegs=gSnapStatus & 0x00ff;
+		if(gFrRowRegs==0 || gFrRowRegs>S1_FR_BLOCK_MAX_REGS)
+		{
+			gFrRowRegs=ENU_SNAP_DSIZE;
+		}
 		gFaultRecorderFag=1;
 	}
+	else if(gFaultRecorderFag==1 && 1==inv_fault_recorder_capture_done())
+	{
+		/* Capture finalised by timeout, stop reading the inverter buffer */
+		gFaultRecorderFag=0;
+		gSnapStatus=0;
+	}
 
 
 	if(gFaultRecorderFag==0) // Normal Modbus Read Custom model 1
@@ -242,27 +210,51 @@ int  S1_INV_MbMng(void)
 				state=WRITE;
 			}
 			break;
+		default :
+			state=READ;
+			break;
 		}
 	}
-	else   // Read Fault recorder buffer
+	else   // Read Fault recorder buffer, one block then one monitoring poll
 	{
+		S1_INV_Updates();
+
 		switch(state)
 		{
-		case READ:
+		case FR_READ:
 			if(0==s1_inverter_read_fault_recorder())
 			{
 				s1Inv.readTimeout=HAL_GetTick();
+				gFrBlockDone=0;
+				state=FR_READ_TIMEOUT;
+			}
+			break;
+		case FR_READ_TIMEOUT:
+			if(gFrBlockDone==1 ||
+			   (HAL_GetTick()-s1Inv.readTimeout)>
+			   (S1_READ_TIMEOUT_VALUE+((5U+2U*gFrBlockRegs)*S1_MB_BYTE_TIME_X10)/10U))
+			{
+				state=READ;
+			}
+			break;
+		case READ:
+			if(0==S1_INV_sendReadReq())
+			{
+				s1Inv.readTimeout=HAL_GetTick();
+				s1_inverter_timeout_check();
 				state=READ_TIMEOUT;
 			}
 			break;
 		case READ_TIMEOUT:
 			if((HAL_GetTick()-s1Inv.readTimeout)>S1_READ_TIMEOUT_VALUE)
 			{
-				state=READ;
+				/* Hand the bus to the other slaves between two blocks */
+				status=0;
+				state=FR_READ;
 			}
 			break;
 		default :
-			state=READ;
+			state=FR_READ;
 			break;
 		}
 	}
@@ -322,6 +314,7 @@ static void S1_INV_resProcess(char *res,int Len)
 
 				gArStuMnt[index].data=((float)invData) * gArStuMnt[index].scale;
 			}
+			gMntFresh=1;
 
 			break;
 		case 0x10:
@@ -335,22 +328,7 @@ static void S1_INV_resProcess(char *res,int Len)
 		switch (res[1]) {
 			case 0x03:
 
-				nDb = res[2];
-
-				for (int index = 1; index < nDb; index++) {
-					ind = 2 * index + 3;
-					invData = (res[ind    ]<< 8 | res[ind + 1] );
-					inv_fault_recorder_set_data(index,invData);
-				}
-				u8 tmp=inv_fault_recorder_inc_idx();
-				if(tmp==0)
-				{
-					gFaultRecorderFag=0;
-					gSnapStatus=0;
-				}
-
-
-
+				s1_inverter_store_fault_recorder(res);
 				break;
 			case 0x10:
 
@@ -437,16 +415,27 @@ static u16 s1_inverter_read_fault_recorder(void)
 	int status = 1;
 	uint16_t crc =0;
 	static int state=0;
+	u16 rows=0;
+	u16 rowsLeft=0;
 
 	switch(state)
 	{
 	case 0:
+		/* As many complete rows as fit in one PDU, never more than the buffer takes */
+		rows=S1_FR_BLOCK_MAX_REGS/gFrRowRegs;
+		rowsLeft=SNAP_SHOT_BUFFER_SIZE-inv_fault_recorder_head_report();
+		if(rows>rowsLeft)
+		{
+			rows=rowsLeft;
+		}
+		gFrBlockRegs=rows*gFrRowRegs;
+
 		mbStr[0] = S1_INV_ID;
 		mbStr[1] = READ;
 		mbStr[2] = (S1_READ_FR_START_ADDRESS & 0xff00) >> 8;
 		mbStr[3] = S1_READ_FR_START_ADDRESS & 0x00ff;
-		mbStr[4] = 0;
-		mbStr[5] = gSnapStatus & 0x00ff;
+		mbStr[4] = (gFrBlockRegs & 0xff00) >> 8;
+		mbStr[5] = gFrBlockRegs & 0x00ff;
 		crc = calculateCRC(mbStr, 6); //
 		mbStr[6] = crc & 0x00ff;
 		mbStr[7] = (crc & 0xff00) >> 8;
@@ -462,6 +451,48 @@ static u16 s1_inverter_read_fault_recorder(void)
 	}
 	return status;
 }
+/*!
+ **************************************************************************************************
+ *
+ *  @fn         static void s1_inverter_store_fault_recorder(const char *res)
+ *
+ *  @par        Scatters a fault recorder block into the snapshot buffer. Every row
+ *              starts with the MODEL_CSTM_2_ID header register, a row with another
+ *              header ends the block. The capture is complete once the buffer is full.
+ *
+ *  @param      res Modbus response frame.
+ *
+ *  @return     None.
+ *
+ *  @par        Design Info
+ *              WCET            : Enter Worst Case Execution Time heres
+ *              Sync/Async      : sync
+ *
+ **************************************************************************************************
+ */
+static void s1_inverter_store_fault_recorder(const char *res)
+{
+	const u8 *row=(const u8 *)&res[3];
+	u16 nRegs=((u8)res[2])/2;
+	u16 rowsLeft=1;
+
+	for(u16 base=0; base+gFrRowRegs<=nRegs && rowsLeft!=0; base+=gFrRowRegs)
+	{
+		if(((row[0]<< 8) | row[1])!=MODEL_CSTM_2_ID)
+		{
+			break;
+		}
+		rowsLeft=inv_fault_recorder_store_row(row,gFrRowRegs);
+		row+=2*gFrRowRegs;
+	}
+
+	if(rowsLeft==0)
+	{
+		gFaultRecorderFag=0;
+		gSnapStatus=0;
+	}
+	gFrBlockDone=1;
+}
 /*!
  **************************************************************************************************
  *
@@ -549,17 +580,14 @@ static int S1_INV_sendWriteReq(void)
  */
 static f32 returnInvWebRef(u16 u16Index)
 {
-	RefDataType *rData=getRefData();
+	RefDataType *rData=getRefHandle(u16Index);
     f32 f32ReturnValue=INVALID_DATA;
     u16 u16IsAnyCfgSet=(u16)getRefIDValue();
 
-if(0!=u16IsAnyCfgSet)
+if(0!=u16IsAnyCfgSet && NULL!=rData)
 {
-	for (int i = 0; i < REF_ARRAY_SIZE; i++)
-	{
-		if (u16Index==rData[i].index && REF_UPDATED_VALUE==(rData[i].flag & REF_UPDATED_VALUE)) {
-			f32ReturnValue= rData[i].value;
-		}
+	if (REF_UPDATED_VALUE==(rData->flag & REF_UPDATED_VALUE)) {
+		f32ReturnValue= rData->value;
 	}
 }
 return f32ReturnValue;
@@ -583,23 +611,18 @@ return f32ReturnValue;
  */
 static void setInvWebRef(u16 u16Index,f32 f32Value)
 {
-	RefDataType *rData=getRefData();
+	RefDataType *rData=getRefHandle(u16Index);
     u16 u16LocalRemote=_memoryMap[39];
     u16 u16IsAnyCfgSet=(u16)getRefIDValue();
 
-if(u16LocalRemote>u16IsAnyCfgSet)
+if(u16LocalRemote>u16IsAnyCfgSet && NULL!=rData)
 {
-	for (int i = 0; i < REF_ARRAY_SIZE; i++)
-	{
-		if (u16Index==rData[i].index) {
-			 if(rData[i].value!=f32Value ||
-					 ((rData[i].flag)&REF_UPDATED_VALUE)!=REF_UPDATED_VALUE)
-			 {
-				 rData[i].flag=(REF_REPORT_TO_WEB | REF_WRITE_TO_MEM | REF_UPDATED_VALUE);
-				 rData[i].value=f32Value;
-			 }
-		}
-	}
+	 if(rData->value!=f32Value ||
+			 ((rData->flag)&REF_UPDATED_VALUE)!=REF_UPDATED_VALUE)
+	 {
+		 rData->flag=(REF_REPORT_TO_WEB | REF_WRITE_TO_MEM | REF_UPDATED_VALUE);
+		 rData->value=f32Value;
+	 }
 }
 }
 /*!
@@ -677,9 +700,6 @@ return u16ReturnValue;
  */
 static void S1_INV_Updates(void)
 {
-	Database_Type* mDb=getMntDatabase();
-	MntDataType* mData = mDb[1].mData;
-    static f32 stcF32HoldData=0;
     static u8 firstTime=1;
 
     if(firstTime==1)
@@ -687,28 +707,33 @@ static void S1_INV_Updates(void)
     	 cstm_mdl1_init();
          firstTime=0;
     }
-	mData[S1_MNT_VDC     ].value  = gArStuMnt[ENU_MNT_VDC_AVG].data;
-	mData[S1_MNT_Iinv1   ].value  = gArStuMnt[ENU_MNT_CU_INV1_RMS].data;
-	mData[S1_MNT_Iinv2   ].value  = gArStuMnt[ENU_MNT_CU_INV2_RMS].data ;
-	mData[S1_MNT_VO1     ].value  = gArStuMnt[ENU_MNT_VC1_RMS].data;
-	mData[S1_MNT_VO2     ].value  = gArStuMnt[ENU_MNT_VC2_RMS].data ;
-	mData[S1_MNT_VG1     ].value  = gArStuMnt[ENU_MNT_VG1_RMS].data;
-	mData[S1_MNT_VG2     ].value  = gArStuMnt[ENU_MNT_VG2_RMS].data;
-	mData[S1_MNT_FRQI    ].value  = gArStuMnt[ENU_MNT_FRQ_INV].data;
-	mData[S1_MNT_SSRS    ].value  = gArStuMnt[ENU_MNT_SSR_STS].data;
-	mData[S1_MNT_FCODE   ].value  = gArStuMnt[ENU_MNT_FCODE].data;
-	mData[S1_MNT_FTRIG   ].value  = gArStuMnt[ENU_MNT_FAULT_TRIG].data;
-	mData[S1_MNT_Tempinv ].value  = gArStuMnt[ENU_MNT_TEMP2].data ;
-	mData[S1_MNT_InvState].value  = gArStuMnt[ENU_MNT_STATE].data;
-	//gSnapStatus=gArStuMnt[ENU_MNT_SNAP].data;
-	mData[S1_MNT_REFID   ].value  = 0;//_memoryMap_invF[17];
-
-	if(mData[S1_MNT_FCODE].value!=stcF32HoldData)
+	/* Only a new poll response is a sample, in between the values are held */
+	if(gMntFresh==1)
 	{
-		WebInsReportUpdate("FCODE",mData[S1_MNT_FCODE].value);
-		stcF32HoldData=mData[S1_MNT_FCODE].value;
-
+		gMntFresh=0;
+		signal_db_begin(SIG_GROUP_S1);
+	}
+	else
+	{
+		signal_db_begin_held(SIG_GROUP_S1);
 	}
+	signal_db_set(SIG_S1_VDC,       gArStuMnt[ENU_MNT_VDC_AVG].data);
+	signal_db_set(SIG_S1_IINV1,     gArStuMnt[ENU_MNT_CU_INV1_RMS].data);
+	signal_db_set(SIG_S1_IINV2,     gArStuMnt[ENU_MNT_CU_INV2_RMS].data);
+	signal_db_set(SIG_S1_VO1,       gArStuMnt[ENU_MNT_VC1_RMS].data);
+	signal_db_set(SIG_S1_VO2,       gArStuMnt[ENU_MNT_VC2_RMS].data);
+	signal_db_set(SIG_S1_VG1,       gArStuMnt[ENU_MNT_VG1_RMS].data);
+	signal_db_set(SIG_S1_VG2,       gArStuMnt[ENU_MNT_VG2_RMS].data);
+	signal_db_set(SIG_S1_FRQI,      gArStuMnt[ENU_MNT_FRQ_INV].data);
+	signal_db_set(SIG_S1_SSRS,      gArStuMnt[ENU_MNT_SSR_STS].data);
+	signal_db_set(SIG_S1_FTRIG,     gArStuMnt[ENU_MNT_FAULT_TRIG].data);
+	signal_db_set(SIG_S1_TEMPINV,   gArStuMnt[ENU_MNT_TEMP2].data);
+	signal_db_set(SIG_S1_INV_STATE, gArStuMnt[ENU_MNT_STATE].data);
+	//gSnapStatus=gArStuMnt[ENU_MNT_SNAP].data;
+	signal_db_set(SIG_S1_REFID,     0);//_memoryMap_invF[17];
+
+	signal_db_set(SIG_S1_FCODE,     gArStuMnt[ENU_MNT_FCODE].data);
+	signal_db_end(SIG_GROUP_S1);
 
 	for(u16 idx=3;idx<ENU_MNT_AR_SIZE;idx++)
 	{
@@ -740,7 +765,6 @@ static f32 S1_INV_GetRef(u16 index)
 {
 	float f32RefData;
 	f32 f32RefValueFromMemoryMap=(f32)_memoryMap[index];
-	Database_Type *mDb = getMntDatabase();
 	u16 u16LocalRemote=_memoryMap[39];
 	u16 u16IsAnyCfgSet=(u16)getRefIDValue();
 
@@ -755,7 +779,7 @@ static f32 S1_INV_GetRef(u16 index)
 	if (index == ENU_REF_VBAT_CH)
 	{
 
-		f32RefData = mDb[2].mData[S2_MNT_VBat_CH].value*gArStuRef[index].scale;
+		f32RefData = signal_db_get(SIG_S2_VBAT_CH)*gArStuRef[index].scale;
 
 	}
 
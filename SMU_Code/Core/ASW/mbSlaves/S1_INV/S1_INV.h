@@ -59,9 +59,15 @@
 /*State*/
 #define READ_TIMEOUT  100
 #define WRITE_TIMEOUT 101
+#define FR_READ         102
+#define FR_READ_TIMEOUT 103
 /*Value*/
 #define S1_WRITE_TIMEOUT_VALUE 200
 #define S1_READ_TIMEOUT_VALUE  200
+/*Fault recorder block read: rows per request limited by the 125 register PDU*/
+#define S1_FR_BLOCK_MAX_REGS   125
+/*Modbus master byte time at 9600 baud in 0.1 ms, added to the block read timeout*/
+#define S1_MB_BYTE_TIME_X10    11U
 
 #define S1_WRITE_BUFFER_SIZE 256
 
@@ -69,23 +75,6 @@
 #define BATTERY_DEAD_PREF -0.5f
 #define SCALE_FACTOR_10   0.1f
 
-typedef enum{
-	S1_MNT_VDC=0,/*1*/
-	S1_MNT_Iinv1,/*2*/
-	S1_MNT_Iinv2,/*3*/
-	S1_MNT_VO1,/*4*/
-	S1_MNT_VO2,/*5*/
-	S1_MNT_VG1,/*6*/
-	S1_MNT_VG2,/*7*/
-	S1_MNT_FRQI,/*8*/
-	S1_MNT_SSRS,/*9*/
-	S1_MNT_FCODE,/*10*/
-	S1_MNT_FTRIG,/*11*/
-    S1_MNT_Tempinv, /*12*/
-    S1_MNT_InvState,  /*13*/
-	S1_MNT_REFID,
-    S1_MNT_DATA_Size
-}S1_MntEnumType;
 
 
 typedef struct{
@@ -114,24 +103,6 @@ extern int16_t _memoryMap[500];
  **************************************************************************************************
  */
 void S1_INV_registerToMbNode(void);
-/*!
- **************************************************************************************************
- *
- *  @fn         void S1_INV_Database_Init()
- *
- *  @par
- *
- *  @param      None.
- *
- *  @return     None.
- *
- *  @par        Design Info
- *              WCET            : Enter Worst Case Execution Time heres
- *              Sync/Async      : sync
- *
- **************************************************************************************************
- */
-void S1_INV_Database_Init();
 
 /*!
  **************************************************************************************************
@@ -18,6 +18,8 @@
 #include <stdio.h>
 #include <string.h>
 #include "server.h"
+#include "dbg.h"
+#include "main.h"
 
 /* ========================================================================
  * Constants
@@ -32,6 +34,9 @@
 /** @brief Snapshot count threshold for local reporting mode */
 #define SNAPSHOT_THRESHOLD 98
 
+/** @brief Size of the API URL buffer in GPRS_HandleTypeDef */
+#define API_STRING_SIZE 50
+
 /* ========================================================================
  * Static Variables
  * ======================================================================== */
@@ -45,6 +50,34 @@ static u8 gLocalReport = 0;
 /** @brief Internal buffer for formatting event data for transmission */
 static u8 iEventBuff[EVENT_BUFFER_SIZE];
 
+/** @brief Bulk upload mode flag (1=packed chunks, 0=one JSON node per POST) */
+static u8 gBulkReport = 1;
+
+/** @brief Packed capture being uploaded in bulk mode */
+static u8 gPack[FR_PACK_BUFFER_SIZE];
+
+/** @brief Packed capture length, 0 while no capture is packed */
+static u16 gPackLen = 0;
+
+/** @brief Acknowledged bytes of the packed capture */
+static u16 gPackOffset = 0;
+
+/** @brief Bytes of the chunk in flight, 0 if none */
+static u16 gPackInFlight = 0;
+
+/** @brief Time the capture was packed */
+static DateTime gPackTime;
+
+/** @brief Time the last row was stored */
+static u32 gRowTick = 0;
+
+/** @brief Capture finalised before the buffer was full, takes no more rows */
+static u8 gCaptureClosed = 0;
+
+/** @brief Base64 alphabet */
+static const char kBase64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
 /* ========================================================================
  * Static Function Prototypes
  * ======================================================================== */
@@ -99,6 +132,23 @@ static void inv_fault_recorder_append_field_s16(char *str, size_t str_size,
  */
 static void inv_fault_recorder_build_json(char *str, size_t str_size, u16 idx);
 
+/**
+ * @brief Pack the capture column by column as zigzag varint deltas
+ */
+static void inv_fault_recorder_pack(void);
+
+/**
+ * @brief Build the next bulk chunk
+ * @param[out] str Output buffer for JSON string
+ * @param[in] str_size Size of output buffer
+ */
+static u16 inv_fault_recorder_build_chunk(char *str, size_t str_size);
+
+/**
+ * @brief Release the capture and start a new snapshot ID
+ */
+static void inv_fault_recorder_release(void);
+
 /* ========================================================================
  * Public Function Implementations
  * ======================================================================== */
@@ -133,13 +183,63 @@ void inv_fault_recorder_set_data(u16 index, u16 invData)
  */
 u8 inv_fault_recorder_inc_idx(void)
 {
-    if (gStuSnapshot.head < SNAP_SHOT_BUFFER_SIZE) {
+    if (gStuSnapshot.head < SNAP_SHOT_BUFFER_SIZE && gCaptureClosed == 0) {
         gStuSnapshot.head++;
+        gRowTick = HAL_GetTick();
         return 1;
     }
     return 0;
 }
 
+/**
+ * @brief Store one snapshot row taken from a Modbus block read
+ *
+ * @param[in] row First byte of the row in the Modbus response
+ * @param[in] nRegs Registers per row
+ *
+ * @return Number of free rows left after the store, 0 when the capture is complete
+ */
+u16 inv_fault_recorder_store_row(const u8 *row, u16 nRegs)
+{
+    u16 headIdx = gStuSnapshot.head;
+
+    if (headIdx >= SNAP_SHOT_BUFFER_SIZE || gCaptureClosed == 1) {
+        return 0;
+    }
+
+    for (u16 field = 1; field < nRegs && field < ENU_SNAP_DSIZE; field++) {
+        gStuSnapshot.node[headIdx].data[field].U =
+            (u16)((row[2 * field] << 8) | row[2 * field + 1]);
+    }
+    gStuSnapshot.head++;
+    gRowTick = HAL_GetTick();
+
+    return SNAP_SHOT_BUFFER_SIZE - gStuSnapshot.head;
+}
+
+/**
+ * @brief Check whether the capture in the buffer is complete
+ *
+ * A transfer that stops early (inverter reset, bus fault) would otherwise hold
+ * the buffer forever, so a stalled capture is closed with the rows it has.
+ *
+ * @return 1 if a complete capture is held, 0 if idle or still capturing
+ */
+u8 inv_fault_recorder_capture_done(void)
+{
+    if (gStuSnapshot.head >= SNAP_SHOT_BUFFER_SIZE) {
+        return 1;
+    }
+    if (gStuSnapshot.head == 0) {
+        return 0;
+    }
+    if (gCaptureClosed == 0 && (HAL_GetTick() - gRowTick) >= FR_CAPTURE_TIMEOUT) {
+        TransmitDebug(">>Fault capture finalised early\r");
+        gCaptureClosed = 1;
+    }
+    return gCaptureClosed;
+}
+
 /**
  * @brief Get fault recorder status
  *
@@ -154,13 +254,17 @@ u8 inv_fault_recorder_inc_idx(void)
 u8 inv_fault_recorder_status(void)
 {
     if (gLocalReport == 0) {
-        /* Remote reporting mode */
-        if (gStuSnapshot.head != 0) {
+        /* Remote reporting mode, bulk upload waits for the complete capture */
+        if (gBulkReport == 1) {
+            if (inv_fault_recorder_capture_done() == 1) {
+                return 1;
+            }
+        } else if (gStuSnapshot.head != 0) {
             return 1;
         }
     } else {
         /* Local reporting mode */
-        if (gStuSnapshot.head >= SNAPSHOT_THRESHOLD) {
+        if (gStuSnapshot.head >= SNAPSHOT_THRESHOLD || inv_fault_recorder_capture_done() == 1) {
             return 2;
         }
     }
@@ -171,6 +275,17 @@ u8 inv_fault_recorder_status(void)
  * Static Helper Function Implementations
  * ======================================================================== */
 
+/**
+ * @brief Release the capture and start a new snapshot ID
+ */
+static void inv_fault_recorder_release(void)
+{
+    gStuSnapshot.head = 0;
+    gStuSnapshot.tail = 0;
+    gStuSnapshot.id++;
+    gCaptureClosed = 0;
+}
+
 /**
  * @brief Append unsigned 16-bit field to JSON string
  *
@@ -312,6 +427,109 @@ static void inv_fault_recorder_build_json(char *str, size_t str_size, u16 idx)
                                         gStuSnapshot.node[idx].data[ENU_SNAP_UTIME].U, "uS", 1);
 }
 
+/**
+ * @brief Pack the capture column by column as zigzag varint deltas
+ *
+ * Column-major order keeps each signal contiguous, so consecutive deltas are
+ * small and mostly fit in one varint byte. Field 0 of every node is packed as
+ * well so the server can decode without knowing which fields are populated.
+ */
+static void inv_fault_recorder_pack(void)
+{
+    u16 len = 0;
+
+    for (u16 field = 0; field < ENU_SNAP_DSIZE; field++) {
+        u16 prev = 0;
+
+        for (u16 idx = 0; idx < gStuSnapshot.head; idx++) {
+            u16 value = gStuSnapshot.node[idx].data[field].U;
+            int16_t delta = (int16_t)(value - prev);
+            u16 zigzag = (u16)(((u16)delta << 1) ^ (u16)(delta >> 15));
+
+            prev = value;
+            do {
+                u8 byte = (u8)(zigzag & 0x7F);
+
+                zigzag >>= 7;
+                if (zigzag != 0) {
+                    byte |= 0x80;
+                }
+                gPack[len++] = byte;
+            } while (zigzag != 0);
+        }
+    }
+
+    gPackLen = len;
+    gPackOffset = 0;
+    gPackInFlight = 0;
+    _rtcFunctionRead(0);
+    gPackTime = urtc;
+}
+
+/**
+ * @brief Build the next bulk chunk
+ *
+ * Format: metadata of the capture, the byte offset and total size of the
+ * packed stream and the chunk itself base64 encoded in "data". If the
+ * buffer ends early only the bytes that were encoded are put in flight, the
+ * rest goes with the next chunk.
+ *
+ * @param[out] str Output buffer for JSON string
+ * @param[in] str_size Size of output buffer
+ *
+ * @return Packed bytes in the chunk, 0 if none fit
+ */
+static u16 inv_fault_recorder_build_chunk(char *str, size_t str_size)
+{
+    u16 chunk = gPackLen - gPackOffset;
+    const u8 *src = &gPack[gPackOffset];
+    u16 sent = 0;
+    size_t len;
+
+    if (chunk > FR_BULK_CHUNK_SIZE) {
+        chunk = FR_BULK_CHUNK_SIZE;
+    }
+
+    snprintf(str, str_size,
+             "{\r\"serial_number\":\"%s\",\r"
+             "\"date\":\"%04d-%02d-%02d\",\r"
+             "\"time\":\"%02d:%02d:%02d\",\r"
+             "\"fault\":\"%d\",\r"
+             "\"nodes\":\"%u\",\r"
+             "\"fields\":\"%u\",\r"
+             "\"enc\":\"zzv\",\r"
+             "\"size\":\"%u\",\r"
+             "\"offset\":\"%u\",\r"
+             "\"data\":\"",
+             _serialN, gPackTime.year, gPackTime.month, gPackTime.day,
+             gPackTime.hour, gPackTime.minute, gPackTime.second,
+             gStuSnapshot.id + 1, gStuSnapshot.head, ENU_SNAP_DSIZE,
+             gPackLen, gPackOffset);
+
+    len = strlen(str);
+    while (sent < chunk && (len + 8) < str_size) {
+        u32 triple = (u32)src[sent] << 16;
+        u8 n = (u8)(((chunk - sent) < 3) ? (chunk - sent) : 3);
+
+        if (n > 1) {
+            triple |= (u32)src[sent + 1] << 8;
+        }
+        if (n > 2) {
+            triple |= src[sent + 2];
+        }
+        str[len++] = kBase64[(triple >> 18) & 0x3F];
+        str[len++] = kBase64[(triple >> 12) & 0x3F];
+        str[len++] = (n > 1) ? kBase64[(triple >> 6) & 0x3F] : '=';
+        str[len++] = (n > 2) ? kBase64[triple & 0x3F] : '=';
+        sent += n;
+    }
+    str[len] = '\0';
+    strncat(str, "\"\r}", str_size - strlen(str) - 1);
+
+    gPackInFlight = sent;
+    return sent;
+}
+
 /* ========================================================================
  * Public Reporting Function Implementations
  * ======================================================================== */
@@ -326,14 +544,31 @@ static void inv_fault_recorder_build_json(char *str, size_t str_size, u16 idx)
  * @param[out] str Output buffer for JSON data (must be at least EVENT_BUFFER_SIZE bytes)
  * @param[out] api Output buffer for API URL (must be at least 100 bytes)
  *
+ * @return 1 if a snapshot was formatted, 0 if the buffer was empty
+ *
  * @note If buffer is empty, resets head, tail, and increments snapshot ID.
  *       The API URL is constructed from the server base URL plus "/api/send-event".
  */
-void inv_fault_recorder_web_report(u8 *str, u8 *api)
+u8 inv_fault_recorder_web_report(u8 *str, u8 *api)
 {
     char tempStr[TEMP_STRING_SIZE];
     u16 tailIdx = gStuSnapshot.tail;
 
+    if (gBulkReport == 1) {
+        if (inv_fault_recorder_capture_done() == 0) {
+            return 0;
+        }
+        if (gPackLen == 0) {
+            inv_fault_recorder_pack();
+        }
+        server_return_url((u8 *)tempStr);
+        snprintf((char *)api, API_STRING_SIZE, "%s/api/send-event-bulk", tempStr);
+        if (inv_fault_recorder_build_chunk((char *)str, EVENT_BUFFER_SIZE) == 0) {
+            return 0;
+        }
+        return 1;
+    }
+
     /* Build API URL */
     server_return_url((u8 *)tempStr);
     snprintf((char *)api, 100, "%s/api/send-event", tempStr);
@@ -342,11 +577,34 @@ void inv_fault_recorder_web_report(u8 *str, u8 *api)
         /* Build JSON for the current snapshot */
         inv_fault_recorder_build_json((char *)str, EVENT_BUFFER_SIZE, tailIdx);
         gStuSnapshot.tail++;
-    } else {
-        /* Reset buffer when empty */
-        gStuSnapshot.head = 0;
-        gStuSnapshot.tail = 0;
-        gStuSnapshot.id++;
+        return 1;
+    }
+
+    /* Reset buffer when empty */
+    inv_fault_recorder_release();
+    return 0;
+}
+
+/**
+ * @brief Acknowledge the last web report frame (HTTP 200)
+ *
+ * In bulk mode advances the upload offset by the chunk in flight and releases
+ * the capture once the last chunk is acknowledged. A chunk that is not
+ * acknowledged is sent again from the same offset. No effect in node mode.
+ */
+void inv_fault_recorder_web_ack(void)
+{
+    if (gPackInFlight == 0) {
+        return;
+    }
+
+    gPackOffset += gPackInFlight;
+    gPackInFlight = 0;
+    if (gPackOffset >= gPackLen) {
+        /* Whole capture delivered, free the buffer for the next fault */
+        gPackLen = 0;
+        gPackOffset = 0;
+        inv_fault_recorder_release();
     }
 }
 
@@ -372,9 +630,7 @@ void inv_fault_recorder_report(void)
     } else {
         /* Notify user that buffer is empty */
         TransmitCMDResponse("\r>Event Buffer is Empty\r");
-        gStuSnapshot.head = 0;
-        gStuSnapshot.tail = 0;
-        gStuSnapshot.id++;
+        inv_fault_recorder_release();
     }
 }
 
@@ -391,6 +647,61 @@ u16 inv_fault_recorder_head_report(void)
     return gStuSnapshot.head;
 }
 
+/**
+ * @brief Get the snapshot buffer
+ *
+ * @return Read-only pointer to the snapshot buffer
+ */
+const StuSnapShotType *inv_fault_recorder_buffer(void)
+{
+    return &gStuSnapshot;
+}
+
+/**
+ * @brief Load a stored capture into the idle snapshot buffer
+ *
+ * @param[in] node SNAP_SHOT_BUFFER_SIZE snapshot nodes
+ * @param[in] rows Valid rows in node, 1 to SNAP_SHOT_BUFFER_SIZE
+ * @param[in] id Snapshot sequence identifier to report the capture with
+ *
+ * @return 1 if loaded, 0 if the buffer is in use
+ */
+u8 inv_fault_recorder_load(const StuNodeData *node, u16 rows, u16 id)
+{
+    if (gStuSnapshot.head != 0 || rows == 0 || rows > SNAP_SHOT_BUFFER_SIZE) {
+        return 0;
+    }
+
+    memcpy(gStuSnapshot.node, node, sizeof(gStuSnapshot.node));
+    gStuSnapshot.tail = 0;
+    gStuSnapshot.id = id;
+    gPackLen = 0;
+    gPackInFlight = 0;
+    gCaptureClosed = (rows < SNAP_SHOT_BUFFER_SIZE) ? 1 : 0;
+    gStuSnapshot.head = rows;
+    return 1;
+}
+
+/**
+ * @brief Select the reporting mode
+ *
+ * @param[in] local 1 for local serial reporting, 0 for web reporting
+ */
+void inv_fault_recorder_set_local(u8 local)
+{
+    gLocalReport = local;
+}
+
+/**
+ * @brief Get the reporting mode
+ *
+ * @return 1 for local serial reporting, 0 for web reporting
+ */
+u8 inv_fault_recorder_get_local(void)
+{
+    return gLocalReport;
+}
+
 /* ========================================================================
  * Command Interface Function Implementations
  * ======================================================================== */
@@ -410,6 +721,8 @@ u16 inv_fault_recorder_head_report(void)
  * @par Supported commands:
  *      - "local": Enable local event log reporting via serial interface
  *      - "remote": Enable remote event log reporting to web server
+ *      - "bulk": Upload complete captures as packed chunks
+ *      - "node": Upload one JSON snapshot per POST
  *
  * @note Uses substring matching, so "local" will match any string containing "local"
  */
@@ -425,6 +738,16 @@ u8 inv_fault_recorder_cmd(char *str)
         TransmitCMDResponse("\r>Enable Sending Event Log to Web\r");
         gLocalReport = 0;
         returnValue = 0;
+    } else if (strstr((char *)str, "bulk")) {
+        TransmitCMDResponse("\r>Event Log Sent as Packed Captures\r");
+        gBulkReport = 1;
+        returnValue = 0;
+    } else if (strstr((char *)str, "node")) {
+        TransmitCMDResponse("\r>Event Log Sent One Snapshot per Post\r");
+        gBulkReport = 0;
+        gPackLen = 0;
+        gPackInFlight = 0;
+        returnValue = 0;
     }
 
     return returnValue;
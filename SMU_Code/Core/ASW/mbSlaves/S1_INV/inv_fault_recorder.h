@@ -44,6 +44,15 @@
 /** @brief Maximum number of snapshots that can be buffered */
 #define SNAP_SHOT_BUFFER_SIZE 100
 
+/** @brief Packed capture bytes per bulk POST (multiple of 3, no base64 padding mid-stream) */
+#define FR_BULK_CHUNK_SIZE 216
+
+/** @brief A capture without a new row for this long (ms) is finalised with the rows it has */
+#define FR_CAPTURE_TIMEOUT 5000U
+
+/** @brief Worst-case packed capture size, 3 varint bytes per 16-bit delta */
+#define FR_PACK_BUFFER_SIZE (ENU_SNAP_DSIZE * SNAP_SHOT_BUFFER_SIZE * 3)
+
 /**
  * @enum EnuSnapshot
  * @brief Enumeration of snapshot data field indices
@@ -131,6 +140,20 @@ void inv_fault_recorder_set_data(u16 index, u16 invData);
  */
 u8 inv_fault_recorder_inc_idx(void);
 
+/**
+ * @brief Store one snapshot row taken from a Modbus block read
+ *
+ * Copies the big-endian registers of one row into the node at the head index
+ * and advances the head. Register 0 of a row is the model header and is not
+ * stored; registers beyond ENU_SNAP_DSIZE are ignored.
+ *
+ * @param[in] row First byte of the row in the Modbus response
+ * @param[in] nRegs Registers per row
+ *
+ * @return Number of free rows left after the store, 0 when the capture is complete
+ */
+u16 inv_fault_recorder_store_row(const u8 *row, u16 nRegs);
+
 /**
  * @brief Get fault recorder status
  *
@@ -139,7 +162,8 @@ u8 inv_fault_recorder_inc_idx(void);
  *
  * @return Status code:
  *         - 0: Idle (no data to report)
- *         - 1: Remote reporting pending (data available for web transmission)
+ *         - 1: Remote reporting pending (data available for web transmission,
+ *              in bulk mode only once the capture is complete)
  *         - 2: Local reporting ready (threshold reached for local output)
  */
 u8 inv_fault_recorder_status(void);
@@ -168,6 +192,8 @@ void inv_fault_recorder_report(void);
  * @par Supported commands:
  *      - "local": Enable local event log reporting via serial interface
  *      - "remote": Enable remote event log reporting to web server
+ *      - "bulk": Upload complete captures as packed chunks
+ *      - "node": Upload one JSON snapshot per POST
  */
 u8 inv_fault_recorder_cmd(char *str);
 
@@ -185,16 +211,77 @@ u8 inv_fault_recorder_cmd_help(void);
 /**
  * @brief Generate web report with fault snapshot data
  *
- * Prepares a JSON-formatted snapshot for transmission to a web API endpoint.
- * Constructs both the JSON payload and the API URL. Automatically advances
- * the tail pointer after successful report generation.
+ * In bulk mode (default) the complete capture is packed column by column as
+ * zigzag varint deltas and sent base64 encoded in FR_BULK_CHUNK_SIZE chunks
+ * to "/api/send-event-bulk"; each chunk carries its byte offset so the server
+ * can reassemble and an interrupted upload resumes at the unacknowledged
+ * chunk. In node mode one JSON snapshot per call is sent to "/api/send-event"
+ * and the tail pointer is advanced immediately.
  *
  * @param[out] str Output buffer for JSON data (must be at least EVENT_BUFFER_SIZE bytes)
  * @param[out] api Output buffer for API URL (must be at least 100 bytes)
  *
+ * @return 1 if a snapshot was formatted, 0 if the buffer was empty
+ *
  * @note If buffer is empty, resets head, tail, and increments snapshot ID
  */
-void inv_fault_recorder_web_report(u8 *str, u8 *api);
+u8 inv_fault_recorder_web_report(u8 *str, u8 *api);
+
+/**
+ * @brief Acknowledge the last web report frame (HTTP 200)
+ *
+ * In bulk mode advances the upload offset by the chunk in flight and releases
+ * the capture once the last chunk is acknowledged. A chunk that is not
+ * acknowledged is sent again from the same offset. No effect in node mode.
+ */
+void inv_fault_recorder_web_ack(void);
+
+/**
+ * @brief Get the snapshot buffer
+ *
+ * Used by the SD fault store to persist a complete capture.
+ *
+ * @return Read-only pointer to the snapshot buffer
+ */
+const StuSnapShotType *inv_fault_recorder_buffer(void);
+
+/**
+ * @brief Load a stored capture into the idle snapshot buffer
+ *
+ * The capture is then reported like a fresh one, locally or to the web
+ * depending on the reporting mode.
+ *
+ * @param[in] node SNAP_SHOT_BUFFER_SIZE snapshot nodes
+ * @param[in] rows Valid rows in node, 1 to SNAP_SHOT_BUFFER_SIZE
+ * @param[in] id Snapshot sequence identifier to report the capture with
+ *
+ * @return 1 if loaded, 0 if the buffer is in use
+ */
+u8 inv_fault_recorder_load(const StuNodeData *node, u16 rows, u16 id);
+
+/**
+ * @brief Check whether the capture in the buffer is complete
+ *
+ * A capture is complete once the buffer is full, or once FR_CAPTURE_TIMEOUT
+ * passed without a new row. A finalised capture takes no more rows.
+ *
+ * @return 1 if a complete capture is held, 0 if idle or still capturing
+ */
+u8 inv_fault_recorder_capture_done(void);
+
+/**
+ * @brief Select the reporting mode
+ *
+ * @param[in] local 1 for local serial reporting, 0 for web reporting
+ */
+void inv_fault_recorder_set_local(u8 local);
+
+/**
+ * @brief Get the reporting mode
+ *
+ * @return 1 for local serial reporting, 0 for web reporting
+ */
+u8 inv_fault_recorder_get_local(void);
 
 /**
  * @brief Get current snapshot buffer head index
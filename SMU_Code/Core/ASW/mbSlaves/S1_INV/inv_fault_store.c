@@ -0,0 +1,513 @@
+/**
+ * @file inv_fault_store.c
+ * @brief Persistent store of inverter fault captures implementation
+ *
+ * The store is a single file on the SD card: a 512-byte index sector
+ * followed by FSTORE_SLOT_COUNT capture slots used as a ring. head is a
+ * free-running capture counter, the slot of a capture is head modulo
+ * FSTORE_SLOT_COUNT and its record offset is kept in the index entry.
+ *
+ * A capture is written before the index that publishes it, so a power loss in
+ * between only loses that capture. As in the telemetry spool the file is
+ * opened and closed for every access (_FS_LOCK = 2).
+ *
+ * The store follows the recorder buffer instead of being called from it:
+ * the capture is complete -> persist, the buffer is released -> delivered, the
+ * buffer is idle -> load the oldest undelivered or a requested capture.
+ * Delivered means reported to the web: a capture printed locally stays
+ * pending, and a replay only switches the reporting mode for its own run.
+ *
+ * @date 2025-10-24
+ * @author Allayar Moazami
+ */
+#include "inv_fault_store.h"
+#include "inv_fault_recorder.h"
+#include "main.h"
+#include "fatfs.h"
+#include "myrtc.h"
+#include "crc.h"
+#include "dbg.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ========================================================================
+ * Constants
+ * ======================================================================== */
+
+/** @brief Header marker, "FLTS" */
+#define FSTORE_MAGIC 0x53544C46UL
+
+/** @brief Size of the index sector in front of the capture slots */
+#define FSTORE_HEADER_SIZE 512U
+
+/** @brief No capture loaded in the recorder */
+#define FSTORE_NONE 0xFFU
+
+/** @brief Capture in the recorder could not be stored */
+#define FSTORE_RAM_ONLY 0xFEU
+
+/** @brief Keep the current reporting mode on replay */
+#define FSTORE_MODE_KEEP 0xFFU
+
+/** @brief Size of temporary string buffer for formatting */
+#define TEMP_STRING_SIZE 80
+
+/* ========================================================================
+ * Types
+ * ======================================================================== */
+
+/**
+ * @struct StuFaultIndex
+ * @brief Index entry of one capture slot
+ */
+typedef struct StuFaultIndexStruct
+{
+    u16 id;         /**< Capture ID, 0 if the slot is empty */
+    u16 fcode;      /**< First non-zero fault code of the capture */
+    u32 offset;     /**< Record offset in the file */
+    u16 crc;        /**< CRC16 over the record */
+    u8 sent;        /**< 1 once the capture was reported */
+    u8 rows;        /**< Valid rows of a finalised partial capture, 0 if full */
+    u16 year;       /**< Capture time */
+    u8 month;
+    u8 day;
+    u8 hour;
+    u8 minute;
+    u8 second;
+    u8 reserved2;
+} StuFaultIndex;
+
+/**
+ * @struct StuFaultHeader
+ * @brief Persisted store state, stored at file offset 0
+ */
+typedef struct StuFaultHeaderStruct
+{
+    u32 magic;                              /**< FSTORE_MAGIC */
+    u32 head;                               /**< Captures written (free-running) */
+    u16 nextId;                             /**< ID of the next capture */
+    u16 slots;                              /**< FSTORE_SLOT_COUNT the file was created with */
+    StuFaultIndex index[FSTORE_SLOT_COUNT]; /**< One entry per slot */
+    u16 crc;                                /**< CRC16 over the fields above */
+    u16 reserved;
+} StuFaultHeader;
+
+/* ========================================================================
+ * Static Variables
+ * ======================================================================== */
+
+/** @brief RAM copy of the persisted header */
+static StuFaultHeader gHeader;
+
+/** @brief Capture read back from the card */
+static StuNodeData gNode[SNAP_SHOT_BUFFER_SIZE];
+
+/** @brief Store mounted and header valid */
+static u8 gReady = 0;
+
+/** @brief Time of the last mount attempt, the first call mounts at once */
+static u32 gMountTick = 0U - FSTORE_RETRY_INTERVAL;
+
+/** @brief Slot of the capture held by the recorder, FSTORE_NONE or FSTORE_RAM_ONLY */
+static u8 gActive = FSTORE_NONE;
+
+/** @brief Capture ID requested by "fault replay", 0 if none */
+static volatile u16 gReplayId = 0;
+
+/** @brief Reporting mode requested with the replay */
+static volatile u8 gReplayMode = FSTORE_MODE_KEEP;
+
+/** @brief Reporting mode to restore once the replayed capture is released */
+static u8 gRestoreMode = FSTORE_MODE_KEEP;
+
+/** @brief File object, only open during a single access */
+static FIL gStoreFile;
+
+/* ========================================================================
+ * Static Function Prototypes
+ * ======================================================================== */
+
+static u8 inv_fault_store_mount(void);
+static u8 inv_fault_store_save_header(void);
+static u8 inv_fault_store_save(void);
+static u8 inv_fault_store_load(u8 slot);
+static u8 inv_fault_store_find(u16 id);
+static u8 inv_fault_store_pending(void);
+static u16 inv_fault_store_header_crc(const StuFaultHeader *header);
+
+/* ========================================================================
+ * Static Helper Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Calculate the header CRC
+ * @param[in] header Header to check
+ * @return CRC16 over all fields in front of crc
+ */
+static u16 inv_fault_store_header_crc(const StuFaultHeader *header)
+{
+    return calculateCRC((u8 *)header, (u16)offsetof(StuFaultHeader, crc));
+}
+
+/**
+ * @brief Open the store file and load or create its header
+ * @return 1 if the store is ready, 0 on SD error
+ */
+static u8 inv_fault_store_mount(void)
+{
+    UINT bytes = 0;
+    FRESULT res;
+
+    gMountTick = HAL_GetTick();
+    res = f_mkdir(FSTORE_DIR);
+    if (FR_OK != res && FR_EXIST != res) {
+        return 0;
+    }
+    if (FR_OK != f_open(&gStoreFile, FSTORE_FILE_PATH, FA_READ | FA_WRITE | FA_OPEN_ALWAYS)) {
+        return 0;
+    }
+
+    res = f_read(&gStoreFile, &gHeader, sizeof(gHeader), &bytes);
+    f_close(&gStoreFile);
+    if (FR_OK != res) {
+        return 0;
+    }
+
+    if (sizeof(gHeader) != bytes || FSTORE_MAGIC != gHeader.magic ||
+        FSTORE_SLOT_COUNT != gHeader.slots ||
+        gHeader.crc != inv_fault_store_header_crc(&gHeader)) {
+        /* New card or incompatible file: start an empty store */
+        memset(&gHeader, 0, sizeof(gHeader));
+        gHeader.magic = FSTORE_MAGIC;
+        gHeader.slots = FSTORE_SLOT_COUNT;
+        gHeader.nextId = 1;
+        TransmitDebug(">>Fault store created\r");
+    }
+
+    gReady = 1;
+    return inv_fault_store_save_header();
+}
+
+/**
+ * @brief Write the RAM header to the store file
+ * @return 1 on success, 0 on SD error (store is remounted later)
+ */
+static u8 inv_fault_store_save_header(void)
+{
+    UINT bytes = 0;
+    FRESULT res;
+
+    gHeader.crc = inv_fault_store_header_crc(&gHeader);
+    res = f_open(&gStoreFile, FSTORE_FILE_PATH, FA_WRITE | FA_OPEN_EXISTING);
+    if (FR_OK == res) {
+        res = f_write(&gStoreFile, &gHeader, sizeof(gHeader), &bytes);
+        if (FR_OK == f_close(&gStoreFile) && FR_OK == res && sizeof(gHeader) == bytes) {
+            return 1;
+        }
+    }
+    gReady = 0;
+    return 0;
+}
+
+/**
+ * @brief Write the recorder buffer into the next slot
+ * @return 1 if the capture is stored, 0 on SD error
+ */
+static u8 inv_fault_store_save(void)
+{
+    const StuSnapShotType *snap = inv_fault_recorder_buffer();
+    u8 slot = (u8)(gHeader.head % FSTORE_SLOT_COUNT);
+    StuFaultIndex *entry = &gHeader.index[slot];
+    UINT bytes = 0;
+    FRESULT res;
+
+    memset(entry, 0, sizeof(*entry));
+    entry->offset = FSTORE_HEADER_SIZE + (u32)slot * FSTORE_SLOT_SIZE;
+    entry->crc = calculateCRC((u8 *)snap->node, (u16)sizeof(snap->node));
+    if (snap->head < SNAP_SHOT_BUFFER_SIZE) {
+        entry->rows = (u8)snap->head;
+    }
+    for (u16 idx = 0; idx < SNAP_SHOT_BUFFER_SIZE; idx++) {
+        if (snap->node[idx].data[ENU_SNAP_FCODE].U != 0) {
+            entry->fcode = snap->node[idx].data[ENU_SNAP_FCODE].U;
+            break;
+        }
+    }
+    _rtcFunctionRead(0);
+    entry->year = (u16)urtc.year;
+    entry->month = (u8)urtc.month;
+    entry->day = (u8)urtc.day;
+    entry->hour = (u8)urtc.hour;
+    entry->minute = (u8)urtc.minute;
+    entry->second = (u8)urtc.second;
+
+    res = f_open(&gStoreFile, FSTORE_FILE_PATH, FA_WRITE | FA_OPEN_EXISTING);
+    if (FR_OK != res) {
+        gReady = 0;
+        return 0;
+    }
+    res = f_lseek(&gStoreFile, entry->offset);
+    if (FR_OK == res) {
+        res = f_write(&gStoreFile, snap->node, sizeof(snap->node), &bytes);
+    }
+    if (FR_OK != f_close(&gStoreFile) || FR_OK != res || sizeof(snap->node) != bytes) {
+        /* Slot content is unknown now, drop its entry */
+        entry->id = 0;
+        gReady = 0;
+        return 0;
+    }
+
+    entry->id = gHeader.nextId++;
+    if (0 == gHeader.nextId) {
+        gHeader.nextId = 1;
+    }
+    gHeader.head++;
+    if (0 == inv_fault_store_save_header()) {
+        return 0;
+    }
+    gActive = slot;
+    return 1;
+}
+
+/**
+ * @brief Read a capture back and hand it to the recorder
+ * @param[in] slot Slot to load
+ * @return 1 if loaded, 0 on SD error, corrupt record or busy recorder
+ */
+static u8 inv_fault_store_load(u8 slot)
+{
+    StuFaultIndex *entry = &gHeader.index[slot];
+    UINT bytes = 0;
+    FRESULT res;
+
+    if (FR_OK != f_open(&gStoreFile, FSTORE_FILE_PATH, FA_READ | FA_OPEN_EXISTING)) {
+        gReady = 0;
+        return 0;
+    }
+    res = f_lseek(&gStoreFile, entry->offset);
+    if (FR_OK == res) {
+        res = f_read(&gStoreFile, gNode, sizeof(gNode), &bytes);
+    }
+    f_close(&gStoreFile);
+    if (FR_OK != res) {
+        gReady = 0;
+        return 0;
+    }
+
+    if (sizeof(gNode) != bytes || entry->crc != calculateCRC((u8 *)gNode, (u16)sizeof(gNode))) {
+        /* Corrupt record, e.g. power lost while it was written */
+        entry->id = 0;
+        inv_fault_store_save_header();
+        return 0;
+    }
+
+    /* The recorder reports id + 1, keep the number shown by "fault list" */
+    if (0 == inv_fault_recorder_load(gNode, (0 != entry->rows) ? entry->rows : SNAP_SHOT_BUFFER_SIZE,
+                                     (u16)(entry->id - 1))) {
+        return 0;
+    }
+    gActive = slot;
+    return 1;
+}
+
+/**
+ * @brief Find the slot of a capture
+ * @param[in] id Capture ID
+ * @return Slot, FSTORE_NONE if the capture is not on the card
+ */
+static u8 inv_fault_store_find(u16 id)
+{
+    for (u8 slot = 0; slot < FSTORE_SLOT_COUNT; slot++) {
+        if (id != 0 && id == gHeader.index[slot].id) {
+            return slot;
+        }
+    }
+    return FSTORE_NONE;
+}
+
+/**
+ * @brief Find the oldest capture that was not reported yet
+ * @return Slot, FSTORE_NONE if every capture was reported
+ */
+static u8 inv_fault_store_pending(void)
+{
+    u8 slot;
+
+    for (u32 n = 0; n < FSTORE_SLOT_COUNT; n++) {
+        slot = (u8)((gHeader.head + n) % FSTORE_SLOT_COUNT);
+        if (0 != gHeader.index[slot].id && 0 == gHeader.index[slot].sent) {
+            return slot;
+        }
+    }
+    return FSTORE_NONE;
+}
+
+/* ========================================================================
+ * Public Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Persist, reload and replay fault captures
+ *
+ * WCET is one FatFs open/write/close of a 2.8 KB capture plus the index
+ * sector, only on the tick a capture completes or is loaded.
+ */
+void inv_fault_store_service(void)
+{
+    u16 head = inv_fault_recorder_head_report();
+    u8 done = inv_fault_recorder_capture_done();
+    u8 slot;
+
+    if (0 == gReady) {
+        if ((HAL_GetTick() - gMountTick) < FSTORE_RETRY_INTERVAL ||
+            0 == inv_fault_store_mount()) {
+            if (FSTORE_NONE == gActive && 1 == done) {
+                gActive = FSTORE_RAM_ONLY;
+            }
+            if (0 == done) {
+                if (FSTORE_MODE_KEEP != gRestoreMode) {
+                    inv_fault_recorder_set_local(gRestoreMode);
+                    gRestoreMode = FSTORE_MODE_KEEP;
+                }
+                gActive = FSTORE_NONE;
+            }
+            return;
+        }
+    }
+
+    if (FSTORE_NONE != gActive && 0 == done) {
+        /* Recorder released the capture: it was reported, to the web unless local */
+        if (FSTORE_RAM_ONLY != gActive && 0 == inv_fault_recorder_get_local()) {
+            gHeader.index[gActive].sent = 1;
+            inv_fault_store_save_header();
+        }
+        if (FSTORE_MODE_KEEP != gRestoreMode) {
+            inv_fault_recorder_set_local(gRestoreMode);
+            gRestoreMode = FSTORE_MODE_KEEP;
+        }
+        gActive = FSTORE_NONE;
+    }
+
+    if (FSTORE_NONE == gActive && 1 == done) {
+        if (0 == inv_fault_store_save()) {
+            gActive = FSTORE_RAM_ONLY;
+            TransmitDebug(">>Fault capture not stored\r");
+        }
+    }
+
+    if (FSTORE_NONE == gActive && 0 == head && 1 == gReady) {
+        if (0 != gReplayId) {
+            slot = inv_fault_store_find(gReplayId);
+            gReplayId = 0;
+            if (FSTORE_NONE != slot) {
+                if (FSTORE_MODE_KEEP != gReplayMode) {
+                    gRestoreMode = inv_fault_recorder_get_local();
+                    inv_fault_recorder_set_local(gReplayMode);
+                }
+                if (0 == inv_fault_store_load(slot) && FSTORE_MODE_KEEP != gRestoreMode) {
+                    inv_fault_recorder_set_local(gRestoreMode);
+                    gRestoreMode = FSTORE_MODE_KEEP;
+                }
+            }
+        } else if (0 == inv_fault_recorder_get_local()) {
+            /* Pending captures wait for web delivery */
+            slot = inv_fault_store_pending();
+            if (FSTORE_NONE != slot) {
+                inv_fault_store_load(slot);
+            }
+        }
+    }
+}
+
+/* ========================================================================
+ * Command Interface Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Process fault store commands
+ *
+ * The command only reads the RAM index or posts a replay request; the SD
+ * access itself is done by inv_fault_store_service().
+ *
+ * @param[in] str Command string to process
+ *
+ * @return 0 when the command is done
+ */
+u8 inv_fault_store_cmd(char *str)
+{
+    static u8 slot = 0;
+    static u8 listed = 0;
+    char tempStr[TEMP_STRING_SIZE];
+    StuFaultIndex *entry;
+    char *arg;
+
+    if (0 == gReady) {
+        TransmitCMDResponse("\r>Fault store offline\r");
+        return 0;
+    }
+
+    if (strstr(str, "replay")) {
+        arg = strstr(str, "replay") + strlen("replay");
+        gReplayMode = FSTORE_MODE_KEEP;
+        if (strstr(arg, "local")) {
+            gReplayMode = 1;
+        } else if (strstr(arg, "web")) {
+            gReplayMode = 0;
+        }
+        gReplayId = (u16)atoi(arg);
+        snprintf(tempStr, sizeof(tempStr), "\r>Fault %u %s\r", gReplayId,
+                 (FSTORE_NONE == inv_fault_store_find(gReplayId)) ? "not found" : "queued for replay");
+        TransmitCMDResponse(tempStr);
+        return 0;
+    }
+
+    /* "fault list": one capture per call, newest first */
+    while (slot < FSTORE_SLOT_COUNT) {
+        entry = &gHeader.index[(gHeader.head + FSTORE_SLOT_COUNT - 1U - slot) % FSTORE_SLOT_COUNT];
+        slot++;
+        if (0 != entry->id) {
+            snprintf(tempStr, sizeof(tempStr),
+                     "\r>Fault %u %04u-%02u-%02u %02u:%02u:%02u code:%u off:%lu %s",
+                     entry->id, entry->year, entry->month, entry->day,
+                     entry->hour, entry->minute, entry->second, entry->fcode,
+                     (unsigned long)entry->offset, (1 == entry->sent) ? "sent" : "pending");
+            TransmitCMDResponse(tempStr);
+            listed++;
+            return 1;
+        }
+    }
+
+    if (0 == listed) {
+        TransmitCMDResponse("\r>No fault captures stored");
+    }
+    TransmitCMDResponse("\r");
+    slot = 0;
+    listed = 0;
+    return 0;
+}
+
+/**
+ * @brief Display help information for fault store commands
+ *
+ * @return 0 when the help text is complete
+ */
+u8 inv_fault_store_cmd_help(void)
+{
+    static u8 state = 0;
+    u8 returnValue = 1;
+
+    switch (state) {
+    case 0:
+        TransmitCMDResponse("     fault list             -> (Lists fault captures stored on SD) \r");
+        state = 1;
+        break;
+    case 1:
+        TransmitCMDResponse("     fault replay <id> [local|web] -> (Reports a stored capture again) \r");
+        state = 0;
+        returnValue = 0;
+        break;
+    }
+    return returnValue;
+}
@@ -0,0 +1,65 @@
+/**
+ * @file inv_fault_store.h
+ * @brief Persistent store of inverter fault captures on the SD card
+ *
+ * Every complete fault recorder capture is written to a ring file on the SD
+ * card as one fixed-size binary record. A small index in the file header
+ * keeps capture ID, time, fault code, record offset and upload state of each
+ * slot, so captures survive resets and any of them can be read back with a
+ * single seek. A capture that was not delivered before a reset is reloaded
+ * into the recorder and sent again.
+ *
+ * @date 2025-10-24
+ * @author Allayar Moazami
+ */
+#ifndef H_INV_FAULT_STORE
+#define H_INV_FAULT_STORE
+
+#include "platform.h"
+
+/** @brief Directory holding the fault store */
+#define FSTORE_DIR "LOG"
+
+/** @brief Fault store file path (index sector followed by capture slots) */
+#define FSTORE_FILE_PATH "LOG/FAULT.BIN"
+
+/** @brief Number of capture slots kept on the card */
+#define FSTORE_SLOT_COUNT 16U
+
+/** @brief Slot size in bytes, a capture rounded up to whole SD sectors */
+#define FSTORE_SLOT_SIZE 3072U
+
+/** @brief Time between two mount attempts while the card is missing, in ms */
+#define FSTORE_RETRY_INTERVAL 10000U
+
+/**
+ * @brief Persist, reload and replay fault captures
+ *
+ * Called from the log manager every monitoring tick. Writes a capture once
+ * the recorder reports it complete, marks it delivered once the recorder has
+ * released it and loads pending or requested captures while the recorder is
+ * idle. All SD access of the module happens here.
+ */
+void inv_fault_store_service(void);
+
+/**
+ * @brief Process fault store commands
+ *
+ * @param[in] str Command string to process
+ *
+ * @return 0 when the command is done
+ *
+ * @par Supported commands:
+ *      - "fault list": Print the capture index, one line per capture
+ *      - "fault replay <id> [local|web]": Report a stored capture again
+ */
+u8 inv_fault_store_cmd(char *str);
+
+/**
+ * @brief Display help information for fault store commands
+ *
+ * @return 0 when the help text is complete
+ */
+u8 inv_fault_store_cmd_help(void);
+
+#endif /* H_INV_FAULT_STORE */
@@ -58,23 +58,10 @@
 u16 U16S2UpdateStatus;
 S2_CH s2Ch;
 MB_Slave_Struct s2Node;
-MntDataType s2MntData[S2_MNT_DATA_Size]=
-{
-		{"VDC_CH","V",0.0},    //0
-		{"VBat_CH","V",0.0},   //1 /*Dash Board 8*/
-		{"IBat_CH","A",0.0},   //2
-		{"IBRI1C","A",0.0},    //3
-		{"IBRI2C","A",0.0},    //4
-		{"POWER1","W",0.0},    //5 /*Dash Board 9*/
-		{"GenS","N",0.0},      //6   /*Dash Board 4*/
-		{"State","N",0.0},     //7  /*Dash Board 5*/
-		{"FCC","N",0.0},       //8    /*Dash Board 6*/
-		{"Ch1REFID","N",0.0},       //9   /*Dash Board 6*/
-
-};
 float _memoryMap_bchF[100];
 int _countch = 0;
 u16 gChTimeout=0;
+static u8 gChFresh=0;
 
 /*!
  **************************************************************************************************
@@ -118,30 +105,6 @@ void S2_CH_registerToMbNode(void)
 	MB_Manager_RegisterSlave(s2Node);
 
 }
-/*!
- **************************************************************************************************
- *
- *  @fn         void S2_CH_Database_Init()
- *
- *  @par
- *
- *  @param      None.
- *
- *  @return     None.
- *
- *  @par        Design Info
- *              WCET            : Enter Worst Case Execution Time heres
- *              Sync/Async      : sync
- *
- **************************************************************************************************
- */
-
-void S2_CH_Database_Init()
-{
-	registerToDatabase("S2_CH",
-			s2MntData,
-			S2_MNT_DATA_Size);
-}
 /*!
  **************************************************************************************************
  *
@@ -262,6 +225,7 @@ if (checkFrameCRC(res, Len)) {
 			memcpy(&_memoryMap_bchF[index], &chData,
 					sizeof(float));
 		}
+		gChFresh=1;
 
 		break;
 	case 0x10:
@@ -418,17 +382,14 @@ static int S2_CH_sendWriteReq(void)
  */
 static float returnChWebRef(int index)
 {
-	RefDataType *rData=getRefData();
+	RefDataType *rData=getRefHandle(index+REF_CH_INDEX_BASE);
 	f32 f32ReturnValue=INVALID_DATA;
 
-	if(0!=getRefIDValue())
+	if(0!=getRefIDValue() && NULL!=rData)
 	{
-		for (int i = 0; i < REF_ARRAY_SIZE; i++)
+		if (1==(rData->flag & 0x01))
 		{
-			if ((index+100)==(int)rData[i].index && 1==(rData[i].flag & 0x01))
-			{
-				f32ReturnValue = rData[i].value;
-			}
+			f32ReturnValue = rData->value;
 		}
 	}
 	return f32ReturnValue;
@@ -452,21 +413,16 @@ static float returnChWebRef(int index)
  */
 static void setChWebRef(u16 u16Index,f32 f32Value)
 {
-	RefDataType *rData=getRefData();
+	RefDataType *rData=getRefHandle(u16Index+REF_CH_INDEX_BASE);
 	u16 u16LocalRemote=_memoryMap[39];
 	u16 u16IsAnyCfgSet=(u16)getRefIDValue();
 
-	if(u16LocalRemote>u16IsAnyCfgSet)
+	if(u16LocalRemote>u16IsAnyCfgSet && NULL!=rData)
 	{
-		for (int i = 0; i < REF_ARRAY_SIZE; i++)
+		if(rData->value!=f32Value || (rData->flag&REF_UPDATED_VALUE)==0)
 		{
-			if ((u16Index+100)==rData[i].index) {
-				if(rData[i].value!=f32Value || (rData[i].flag&REF_UPDATED_VALUE)==0)
-				{
-					rData[i].flag=(REF_REPORT_TO_WEB | REF_WRITE_TO_MEM | REF_UPDATED_VALUE);
-					rData[i].value=f32Value;
-				}
-			}
+			rData->flag=(REF_REPORT_TO_WEB | REF_WRITE_TO_MEM | REF_UPDATED_VALUE);
+			rData->value=f32Value;
 		}
 	}
 }
@@ -545,29 +501,28 @@ u16 S2_CH_getUpdateStatus(void)
  */
 static void S2_CH_Updates(void)
 {
-
-	Database_Type* mDb=getMntDatabase();
-	MntDataType* mData = mDb[1].mData;
-	static f32 stcF32HoldData=0;
-	//char dstr[50];
-
-	mData = mDb[2].mData;
-	mData[S2_MNT_VDC_CH ].value = _memoryMap_bchF[0];
-	mData[S2_MNT_VBat_CH].value  = _memoryMap_bchF[1];
-	mData[S2_MNT_IBat_CH].value  = _memoryMap_bchF[2];
-	mData[S2_MNT_IBRI1C].value  = _memoryMap_bchF[3];
-	mData[S2_MNT_IBRI2C].value  = _memoryMap_bchF[4];
-	mData[S2_MNT_POWER1].value  = _memoryMap_bchF[5];
-	mData[S2_MNT_GenS].value  = _memoryMap_bchF[6];
-	mData[S2_MNT_State].value  = _memoryMap_bchF[7];
-	mData[S2_MNT_FCC].value  = _memoryMap_bchF[8];
-	mData[S2_MNT_REFID].value  = _memoryMap_bchF[9];
-
-   if(mData[S2_MNT_FCC].value!=stcF32HoldData)
-    {
-	WebInsReportUpdate("FCC",mData[S2_MNT_FCC].value);
-	stcF32HoldData=mData[S2_MNT_FCC].value;
+	/* Only a new poll response is a sample, in between the values are held */
+	if(gChFresh==1)
+	{
+		gChFresh=0;
+		signal_db_begin(SIG_GROUP_S2);
+	}
+	else
+	{
+		signal_db_begin_held(SIG_GROUP_S2);
 	}
+	signal_db_set(SIG_S2_VDC_CH,  _memoryMap_bchF[0]);
+	signal_db_set(SIG_S2_VBAT_CH, _memoryMap_bchF[1]);
+	signal_db_set(SIG_S2_IBAT_CH, _memoryMap_bchF[2]);
+	signal_db_set(SIG_S2_IBRI1C,  _memoryMap_bchF[3]);
+	signal_db_set(SIG_S2_IBRI2C,  _memoryMap_bchF[4]);
+	signal_db_set(SIG_S2_POWER1,  _memoryMap_bchF[5]);
+	signal_db_set(SIG_S2_GENS,    _memoryMap_bchF[6]);
+	signal_db_set(SIG_S2_STATE,   _memoryMap_bchF[7]);
+	signal_db_set(SIG_S2_REFID,   _memoryMap_bchF[9]);
+
+	signal_db_set(SIG_S2_FCC,     _memoryMap_bchF[8]);
+	signal_db_end(SIG_GROUP_S2);
 
 	_memoryMap[220] = (int) (_memoryMap_bchF[0] * 10);
 	_memoryMap[221] = (int) (_memoryMap_bchF[1] * 10);
@@ -60,19 +60,6 @@
 #define S2_WRITE_BUFFER_SIZE 256
 
 
-typedef enum{
-	S2_MNT_VDC_CH=0,   /*0*/
-	S2_MNT_VBat_CH,    /*1*/
-	S2_MNT_IBat_CH,    /*2*/
-	S2_MNT_IBRI1C,     /*3*/
-	S2_MNT_IBRI2C,     /*4*/
-	S2_MNT_POWER1,     /*5*/
-	S2_MNT_GenS,       /*6*/
-	S2_MNT_State,      /*7*/
-	S2_MNT_FCC,       /*8*/
-	S2_MNT_REFID,
-        S2_MNT_DATA_Size
-}S2_MntEnumType;
 
 typedef struct{
 uint32_t readTimeout;
@@ -100,24 +87,6 @@ extern int16_t _memoryMap[500];
  **************************************************************************************************
  */
 void S2_CH_registerToMbNode(void);
-/*!
- **************************************************************************************************
- *
- *  @fn         void S2_CH_Database_Init()
- *
- *  @par
- *
- *  @param      None.
- *
- *  @return     None.
- *
- *  @par        Design Info
- *              WCET            : Enter Worst Case Execution Time heres
- *              Sync/Async      : sync
- *
- **************************************************************************************************
- */
-void S2_CH_Database_Init();
 /*!
  **************************************************************************************************
  *
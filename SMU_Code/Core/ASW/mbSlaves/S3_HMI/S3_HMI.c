@@ -18,7 +18,17 @@
 S3_HMI s3Hmi;
 MB_Slave_Struct s3Node;
 
+/* Write change tracking: s3Shadow holds the register values the HMI has
+ * acknowledged. Writers keep updating _memoryMap directly; a register is
+ * dirty when it differs from its shadow or was never acknowledged. */
+static int16_t s3Shadow[WRITE_NUMBER_BYTE];
+static uint8_t s3Synced[WRITE_NUMBER_BYTE];
+static int16_t s3Sent[WRITE_NUMBER_BYTE];   /* values of the frame in flight */
+static int s3SentStart=0;                   /* offset from WRITE_START_ADDRESS */
+static int s3SentCount=0;
+
 int S3_HMI_sendWriteReq(void);
+static int S3_HMI_nextRun(int *start);
 
 
 
@@ -35,14 +45,21 @@ void S3_HMI_registerToMbNode(void){
 int  S3_HMI_MbMng(void){
   static int state=READ;
   volatile int status=1;
+  int ret;
   switch(state)
   {
   case WRITE:
-    if(0==S3_HMI_sendWriteReq()){
+    ret=S3_HMI_sendWriteReq();
+    if(0==ret){
       
       s3Hmi.writeTimeout=HAL_GetTick();
       state=WRITE_TIMEOUT;
     }
+    else if(ret<0){
+      /* Nothing changed since the last acknowledged write */
+      status=0;
+      state=READ;
+    }
     break;
   case READ:
     if(0==S3_HMI_sendReadReq()){
@@ -51,13 +68,18 @@ int  S3_HMI_MbMng(void){
     }
     break;
   case WRITE_TIMEOUT:
-    if((HAL_GetTick()-s3Hmi.writeTimeout)>S3_WRITE_TIMEOUT_VALUE){
+    if(1==s3Hmi.resDone && ++s3Hmi.writeRuns<S3_WRITE_RUNS_MAX){
+      /* Acknowledged, send the next dirty block in the same turn */
+      state=WRITE;
+    }
+    else if(1==s3Hmi.resDone || (HAL_GetTick()-s3Hmi.writeTimeout)>S3_WRITE_TIMEOUT_VALUE){
       status=0;
       state=READ;
     }
     break;
   case READ_TIMEOUT:
-    if((HAL_GetTick()-s3Hmi.readTimeout)>S3_READ_TIMEOUT_VALUE){
+    if(1==s3Hmi.resDone || (HAL_GetTick()-s3Hmi.readTimeout)>S3_READ_TIMEOUT_VALUE){
+      s3Hmi.writeRuns=0;
       state=WRITE;
     }
     break;
@@ -82,6 +104,7 @@ int S3_HMI_sendReadReq(void){
     uint16_t crc = calculateCRC(mbStr, 6); //
     mbStr[6] = crc & 0x00ff;
     mbStr[7] = (crc & 0xff00) >> 8;
+    s3Hmi.resDone=0;
     state=1;
     break;
   case 1:
@@ -94,40 +117,78 @@ int S3_HMI_sendReadReq(void){
   return status;
 }
 
+/* First dirty register up to the last one reachable without crossing more
+ * than S3_WRITE_GAP_MAX clean registers. A longer gap costs more bus time
+ * than a second frame header. Returns the register count, 0 if all clean. */
+static int S3_HMI_nextRun(int *start)
+{
+  int first=-1;
+  int last=-1;
+
+  for (int index = 0; index < WRITE_NUMBER_BYTE; index++) {
+    if (0==s3Synced[index] || s3Shadow[index]!=_memoryMap[index + WRITE_START_ADDRESS]) {
+      if (first<0) {
+        first=index;
+      } else if ((index-last-1)>S3_WRITE_GAP_MAX) {
+        break;
+      }
+      last=index;
+    }
+  }
+  if (first<0) {
+    return 0;
+  }
+  *start=first;
+  return last-first+1;
+}
+
+/* Returns 1 while sending, 0 when the frame is out, -1 if nothing is dirty */
 int S3_HMI_sendWriteReq(void){
   static uint8_t mbStr[S3_WRITE_BUFFER_SIZE];
   int status = 1;
   static int kindex = 7;
   static int state=0;
+  int start=0;
+  int count;
   
   switch(state)
   {
   case 0:
+    if((HAL_GetTick()-s3Hmi.refreshTick)>S3_WRITE_REFRESH_TIME){
+      s3Hmi.refreshTick=HAL_GetTick();
+      memset(s3Synced,0,sizeof(s3Synced));
+    }
+    count=S3_HMI_nextRun(&start);
+    if(0==count){
+      status=-1;
+      break;
+    }
+    s3SentStart=start;
+    s3SentCount=count;
     mbStr[0]= S3_HMI_ID;
     mbStr[1] = WRITE;
-    mbStr[2] = (WRITE_START_ADDRESS & 0xff00) >> 8;
-    mbStr[3] =  WRITE_START_ADDRESS & 0x00ff;
-    mbStr[4] = (WRITE_NUMBER_BYTE & 0xff00) >> 8;
-    mbStr[5] =  WRITE_NUMBER_BYTE & 0x00ff;
-    mbStr[6] = 2 * WRITE_NUMBER_BYTE;
+    mbStr[2] = ((WRITE_START_ADDRESS + start) & 0xff00) >> 8;
+    mbStr[3] =  (WRITE_START_ADDRESS + start) & 0x00ff;
+    mbStr[4] = (count & 0xff00) >> 8;
+    mbStr[5] =  count & 0x00ff;
+    mbStr[6] = 2 * count;
     kindex = 7;
-    for (int index = 0; index < WRITE_NUMBER_BYTE; index++) {
-      mbStr[kindex++] = (((int) (_memoryMap[index
-                                 + WRITE_START_ADDRESS])) & 0xff00) >> 8;
-      mbStr[kindex++] = ((int)  (_memoryMap[index
-                                 + WRITE_START_ADDRESS])) & 0x00ff;
+    for (int index = start; index < start + count; index++) {
+      s3Sent[index] = _memoryMap[index + WRITE_START_ADDRESS];
+      mbStr[kindex++] = (((int) s3Sent[index]) & 0xff00) >> 8;
+      mbStr[kindex++] = ((int)  s3Sent[index]) & 0x00ff;
       
     }
     uint16_t crc = calculateCRC(mbStr, kindex); //
     mbStr[kindex++] = crc & 0x00ff;
     mbStr[kindex++] = (crc & 0xff00) >> 8;
+    s3Hmi.resDone=0;
     state=1;
     break;
   case 1:
     if(0==MAC_MbmSendData(mbStr,kindex)){
       state=0;
       status=0;
-      memset(mbStr,0,S3_WRITE_BUFFER_SIZE);
     }
     break;
   }
@@ -140,38 +201,39 @@ int S3_HMI_sendWriteReq(void){
 
 void S3_HMI_resProcess(char *res,int Len)
 {
+  uint8_t *frame = (uint8_t *) res;
   int ind = 0;
   int nDb = 0;
-  int dummyHMI[200];
   if (checkFrameCRC(res, Len)) {
-    switch (res[1]) {
+    switch (frame[1]) {
     case 0x03:
+      nDb = frame[2];
+      /* addr, fc, byte count, data, crc */
+      if ((nDb & 1) != 0 || Len != nDb + 5 || (nDb / 2) < S3_READ_STORE_COUNT) {
+        break;
+      }
       _memoryMap[200] = ~_memoryMap[200];
-      nDb = res[2]; 
-      
-      for (int index = 0; index < nDb; index++) {
+      for (int index = 0; index < S3_READ_STORE_COUNT; index++) {
         ind = 2 * index + 3;
-        dummyHMI[index] = (res[ind] << 8
-                           | res[ind + 1]);
+        _memoryMap[READ_START_ADDRESS + index] = (int16_t) (frame[ind] << 8
+                                                            | frame[ind + 1]);
       }
-      //char pVoidVar = (char) dummyHMI[38];
-
-        for (int index = 0; index <= 40; index++) {
-          _memoryMap[index] = dummyHMI[index];
-        }
-      
-      
+      s3Hmi.resDone=1;
       break;
     case 0x10:
-      
+      /* Echo of start address and quantity of the frame in flight */
+      if (Len == 8 &&
+          ((frame[2] << 8) | frame[3]) == WRITE_START_ADDRESS + s3SentStart &&
+          ((frame[4] << 8) | frame[5]) == s3SentCount) {
+        for (int index = s3SentStart; index < s3SentStart + s3SentCount; index++) {
+          s3Shadow[index] = s3Sent[index];
+          s3Synced[index] = 1;
+        }
+        s3Hmi.resDone=1;
+      }
       break;
     default:
       break;
     }
   }
 }
-
-
-
-
-
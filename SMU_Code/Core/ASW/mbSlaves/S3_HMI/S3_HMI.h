@@ -27,11 +27,19 @@
 #define S3_READ_TIMEOUT_VALUE  200
 
 #define S3_WRITE_BUFFER_SIZE 256
+/*Diff write*/
+#define S3_WRITE_GAP_MAX       8     /* unchanged registers bridged instead of starting a new frame */
+#define S3_WRITE_RUNS_MAX      3     /* FC16 frames per bus turn */
+#define S3_WRITE_REFRESH_TIME  10000 /* ms, full rewrite in case the HMI restarted */
+#define S3_READ_STORE_COUNT    41    /* registers of the read block copied to _memoryMap */
 
 
 typedef struct{
 uint32_t readTimeout;
 uint32_t writeTimeout;
+uint32_t refreshTick;
+uint8_t  resDone;     /* answer of the request in flight received */
+uint8_t  writeRuns;   /* FC16 frames sent in this bus turn */
 }S3_HMI;
 
 extern int16_t _memoryMap[500];
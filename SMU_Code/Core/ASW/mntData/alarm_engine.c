@@ -0,0 +1,377 @@
+/**
+ * @file alarm_engine.c
+ * @brief Table-driven alarm engine implementation
+ *
+ * The rule table is const and indexed by EnuAlarmId. At init the rules are
+ * sorted by input signal into a compressed dependency list: the rules of
+ * signal s are gDepRule[gDepFirst[s]] .. gDepRule[gDepFirst[s + 1] - 1].
+ * A service call walks the SIG_COUNT change flags of the signal registry
+ * and evaluates only the rules behind a raised flag, plus the rules whose
+ * on/off delay is running. The cost per call is therefore bounded by the
+ * number of changed signals and running timers, not by the rule count.
+ *
+ * Rule state machine:
+ *   IDLE     --cond-->      PEND_ON  (or ACTIVE when onDelay is 0)
+ *   PEND_ON  --!cond-->     IDLE
+ *   PEND_ON  --onDelay-->   ACTIVE   raise event
+ *   ACTIVE   --!cond-->     PEND_OFF (or IDLE when offDelay is 0)
+ *   PEND_OFF --cond-->      ACTIVE
+ *   PEND_OFF --offDelay-->  IDLE     clear event
+ *
+ * @date 2025-10-27
+ * @author Allayar Moazami
+ */
+#include "alarm_engine.h"
+#include "WebInstanceReport.h"
+#include "Ctrl.h"
+#include "power_quality.h"
+#include "dbg.h"
+#include "main.h"
+#include <stdio.h>
+#include <string.h>
+
+/* ========================================================================
+ * Constants
+ * ======================================================================== */
+
+/** @brief Name of the state event carrying alarm codes */
+#define ALARM_EVENT_NAME    "ALM"
+
+/** @brief Words of the running timer bit set */
+#define ALARM_TIMER_WORDS   ((ALARM_RULE_COUNT + 31U) / 32U)
+
+/** @brief Size of temporary string buffer for formatting */
+#define TEMP_STRING_SIZE 80
+
+/** @brief Any bit of a 32-bit status code */
+#define ALARM_ANY_BIT       0xFFFFFFFFUL
+
+/**
+ * @enum EnuAlarmState
+ * @brief Runtime state of a rule
+ */
+typedef enum EnuAlarmStateEnum
+{
+    ALARM_IDLE = 0,         /**< Condition false */
+    ALARM_PEND_ON,          /**< Condition true, on-delay running */
+    ALARM_ACTIVE,           /**< Alarm raised */
+    ALARM_PEND_OFF          /**< Condition false, off-delay running */
+} EnuAlarmState;
+
+/** @brief Rules, indexed by EnuAlarmId */
+static const StuAlarmRule gAlarmRule[ALARM_RULE_COUNT] =
+{
+    /*                          name           code  signal             kind          set      clear    mask           on     off    flags */
+    [ALARM_S1_FCODE]         = { "InvFault",      1, SIG_S1_FCODE,      ALARM_CHANGE, 0.0f,    0.0f,    0,             0,     0,     ALARM_FLAG_REPORT },
+    [ALARM_S2_FCC]           = { "ChFault",       2, SIG_S2_FCC,        ALARM_CHANGE, 0.0f,    0.0f,    0,             0,     0,     ALARM_FLAG_REPORT },
+    [ALARM_S1_OVER_TEMP]     = { "InvOverTemp",  10, SIG_S1_TEMPINV,    ALARM_ABOVE,  80.0f,   70.0f,   0,             10000, 10000, ALARM_FLAG_REPORT },
+    [ALARM_SMU_OVER_TEMP]    = { "SmuOverTemp",  11, SIG_SMU_TEMPE,     ALARM_ABOVE,  60.0f,   55.0f,   0,             30000, 30000, ALARM_FLAG_REPORT },
+    [ALARM_BATT_DEAD]        = { "BattDead",     20, SIG_S1_INV_STATE,  ALARM_EQUAL,  (f32)BATTERY_DEAD, 0.0f, 0,       0,     0,     ALARM_FLAG_REPORT },
+    [ALARM_BATT_CHARGING]    = { "BattCharge",   21, SIG_S2_POWER1,     ALARM_ABOVE,  BATT_POWER_HIGH_HYST, BATT_POWER_HIGH_HYST, 0, 0, 0, 0 },
+    [ALARM_BATT_DISCHARGING] = { "BattDischarge",22, SIG_S2_POWER1,     ALARM_BELOW,  BATT_POWER_LOW_HYST,  BATT_POWER_LOW_HYST,  0, 0, 0, 0 },
+    [ALARM_BP1_PROTECTION]   = { "Bp1Protect",   30, SIG_BP1_PRT_CODE,  ALARM_MASK,   0.0f,    0.0f,    ALARM_ANY_BIT, 0,     5000,  ALARM_FLAG_REPORT },
+    [ALARM_BP1_WARNING]      = { "Bp1Warning",   31, SIG_BP1_WAR_CODE,  ALARM_MASK,   0.0f,    0.0f,    ALARM_ANY_BIT, 0,     5000,  ALARM_FLAG_REPORT },
+    [ALARM_BP1_OVER_TEMP]    = { "Bp1OverTemp",  32, SIG_BP1_TMAX,      ALARM_ABOVE,  55.0f,   50.0f,   0,             10000, 10000, ALARM_FLAG_REPORT },
+    [ALARM_BP1_LOW_SOC]      = { "Bp1LowSoc",    33, SIG_BP1_SOC,       ALARM_BELOW,  10.0f,   15.0f,   0,             30000, 30000, ALARM_FLAG_REPORT },
+    [ALARM_BP2_PROTECTION]   = { "Bp2Protect",   40, SIG_BP2_PRT_CODE,  ALARM_MASK,   0.0f,    0.0f,    ALARM_ANY_BIT, 0,     5000,  ALARM_FLAG_REPORT },
+    [ALARM_BP2_WARNING]      = { "Bp2Warning",   41, SIG_BP2_WAR_CODE,  ALARM_MASK,   0.0f,    0.0f,    ALARM_ANY_BIT, 0,     5000,  ALARM_FLAG_REPORT },
+    [ALARM_BP2_OVER_TEMP]    = { "Bp2OverTemp",  42, SIG_BP2_TMAX,      ALARM_ABOVE,  55.0f,   50.0f,   0,             10000, 10000, ALARM_FLAG_REPORT },
+    [ALARM_BP2_LOW_SOC]      = { "Bp2LowSoc",    43, SIG_BP2_SOC,       ALARM_BELOW,  10.0f,   15.0f,   0,             30000, 30000, ALARM_FLAG_REPORT },
+    [ALARM_EM1_SAG]          = { "Em1Sag",       50, SIG_PQ_STATE,      ALARM_MASK,   0.0f,    0.0f,    PQ_STATE_BIT(0U, PQ_EVENT_SAG),          0, 0, ALARM_FLAG_REPORT },
+    [ALARM_EM1_SWELL]        = { "Em1Swell",     51, SIG_PQ_STATE,      ALARM_MASK,   0.0f,    0.0f,    PQ_STATE_BIT(0U, PQ_EVENT_SWELL),        0, 0, ALARM_FLAG_REPORT },
+    [ALARM_EM1_INTERRUPTION] = { "Em1Interrupt", 52, SIG_PQ_STATE,      ALARM_MASK,   0.0f,    0.0f,    PQ_STATE_BIT(0U, PQ_EVENT_INTERRUPTION), 0, 0, ALARM_FLAG_REPORT },
+    [ALARM_EM2_SAG]          = { "Em2Sag",       60, SIG_PQ_STATE,      ALARM_MASK,   0.0f,    0.0f,    PQ_STATE_BIT(1U, PQ_EVENT_SAG),          0, 0, ALARM_FLAG_REPORT },
+    [ALARM_EM2_SWELL]        = { "Em2Swell",     61, SIG_PQ_STATE,      ALARM_MASK,   0.0f,    0.0f,    PQ_STATE_BIT(1U, PQ_EVENT_SWELL),        0, 0, ALARM_FLAG_REPORT },
+    [ALARM_EM2_INTERRUPTION] = { "Em2Interrupt", 62, SIG_PQ_STATE,      ALARM_MASK,   0.0f,    0.0f,    PQ_STATE_BIT(1U, PQ_EVENT_INTERRUPTION), 0, 0, ALARM_FLAG_REPORT },
+};
+
+/* ========================================================================
+ * Static Variables
+ * ======================================================================== */
+
+/** @brief First dependency list entry of each signal, followed by the end */
+static u16 gDepFirst[SIG_COUNT + 1];
+
+/** @brief Rule IDs grouped by input signal */
+static u16 gDepRule[ALARM_RULE_COUNT];
+
+/** @brief EnuAlarmState of each rule */
+static volatile u8 gAlarmState[ALARM_RULE_COUNT];
+
+/** @brief Tick of the last state change of each rule */
+static u32 gAlarmSince[ALARM_RULE_COUNT];
+
+/** @brief Rules with a running on/off delay */
+static u32 gAlarmTimer[ALARM_TIMER_WORDS];
+
+/** @brief Raised alarms */
+static u16 gActiveCount = 0;
+
+/** @brief Rule evaluations since start-up, for the command port */
+static u32 gEvalCount = 0;
+
+/* ========================================================================
+ * Static Helper Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Test the raise or hold condition of a rule
+ * @param[in] rule   Rule
+ * @param[in] value  Input value
+ * @param[in] active 1 if the alarm is raised or clearing, selects the clear level
+ * @return 1 if the alarm condition holds
+ */
+static u8 alarm_engine_condition(const StuAlarmRule *rule, f32 value, u8 active)
+{
+    switch (rule->kind) {
+    case ALARM_ABOVE:
+        return (value > ((1U == active) ? rule->clear : rule->set)) ? 1U : 0U;
+    case ALARM_BELOW:
+        return (value < ((1U == active) ? rule->clear : rule->set)) ? 1U : 0U;
+    case ALARM_EQUAL:
+        return (value == rule->set) ? 1U : 0U;
+    case ALARM_MASK:
+        return (0U != ((u32)value & rule->mask)) ? 1U : 0U;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Start or stop the delay timer of a rule
+ * @param[in] id  Rule ID
+ * @param[in] run 1 to start, 0 to stop
+ */
+static void alarm_engine_timer(u16 id, u8 run)
+{
+    u32 bit = 1UL << (id & 31U);
+
+    if (1U == run) {
+        gAlarmTimer[id >> 5] |= bit;
+    } else {
+        gAlarmTimer[id >> 5] &= ~bit;
+    }
+}
+
+/**
+ * @brief Raise or clear an alarm and queue its event
+ * @param[in] id     Rule ID
+ * @param[in] raised 1 when raised, 0 when cleared
+ * @param[in] now    Current tick
+ */
+static void alarm_engine_commit(u16 id, u8 raised, u32 now)
+{
+    const StuAlarmRule *rule = &gAlarmRule[id];
+
+    gAlarmState[id] = (1U == raised) ? ALARM_ACTIVE : ALARM_IDLE;
+    gAlarmSince[id] = now;
+    alarm_engine_timer(id, 0);
+    if (1U == raised) {
+        gActiveCount++;
+    } else if (gActiveCount > 0U) {
+        gActiveCount--;
+    }
+    if (0U != (rule->flags & ALARM_FLAG_REPORT)) {
+        WebInsReportUpdate((u8 *)ALARM_EVENT_NAME,
+                           (1U == raised) ? (f32)rule->code : -(f32)rule->code);
+    }
+}
+
+/**
+ * @brief Evaluate a rule after its input signal changed
+ * @param[in] id  Rule ID
+ * @param[in] now Current tick
+ */
+static void alarm_engine_evaluate(u16 id, u32 now)
+{
+    const StuAlarmRule *rule = &gAlarmRule[id];
+    f32 value = signal_db_get((EnuSignalId)rule->signal);
+    u8 state = gAlarmState[id];
+    u8 cond;
+
+    gEvalCount++;
+    if (ALARM_CHANGE == rule->kind) {
+        if (0U != (rule->flags & ALARM_FLAG_REPORT)) {
+            WebInsReportUpdate((u8 *)signal_db_meta((EnuSignalId)rule->signal)->name, value);
+        }
+        return;
+    }
+
+    cond = alarm_engine_condition(rule, value,
+                                  (ALARM_ACTIVE == state || ALARM_PEND_OFF == state) ? 1U : 0U);
+    switch (state) {
+    case ALARM_IDLE:
+        if (1U == cond) {
+            if (0U == rule->onDelay) {
+                alarm_engine_commit(id, 1, now);
+            } else {
+                gAlarmState[id] = ALARM_PEND_ON;
+                gAlarmSince[id] = now;
+                alarm_engine_timer(id, 1);
+            }
+        }
+        break;
+    case ALARM_PEND_ON:
+        if (0U == cond) {
+            gAlarmState[id] = ALARM_IDLE;
+            alarm_engine_timer(id, 0);
+        }
+        break;
+    case ALARM_ACTIVE:
+        if (0U == cond) {
+            if (0U == rule->offDelay) {
+                alarm_engine_commit(id, 0, now);
+            } else {
+                gAlarmState[id] = ALARM_PEND_OFF;
+                gAlarmSince[id] = now;
+                alarm_engine_timer(id, 1);
+            }
+        }
+        break;
+    case ALARM_PEND_OFF:
+        if (1U == cond) {
+            gAlarmState[id] = ALARM_ACTIVE;
+            alarm_engine_timer(id, 0);
+        }
+        break;
+    default:
+        gAlarmState[id] = ALARM_IDLE;
+        break;
+    }
+}
+
+/* ========================================================================
+ * Public Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Build the dependency lists and clear all alarm states
+ */
+void alarm_engine_init(void)
+{
+    u16 fill[SIG_COUNT];
+
+    memset(gDepFirst, 0, sizeof(gDepFirst));
+    for (u16 r = 0; r < ALARM_RULE_COUNT; r++) {
+        gDepFirst[gAlarmRule[r].signal + 1U]++;
+    }
+    for (u16 s = 0; s < SIG_COUNT; s++) {
+        gDepFirst[s + 1U] += gDepFirst[s];
+        fill[s] = gDepFirst[s];
+    }
+    for (u16 r = 0; r < ALARM_RULE_COUNT; r++) {
+        gDepRule[fill[gAlarmRule[r].signal]++] = r;
+    }
+
+    memset((void *)gAlarmState, ALARM_IDLE, sizeof(gAlarmState));
+    memset(gAlarmSince, 0, sizeof(gAlarmSince));
+    memset(gAlarmTimer, 0, sizeof(gAlarmTimer));
+    gActiveCount = 0;
+}
+
+/**
+ * @brief Evaluate rules of changed signals and expired delays
+ */
+void alarm_engine_service(void)
+{
+    u32 now = HAL_GetTick();
+
+    for (u16 s = 0; s < SIG_COUNT; s++) {
+        if (gDepFirst[s] == gDepFirst[s + 1U]) {
+            continue;
+        }
+        if (1U == signal_db_take_changed((EnuSignalId)s)) {
+            for (u16 d = gDepFirst[s]; d < gDepFirst[s + 1U]; d++) {
+                alarm_engine_evaluate(gDepRule[d], now);
+            }
+        }
+    }
+
+    for (u16 w = 0; w < ALARM_TIMER_WORDS; w++) {
+        u32 pending = gAlarmTimer[w];
+
+        while (0U != pending) {
+            u16 bit = (u16)__builtin_ctz(pending);
+            u16 id = (u16)((w << 5) + bit);
+            u8 state = gAlarmState[id];
+            u16 delay = (ALARM_PEND_ON == state) ? gAlarmRule[id].onDelay
+                                                 : gAlarmRule[id].offDelay;
+
+            pending &= pending - 1U;
+            if ((now - gAlarmSince[id]) >= delay) {
+                /* The condition was re-checked on every input change meanwhile */
+                alarm_engine_commit(id, (ALARM_PEND_ON == state) ? 1U : 0U, now);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Check whether an alarm is raised
+ *
+ * @param[in] id Rule ID
+ *
+ * @return 1 if raised, 0 otherwise
+ */
+u8 alarm_engine_active(EnuAlarmId id)
+{
+    if (id >= ALARM_RULE_COUNT) {
+        return 0;
+    }
+    /* A clearing alarm is still raised until its off-delay expires */
+    return (ALARM_ACTIVE == gAlarmState[id] || ALARM_PEND_OFF == gAlarmState[id]) ? 1U : 0U;
+}
+
+/**
+ * @brief Get the number of raised alarms
+ *
+ * @return Raised alarm count
+ */
+u16 alarm_engine_active_count(void)
+{
+    return gActiveCount;
+}
+
+/**
+ * @brief Process alarm debug commands
+ *
+ * @param[in] str Command string to process
+ *
+ * @return 0 when the command is done, 1 to be called again
+ */
+u8 alarm_engine_cmd(char *str)
+{
+    static u16 cursor = 0;
+    char tempStr[TEMP_STRING_SIZE];
+    u32 now = HAL_GetTick();
+
+    (void)str;
+    /* One line per call, the command port is not blocked by a long list */
+    while (cursor < ALARM_RULE_COUNT) {
+        u16 id = cursor++;
+
+        if (1U == alarm_engine_active((EnuAlarmId)id)) {
+            snprintf(tempStr, sizeof(tempStr), "\r>ALM %u %s since %lus\r",
+                     gAlarmRule[id].code, gAlarmRule[id].name,
+                     (unsigned long)((now - gAlarmSince[id]) / 1000U));
+            TransmitCMDResponse(tempStr);
+            return 1;
+        }
+    }
+    cursor = 0;
+    snprintf(tempStr, sizeof(tempStr), "\r>Alarms active:%u rules:%u evaluated:%lu\r",
+             gActiveCount, (unsigned)ALARM_RULE_COUNT, (unsigned long)gEvalCount);
+    TransmitCMDResponse(tempStr);
+    return 0;
+}
+
+/**
+ * @brief Display help information for alarm commands
+ *
+ * @return 0 when the help text is complete
+ */
+u8 alarm_engine_cmd_help(void)
+{
+    TransmitCMDResponse("     alarm                  -> (Lists raised alarms) \r");
+    return 0;
+}
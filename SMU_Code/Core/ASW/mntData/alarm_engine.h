@@ -0,0 +1,138 @@
+/**
+ * @file alarm_engine.h
+ * @brief Table-driven alarm engine over the signal registry
+ *
+ * Every alarm is a constant rule on one signal ID: a threshold with
+ * hysteresis above or below a level, an equality test, a bit mask test or a
+ * plain change report. A rule may delay raising (on-delay) and clearing
+ * (off-delay). Rules are only evaluated when their input signal changed, the
+ * engine keeps a signal-to-rules dependency list for that; rules with a
+ * running delay are kept in a timer bit set and checked on every service
+ * call. Raised and cleared alarms are queued as "ALM" state events (code
+ * positive when raised, negative when cleared) and reach the server with
+ * the next STATE_EVENT upload.
+ *
+ * @date 2025-10-27
+ * @author Allayar Moazami
+ */
+#ifndef H_ALARM_ENGINE
+#define H_ALARM_ENGINE
+
+#include "platform.h"
+#include "signal_db.h"
+
+/** @brief Rule sends its raise/clear events to the server */
+#define ALARM_FLAG_REPORT   0x01U
+
+/**
+ * @enum EnuAlarmKind
+ * @brief Condition of a rule
+ */
+typedef enum EnuAlarmKindEnum
+{
+    ALARM_ABOVE = 0,        /**< Raise above set, clear below clear */
+    ALARM_BELOW,            /**< Raise below set, clear above clear */
+    ALARM_EQUAL,            /**< Raise while the value equals set */
+    ALARM_MASK,             /**< Raise while any bit of mask is set */
+    ALARM_CHANGE            /**< Report every change of the value under the signal name */
+} EnuAlarmKind;
+
+/**
+ * @enum EnuAlarmId
+ * @brief Rule IDs, index into the rule table
+ */
+typedef enum EnuAlarmIdEnum
+{
+    ALARM_S1_FCODE = 0,     /**< Inverter fault code report */
+    ALARM_S2_FCC,           /**< Charger fault code report */
+    ALARM_S1_OVER_TEMP,     /**< Inverter over temperature */
+    ALARM_SMU_OVER_TEMP,    /**< Enclosure over temperature */
+    ALARM_BATT_DEAD,        /**< Inverter in dead battery recovery */
+    ALARM_BATT_CHARGING,    /**< Battery power above the charge threshold */
+    ALARM_BATT_DISCHARGING, /**< Battery power below the discharge threshold */
+    ALARM_BP1_PROTECTION,   /**< Pack 1 protection code set */
+    ALARM_BP1_WARNING,      /**< Pack 1 warning code set */
+    ALARM_BP1_OVER_TEMP,    /**< Pack 1 cell over temperature */
+    ALARM_BP1_LOW_SOC,      /**< Pack 1 state of charge low */
+    ALARM_BP2_PROTECTION,   /**< Pack 2 protection code set */
+    ALARM_BP2_WARNING,      /**< Pack 2 warning code set */
+    ALARM_BP2_OVER_TEMP,    /**< Pack 2 cell over temperature */
+    ALARM_BP2_LOW_SOC,      /**< Pack 2 state of charge low */
+    ALARM_EM1_SAG,          /**< Meter channel 1 voltage sag */
+    ALARM_EM1_SWELL,        /**< Meter channel 1 voltage swell */
+    ALARM_EM1_INTERRUPTION, /**< Meter channel 1 supply interruption */
+    ALARM_EM2_SAG,          /**< Meter channel 2 voltage sag */
+    ALARM_EM2_SWELL,        /**< Meter channel 2 voltage swell */
+    ALARM_EM2_INTERRUPTION, /**< Meter channel 2 supply interruption */
+    ALARM_RULE_COUNT        /**< Number of rules */
+} EnuAlarmId;
+
+/**
+ * @struct StuAlarmRule
+ * @brief Constant rule description, kept in flash
+ */
+typedef struct StuAlarmRuleStruct
+{
+    const char *name;       /**< Name on the command port */
+    u16 code;               /**< Code of the "ALM" event, fixed per alarm */
+    u8 signal;              /**< Input EnuSignalId */
+    u8 kind;                /**< EnuAlarmKind */
+    f32 set;                /**< Raise level or compared value */
+    f32 clear;              /**< Clear level, hysteresis to set */
+    u32 mask;               /**< Bits tested by ALARM_MASK */
+    u16 onDelay;            /**< Condition must hold this long before raising, ms */
+    u16 offDelay;           /**< Condition must be gone this long before clearing, ms */
+    u8 flags;               /**< ALARM_FLAG_xxx */
+} StuAlarmRule;
+
+/**
+ * @brief Build the dependency lists and clear all alarm states
+ *
+ * Must be called after signal_db_init().
+ */
+void alarm_engine_init(void);
+
+/**
+ * @brief Evaluate rules of changed signals and expired delays
+ *
+ * Called from the Modbus manager context, the same context that produces
+ * the other WebInstanceReport events.
+ */
+void alarm_engine_service(void);
+
+/**
+ * @brief Check whether an alarm is raised
+ *
+ * @param[in] id Rule ID
+ *
+ * @return 1 if raised, 0 otherwise
+ */
+u8 alarm_engine_active(EnuAlarmId id);
+
+/**
+ * @brief Get the number of raised alarms
+ *
+ * @return Raised alarm count
+ */
+u16 alarm_engine_active_count(void);
+
+/**
+ * @brief Process alarm debug commands
+ *
+ * @param[in] str Command string to process
+ *
+ * @return 0 when the command is done, 1 to be called again
+ *
+ * @par Supported commands:
+ *      - "alarm": List raised alarms
+ */
+u8 alarm_engine_cmd(char *str);
+
+/**
+ * @brief Display help information for alarm commands
+ *
+ * @return Always returns 0
+ */
+u8 alarm_engine_cmd_help(void);
+
+#endif /* H_ALARM_ENGINE */
@@ -11,45 +11,7 @@
 
 //#include "ASW/MntData/mntdata.h"
 float _Vref[31];
-static Database_Type mntDb[DATABASE_SIZE];
-static size_t dbIndex = 0;
 int sendCfg=0;
-MntDataType mntData[MONITORING_ARRAY_SIZE]=
-{
-		{"Live","N",0.0}, //0
-		{"VDC","V",0.0},  //1
-		{"Iinv1","A",0.0},//2
-		{"Iinv2","A",0.0},//3
-		{"VO1","V",0.0},  //4  /*Dash Board 1*/
-		{"VO2","V",0.0},  //5  /*Dash Board 2*/
-		{"VG1","V",0.0},  //6
-		{"VG2","V",0.0},  //7
-		{"FRQI","Hz",0.0},//8
-		{"SSRS","N",0.0},//9  /*Dash Board 3*/
-		{"FCODE","N",0.0},//10 /*Dash Board 7*/
-		{"FTRIG","N",0.0},//11
-		{"Tempinv","C",0.0},//12
-		{"InvState","N",0.0},//13
-		{"VDC_CH","V",0.0},//14
-		{"VBat_CH","V",0.0},//15 /*Dash Board 8*/
-		{"IBat_CH","A",0.0},//16
-		{"IBRI1C","A",0.0},//17
-		{"IBRI2C","A",0.0},//18
-		{"POWER1","W",0.0},//19 /*Dash Board 9*/
-		{"GenS","N",0.0},//20   /*Dash Board 4*/
-		{"State","N",0.0},//21  /*Dash Board 5*/
-		{"FCC","N",0.0},//22    /*Dash Board 6*/
-		{"TempE","C",0.0},//23
-		{"Vtotal","V",0.0},//24
-		{"Itotal","A",0.0},//25
-		{"SOC","N",0.0},//26
-		{"SOH","N",0.0},//27
-		{"MaxVcell","V",0.0},//28
-		{"Tmax","C",0.0},//29
-		{"Tmos","C",0.0},//30
-		{"PrtCode","A",0.0},//31
-		{"WarCode","A",0.0}//32
-};
 /*************************************************************/
 RefDataType refData[REF_ARRAY_SIZE]=
 {
@@ -71,7 +33,7 @@ RefDataType refData[REF_ARRAY_SIZE]=
 		{"REF16","vBattCh","V",			0.0,	INV_VBATT_CH_INDEX			    ,0},//15
 		{"REF17","I_Th","A",			0.0,	INV_I_TH_INDEX				    ,0},//16
 		{"REF18","rmsOverTime","A",		0.0,	INV_RMS_OVER_TIME_INDEX		    ,0},//17
-		{"REF19","I_ThRms","A",			0.0,	INV_RMS_OVER_TIME_INDEX		    ,0},//18
+		{"REF19","I_ThRms","A",			0.0,	INV_ITH_RMS_INDEX		        ,0},//18
 		{"REF20","LoadRlyCtrl","N",		0.0,	INV_LOAD_RLY_INDEX  		    ,0},//19
 		{"REF21","Server","N",			0.0,	INV_SERVER_INDEX     		    ,0},//20
 		{"REF22","modWriteEn","N",			0.0,	CH_MOD_WRITE_EN_INDEX		,0},//21
@@ -83,78 +45,125 @@ RefDataType refData[REF_ARRAY_SIZE]=
 		{"REF28","lowBattFaultHiTh","V",	0.0,	CH_LOW_BATT_F_HI_TH_INDEX	,0},//27
 		{"REFSM","REFID","N",			0.0,	REFID_INDEX,0}//28
 };
-MntDataType* getMntData(void){
-	return mntData;
-}
+/* Handles into refData keyed by REF_WEB_INDEX, resolved once by refDataInit() */
+static RefDataType *refInvHandle[REF_INV_INDEX_COUNT];
+static RefDataType *refChHandle[REF_CH_INDEX_COUNT];
+static RefDataType *refIdData=NULL;
+static uint16_t refIdRow=0;
 
 RefDataType* getRefData(void){
 	return refData;
 }
-Database_Type* getMntDatabase(void){
-	return mntDb;
-}
 
-float getRefIDValue()
+/*!
+ **************************************************************************************************
+ *
+ *  @fn         void refDataInit(void)
+ *
+ *  @par        Resolves the REF_WEB_INDEX handles and the REFID row of refData. Rows without a
+ *              ref name are unused. Called at init, the getters resolve on first use as well.
+ *
+ *  @param      None.
+ *
+ *  @return     None.
+ *
+ *  @par        Design Info
+ *              WCET            : Enter Worst Case Execution Time heres
+ *              Sync/Async      : sync
+ *
+ **************************************************************************************************
+ */
+void refDataInit(void)
 {
-	f32 f32ReturnValue=INVALID_DATA;
+	memset(refInvHandle,0,sizeof(refInvHandle));
+	memset(refChHandle,0,sizeof(refChHandle));
 
 	for (int i = 0; i < REF_ARRAY_SIZE; i++)
 	{
-		if (strcmp(refData[i].name, "REFID") == 0)
+		if (0 == refData[i].ref[0])
+		{
+			continue;
+		}
+		if (REFID_INDEX == refData[i].index)
+		{
+			refIdData=&refData[i];
+			refIdRow=i;
+		}
+		else if (refData[i].index < REF_INV_INDEX_COUNT)
+		{
+			refInvHandle[refData[i].index]=&refData[i];
+		}
+		else if (refData[i].index >= REF_CH_INDEX_BASE &&
+				refData[i].index < (REF_CH_INDEX_BASE + REF_CH_INDEX_COUNT))
 		{
-			f32ReturnValue= refData[i].value;
-			break;
+			refChHandle[refData[i].index - REF_CH_INDEX_BASE]=&refData[i];
 		}
 	}
-	return f32ReturnValue;
 }
-uint16_t getRefIDIndex()
+/*!
+ **************************************************************************************************
+ *
+ *  @fn         RefDataType* getRefHandle(uint16_t index)
+ *
+ *  @par        Constant time lookup of a reference by its REF_WEB_INDEX.
+ *
+ *  @param      index   REF_WEB_INDEX of the reference.
+ *
+ *  @return     Reference row, NULL if no row carries this index.
+ *
+ *  @par        Design Info
+ *              WCET            : Enter Worst Case Execution Time heres
+ *              Sync/Async      : sync
+ *
+ **************************************************************************************************
+ */
+RefDataType* getRefHandle(uint16_t index)
 {
-	u16 u16ReturnValue;
-	for (int i = 0; i < REF_ARRAY_SIZE; i++)
+	if (NULL == refIdData)
 	{
-		if (strcmp(refData[i].name, "REFID") == 0)
-		{
-			u16ReturnValue=i;
-			break;
-		}
+		refDataInit();
+	}
+	if (index < REF_INV_INDEX_COUNT)
+	{
+		return refInvHandle[index];
+	}
+	if (index >= REF_CH_INDEX_BASE && index < (REF_CH_INDEX_BASE + REF_CH_INDEX_COUNT))
+	{
+		return refChHandle[index - REF_CH_INDEX_BASE];
+	}
+	if (REFID_INDEX == index)
+	{
+		return refIdData;
 	}
-	return u16ReturnValue;
+	return NULL;
 }
-void setRefIDValue(float x)
+
+float getRefIDValue()
 {
-	for (int i = 0; i < REF_ARRAY_SIZE; i++)
+	if (NULL == refIdData)
 	{
-		if (strcmp(refData[i].name, "REFID") == 0)
-		{
-			refData[i].value=x;
-			refData[i].flag=(REF_REPORT_TO_WEB | REF_WRITE_TO_MEM | REF_UPDATED_VALUE);
-			return;
-		}
+		refDataInit();
 	}
+	return refIdData->value;
 }
-
-int registerToDatabase(const char *moduleName,
-		MntDataType *moduleDb,
-		size_t moduleDatasize)
+uint16_t getRefIDIndex()
 {
-	if (dbIndex >= DATABASE_SIZE)
+	if (NULL == refIdData)
 	{
-		// Registry is full
-		return -1;
+		refDataInit();
 	}
-
-	mntDb[dbIndex].mName = moduleName;
-	mntDb[dbIndex].mData = moduleDb;
-	mntDb[dbIndex].mDataSize = moduleDatasize;
-	dbIndex++;
-
-	return 0;
+	return refIdRow;
 }
-
-int getSizeOfRgsModule(void){
-	return dbIndex;
+void setRefIDValue(float x)
+{
+	if (NULL == refIdData)
+	{
+		refDataInit();
+	}
+	refIdData->value=x;
+	refIdData->flag=(REF_REPORT_TO_WEB | REF_WRITE_TO_MEM | REF_UPDATED_VALUE);
 }
+
 /*!
  **************************************************************************************************
  *
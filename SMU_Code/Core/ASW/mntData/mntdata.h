@@ -10,12 +10,11 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "Platform.h"
+#include "signal_db.h"
 
-#define MONITORING_ARRAY_SIZE 50
 #define REF_ARRAY_SIZE 30
 
 #define REF_SIZE 10
-#define DATABASE_SIZE 10
 #define LOCAL 1
 #define REMOTE 0
 
@@ -56,6 +55,11 @@ typedef enum{
 
 }REF_WEB_INDEX;
 
+/* Dense ranges of REF_WEB_INDEX used for the handle tables */
+#define REF_INV_INDEX_COUNT  (INV_SERVER_INDEX + 1)
+#define REF_CH_INDEX_BASE    CH_MOD_WRITE_EN_INDEX
+#define REF_CH_INDEX_COUNT   (CH_LOW_BATT_F_HI_TH_INDEX - CH_MOD_WRITE_EN_INDEX + 1)
+
 
 
 
@@ -69,22 +73,9 @@ typedef struct {
 	char 			flag;
 }RefDataType;
 
-typedef struct
-{
-    const char  *mName;
-    MntDataType *mData;
-    size_t       mDataSize;
-} Database_Type;
-
-
-
-//MntDataType* getMntData(void);
-int registerToDatabase(const char *moduleName,
-                      MntDataType *moduleDb,
-                      size_t moduleDatasize);
-  Database_Type* getMntDatabase(void);
-  int getSizeOfRgsModule(void);
   RefDataType* getRefData(void);
+  void refDataInit(void);
+  RefDataType* getRefHandle(uint16_t index);
   float getRefIDValue(void) ;
   void setRefIDValue(float x) ;
   uint16_t getRefIDIndex() ;
@@ -0,0 +1,520 @@
+/**
+ * @file signal_db.c
+ * @brief Monitoring signal registry implementation
+ *
+ * The metadata table is const and indexed by signal ID, so it is placed in
+ * flash and a lookup is a single array access. Values, time stamps and
+ * quality bits are kept in separate dense arrays: a snapshot only touches
+ * the value array and the old 32-byte name/unit/value rows are gone from RAM.
+ *
+ * Values are written from the Modbus manager, the BMS frame handler and the
+ * control loop and read from the log manager and the control loop. Every
+ * group has two value buffers: a block update refreshes the back buffer
+ * from the front one, overwrites the polled values and then flips the front
+ * index and bumps the group sequence counter. A reader copies the front
+ * buffer and repeats the copy if the counter moved meanwhile. A front buffer
+ * is only written again after the next flip, so an unchanged counter proves
+ * the copy is coherent. Writers never wait and readers retry a bounded
+ * number of times; a group that still moved under every retry is copied
+ * once more with interrupts masked for the few words of the group.
+ *
+ * @date 2025-10-26
+ * @author Allayar Moazami
+ */
+#include "signal_db.h"
+#include "main.h"
+#include <string.h>
+
+/* ========================================================================
+ * Constants
+ * ======================================================================== */
+
+/** @brief Policy of values received from the slaves */
+#define SIG_WEB         SIG_POLICY_WEB
+
+/** @brief Policy of measured values of the slaves */
+#define SIG_WEB_STATS   (SIG_POLICY_WEB | SIG_POLICY_STATS)
+
+/** @brief Policy of optional devices that may never answer */
+#define SIG_WEB_VALID   (SIG_POLICY_WEB | SIG_POLICY_VALID)
+
+/** @brief Policy of measured values of optional devices */
+#define SIG_WEB_VALID_STATS (SIG_POLICY_WEB | SIG_POLICY_VALID | SIG_POLICY_STATS)
+
+/** @brief Policy of key measured values, their aggregate is uploaded */
+#define SIG_WEB_AGG         (SIG_WEB_STATS | SIG_POLICY_UPLOAD)
+
+/** @brief Policy of key measured values of optional devices */
+#define SIG_WEB_VALID_AGG   (SIG_WEB_VALID_STATS | SIG_POLICY_UPLOAD)
+
+/** @brief Signal descriptions, indexed by EnuSignalId */
+static const StuSignalMeta gSignalMeta[SIG_COUNT] =
+{
+    [SIG_SMU_LIVE]      = { "Live",      "N",  1.0f, SIG_WEB,              SIG_GROUP_SMU },
+    [SIG_SMU_TEMPE]     = { "TempE",     "C",  1.0f, SIG_WEB_STATS,        SIG_GROUP_SMU },
+
+    [SIG_S1_VDC]        = { "VDC",       "V",  1.0f, SIG_WEB_AGG,          SIG_GROUP_S1 },
+    [SIG_S1_IINV1]      = { "Iinv1",     "A",  1.0f, SIG_WEB_STATS,        SIG_GROUP_S1 },
+    [SIG_S1_IINV2]      = { "Iinv2",     "A",  1.0f, SIG_WEB_STATS,        SIG_GROUP_S1 },
+    [SIG_S1_VO1]        = { "VO1",       "V",  1.0f, SIG_WEB_AGG,          SIG_GROUP_S1 },
+    [SIG_S1_VO2]        = { "VO2",       "V",  1.0f, SIG_WEB_AGG,          SIG_GROUP_S1 },
+    [SIG_S1_VG1]        = { "VG1",       "V",  1.0f, SIG_WEB_STATS,        SIG_GROUP_S1 },
+    [SIG_S1_VG2]        = { "VG2",       "V",  1.0f, SIG_WEB_STATS,        SIG_GROUP_S1 },
+    [SIG_S1_FRQI]       = { "FRQI",      "Hz", 1.0f, SIG_WEB_STATS,        SIG_GROUP_S1 },
+    [SIG_S1_SSRS]       = { "SSRS",      "N",  1.0f, SIG_WEB,              SIG_GROUP_S1 },
+    [SIG_S1_FCODE]      = { "FCODE",     "N",  1.0f, SIG_WEB,              SIG_GROUP_S1 },
+    [SIG_S1_FTRIG]      = { "FTRIG",     "N",  1.0f, SIG_WEB,              SIG_GROUP_S1 },
+    [SIG_S1_TEMPINV]    = { "Tempinv",   "C",  1.0f, SIG_WEB_AGG,          SIG_GROUP_S1 },
+    [SIG_S1_INV_STATE]  = { "InvState",  "N",  1.0f, SIG_WEB,              SIG_GROUP_S1 },
+    [SIG_S1_REFID]      = { "Inv1REFID", "N",  1.0f, SIG_WEB,              SIG_GROUP_S1 },
+
+    [SIG_S2_VDC_CH]     = { "VDC_CH",    "V",  1.0f, SIG_WEB_STATS,        SIG_GROUP_S2 },
+    [SIG_S2_VBAT_CH]    = { "VBat_CH",   "V",  1.0f, SIG_WEB_AGG,          SIG_GROUP_S2 },
+    [SIG_S2_IBAT_CH]    = { "IBat_CH",   "A",  1.0f, SIG_WEB_AGG,          SIG_GROUP_S2 },
+    [SIG_S2_IBRI1C]     = { "IBRI1C",    "A",  1.0f, SIG_WEB_STATS,        SIG_GROUP_S2 },
+    [SIG_S2_IBRI2C]     = { "IBRI2C",    "A",  1.0f, SIG_WEB_STATS,        SIG_GROUP_S2 },
+    [SIG_S2_POWER1]     = { "POWER1",    "W",  1.0f, SIG_WEB_AGG,          SIG_GROUP_S2 },
+    [SIG_S2_GENS]       = { "GenS",      "N",  1.0f, SIG_WEB,              SIG_GROUP_S2 },
+    [SIG_S2_STATE]      = { "State",     "N",  1.0f, SIG_WEB,              SIG_GROUP_S2 },
+    [SIG_S2_FCC]        = { "FCC",       "N",  1.0f, SIG_WEB,              SIG_GROUP_S2 },
+    [SIG_S2_REFID]      = { "Ch1REFID",  "N",  1.0f, SIG_WEB,              SIG_GROUP_S2 },
+
+    [SIG_BP1_VTOTAL]    = { "Vtotal1",   "V",  1.0f, SIG_WEB_VALID_STATS,  SIG_GROUP_BP1 },
+    [SIG_BP1_ITOTAL]    = { "Itotal1",   "A",  1.0f, SIG_WEB_VALID_STATS,  SIG_GROUP_BP1 },
+    [SIG_BP1_SOC]       = { "SOC1",      "N",  1.0f, SIG_WEB_VALID_AGG,    SIG_GROUP_BP1 },
+    [SIG_BP1_SOH]       = { "SOH1",      "N",  1.0f, SIG_WEB_VALID,        SIG_GROUP_BP1 },
+    [SIG_BP1_MAX_VCELL] = { "MaxVcell1", "V",  1.0f, SIG_WEB_VALID_STATS,  SIG_GROUP_BP1 },
+    [SIG_BP1_TMAX]      = { "Tmax1",     "C",  1.0f, SIG_WEB_VALID_STATS,  SIG_GROUP_BP1 },
+    [SIG_BP1_TMOS]      = { "Tmos1",     "C",  1.0f, SIG_WEB_VALID_STATS,  SIG_GROUP_BP1 },
+    [SIG_BP1_PRT_CODE]  = { "PrtCode1",  "A",  1.0f, SIG_WEB_VALID,        SIG_GROUP_BP1 },
+    [SIG_BP1_WAR_CODE]  = { "WarCode1",  "A",  1.0f, SIG_WEB_VALID,        SIG_GROUP_BP1 },
+    [SIG_BP2_VTOTAL]    = { "Vtotal2",   "V",  1.0f, SIG_WEB_VALID_STATS,  SIG_GROUP_BP2 },
+    [SIG_BP2_ITOTAL]    = { "Itotal2",   "A",  1.0f, SIG_WEB_VALID_STATS,  SIG_GROUP_BP2 },
+    [SIG_BP2_SOC]       = { "SOC2",      "N",  1.0f, SIG_WEB_VALID_AGG,    SIG_GROUP_BP2 },
+    [SIG_BP2_SOH]       = { "SOH2",      "N",  1.0f, SIG_WEB_VALID,        SIG_GROUP_BP2 },
+    [SIG_BP2_MAX_VCELL] = { "MaxVcell2", "V",  1.0f, SIG_WEB_VALID_STATS,  SIG_GROUP_BP2 },
+    [SIG_BP2_TMAX]      = { "Tmax2",     "C",  1.0f, SIG_WEB_VALID_STATS,  SIG_GROUP_BP2 },
+    [SIG_BP2_TMOS]      = { "Tmos2",     "C",  1.0f, SIG_WEB_VALID_STATS,  SIG_GROUP_BP2 },
+    [SIG_BP2_PRT_CODE]  = { "PrtCode2",  "A",  1.0f, SIG_WEB_VALID,        SIG_GROUP_BP2 },
+    [SIG_BP2_WAR_CODE]  = { "WarCode2",  "A",  1.0f, SIG_WEB_VALID,        SIG_GROUP_BP2 },
+
+    [SIG_EM1_EP_IMP]    = { "EPimp1",    "kWh",   1.0f, SIG_WEB_VALID,     SIG_GROUP_EM },
+    [SIG_EM1_EP_EXP]    = { "EPexp1",    "kWh",   1.0f, SIG_WEB_VALID,     SIG_GROUP_EM },
+    [SIG_EM1_EQ_IMP]    = { "EQimp1",    "kvarh", 1.0f, SIG_WEB_VALID,     SIG_GROUP_EM },
+    [SIG_EM1_EQ_EXP]    = { "EQexp1",    "kvarh", 1.0f, SIG_WEB_VALID,     SIG_GROUP_EM },
+    [SIG_EM2_EP_IMP]    = { "EPimp2",    "kWh",   1.0f, SIG_WEB_VALID,     SIG_GROUP_EM },
+    [SIG_EM2_EP_EXP]    = { "EPexp2",    "kWh",   1.0f, SIG_WEB_VALID,     SIG_GROUP_EM },
+    [SIG_EM2_EQ_IMP]    = { "EQimp2",    "kvarh", 1.0f, SIG_WEB_VALID,     SIG_GROUP_EM },
+    [SIG_EM2_EQ_EXP]    = { "EQexp2",    "kvarh", 1.0f, SIG_WEB_VALID,     SIG_GROUP_EM },
+
+    [SIG_PQ1_VRMS]      = { "Vem1",      "V",  1.0f, SIG_WEB_VALID_AGG,    SIG_GROUP_PQ },
+    [SIG_PQ1_S]         = { "Sem1",      "VA", 1.0f, SIG_WEB_VALID_STATS,  SIG_GROUP_PQ },
+    [SIG_PQ1_PF]        = { "PFem1",     "N",  1.0f, SIG_WEB_VALID_STATS,  SIG_GROUP_PQ },
+    [SIG_PQ2_VRMS]      = { "Vem2",      "V",  1.0f, SIG_WEB_VALID_AGG,    SIG_GROUP_PQ },
+    [SIG_PQ2_S]         = { "Sem2",      "VA", 1.0f, SIG_WEB_VALID_STATS,  SIG_GROUP_PQ },
+    [SIG_PQ2_PF]        = { "PFem2",     "N",  1.0f, SIG_WEB_VALID_STATS,  SIG_GROUP_PQ },
+    [SIG_PQ_FREQ]       = { "Fem",       "Hz", 1.0f, SIG_WEB_VALID_AGG,    SIG_GROUP_PQ },
+    [SIG_PQ_STATE]      = { "PQstate",   "N",  1.0f, SIG_WEB_VALID,        SIG_GROUP_PQ },
+};
+
+/** @brief First signal ID of each group, followed by SIG_COUNT */
+static const u8 gGroupFirst[SIG_GROUP_COUNT + 1] =
+{
+    SIG_SMU_LIVE, SIG_S1_VDC, SIG_S2_VDC_CH, SIG_BP1_VTOTAL, SIG_BP2_VTOTAL, SIG_EM1_EP_IMP,
+    SIG_PQ1_VRMS, SIG_COUNT
+};
+
+/* ========================================================================
+ * Static Variables
+ * ======================================================================== */
+
+/** @brief Front and back value buffers */
+static f32 gSignalValue[2][SIG_COUNT];
+
+/** @brief Buffer index holding the published values of each group */
+static volatile u8 gGroupFront[SIG_GROUP_COUNT];
+
+/** @brief Publish counter of each group */
+static volatile u32 gGroupSeq[SIG_GROUP_COUNT];
+
+/** @brief Group has a block update open */
+static volatile u8 gGroupOpen[SIG_GROUP_COUNT];
+
+/** @brief Open block republishes held values, its writes are not samples */
+static volatile u8 gGroupHeld[SIG_GROUP_COUNT];
+
+/** @brief Running aggregate, two windows so closing never races a writer */
+typedef struct StuSignalAccStruct
+{
+    f32 min;
+    f32 max;
+    f32 sum;        /**< Running sum, single precision for the FPU */
+    f32 comp;       /**< Kahan compensation, the low bits sum has lost */
+    u32 count;
+} StuSignalAcc;
+
+/** @brief Aggregators, gSignalAcc[gWindow] collects the current window */
+static StuSignalAcc gSignalAcc[2][SIG_COUNT];
+
+/** @brief Index of the window being collected */
+static volatile u8 gWindow;
+
+/** @brief Tick of the last update */
+static u32 gSignalStamp[SIG_COUNT];
+
+/** @brief SIG_Q_xxx flags */
+static u8 gSignalQuality[SIG_COUNT];
+
+/** @brief Value changed since the last signal_db_take_changed(), one byte per signal */
+static volatile u8 gSignalChanged[SIG_COUNT];
+
+/* ========================================================================
+ * Public Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Clear all values and quality bits
+ */
+void signal_db_init(void)
+{
+    memset(gSignalValue, 0, sizeof(gSignalValue));
+    memset(gSignalStamp, 0, sizeof(gSignalStamp));
+    memset(gSignalQuality, 0, sizeof(gSignalQuality));
+    memset(gSignalAcc, 0, sizeof(gSignalAcc));
+    memset((void *)gSignalChanged, 0, sizeof(gSignalChanged));
+    gWindow = 0;
+    for (u8 g = 0; g < SIG_GROUP_COUNT; g++) {
+        gGroupFront[g] = 0;
+        gGroupSeq[g] = 0;
+        gGroupOpen[g] = 0;
+        gGroupHeld[g] = 0;
+    }
+}
+
+/**
+ * @brief Get the constant description of a signal
+ *
+ * @param[in] id Signal ID
+ *
+ * @return Description, NULL for an unknown ID
+ */
+const StuSignalMeta *signal_db_meta(EnuSignalId id)
+{
+    if (id >= SIG_COUNT) {
+        return NULL;
+    }
+    return &gSignalMeta[id];
+}
+
+/**
+ * @brief Open a block update of a signal group
+ *
+ * @param[in] group Signal group
+ */
+void signal_db_begin(EnuSignalGroup group)
+{
+    u8 front;
+    u8 first;
+
+    if (group >= SIG_GROUP_COUNT) {
+        return;
+    }
+    front = gGroupFront[group];
+    first = gGroupFirst[group];
+    /* Signals the driver does not write this time keep their value */
+    memcpy(&gSignalValue[front ^ 1U][first], &gSignalValue[front][first],
+           (size_t)(gGroupFirst[group + 1] - first) * sizeof(f32));
+    gGroupHeld[group] = 0;
+    gGroupOpen[group] = 1;
+}
+
+/**
+ * @brief Open a block update that republishes held values
+ *
+ * @param[in] group Signal group
+ */
+void signal_db_begin_held(EnuSignalGroup group)
+{
+    if (group >= SIG_GROUP_COUNT) {
+        return;
+    }
+    signal_db_begin(group);
+    gGroupHeld[group] = 1;
+}
+
+/**
+ * @brief Publish the values set since signal_db_begin()
+ *
+ * @param[in] group Signal group
+ */
+void signal_db_end(EnuSignalGroup group)
+{
+    if (group >= SIG_GROUP_COUNT || 0 == gGroupOpen[group]) {
+        return;
+    }
+    __DMB();
+    gGroupFront[group] ^= 1U;
+    __DMB();
+    gGroupSeq[group]++;
+    gGroupOpen[group] = 0;
+    gGroupHeld[group] = 0;
+}
+
+/**
+ * @brief Store a new value
+ *
+ * @param[in] id    Signal ID
+ * @param[in] value New value
+ *
+ * @return 1 if the value differs from the previous one, 0 otherwise
+ */
+u8 signal_db_set(EnuSignalId id, f32 value)
+{
+    u8 group;
+    u8 front;
+    u8 changed;
+
+    if (id >= SIG_COUNT) {
+        return 0;
+    }
+    group = gSignalMeta[id].group;
+    front = gGroupFront[group];
+    changed = (value != gSignalValue[front][id]) ? 1U : 0U;
+    if (1U == gGroupOpen[group]) {
+        gSignalValue[front ^ 1U][id] = value;
+    } else {
+        /* Single word store, visible at once */
+        gSignalValue[front][id] = value;
+    }
+    if (1U == changed || 0U == (gSignalQuality[id] & SIG_Q_VALID)) {
+        /* The first value counts as a change, consumers start from it */
+        gSignalChanged[id] = 1;
+    }
+    gSignalQuality[id] |= SIG_Q_VALID;
+    if (1U == gGroupOpen[group] && 1U == gGroupHeld[group]) {
+        /* Held value, already counted when it was read */
+        return changed;
+    }
+    gSignalStamp[id] = HAL_GetTick();
+
+    if (0U != (gSignalMeta[id].policy & SIG_POLICY_STATS)) {
+        StuSignalAcc *acc = &gSignalAcc[gWindow][id];
+
+        if (0U == acc->count) {
+            acc->min = value;
+            acc->max = value;
+            acc->sum = 0.0f;
+            acc->comp = 0.0f;
+        } else if (value < acc->min) {
+            acc->min = value;
+        } else if (value > acc->max) {
+            acc->max = value;
+        }
+        if (acc->count < 0xFFFFFFFFUL) {
+            /* A plain f32 sum stops moving once it dwarfs a sample */
+            f32 y = value - acc->comp;
+            f32 t = acc->sum + y;
+
+            acc->comp = (t - acc->sum) - y;
+            acc->sum = t;
+            acc->count++;
+        }
+    }
+    return changed;
+}
+
+/**
+ * @brief Consume the change flag of a signal
+ *
+ * @param[in] id Signal ID
+ *
+ * @return 1 if the published value changed since the last call, 0 otherwise
+ */
+u8 signal_db_take_changed(EnuSignalId id)
+{
+    if (id >= SIG_COUNT || 0U == gSignalChanged[id]) {
+        return 0;
+    }
+    if (1U == gGroupOpen[gSignalMeta[id].group]) {
+        /* Not published yet, keep the flag for the next call */
+        return 0;
+    }
+    gSignalChanged[id] = 0;
+    return 1;
+}
+
+/**
+ * @brief Get the current published value
+ *
+ * @param[in] id Signal ID
+ *
+ * @return Value, 0 for an unknown ID
+ */
+f32 signal_db_get(EnuSignalId id)
+{
+    if (id >= SIG_COUNT) {
+        return 0.0f;
+    }
+    return gSignalValue[gGroupFront[gSignalMeta[id].group]][id];
+}
+
+/**
+ * @brief Copy all published values
+ *
+ * @param[out] value SIG_COUNT values in signal ID order
+ */
+void signal_db_snapshot(f32 *value)
+{
+    u32 seq;
+    u8 first;
+    size_t size;
+
+    for (u8 g = 0; g < SIG_GROUP_COUNT; g++) {
+        first = gGroupFirst[g];
+        size = (size_t)(gGroupFirst[g + 1] - first) * sizeof(f32);
+        u8 retry;
+
+        for (retry = 0; retry < SIG_SNAPSHOT_RETRY; retry++) {
+            seq = gGroupSeq[g];
+            __DMB();
+            memcpy(&value[first], &gSignalValue[gGroupFront[g]][first], size);
+            __DMB();
+            if (seq == gGroupSeq[g]) {
+                break;
+            }
+        }
+        if (SIG_SNAPSHOT_RETRY == retry) {
+            /* Publishes keep overtaking the copy, no writer runs while masked */
+            u32 primask = __get_PRIMASK();
+
+            __disable_irq();
+            memcpy(&value[first], &gSignalValue[gGroupFront[g]][first], size);
+            __set_PRIMASK(primask);
+        }
+    }
+}
+
+/**
+ * @brief Close the current aggregation window and start a new one
+ */
+void signal_db_window_close(void)
+{
+    u8 next = gWindow ^ 1U;
+
+    /* The next window was read out one log tick ago, no writer touches it */
+    memset(gSignalAcc[next], 0, sizeof(gSignalAcc[next]));
+    __DMB();
+    gWindow = next;
+    __DMB();
+}
+
+/**
+ * @brief Get the aggregate of the last closed window
+ *
+ * @param[in]  id    Signal ID
+ * @param[out] stats Aggregate, count is 0 if the window had no samples
+ *
+ * @return 1 if the signal is aggregated and had samples, 0 otherwise
+ */
+u8 signal_db_stats(EnuSignalId id, StuSignalStats *stats)
+{
+    const StuSignalAcc *acc;
+
+    memset(stats, 0, sizeof(*stats));
+    if (id >= SIG_COUNT || 0U == (gSignalMeta[id].policy & SIG_POLICY_STATS)) {
+        return 0;
+    }
+    acc = &gSignalAcc[gWindow ^ 1U][id];
+    if (0U == acc->count) {
+        return 0;
+    }
+    stats->min = acc->min;
+    stats->max = acc->max;
+    stats->mean = acc->sum / (f32)acc->count;
+    stats->count = acc->count;
+    return 1;
+}
+
+/**
+ * @brief Get the tick of the last update
+ *
+ * @param[in] id Signal ID
+ *
+ * @return HAL tick of the last fresh signal_db_set()
+ */
+u32 signal_db_stamp(EnuSignalId id)
+{
+    if (id >= SIG_COUNT) {
+        return 0;
+    }
+    return gSignalStamp[id];
+}
+
+/**
+ * @brief Get the quality bits
+ *
+ * @param[in] id Signal ID
+ *
+ * @return SIG_Q_xxx flags
+ */
+u8 signal_db_quality(EnuSignalId id)
+{
+    if (id >= SIG_COUNT) {
+        return 0;
+    }
+    return gSignalQuality[id];
+}
+
+/**
+ * @brief Check whether a signal belongs in the web snapshot right now
+ *
+ * @param[in] id Signal ID
+ *
+ * @return 1 if the report policy allows the signal, 0 otherwise
+ */
+u8 signal_db_reported(EnuSignalId id)
+{
+    u8 policy;
+
+    if (id >= SIG_COUNT) {
+        return 0;
+    }
+    policy = gSignalMeta[id].policy;
+    if (0U == (policy & SIG_POLICY_WEB)) {
+        return 0;
+    }
+    if (0U != (policy & SIG_POLICY_VALID) && 0U == (gSignalQuality[id] & SIG_Q_VALID)) {
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Check whether the window aggregate of a signal is uploaded
+ *
+ * @param[in] id Signal ID
+ *
+ * @return 1 if the signal has SIG_POLICY_UPLOAD, 0 otherwise
+ */
+u8 signal_db_stats_uploaded(EnuSignalId id)
+{
+    if (id >= SIG_COUNT || 0U == (gSignalMeta[id].policy & SIG_POLICY_UPLOAD)) {
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Get a value with the report scale applied
+ *
+ * @param[in] id Signal ID
+ *
+ * @return Scaled value
+ */
+f32 signal_db_report_value(EnuSignalId id)
+{
+    if (id >= SIG_COUNT) {
+        return 0.0f;
+    }
+    return signal_db_get(id) * gSignalMeta[id].scale;
+}
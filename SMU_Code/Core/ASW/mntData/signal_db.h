@@ -0,0 +1,345 @@
+/**
+ * @file signal_db.h
+ * @brief Monitoring signal registry
+ *
+ * Every monitoring value of the SMU and its slaves has a fixed signal ID.
+ * Name, unit, report scale and report policy of a signal are constant and
+ * live in flash; RAM only holds a dense value array with a time stamp and
+ * quality bits per signal. Producers and consumers address a signal by its
+ * ID, snapshot builders walk the IDs in order.
+ *
+ * Signals of one device form a group. A driver that refreshes a device
+ * wraps its writes in signal_db_begin()/signal_db_end(); readers see either
+ * all values of the previous poll or all values of the new one, never a mix.
+ * Writers never mask interrupts; a reader only does when lock-free copies
+ * of a group keep failing.
+ *
+ * Every write that changes a value also raises a per-signal change flag;
+ * event-driven consumers such as the alarm engine poll and clear it with
+ * signal_db_take_changed() instead of comparing all values themselves.
+ *
+ * Signals with SIG_POLICY_STATS also feed a streaming aggregator on every
+ * fresh write: sample count, min, max and a running sum for the mean. A
+ * driver that republishes held values between polls opens its block with
+ * signal_db_begin_held(), those writes are not samples. The log
+ * manager closes the window once per log tick; the closed window is
+ * spooled next to the last value. Only signals with SIG_POLICY_UPLOAD send
+ * their aggregate to the server, every aggregated entry costs link time.
+ *
+ * @date 2025-10-26
+ * @author Allayar Moazami
+ */
+#ifndef H_SIGNAL_DB
+#define H_SIGNAL_DB
+
+#include "platform.h"
+
+/** @brief Signal is part of the web snapshot and the telemetry spool */
+#define SIG_POLICY_WEB      0x01U
+
+/** @brief Signal is only reported once a value was received */
+#define SIG_POLICY_VALID    0x02U
+
+/** @brief Signal keeps min/max/mean of every logging window */
+#define SIG_POLICY_STATS    0x04U
+
+/** @brief Window aggregate of the signal is uploaded, not only spooled */
+#define SIG_POLICY_UPLOAD   0x08U
+
+/** @brief Signal received a value since start-up */
+#define SIG_Q_VALID         0x01U
+
+/** @brief Lock-free copies of a group before signal_db_snapshot() masks interrupts */
+#define SIG_SNAPSHOT_RETRY  3U
+
+/**
+ * @enum EnuSignalGroup
+ * @brief Signal groups, each is published as one consistent block
+ */
+typedef enum EnuSignalGroupEnum
+{
+    SIG_GROUP_SMU = 0,      /**< SMU local values */
+    SIG_GROUP_S1,           /**< S1 inverter poll */
+    SIG_GROUP_S2,           /**< S2 charger poll */
+    SIG_GROUP_BP1,          /**< BP3 pack 1 frame */
+    SIG_GROUP_BP2,          /**< BP3 pack 2 frame */
+    SIG_GROUP_EM,           /**< STPM34 energy counters */
+    SIG_GROUP_PQ,           /**< STPM34 power quality second */
+    SIG_GROUP_COUNT         /**< Number of groups */
+} EnuSignalGroup;
+
+/**
+ * @enum EnuSignalId
+ * @brief Signal IDs, also the report order of the web snapshot
+ */
+typedef enum EnuSignalIdEnum
+{
+    /* SMU */
+    SIG_SMU_LIVE = 0,       /**< Snapshot counter */
+    SIG_SMU_TEMPE,          /**< Enclosure temperature */
+
+    /* S1 inverter */
+    SIG_S1_VDC,             /**< DC link voltage */
+    SIG_S1_IINV1,           /**< Inverter 1 current */
+    SIG_S1_IINV2,           /**< Inverter 2 current */
+    SIG_S1_VO1,             /**< Output 1 voltage, dash board 1 */
+    SIG_S1_VO2,             /**< Output 2 voltage, dash board 2 */
+    SIG_S1_VG1,             /**< Grid 1 voltage */
+    SIG_S1_VG2,             /**< Grid 2 voltage */
+    SIG_S1_FRQI,            /**< Inverter frequency */
+    SIG_S1_SSRS,            /**< SSR status, dash board 3 */
+    SIG_S1_FCODE,           /**< Fault code, dash board 7 */
+    SIG_S1_FTRIG,           /**< Fault trigger */
+    SIG_S1_TEMPINV,         /**< Inverter temperature */
+    SIG_S1_INV_STATE,       /**< Inverter state */
+    SIG_S1_REFID,           /**< Reference set ID of the inverter */
+
+    /* S2 charger */
+    SIG_S2_VDC_CH,          /**< Charger DC voltage */
+    SIG_S2_VBAT_CH,         /**< Battery voltage, dash board 8 */
+    SIG_S2_IBAT_CH,         /**< Battery current */
+    SIG_S2_IBRI1C,          /**< Bridge 1 current */
+    SIG_S2_IBRI2C,          /**< Bridge 2 current */
+    SIG_S2_POWER1,          /**< Charger power, dash board 9 */
+    SIG_S2_GENS,            /**< Generator state, dash board 4 */
+    SIG_S2_STATE,           /**< Charger state, dash board 5 */
+    SIG_S2_FCC,             /**< Fault code, dash board 6 */
+    SIG_S2_REFID,           /**< Reference set ID of the charger */
+
+    /* BP3 battery packs 1 and 2 */
+    SIG_BP1_VTOTAL,         /**< Pack 1 voltage */
+    SIG_BP1_ITOTAL,         /**< Pack 1 current */
+    SIG_BP1_SOC,            /**< Pack 1 state of charge */
+    SIG_BP1_SOH,            /**< Pack 1 state of health */
+    SIG_BP1_MAX_VCELL,      /**< Pack 1 highest cell voltage */
+    SIG_BP1_TMAX,           /**< Pack 1 highest cell temperature */
+    SIG_BP1_TMOS,           /**< Pack 1 MOSFET temperature */
+    SIG_BP1_PRT_CODE,       /**< Pack 1 protection code */
+    SIG_BP1_WAR_CODE,       /**< Pack 1 warning code */
+    SIG_BP2_VTOTAL,         /**< Pack 2 voltage */
+    SIG_BP2_ITOTAL,         /**< Pack 2 current */
+    SIG_BP2_SOC,            /**< Pack 2 state of charge */
+    SIG_BP2_SOH,            /**< Pack 2 state of health */
+    SIG_BP2_MAX_VCELL,      /**< Pack 2 highest cell voltage */
+    SIG_BP2_TMAX,           /**< Pack 2 highest cell temperature */
+    SIG_BP2_TMOS,           /**< Pack 2 MOSFET temperature */
+    SIG_BP2_PRT_CODE,       /**< Pack 2 protection code */
+    SIG_BP2_WAR_CODE,       /**< Pack 2 warning code */
+
+    /* STPM34 energy counters, channels 1 and 2 */
+    SIG_EM1_EP_IMP,         /**< Channel 1 imported active energy */
+    SIG_EM1_EP_EXP,         /**< Channel 1 exported active energy */
+    SIG_EM1_EQ_IMP,         /**< Channel 1 imported reactive energy */
+    SIG_EM1_EQ_EXP,         /**< Channel 1 exported reactive energy */
+    SIG_EM2_EP_IMP,         /**< Channel 2 imported active energy */
+    SIG_EM2_EP_EXP,         /**< Channel 2 exported active energy */
+    SIG_EM2_EQ_IMP,         /**< Channel 2 imported reactive energy */
+    SIG_EM2_EQ_EXP,         /**< Channel 2 exported reactive energy */
+
+    /* STPM34 power quality, one-second windows */
+    SIG_PQ1_VRMS,           /**< Channel 1 RMS voltage */
+    SIG_PQ1_S,              /**< Channel 1 apparent power */
+    SIG_PQ1_PF,             /**< Channel 1 power factor */
+    SIG_PQ2_VRMS,           /**< Channel 2 RMS voltage */
+    SIG_PQ2_S,              /**< Channel 2 apparent power */
+    SIG_PQ2_PF,             /**< Channel 2 power factor */
+    SIG_PQ_FREQ,            /**< Line frequency */
+    SIG_PQ_STATE,           /**< Voltage event bits, see PQ_STATE_BIT() */
+
+    SIG_COUNT               /**< Number of signals */
+} EnuSignalId;
+
+/**
+ * @enum EnuSignalPart
+ * @brief Reported parts of a signal: the value, then its window aggregate
+ */
+typedef enum EnuSignalPartEnum
+{
+    SIG_PART_LAST = 0,      /**< Value at the end of the window */
+    SIG_PART_STATS,         /**< Window min, max and mean as one entry */
+    SIG_PART_COUNT          /**< Number of parts */
+} EnuSignalPart;
+
+/**
+ * @struct StuSignalMeta
+ * @brief Constant signal description, kept in flash
+ */
+typedef struct StuSignalMetaStruct
+{
+    const char *name;       /**< Name used in the web frame */
+    const char *unit;       /**< Unit used in the web frame */
+    f32 scale;              /**< Factor applied to the value when reported */
+    u8 policy;              /**< SIG_POLICY_xxx flags */
+    u8 group;               /**< EnuSignalGroup the signal is published with */
+} StuSignalMeta;
+
+/**
+ * @struct StuSignalStats
+ * @brief Aggregate of one signal over a closed logging window
+ */
+typedef struct StuSignalStatsStruct
+{
+    f32 min;                /**< Smallest sample */
+    f32 max;                /**< Largest sample */
+    f32 mean;               /**< Average of all samples */
+    u32 count;              /**< Number of samples, 0 if none arrived */
+} StuSignalStats;
+
+/**
+ * @brief Clear all values and quality bits
+ */
+void signal_db_init(void);
+
+/**
+ * @brief Get the constant description of a signal
+ *
+ * @param[in] id Signal ID
+ *
+ * @return Description, NULL for an unknown ID
+ */
+const StuSignalMeta *signal_db_meta(EnuSignalId id);
+
+/**
+ * @brief Open a block update of a signal group
+ *
+ * Values set until signal_db_end() go to the group's back buffer and are
+ * published together. Each group may only be block-updated from one
+ * context; single signal_db_set() calls outside a block are atomic on
+ * their own and may come from any context.
+ *
+ * @param[in] group Signal group
+ */
+void signal_db_begin(EnuSignalGroup group);
+
+/**
+ * @brief Open a block update that republishes held values
+ *
+ * Like signal_db_begin(), for a driver that refreshes its group without a
+ * new reading from the device, e.g. every cycle between two polls or with
+ * values cleared after a timeout. The values are published but keep their
+ * time stamp and do not feed the window aggregate.
+ *
+ * @param[in] group Signal group
+ */
+void signal_db_begin_held(EnuSignalGroup group);
+
+/**
+ * @brief Publish the values set since signal_db_begin()
+ *
+ * @param[in] group Signal group
+ */
+void signal_db_end(EnuSignalGroup group);
+
+/**
+ * @brief Store a new value
+ *
+ * Stamps the value with the current tick, marks it valid and adds it to the
+ * window aggregate. Inside a block the value becomes visible with
+ * signal_db_end(); inside a held block it is neither stamped nor aggregated.
+ *
+ * @param[in] id    Signal ID
+ * @param[in] value New value
+ *
+ * @return 1 if the value differs from the previous one, 0 otherwise
+ */
+u8 signal_db_set(EnuSignalId id, f32 value);
+
+/**
+ * @brief Consume the change flag of a signal
+ *
+ * The flag is raised by signal_db_set() when the value differs from the
+ * previous one or is the first value received. While the group has a block
+ * update open the flag is kept until the block is published. Only one
+ * context may consume the flags.
+ *
+ * @param[in] id Signal ID
+ *
+ * @return 1 if the published value changed since the last call, 0 otherwise
+ */
+u8 signal_db_take_changed(EnuSignalId id);
+
+/**
+ * @brief Get the current published value
+ *
+ * @param[in] id Signal ID
+ *
+ * @return Value, 0 for an unknown ID
+ */
+f32 signal_db_get(EnuSignalId id);
+
+/**
+ * @brief Copy all published values
+ *
+ * Every group is copied as a whole: a copy that overlapped a publish of the
+ * same group is repeated, up to SIG_SNAPSHOT_RETRY times, and then done
+ * once with interrupts masked. Writers run in interrupts or in the main
+ * loop with the caller, so the result never mixes two publishes.
+ *
+ * @param[out] value SIG_COUNT values in signal ID order
+ */
+void signal_db_snapshot(f32 *value);
+
+/**
+ * @brief Close the current aggregation window and start a new one
+ *
+ * Called by the log manager once per log tick, before the record of that
+ * tick is captured.
+ */
+void signal_db_window_close(void);
+
+/**
+ * @brief Get the aggregate of the last closed window
+ *
+ * @param[in]  id    Signal ID
+ * @param[out] stats Aggregate, count is 0 if the window had no samples
+ *
+ * @return 1 if the signal is aggregated and had samples, 0 otherwise
+ */
+u8 signal_db_stats(EnuSignalId id, StuSignalStats *stats);
+
+/**
+ * @brief Get the tick of the last update
+ *
+ * @param[in] id Signal ID
+ *
+ * @return HAL tick of the last fresh signal_db_set()
+ */
+u32 signal_db_stamp(EnuSignalId id);
+
+/**
+ * @brief Get the quality bits
+ *
+ * @param[in] id Signal ID
+ *
+ * @return SIG_Q_xxx flags
+ */
+u8 signal_db_quality(EnuSignalId id);
+
+/**
+ * @brief Check whether a signal belongs in the web snapshot right now
+ *
+ * @param[in] id Signal ID
+ *
+ * @return 1 if the report policy allows the signal, 0 otherwise
+ */
+u8 signal_db_reported(EnuSignalId id);
+
+/**
+ * @brief Check whether the window aggregate of a signal is uploaded
+ *
+ * @param[in] id Signal ID
+ *
+ * @return 1 if the signal has SIG_POLICY_UPLOAD, 0 otherwise
+ */
+u8 signal_db_stats_uploaded(EnuSignalId id);
+
+/**
+ * @brief Get a value with the report scale applied
+ *
+ * @param[in] id Signal ID
+ *
+ * @return Scaled value
+ */
+f32 signal_db_report_value(EnuSignalId id);
+
+#endif /* H_SIGNAL_DB */
@@ -42,6 +42,34 @@ void MDM_SendData(uint8_t *str)
 	MdmUart.gState = HAL_UART_STATE_READY;
 	HAL_UART_Transmit_DMA(&MdmUart,U8MdmBuffer,size);
 }
+/*!
+ **************************************************************************************************
+ *
+ *  @fn         void MDM_SendBinary(uint8_t *data, uint16_t len)
+ *
+ *  @par        This function Sends MDM binary data (may contain zero bytes).
+ *
+ *  @param      data    Bytes to send.
+ *  @param      len     Number of bytes, clipped to MDM_DMA_SEND_BUF_SIZE.
+ *
+ *  @return     None.
+ *
+ *  @par        Design Info
+ *              WCET            : Enter Worst Case Execution Time heres
+ *              Sync/Async      : async
+ *
+ **************************************************************************************************
+ */
+void MDM_SendBinary(uint8_t *data, uint16_t len)
+{
+	if(len>MDM_DMA_SEND_BUF_SIZE)
+	{
+		len=MDM_DMA_SEND_BUF_SIZE;
+	}
+	memcpy(U8MdmBuffer,data,len);
+	MdmUart.gState = HAL_UART_STATE_READY;
+	HAL_UART_Transmit_DMA(&MdmUart,U8MdmBuffer,len);
+}
 
 
 
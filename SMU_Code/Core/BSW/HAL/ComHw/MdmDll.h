@@ -25,6 +25,7 @@ typedef struct
 
 
 void MDM_SendData(uint8_t *str);
+void MDM_SendBinary(uint8_t *data, uint16_t len);
 int MAC_MdmReciveData(void);
 MDMTypeDef* getMdm(void);
 
@@ -5,6 +5,25 @@
  * Implements data link layer functions for STPM34 communication including
  * frame transmission, reception with DMA, and data buffering.
  *
+ * Transactions are queued in gXfer[] and started one after the other in
+ * submit order. Everything after the start is event driven:
+ * - UART: TX DMA completion and the receive events of the continuous
+ *   circular RX DMA; the bytes are copied from the ring into the
+ *   transaction, and it completes once it is sent and fully answered.
+ * - SPI: one interrupt transfer per frame, chained from the completion
+ *   interrupt.
+ * - Timeout: counted down by the 1 ms TIM4 tick.
+ * Completion starts the next queued transaction from the same interrupt,
+ * so back-to-back transactions do not wait for the caller.
+ *
+ * The events come from interrupts of different priority and the queue is
+ * also used by the energy meter handler, so queue and link state are only
+ * touched inside energy_meter_dll_lock() / energy_meter_dll_unlock().
+ *
+ * Every transaction also records its time on the link in CPU cycles of the
+ * DWT counter. MEM.c resets that counter for its own measurements; a
+ * transaction spanning such a reset reports 0 instead of a wrong time.
+ *
  * @date Created on: Oct 16, 2025
  * @author A. Moazami
  */
@@ -15,215 +34,717 @@
 #include "stm32f4xx_hal_uart.h"
 #include <string.h>
 
+/* ========================================================================
+ * Private Types
+ * ======================================================================== */
+
+/**
+ * @struct StuEnergyMeterXfer
+ * @brief One transaction slot
+ */
+typedef struct {
+    volatile EnuEnergyMeterXferState state;     /**< Slot state */
+    u8 detached;                                /**< Released while pending, freed when it finishes */
+    u16 size;                                   /**< Bytes to send and to receive */
+    u16 rxCount;                                /**< Bytes received so far */
+    u32 submitTick;                             /**< HAL tick at submission */
+    u32 startTick;                              /**< HAL tick at start on the link */
+    u32 doneTick;                               /**< HAL tick at completion */
+    u32 startCycles;                            /**< DWT cycle count at start on the link */
+    u32 wireCycles;                             /**< Cycles from start to completion, 0 if unknown */
+    u8 tx[ENERGY_METER_BUFFER_SIZE];            /**< Frames, the DMA source */
+    u8 rx[ENERGY_METER_BUFFER_SIZE];            /**< Responses */
+} StuEnergyMeterXfer;
+
 /* ========================================================================
  * Private Variables
  * ======================================================================== */
 
-/** @brief RX buffer for energy meter data */
-static u8 gEnergyRxData[ENERGY_METER_BUFFER_SIZE];
+/** @brief Transaction slots */
+static StuEnergyMeterXfer gXfer[ENERGY_METER_DLL_QUEUE_SIZE];
+
+/** @brief Slots waiting to start, in submit order */
+static u8 gOrder[ENERGY_METER_DLL_QUEUE_SIZE];
+
+/** @brief First entry of gOrder */
+static u8 gOrderHead = 0;
+
+/** @brief Entries in gOrder */
+static u8 gOrderCount = 0;
+
+/** @brief Slot on the link, ENERGY_METER_DLL_NO_XFER when idle */
+static volatile u8 gActive = ENERGY_METER_DLL_NO_XFER;
+
+/** @brief ms left before the active transaction times out */
+static u16 gMsLeft = 0;
+
+/** @brief ms before the next start after a failed transaction */
+static u16 gGuardMs = 0;
 
-/** @brief Number of bytes received in last transaction */
-static u16 gRxByteCount = 0;
+/** @brief UART: all frames of the active transaction are sent */
+static u8 gTxDone = 0;
+
+/** @brief UART: continuous reception ring, written by DMA */
+static u8 gRxRing[ENERGY_METER_RX_RING_SIZE];
+
+/** @brief UART: next ring position not yet consumed */
+static u16 gRxHead = 0;
 
 /** @brief DMA reception state flag */
 static u8 gRxInitialized = 0;
 
-/** @brief Flag indicating data was read and buffer should be cleared */
-static u8 gDataReadFlag = 0;
+/** @brief SPI: offset of the frame being transferred */
+static u16 gSpiOffset = 0;
 
-/** @brief TX buffer to ensure data persists during DMA transmission */
-static u8 gEnergyTxData[STPM34_FRAME_SIZE];
+/** @brief Selected link */
+static EnuEnergyMeterLink gLink = ENERGY_METER_LINK_DEFAULT;
 
-/** @brief Flag indicating TX is in progress */
-static volatile u8 gTxBusy = 0;
+/** @brief Link counters */
+static StuEnergyMeterDllStats gStats;
 
-/** @brief TX complete flag (set by HAL_UART_TxCpltCallback) */
- volatile u8 gTxComplete = 0;
+/* ========================================================================
+ * Static Function Implementations
+ * ======================================================================== */
 
-/** @brief RX complete flag (set by HAL_UART_RxCpltCallback) */
- volatile u8 gRxComplete = 0;
+/**
+ * @brief Enter a section shared with the link interrupts
+ * @return Previous interrupt mask for energy_meter_dll_unlock()
+ */
+static inline u32 energy_meter_dll_lock(void)
+{
+    u32 primask = __get_PRIMASK();
 
-/** @brief Counter for transmission attempts (for debugging) */
-static volatile u32 gTxAttemptCount = 0;
+    __disable_irq();
+    return primask;
+}
 
-/** @brief Counter for successful transmissions (for debugging) */
-static volatile u32 gTxSuccessCount = 0;
+/**
+ * @brief Leave a section entered with energy_meter_dll_lock()
+ * @param[in] primask Value returned by energy_meter_dll_lock()
+ */
+static inline void energy_meter_dll_unlock(u32 primask)
+{
+    __set_PRIMASK(primask);
+}
+
+/**
+ * @brief Arm the continuous UART reception into gRxRing
+ *
+ * Receive events fire on the half and full ring and whenever the line goes
+ * idle, which is right after the last response of a transaction.
+ */
+static void energy_meter_dll_uart_rx_start(void)
+{
+    gRxHead = 0;
+    HAL_UARTEx_ReceiveToIdle_DMA(&ENERGY_METER_UART, gRxRing, ENERGY_METER_RX_RING_SIZE);
+}
+
+/**
+ * @brief Timeout of a transaction
+ *
+ * On the UART the STPM34 answers each frame while the next one is coming
+ * in, so the wire time is one frame more than the transaction.
+ *
+ * @param[in] size Bytes of the transaction
+ * @return Timeout in 1 ms ticks, including the tick already running
+ */
+static u16 energy_meter_dll_timeout(u16 size)
+{
+    u32 ms = ENERGY_METER_DLL_TIMEOUT_MARGIN + 1U;
+
+    if (gLink == ENU_EM_LINK_UART) {
+        u32 baud = ENERGY_METER_UART.Init.BaudRate;
+
+        ms += ((u32)(size + STPM34_FRAME_SIZE) * 10000UL + baud - 1U) / baud;
+    }
+    return (u16)ms;
+}
+
+/**
+ * @brief Transfer the frame at gSpiOffset on the SPI link
+ *
+ * In SPI mode every frame is framed by its own chip select pulse, and the
+ * response is clocked out while the frame is clocked in.
+ *
+ * @return HAL status of HAL_SPI_TransmitReceive_IT
+ */
+static HAL_StatusTypeDef energy_meter_dll_spi_frame(void)
+{
+    StuEnergyMeterXfer *xfer = &gXfer[gActive];
+
+    ENERGY_METER_CS_SELECT();
+
+    return HAL_SPI_TransmitReceive_IT(&ENERGY_METER_SPI, &xfer->tx[gSpiOffset],
+            &xfer->rx[gSpiOffset], STPM34_FRAME_SIZE);
+}
+
+/**
+ * @brief Finish the active transaction
+ *
+ * Releases chip select and books the result. Does not start the next
+ * transaction. Called locked.
+ *
+ * @param[in] state ENU_EM_XFER_DONE, ENU_EM_XFER_TIMEOUT or ENU_EM_XFER_ERROR
+ */
+static void energy_meter_dll_finish(EnuEnergyMeterXferState state)
+{
+    StuEnergyMeterXfer *xfer = &gXfer[gActive];
+    u32 latency;
+    u32 cycles;
+
+    ENERGY_METER_CS_DESELECT();
+
+    cycles = DWT->CYCCNT - xfer->startCycles;
+    xfer->doneTick = HAL_GetTick();
+
+    /* Longer than the ticks seen means the counter was reset meanwhile */
+    if (cycles > (xfer->doneTick - xfer->startTick + 1U) * (SystemCoreClock / 1000U)) {
+        cycles = 0;
+    }
+    xfer->wireCycles = cycles;
+
+    if (state == ENU_EM_XFER_DONE) {
+        latency = xfer->doneTick - xfer->submitTick;
+        if (latency > gStats.maxLatency) {
+            gStats.maxLatency = latency;
+        }
+        gStats.completed++;
+    } else if (state == ENU_EM_XFER_TIMEOUT) {
+        gStats.timeouts++;
+    } else {
+        gStats.errors++;
+    }
+
+    if (xfer->detached) {
+        xfer->detached = 0;
+        state = ENU_EM_XFER_FREE;
+    }
+    xfer->state = state;
+    gActive = ENERGY_METER_DLL_NO_XFER;
+    gMsLeft = 0;
+}
+
+/**
+ * @brief Start queued transactions while the link is idle
+ *
+ * A transaction failing to start is finished with ENU_EM_XFER_ERROR and
+ * the next one is tried. Called locked.
+ */
+static void energy_meter_dll_start_next(void)
+{
+    HAL_StatusTypeDef status;
+    StuEnergyMeterXfer *xfer;
+
+    while (gActive == ENERGY_METER_DLL_NO_XFER && gOrderCount > 0 && gGuardMs == 0) {
+        /* A frame still leaving from a failed transaction finishes first */
+        if (gLink == ENU_EM_LINK_UART && ENERGY_METER_UART.gState != HAL_UART_STATE_READY) {
+            return;
+        }
+
+        gActive = gOrder[gOrderHead];
+        gOrderHead = (gOrderHead + 1U) % ENERGY_METER_DLL_QUEUE_SIZE;
+        gOrderCount--;
+
+        xfer = &gXfer[gActive];
+        xfer->state = ENU_EM_XFER_ACTIVE;
+        xfer->rxCount = 0;
+        xfer->startTick = HAL_GetTick();
+        xfer->startCycles = DWT->CYCCNT;
+        gTxDone = 0;
+        gMsLeft = energy_meter_dll_timeout(xfer->size);
+
+        if (gLink == ENU_EM_LINK_SPI) {
+            gSpiOffset = 0;
+            status = energy_meter_dll_spi_frame();
+        } else {
+            /* The start bit follows the DMA setup, well after the CS setup time */
+            ENERGY_METER_CS_SELECT();
+            status = HAL_UART_Transmit_DMA(&ENERGY_METER_UART, xfer->tx, xfer->size);
+        }
+
+        if (status != HAL_OK) {
+            energy_meter_dll_finish(ENU_EM_XFER_ERROR);
+        }
+    }
+}
+
+/**
+ * @brief Complete the active UART transaction once sent and answered
+ *
+ * Called locked.
+ */
+static void energy_meter_dll_check_done(void)
+{
+    StuEnergyMeterXfer *xfer;
+
+    if (gActive == ENERGY_METER_DLL_NO_XFER || !gTxDone) {
+        return;
+    }
+
+    xfer = &gXfer[gActive];
+    if (xfer->rxCount >= xfer->size) {
+        energy_meter_dll_finish(ENU_EM_XFER_DONE);
+        energy_meter_dll_start_next();
+    }
+}
+
+/**
+ * @brief Queue one transaction
+ *
+ * @param[in] msg Frames to send
+ * @param[in] size Bytes, a multiple of STPM34_FRAME_SIZE
+ * @return Handle, ENERGY_METER_DLL_NO_XFER if refused
+ */
+static u8 energy_meter_dll_submit(const u8 *msg, u16 size)
+{
+    StuEnergyMeterXfer *xfer;
+    u32 primask;
+    u8 slot;
+
+    if (size == 0 || size > ENERGY_METER_BUFFER_SIZE || (size % STPM34_FRAME_SIZE) != 0) {
+        gStats.rejected++;
+        return ENERGY_METER_DLL_NO_XFER;
+    }
+
+    primask = energy_meter_dll_lock();
+
+    for (slot = 0; slot < ENERGY_METER_DLL_QUEUE_SIZE; slot++) {
+        if (gXfer[slot].state == ENU_EM_XFER_FREE) {
+            break;
+        }
+    }
+
+    if (slot == ENERGY_METER_DLL_QUEUE_SIZE) {
+        gStats.rejected++;
+        energy_meter_dll_unlock(primask);
+        return ENERGY_METER_DLL_NO_XFER;
+    }
+
+    xfer = &gXfer[slot];
+    memcpy(xfer->tx, msg, size);
+    xfer->size = size;
+    xfer->rxCount = 0;
+    xfer->detached = 0;
+    xfer->submitTick = HAL_GetTick();
+    xfer->state = ENU_EM_XFER_QUEUED;
+
+    gOrder[(gOrderHead + gOrderCount) % ENERGY_METER_DLL_QUEUE_SIZE] = slot;
+    gOrderCount++;
+    gStats.submitted++;
+
+    energy_meter_dll_start_next();
+
+    energy_meter_dll_unlock(primask);
+
+    return slot;
+}
 
 /* ========================================================================
  * Public Function Implementations
  * ======================================================================== */
 
 /**
- * @brief Start transaction and send data to energy meter
- *
- * Asserts chip select LOW (active), then transmits data to the STPM34
- * energy meter using DMA. Chip select remains LOW until transaction_end()
- * is called.
+ * @brief Queue a single-frame transaction
  *
  * @param[in] msg Pointer to message buffer
- * @param[in] size Size of message in bytes (max STPM34_FRAME_SIZE)
+ * @param[in] size Size of message in bytes (STPM34_FRAME_SIZE)
+ * @return Transaction handle, ENERGY_METER_DLL_NO_XFER if refused
  *
- * @note Chip select timing is handled by DLL layer for proper protocol
- * @note Data is copied to internal buffer to ensure it persists during DMA
- * @note DMA completion triggers HAL_UART_TxCpltCallback / HAL_UART_RxCpltCallback
  * @note For multiple meter support, add device instance parameter
  */
-void energy_meter_dll_transaction_send(u8 *msg, u16 size)
+u8 energy_meter_dll_transaction_send(const u8 *msg, u16 size)
 {
-    HAL_StatusTypeDef status;
-
-    /* Increment attempt counter for debugging */
-    gTxAttemptCount++;
-
     /* Validate size */
     if (size > STPM34_FRAME_SIZE) {
         size = STPM34_FRAME_SIZE;
     }
 
-    /* Copy data to internal TX buffer (DMA needs persistent buffer) */
-    memcpy(gEnergyTxData, msg, size);
-
-    /* Assert chip select LOW (select device) */
-    ENERGY_METER_CS_SELECT();
-
-    /* Small delay to ensure chip select is stable before transmission */
-    for (volatile int i = 0; i < 10; i++);
-
-    /* Clear completion flags */
-    gTxComplete = 0;
-    gRxComplete = 0;
+    return energy_meter_dll_submit(msg, size);
+}
 
-    /* Abort any ongoing DMA transfers to ensure clean state */
-    HAL_UART_AbortTransmit(&ENERGY_METER_UART);
-    HAL_UART_AbortReceive(&ENERGY_METER_UART);
+/**
+ * @brief Queue a transaction of several frames
+ *
+ * The frames are copied, so the caller's buffer is free on return. On the
+ * UART they go out in one DMA transfer with chip select LOW throughout and
+ * the chip's answer to every frame lands in the RX buffer of the
+ * transaction at the offset of the frame it answers. On the SPI link the
+ * frames are transferred one after the other from the completion
+ * interrupt, each with its own chip select pulse.
+ *
+ * @param[in] msg Pointer to consecutive STPM34_FRAME_SIZE byte frames
+ * @param[in] size Size of message in bytes (max ENERGY_METER_BUFFER_SIZE)
+ * @return Transaction handle, ENERGY_METER_DLL_NO_XFER if refused
+ */
+u8 energy_meter_dll_transaction_stream(const u8 *msg, u16 size)
+{
+    return energy_meter_dll_submit(msg, size);
+}
 
-    /* Wait a bit for abort to complete */
-    for (volatile int i = 0; i < 100; i++);
+/**
+ * @brief Get the state of a transaction
+ *
+ * @param[in] xfer Transaction handle
+ * @return Slot state, ENU_EM_XFER_ERROR for an invalid handle
+ */
+EnuEnergyMeterXferState energy_meter_dll_poll(u8 xfer)
+{
+    if (xfer >= ENERGY_METER_DLL_QUEUE_SIZE) {
+        return ENU_EM_XFER_ERROR;
+    }
+    return gXfer[xfer].state;
+}
 
-    /* Start DMA reception first (must be ready before TX) */
-    HAL_UART_Receive_DMA(&ENERGY_METER_UART, gEnergyRxData, STPM34_FRAME_SIZE);
+/**
+ * @brief Release a transaction
+ *
+ * A finished transaction is freed at once. A pending one is never
+ * aborted: it runs to its end and frees its slot then.
+ *
+ * @param[in] xfer Transaction handle, ENERGY_METER_DLL_NO_XFER is ignored
+ *
+ * @note For multiple meter support, add device instance parameter
+ */
+void energy_meter_dll_transaction_end(u8 xfer)
+{
+    u32 primask;
 
-    /* Then transmit data via DMA */
-    status = HAL_UART_Transmit_DMA(&ENERGY_METER_UART, gEnergyTxData, size);
+    if (xfer >= ENERGY_METER_DLL_QUEUE_SIZE) {
+        return;
+    }
 
-    /* Track status */
-    if (status == HAL_OK) {
-        gTxSuccessCount++;
-        gTxBusy = 1;
+    primask = energy_meter_dll_lock();
+    if (gXfer[xfer].state == ENU_EM_XFER_QUEUED || gXfer[xfer].state == ENU_EM_XFER_ACTIVE) {
+        gXfer[xfer].detached = 1;
     } else {
-        /* Transmission failed - still mark as busy but it will timeout */
-        gTxBusy = 1;
+        gXfer[xfer].state = ENU_EM_XFER_FREE;
     }
+    energy_meter_dll_unlock(primask);
 }
 
 /**
- * @brief End transaction and deselect energy meter
+ * @brief Select the link to the energy meter
  *
- * De-asserts chip select HIGH (inactive) to end the communication transaction.
- * Should be called after receiving response or on timeout.
+ * Stops both links, fails every pending transaction and forces
+ * energy_meter_dll_receive_init() to set up the new one.
  *
- * @note For multiple meter support, add device instance parameter
+ * @param[in] link ENU_EM_LINK_UART or ENU_EM_LINK_SPI
  */
-void energy_meter_dll_transaction_end(void)
+void energy_meter_dll_set_link(EnuEnergyMeterLink link)
 {
-    /* De-assert chip select HIGH (deselect device) */
+    u32 primask = energy_meter_dll_lock();
+
+    HAL_UART_Abort(&ENERGY_METER_UART);
+    HAL_SPI_Abort(&ENERGY_METER_SPI);
+
+    if (gActive != ENERGY_METER_DLL_NO_XFER) {
+        energy_meter_dll_finish(ENU_EM_XFER_ERROR);
+    }
+    while (gOrderCount > 0) {
+        gActive = gOrder[gOrderHead];
+        gOrderHead = (gOrderHead + 1U) % ENERGY_METER_DLL_QUEUE_SIZE;
+        gOrderCount--;
+        energy_meter_dll_finish(ENU_EM_XFER_ERROR);
+    }
     ENERGY_METER_CS_DESELECT();
 
-    /* Clear TX busy flag (transaction is complete) */
-    gTxBusy = 0;
+    gLink = link;
+    gGuardMs = 0;
+    gRxInitialized = 0;
+
+    energy_meter_dll_unlock(primask);
+}
+
+/**
+ * @brief Get the selected link
+ * @return ENU_EM_LINK_UART or ENU_EM_LINK_SPI
+ */
+EnuEnergyMeterLink energy_meter_dll_get_link(void)
+{
+    return gLink;
 }
 
 /**
- * @brief Initialize DMA reception for energy meter
+ * @brief Initialize reception for energy meter
  *
- * Starts continuous DMA reception on UART4 for energy meter communication.
+ * Starts continuous DMA reception on UART4 for energy meter communication,
+ * or configures SPI2 when the SPI link is selected.
  * Should be called once during initialization.
  */
 void energy_meter_dll_receive_init(void)
 {
     if (!gRxInitialized) {
-        /* Clear RX buffer */
-        memset(gEnergyRxData, 0, ENERGY_METER_BUFFER_SIZE);
-
-        /* Start DMA reception in circular mode */
-        HAL_UART_Receive_DMA(&ENERGY_METER_UART, gEnergyRxData, ENERGY_METER_BUFFER_SIZE);
+        if (gLink == ENU_EM_LINK_SPI) {
+            energy_meters_hal_spi_init();
+        } else {
+            /* Start DMA reception in circular mode, it is never re-armed per transaction */
+            memset(gRxRing, 0, sizeof(gRxRing));
+            energy_meter_dll_uart_rx_start();
+        }
 
         gRxInitialized = 1;
     }
 }
 
 /**
- * @brief Check and process received energy meter data
+ * @brief Get pointer to the received data of a transaction
+ *
+ * @param[in] xfer Transaction handle
+ * @return Pointer to the RX buffer of the transaction
+ *
+ * @note Data in buffer is valid once energy_meter_dll_poll() returns
+ *       ENU_EM_XFER_DONE, until the transaction is ended
+ */
+u8* energy_meter_dll_get_rx_buffer(u8 xfer)
+{
+    return gXfer[xfer % ENERGY_METER_DLL_QUEUE_SIZE].rx;
+}
+
+/**
+ * @brief Get number of bytes received by a transaction
+ *
+ * @param[in] xfer Transaction handle
+ * @return Number of bytes received
+ */
+u16 energy_meter_dll_get_rx_count(u8 xfer)
+{
+    return gXfer[xfer % ENERGY_METER_DLL_QUEUE_SIZE].rxCount;
+}
+
+/**
+ * @brief Get the completion time of a transaction
+ *
+ * @param[in] xfer Transaction handle
+ * @return HAL tick at which the last response arrived
+ */
+u32 energy_meter_dll_get_done_tick(u8 xfer)
+{
+    return gXfer[xfer % ENERGY_METER_DLL_QUEUE_SIZE].doneTick;
+}
+
+/**
+ * @brief Get the time a transaction spent on the link
  *
- * Checks if data has been received via interrupt mode (IT).
- * Uses gRxComplete flag set by HAL_UART_RxCpltCallback.
+ * @param[in] xfer Transaction handle
+ * @return CPU cycles from start to completion, 0 if not measured
+ */
+u32 energy_meter_dll_get_wire_cycles(u8 xfer)
+{
+    return gXfer[xfer % ENERGY_METER_DLL_QUEUE_SIZE].wireCycles;
+}
+
+/**
+ * @brief Change the UART baud rate towards the energy meter
  *
- * @return Number of bytes received, 0 if no data available
+ * Reprograms the UART and restarts the continuous reception. Used after
+ * the STPM34 was told to switch its own rate in US_REG2; call it with no
+ * transaction pending.
  *
- * @note This function should be called periodically to poll for received data
- * @note After application reads data via get_rx_buffer(), reception is complete
+ * @param[in] baud New baud rate
  */
-u16 energy_meter_dll_receive(void)
+void energy_meter_dll_set_baud(u32 baud)
 {
-    u16 returnValue = 0;
+    u32 primask;
+
+    if (gLink != ENU_EM_LINK_UART) {
+        return;
+    }
+
+    primask = energy_meter_dll_lock();
+
+    HAL_UART_Abort(&ENERGY_METER_UART);
+
+    ENERGY_METER_UART.Init.BaudRate = baud;
+    HAL_UART_Init(&ENERGY_METER_UART);
 
-    /* Check if RX complete flag is set by interrupt callback */
-    if (gRxComplete)
-    {
-        /* Data received successfully */
-        gRxByteCount = STPM34_FRAME_SIZE;
-        returnValue = gRxByteCount;
+    if (gRxInitialized) {
+        energy_meter_dll_uart_rx_start();
+    }
+
+    energy_meter_dll_unlock(primask);
+}
+
+/**
+ * @brief UART TX complete, called from HAL_UART_TxCpltCallback
+ */
+void energy_meter_dll_tx_complete(void)
+{
+    u32 primask = energy_meter_dll_lock();
 
-        /* Clear the flag (one-time read) */
-        gRxComplete = 0;
+    if (gActive != ENERGY_METER_DLL_NO_XFER) {
+        gStats.txBytes += gXfer[gActive].size;
+        gTxDone = 1;
+        energy_meter_dll_check_done();
+    } else {
+        /* Last frame of a failed transaction left, the link is free again */
+        energy_meter_dll_start_next();
     }
 
-    return returnValue;
+    energy_meter_dll_unlock(primask);
 }
 
 /**
- * @brief Get pointer to received data buffer
+ * @brief UART receive event, called from HAL_UARTEx_RxEventCallback
+ *
+ * Moves the bytes the DMA wrote since the last event into the active
+ * transaction. Bytes arriving while no transaction is active, e.g. late
+ * answers of a timed out one, are dropped.
  *
- * Provides access to the internal RX buffer containing received data.
+ * @param[in] pos Ring position the DMA has written up to
+ */
+void energy_meter_dll_rx_event(u16 pos)
+{
+    StuEnergyMeterXfer *xfer;
+    u32 primask;
+
+    if (gLink != ENU_EM_LINK_UART) {
+        return;
+    }
+
+    primask = energy_meter_dll_lock();
+
+    pos %= ENERGY_METER_RX_RING_SIZE;
+    while (gRxHead != pos) {
+        xfer = (gActive != ENERGY_METER_DLL_NO_XFER) ? &gXfer[gActive] : NULL;
+
+        if (xfer != NULL && xfer->rxCount < xfer->size) {
+            xfer->rx[xfer->rxCount++] = gRxRing[gRxHead];
+            gStats.rxBytes++;
+        } else {
+            gStats.strayBytes++;
+        }
+        gRxHead = (gRxHead + 1U) % ENERGY_METER_RX_RING_SIZE;
+    }
+
+    energy_meter_dll_check_done();
+
+    energy_meter_dll_unlock(primask);
+}
+
+/**
+ * @brief UART error, called from HAL_UART_ErrorCallback
  *
- * @return Pointer to internal RX buffer
+ * Noise and framing errors leave the reception running and are caught by
+ * the frame CRC. An overrun stops it: the active transaction has lost
+ * bytes and fails, and the reception is started again.
+ */
+void energy_meter_dll_link_error(void)
+{
+    u32 primask = energy_meter_dll_lock();
+
+    gStats.linkErrors++;
+
+    if (gLink == ENU_EM_LINK_UART && gRxInitialized &&
+            ENERGY_METER_UART.RxState == HAL_UART_STATE_READY) {
+        if (gActive != ENERGY_METER_DLL_NO_XFER) {
+            energy_meter_dll_finish(ENU_EM_XFER_ERROR);
+            gGuardMs = ENERGY_METER_DLL_GUARD_MS;
+        }
+        energy_meter_dll_uart_rx_start();
+    }
+
+    energy_meter_dll_unlock(primask);
+}
+
+/**
+ * @brief SPI frame complete, called from HAL_SPI_TxRxCpltCallback
  *
- * @note Data in buffer is valid only after energy_meter_dll_receive()
- *       returns non-zero value
+ * Runs in interrupt context. Releases chip select so the STPM34 takes the
+ * frame, then starts the next frame of the transaction or completes it.
+ * The bookkeeping and the HAL call between release and the next select
+ * take longer than the minimum chip select high time.
  */
-u8* energy_meter_dll_get_rx_buffer(void)
+void energy_meter_dll_spi_complete(void)
 {
-    return gEnergyRxData;
+    StuEnergyMeterXfer *xfer;
+    u32 primask = energy_meter_dll_lock();
+
+    ENERGY_METER_CS_DESELECT();
+
+    if (gActive == ENERGY_METER_DLL_NO_XFER) {
+        energy_meter_dll_unlock(primask);
+        return;
+    }
+
+    xfer = &gXfer[gActive];
+    gSpiOffset += STPM34_FRAME_SIZE;
+    xfer->rxCount = gSpiOffset;
+    gStats.txBytes += STPM34_FRAME_SIZE;
+    gStats.rxBytes += STPM34_FRAME_SIZE;
+
+    if (gSpiOffset >= xfer->size) {
+        energy_meter_dll_finish(ENU_EM_XFER_DONE);
+        energy_meter_dll_start_next();
+    } else if (energy_meter_dll_spi_frame() != HAL_OK) {
+        energy_meter_dll_finish(ENU_EM_XFER_ERROR);
+        energy_meter_dll_start_next();
+    }
+
+    energy_meter_dll_unlock(primask);
 }
 
 /**
- * @brief Get number of bytes received in last transaction
+ * @brief 1 ms tick, called from the TIM4 interrupt
  *
- * Returns the count of bytes received in the most recent reception event.
+ * Times out the active transaction. Only a timed out transaction is ever
+ * stopped: a UART frame still sending is aborted, the reception keeps
+ * running, and the next transaction starts after ENERGY_METER_DLL_GUARD_MS
+ * so late answers are not taken for its own.
+ */
+void energy_meter_dll_timer_tick(void)
+{
+    u32 primask = energy_meter_dll_lock();
+
+    if (gGuardMs > 0) {
+        if (--gGuardMs == 0) {
+            energy_meter_dll_start_next();
+        }
+    } else if (gActive != ENERGY_METER_DLL_NO_XFER && gMsLeft > 0 && --gMsLeft == 0) {
+        if (gLink == ENU_EM_LINK_SPI) {
+            HAL_SPI_Abort(&ENERGY_METER_SPI);
+        } else if (ENERGY_METER_UART.gState != HAL_UART_STATE_READY) {
+            HAL_UART_AbortTransmit(&ENERGY_METER_UART);
+        }
+        energy_meter_dll_finish(ENU_EM_XFER_TIMEOUT);
+        gGuardMs = ENERGY_METER_DLL_GUARD_MS;
+    }
+
+    energy_meter_dll_unlock(primask);
+}
+
+/**
+ * @brief Get the link counters
  *
- * @return Number of bytes received
+ * @param[out] stats Copy of the counters
  */
-u16 energy_meter_dll_get_rx_count(void)
+void energy_meter_dll_get_stats(StuEnergyMeterDllStats *stats)
 {
-    return gRxByteCount;
+    u32 primask;
+
+    if (stats == NULL) {
+        return;
+    }
+
+    primask = energy_meter_dll_lock();
+    *stats = gStats;
+    energy_meter_dll_unlock(primask);
 }
 
 /**
- * @brief Get DMA transmission statistics (for debugging)
+ * @brief Get transaction statistics (for debugging)
  *
- * Returns counters that help debug DMA transmission issues.
- * Useful to check if HAL_UART_Transmit_DMA is being called and succeeding.
+ * Short form of energy_meter_dll_get_stats().
  *
- * @param[out] tx_attempts Total number of transmission attempts (can be NULL)
- * @param[out] tx_success Number of successful HAL_UART_Transmit_DMA calls (can be NULL)
+ * @param[out] tx_attempts Transactions submitted (can be NULL)
+ * @param[out] tx_success Transactions completed with a full answer (can be NULL)
  */
 void energy_meter_dll_get_tx_stats(u32 *tx_attempts, u32 *tx_success)
 {
     if (tx_attempts != NULL) {
-        *tx_attempts = gTxAttemptCount;
+        *tx_attempts = gStats.submitted;
     }
 
     if (tx_success != NULL) {
-        *tx_success = gTxSuccessCount;
+        *tx_success = gStats.completed;
     }
 }
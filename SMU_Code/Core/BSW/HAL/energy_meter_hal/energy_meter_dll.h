@@ -4,7 +4,14 @@
  *
  * Provides data link layer functions for STPM34 communication including
  * frame transmission, reception with DMA, CRC verification, and chip select
- * control.
+ * control. Frames go over UART4 or SPI2, selected at runtime; both links
+ * return the data requested by the previous frame, so the layers above do
+ * not see which one is used.
+ *
+ * Transactions are queued and run asynchronously: a submit returns a
+ * handle at once, the link interrupts move the transaction along, and the
+ * caller polls the handle for the result and releases it. Each transaction
+ * has a timeout derived from its length and counted by the TIM4 1 ms tick.
  *
  * ARCHITECTURE DECISION: Chip Select Handling
  * ------------------------------------------
@@ -30,80 +37,212 @@
  * Constants
  * ======================================================================== */
 
-#define ENERGY_METER_BUFFER_SIZE    100     /**< Size of energy meter RX buffer */
+#define ENERGY_METER_BUFFER_SIZE    100     /**< Largest transaction in bytes */
 #define STPM34_FRAME_SIZE           5       /**< Size of STPM34 communication frame */
 
+#define ENERGY_METER_DLL_QUEUE_SIZE     4U      /**< Transactions pending or held at once */
+#define ENERGY_METER_DLL_NO_XFER        0xFFU   /**< Invalid transaction handle */
+#define ENERGY_METER_DLL_TIMEOUT_MARGIN 3U      /**< ms allowed on top of the wire time */
+#define ENERGY_METER_DLL_GUARD_MS       2U      /**< ms without a start after a failed transaction */
+#define ENERGY_METER_RX_RING_SIZE       128U    /**< UART continuous reception ring */
+
 /* ========================================================================
- * External Variables (for UART interrupt callbacks)
+ * Type Definitions
  * ======================================================================== */
 
-/** @brief TX complete flag (set by HAL_UART_TxCpltCallback) */
-extern volatile u8 gTxComplete;
+/**
+ * @enum EnuEnergyMeterLink
+ * @brief Physical link to the energy meter
+ */
+typedef enum {
+    ENU_EM_LINK_UART = 0,       /**< UART4 with DMA, about 0.5 ms per frame at 115200 baud */
+    ENU_EM_LINK_SPI             /**< SPI2, a few us per frame */
+} EnuEnergyMeterLink;
+
+/** @brief Link used after reset */
+#define ENERGY_METER_LINK_DEFAULT   ENU_EM_LINK_UART
+
+/**
+ * @enum EnuEnergyMeterXferState
+ * @brief State of a queued transaction
+ */
+typedef enum {
+    ENU_EM_XFER_FREE = 0,       /**< Slot unused */
+    ENU_EM_XFER_QUEUED,         /**< Waiting for the link */
+    ENU_EM_XFER_ACTIVE,         /**< On the link */
+    ENU_EM_XFER_DONE,           /**< Sent and fully answered */
+    ENU_EM_XFER_TIMEOUT,        /**< Not answered in time */
+    ENU_EM_XFER_ERROR           /**< Failed to start, link error or link change */
+} EnuEnergyMeterXferState;
 
-/** @brief RX complete flag (set by HAL_UART_RxCpltCallback) */
-extern volatile u8 gRxComplete;
+/**
+ * @struct StuEnergyMeterDllStats
+ * @brief Link counters since start-up
+ */
+typedef struct {
+    u32 submitted;              /**< Transactions accepted */
+    u32 rejected;               /**< Transactions refused, queue full or bad size */
+    u32 completed;              /**< Transactions sent and fully answered */
+    u32 timeouts;               /**< Transactions timed out */
+    u32 errors;                 /**< Transactions failed otherwise */
+    u32 linkErrors;             /**< UART noise, framing and overrun errors */
+    u32 txBytes;                /**< Bytes sent */
+    u32 rxBytes;                /**< Bytes received into transactions */
+    u32 strayBytes;             /**< Bytes received outside any transaction */
+    u32 maxLatency;             /**< Longest submit to completion time in ms */
+} StuEnergyMeterDllStats;
 
 /* ========================================================================
  * Function Prototypes
  * ======================================================================== */
 
 /**
- * @brief Initialize DMA reception for energy meter
+ * @brief Select the link to the energy meter
+ *
+ * Fails every pending transaction. The new link is set up by the next
+ * energy_meter_dll_receive_init().
+ *
+ * @param[in] link ENU_EM_LINK_UART or ENU_EM_LINK_SPI
  */
-void energy_meter_dll_receive_init(void);
+void energy_meter_dll_set_link(EnuEnergyMeterLink link);
+
+/**
+ * @brief Get the selected link
+ * @return ENU_EM_LINK_UART or ENU_EM_LINK_SPI
+ */
+EnuEnergyMeterLink energy_meter_dll_get_link(void);
 
 /**
- * @brief Start transaction and send data to energy meter
+ * @brief Initialize reception for energy meter
  *
- * Asserts chip select LOW, then transmits data via UART with DMA.
- * This function combines chip select control with data transmission.
+ * Starts the continuous DMA reception on UART4, or configures SPI2 when
+ * the SPI link is selected.
+ */
+void energy_meter_dll_receive_init(void);
+
+/**
+ * @brief Queue a single-frame transaction
  *
  * @param[in] msg Pointer to message buffer
  * @param[in] size Size of message in bytes
+ * @return Transaction handle, ENERGY_METER_DLL_NO_XFER if refused
  *
- * @note Chip select remains LOW until energy_meter_dll_transaction_end() is called
  * @note For multiple meter support, this would take a device instance parameter
  */
-void energy_meter_dll_transaction_send(u8 *msg, u16 size);
+u8 energy_meter_dll_transaction_send(const u8 *msg, u16 size);
 
 /**
- * @brief Check and process received energy meter data
+ * @brief Queue a transaction of several frames
+ *
+ * Like energy_meter_dll_transaction_send(), but sends all frames back to
+ * back and completes once as many bytes came back. The frames are copied.
  *
- * Checks if data has been received via DMA using UART IDLE detection.
+ * @param[in] msg Pointer to consecutive STPM34_FRAME_SIZE byte frames
+ * @param[in] size Size of message in bytes (max ENERGY_METER_BUFFER_SIZE)
+ * @return Transaction handle, ENERGY_METER_DLL_NO_XFER if refused
+ */
+u8 energy_meter_dll_transaction_stream(const u8 *msg, u16 size);
+
+/**
+ * @brief Get the state of a transaction
  *
- * @return Number of bytes received, 0 if no data available
+ * @param[in] xfer Transaction handle
+ * @return Slot state, ENU_EM_XFER_ERROR for an invalid handle
  */
-u16 energy_meter_dll_receive(void);
+EnuEnergyMeterXferState energy_meter_dll_poll(u8 xfer);
 
 /**
- * @brief End transaction and deselect energy meter
+ * @brief Release a transaction
+ *
+ * Frees a finished transaction. A pending one is not aborted; it runs to
+ * its end and is freed then.
  *
- * De-asserts chip select HIGH to end the transaction.
- * Call this after receiving response or on timeout.
+ * @param[in] xfer Transaction handle, ENERGY_METER_DLL_NO_XFER is ignored
  *
  * @note For multiple meter support, this would take a device instance parameter
  */
-void energy_meter_dll_transaction_end(void);
+void energy_meter_dll_transaction_end(u8 xfer);
 
 /**
- * @brief Get pointer to received data buffer
- * @return Pointer to internal RX buffer
+ * @brief Get pointer to the received data of a transaction
+ * @param[in] xfer Transaction handle
+ * @return Pointer to the RX buffer of the transaction
  */
-u8* energy_meter_dll_get_rx_buffer(void);
+u8* energy_meter_dll_get_rx_buffer(u8 xfer);
 
 /**
- * @brief Get number of bytes received in last transaction
+ * @brief Get number of bytes received by a transaction
+ * @param[in] xfer Transaction handle
  * @return Number of bytes received
  */
-u16 energy_meter_dll_get_rx_count(void);
+u16 energy_meter_dll_get_rx_count(u8 xfer);
+
+/**
+ * @brief Get the completion time of a transaction
+ * @param[in] xfer Transaction handle
+ * @return HAL tick at which the last response arrived
+ */
+u32 energy_meter_dll_get_done_tick(u8 xfer);
+
+/**
+ * @brief Get the time a transaction spent on the link
+ * @param[in] xfer Transaction handle
+ * @return CPU cycles from start to completion, 0 if not measured
+ */
+u32 energy_meter_dll_get_wire_cycles(u8 xfer);
+
+/**
+ * @brief Change the UART baud rate towards the energy meter
+ *
+ * Does nothing on the SPI link. Call it with no transaction pending.
+ *
+ * @param[in] baud New baud rate
+ */
+void energy_meter_dll_set_baud(u32 baud);
+
+/**
+ * @brief UART TX complete, called from HAL_UART_TxCpltCallback
+ */
+void energy_meter_dll_tx_complete(void);
+
+/**
+ * @brief UART receive event, called from HAL_UARTEx_RxEventCallback
+ * @param[in] pos Ring position the DMA has written up to
+ */
+void energy_meter_dll_rx_event(u16 pos);
+
+/**
+ * @brief UART error, called from HAL_UART_ErrorCallback
+ */
+void energy_meter_dll_link_error(void);
+
+/**
+ * @brief SPI frame complete, called from HAL_SPI_TxRxCpltCallback
+ *
+ * Starts the next frame of the transaction or completes it.
+ */
+void energy_meter_dll_spi_complete(void);
+
+/**
+ * @brief 1 ms tick, called from the TIM4 interrupt
+ *
+ * Times out the active transaction.
+ */
+void energy_meter_dll_timer_tick(void);
+
+/**
+ * @brief Get the link counters
+ * @param[out] stats Copy of the counters
+ */
+void energy_meter_dll_get_stats(StuEnergyMeterDllStats *stats);
 
 /**
- * @brief Get DMA transmission statistics (for debugging)
+ * @brief Get transaction statistics (for debugging)
  *
- * Returns counters that help debug DMA transmission issues.
+ * Short form of energy_meter_dll_get_stats().
  *
- * @param[out] tx_attempts Total number of transmission attempts (can be NULL)
- * @param[out] tx_success Number of successful HAL_UART_Transmit_DMA calls (can be NULL)
+ * @param[out] tx_attempts Transactions submitted (can be NULL)
+ * @param[out] tx_success Transactions completed with a full answer (can be NULL)
  */
 void energy_meter_dll_get_tx_stats(u32 *tx_attempts, u32 *tx_success);
 
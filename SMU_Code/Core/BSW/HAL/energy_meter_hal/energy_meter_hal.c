@@ -3,8 +3,8 @@
  * @brief STPM34 Energy Meter HAL layer implementation
  *
  * This module provides hardware abstraction for the STPM34 energy metering IC.
- * It serves as a convenience wrapper around the GPIO and UART initialization
- * functions provided by gpio.c and usart.c.
+ * It serves as a convenience wrapper around the GPIO, UART and SPI
+ * initialization functions provided by gpio.c, usart.c and spi.c.
  *
  * @date Created on: Oct 16, 2025
  * @author A. Moazami
@@ -13,6 +13,7 @@
 #include "energy_meter_hal.h"
 #include "gpio.h"
 #include "usart.h"
+#include "spi.h"
 
 /* ========================================================================
  * Public Function Implementations
@@ -35,3 +36,25 @@ void energy_meters_hal_init(void)
     /* Initialize UART4 for STPM34 communication (9600 baud, 8N1) */
     MX_UART4_UART_Init();
 }
+
+/**
+ * @brief Configure SPI2 for the STPM34
+ *
+ * SPI2 is initialized by MX_SPI2_Init() in mode 0 at full speed. The STPM34
+ * samples on the rising edge with the clock idling high (mode 3) and
+ * accepts at most a few MHz, so the peripheral is set up again here.
+ *
+ * @note Full-duplex DMA is not available: the SPI2 RX stream (DMA1 stream 3)
+ *       serves USART3 TX, so frames are transferred by interrupt.
+ */
+void energy_meters_hal_spi_init(void)
+{
+    ENERGY_METER_SPI.Init.CLKPolarity = SPI_POLARITY_HIGH;
+    ENERGY_METER_SPI.Init.CLKPhase = SPI_PHASE_2EDGE;
+    ENERGY_METER_SPI.Init.BaudRatePrescaler = ENERGY_METER_SPI_PRESCALER;
+    ENERGY_METER_SPI.Init.FirstBit = SPI_FIRSTBIT_MSB;
+    HAL_SPI_Init(&ENERGY_METER_SPI);
+
+    HAL_NVIC_SetPriority(SPI2_IRQn, 2, 0);
+    HAL_NVIC_EnableIRQ(SPI2_IRQn);
+}
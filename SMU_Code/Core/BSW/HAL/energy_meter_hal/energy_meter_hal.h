@@ -3,7 +3,9 @@
  * @brief STPM34 Energy Meter HAL layer interface
  *
  * This module provides hardware abstraction for the STPM34 energy metering IC.
- * Communication is via UART4 with DMA support.
+ * Communication is via UART4 with DMA support or via SPI2. The STPM34 picks
+ * its interface from the SCS level at power-up, so the link used must match
+ * the board strapping.
  *
  * CURRENT DESIGN: Single energy meter instance
  * FUTURE EXTENSION: For multiple energy meters, use the following pattern:
@@ -36,6 +38,7 @@
 #include "stm32f4xx_hal.h"
 #include "platform.h"
 #include "usart.h"
+#include "spi.h"
 
 /* ========================================================================
  * GPIO Definitions - Energy Meter Chip Select
@@ -70,6 +73,16 @@
 /** @brief Energy meter UART interface (maps to huart4 from usart.h) */
 #define ENERGY_METER_UART huart4
 
+/* ========================================================================
+ * SPI Definitions - Energy Meter Communication
+ * ======================================================================== */
+
+/** @brief Energy meter SPI interface (maps to hspi2 from spi.h) */
+#define ENERGY_METER_SPI hspi2
+
+/** @brief SPI clock prescaler, APB1 42 MHz / 8 = 5.25 MHz */
+#define ENERGY_METER_SPI_PRESCALER SPI_BAUDRATEPRESCALER_8
+
 /* ========================================================================
  * STPM34 Register Addresses
  * ======================================================================== */
@@ -143,6 +156,9 @@
 #define STPM34_REG_CH2_VOLTAGE_RMS      0x31    /**< Channel 2 RMS Voltage (DSP_REG14) */
 #define STPM34_REG_CH2_CURRENT_RMS      0x30    /**< Channel 2 RMS Current (DSP_REG13) */
 
+/* Line Period Register */
+#define STPM34_REG_LINE_PERIOD          STPM34_REG_DSP_REG9  /**< Line period of both channels */
+
 /** @} */
 
 /* ========================================================================
@@ -165,6 +181,18 @@
 /** @brief Power LSB value in mW */
 #define STPM34_POWER_LSB_MW             1.0f
 
+/** @brief Energy register LSB value in uWs, whole so the counters stay exact */
+#define STPM34_ENERGY_LSB_UWS           1000LL
+
+/** @brief Line period LSB value in us */
+#define STPM34_PERIOD_LSB_US            8.0f
+
+/** @brief Line period field of one channel in the period register */
+#define STPM34_PERIOD_MASK              0x0FFFUL
+
+/** @brief Position of the channel 2 line period in the period register */
+#define STPM34_PERIOD_CH2_SHIFT         16U
+
 /** @brief Maximum raw value from 24-bit signed register */
 #define STPM34_RAW_MAX_VALUE            8388607L  /* 2^23 - 1 */
 
@@ -201,6 +229,18 @@
 #define STPM34_US_REG1_DEFAULT      0x00000700  /**< CRC enabled, polynomial 0x07 */
 #define STPM34_US_REG2_DEFAULT      0x00000683  /**< Baud rate for 9600 */
 
+/** @brief Clock the US_REG2 baud divider runs from */
+#define STPM34_UART_CLOCK           16000000UL
+
+/** @brief Baud rate of the chip after a reset */
+#define ENERGY_METER_BAUD_DEFAULT   9600UL
+
+/** @brief Baud rate used once the chip is configured */
+#define ENERGY_METER_BAUD_FAST      115200UL
+
+/** @brief US_REG2 value selecting ENERGY_METER_BAUD_FAST */
+#define STPM34_US_REG2_FAST         (STPM34_UART_CLOCK / ENERGY_METER_BAUD_FAST)
+
 /* ========================================================================
  * Data Structures
  * ======================================================================== */
@@ -254,4 +294,12 @@ typedef struct {
  */
 void energy_meters_hal_init(void);
 
+/**
+ * @brief Configure SPI2 for the STPM34
+ *
+ * Switches the SPI2 set up by MX_SPI2_Init() to the STPM34 frame format
+ * (mode 3, MSB first) and enables its interrupt.
+ */
+void energy_meters_hal_spi_init(void);
+
 #endif /* BSW_HAL_ENERGY_METER_HAL_ENERGY_METER_HAL_H_ */
@@ -31,12 +31,6 @@ typedef void (*PVoidCallBackFuncType) (void);
 #define NAME_SIZE 20
 #define UNIT_SIZE 5
 
-typedef struct {
-	char name[NAME_SIZE];
-	char unit[UNIT_SIZE];
-	float value;
-
-}MntDataType;
 
 
 
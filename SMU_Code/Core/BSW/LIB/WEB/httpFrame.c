@@ -23,90 +23,90 @@ void startJsonFrame( char *str, DateTime tm)
           "\"date\":\"%04d-%02d-%02d\",\r"
             "\"time\":\"%02d:%02d:%02d\",\r\"data\":{\r",_serialN,tm.year,tm.month,tm.day,tm.hour,tm.minute,tm.second);
 }
-/**********************************_addData2Frame*************************************/
-int   addDataToJsonFrame(char *str){
-  // static variables to keep our place
-  static size_t tableIndex   = 0;
-  static size_t itemIndex    = 0;
-  static size_t itemsRead    = 0;
-  static size_t totalItems   = 0;
-  static int    initialized  = 0;
-  static int live=0;
-  
-  const Database_Type *mDb = getMntDatabase();
-  size_t numTables = getSizeOfRgsModule();
+/**********************************_formatEntry*************************************/
+/* "Vn": "Name*value*Unit" */
+int formatJsonEntry(char *entry, size_t size, int n, EnuSignalId id, float value)
+{
+  const StuSignalMeta *meta = signal_db_meta(id);
   
-  // If not initialized, calculate total number of items
-  if (!initialized)
+  if (NULL == meta)
   {
-    for (size_t t = 0; t < numTables; t++)
-    {
-      totalItems += mDb[t].mDataSize;
-    }
-    initialized = 1;
+    entry[0] = 0;
+    return 0;
   }
+  return snprintf(entry, size, "    \"V%d\": \"%s*%.1f*%s\"",
+                  n, meta->name, value * meta->scale, meta->unit);
+}
+/**********************************_formatStats*************************************/
+/* "Vn": "Name_agg*min*max*avg*Unit", the whole window aggregate in one entry.
+ * A value entry is about 30 bytes and an aggregate about 40; with every device
+ * present a spooled record is about 60 values and 12 aggregates, 2.2 KB or six
+ * frames of BUFFER_SIZE, so a record uploads within its LOG_TICK. Four
+ * entries per aggregate took 14-16 frames and the spool never drained. */
+int formatJsonStats(char *entry, size_t size, int n, EnuSignalId id, const StuSignalStats *stats)
+{
+  const StuSignalMeta *meta = signal_db_meta(id);
   
-  // If we've already read all items, return empty JSON
-  if (itemsRead >= totalItems || totalItems == 0)
-  {   itemsRead=0;
-  itemIndex=0;
-  tableIndex=0;
-  return 2;
+  if (NULL == meta)
+  {
+    entry[0] = 0;
+    return 0;
   }
+  return snprintf(entry, size, "    \"V%d\": \"%s_agg*%.1f*%.1f*%.1f*%s\"",
+                  n, meta->name, stats->min * meta->scale, stats->max * meta->scale,
+                  stats->mean * meta->scale, meta->unit);
+}
+/**********************************_addData2Frame*************************************/
+int   addDataToJsonFrame(char *str){
+  // static cursor (signal ID) and snapshot to keep our place across frames.
+  // Live frames only go out while the SD spool is unusable, they carry the
+  // values alone; window aggregates are uploaded from spooled records.
+  static uint16_t entryIndex = 0;
+  static f32 snapshot[SIG_COUNT];
+  size_t itemsRead = 0;
   
+  // All frames of one upload report the same coherent snapshot
+  if (0 == entryIndex)
+  {
+    signal_db_set(SIG_SMU_LIVE, signal_db_get(SIG_SMU_LIVE) + 1);
+    signal_db_snapshot(snapshot);
+  }
   
-  // Decide how many items to fetch: up to 6, or the remainder
-  size_t itemsRemaining = totalItems - itemsRead;
-  size_t itemsToFetch   = (itemsRemaining < 6) ? itemsRemaining : 6;
-  
-  for (size_t i = 0; i < itemsToFetch; i++)
+  // Fetch up to 6 entries per frame
+  while (entryIndex < SIG_COUNT && itemsRead < 6)
   {
-    // If we are at the end of current table, move to next
-    while (tableIndex < numTables &&
-           itemIndex >= mDb[tableIndex].mDataSize)
-    {
-      tableIndex++;
-      itemIndex = 0;
-    }
+    EnuSignalId id = (EnuSignalId)entryIndex;
     
-    // If we are past the last table, it means no more items
-    if (tableIndex >= numTables)
+    entryIndex++;
+    // Skip signals the report policy leaves out
+    if (!signal_db_reported(id))
     {
-      // Shouldn't happen unless totalItems changed on the fly,
-      // but let's handle it safely:
-      break;
+      continue;
     }
     
-    MntDataType *item = &mDb[tableIndex].mData[itemIndex];
-    
     // Format the JSON field
     // "V1": "Name*value*Unit",
-    char entry[500];
-    if(0==strcmp(item->name,"Live"))
-       item->value=live++;
-    snprintf(entry, sizeof(entry),
-             "    \"V%d\": \"%s*%.1f*%s\"",
-             i + 1,
-             item->name,
-             item->value,
-             item->unit);
+    char entry[80];
+    formatJsonEntry(entry, sizeof(entry), (int)itemsRead + 1, id, snapshot[id]);
     
-    // Comma except for the last item
-    if (i < itemsToFetch - 1)
-      strncat(entry, ",\r", sizeof(entry) - strlen(entry) - 1);
-    else
-      strncat(entry, "\r", sizeof(entry) - strlen(entry) - 1);
+    // Comma in front of all but the first item
+    if (itemsRead > 0)
+      strncat(str, ",\r", BUFFER_SIZE - strlen(str) - 1);
     
     // Append to main buffer
     strncat(str, entry, BUFFER_SIZE - strlen(str) - 1);
-    
-    // Move on
-    itemIndex++;
     itemsRead++;
   }
   
+  // If we've already read all entries, return empty JSON
+  if (0 == itemsRead)
+  {
+    entryIndex = 0;
+    return 2;
+  }
+  
   // Close JSON
-  strncat(str, "}\r}", BUFFER_SIZE - strlen(str) - 1);
+  strncat(str, "\r}\r}", BUFFER_SIZE - strlen(str) - 1);
   //TransmitDebug(str);
   return 1;
   
@@ -13,11 +13,14 @@
 #include <stdint.h>     // For uint8_t, etc.
 #include "myrtc.h"
 #include "../../SVC/COM/MDM/MdmSrv.h"
+#include "signal_db.h"
 
 extern DateTime urtc,mdt,dt,urtcd;
 
 
 void startJsonFrame( char *str, DateTime tm);
 int addDataToJsonFrame( char *str);
+int formatJsonEntry(char *entry, size_t size, int n, EnuSignalId id, float value);
+int formatJsonStats(char *entry, size_t size, int n, EnuSignalId id, const StuSignalStats *stats);
 
 #endif /* SRC_HTTPFRAME_H_ */
@@ -0,0 +1,370 @@
+/**
+ * @file payload_codec.c
+ * @brief HTTP payload compression implementation
+ *
+ * Greedy LZ77 matching over the whole payload (the payload never exceeds the
+ * 500-byte modem buffer, so the "window" is the input itself) followed by
+ * fixed-Huffman deflate coding. Fixed codes need no code tables in RAM and
+ * compress short, repetitive JSON nearly as well as dynamic ones.
+ *
+ * RAM: hash heads and chain links, 1.5 KiB, all static.
+ *
+ * @date 2025-10-21
+ * @author Allayar Moazami
+ */
+#include "payload_codec.h"
+#include "dbg.h"
+#include <stdio.h>
+#include <string.h>
+
+/* ========================================================================
+ * Constants
+ * ======================================================================== */
+
+/** @brief Empty hash chain marker */
+#define CHAIN_END 0xFFFFU
+
+/** @brief Shortest and longest match deflate can code */
+#define MIN_MATCH 3U
+#define MAX_MATCH 258U
+
+/** @brief Modulus of the Adler-32 checksum */
+#define ADLER_MOD 65521UL
+
+/** @brief Size of temporary string buffer for formatting */
+#define TEMP_STRING_SIZE 100
+
+/* ========================================================================
+ * Types
+ * ======================================================================== */
+
+/**
+ * @struct StuBitWriter
+ * @brief LSB-first bit packer into a bounded output buffer
+ */
+typedef struct StuBitWriterStruct
+{
+    u8 *out;        /**< Output buffer */
+    u16 size;       /**< Output buffer size */
+    u16 pos;        /**< Bytes written */
+    u32 bits;       /**< Pending bits */
+    u8 count;       /**< Number of pending bits */
+    u8 overflow;    /**< Output buffer exhausted */
+} StuBitWriter;
+
+/* ========================================================================
+ * Static Variables
+ * ======================================================================== */
+
+/** @brief Length code base values, symbols 257..285 */
+static const u16 kLenBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+/** @brief Length code extra bits, symbols 257..285 */
+static const u8 kLenExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+/** @brief Distance code base values, first 20 codes cover 1..1024 */
+static const u16 kDistBase[20] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769
+};
+
+/** @brief Distance code extra bits */
+static const u8 kDistExtra[20] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8
+};
+
+/** @brief Most recent position for each hash value */
+static u16 gHashHead[PAYLOAD_CODEC_HASH_SIZE];
+
+/** @brief Previous position with the same hash, per input position */
+static u16 gHashPrev[PAYLOAD_CODEC_MAX_INPUT];
+
+/** @brief Compression switch, cleared when the server rejects deflate */
+static u8 gEnable = PAYLOAD_CODEC_DEFAULT_ENABLE;
+
+/** @brief Benchmark totals */
+static StuPayloadCodecStats gStats;
+
+/* ========================================================================
+ * Static Helper Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Append bits to the stream, least significant bit first
+ * @param[in,out] bw Bit writer
+ * @param[in] value Bits to write
+ * @param[in] n Number of bits (at most 16)
+ */
+static void payload_codec_put_bits(StuBitWriter *bw, u32 value, u8 n)
+{
+    bw->bits |= value << bw->count;
+    bw->count += n;
+    while (bw->count >= 8U) {
+        if (bw->pos < bw->size) {
+            bw->out[bw->pos++] = (u8)bw->bits;
+        } else {
+            bw->overflow = 1;
+        }
+        bw->bits >>= 8;
+        bw->count -= 8U;
+    }
+}
+
+/**
+ * @brief Append a Huffman code, which deflate stores most significant bit first
+ * @param[in,out] bw Bit writer
+ * @param[in] code Huffman code
+ * @param[in] len Code length in bits
+ */
+static void payload_codec_put_code(StuBitWriter *bw, u16 code, u8 len)
+{
+    u16 rev = 0;
+
+    for (u8 i = 0; i < len; i++) {
+        rev = (u16)((rev << 1) | ((code >> i) & 1U));
+    }
+    payload_codec_put_bits(bw, rev, len);
+}
+
+/**
+ * @brief Write a literal/length symbol with the fixed Huffman table
+ * @param[in,out] bw Bit writer
+ * @param[in] sym Symbol 0..285
+ */
+static void payload_codec_put_symbol(StuBitWriter *bw, u16 sym)
+{
+    if (sym <= 143U) {
+        payload_codec_put_code(bw, (u16)(0x30U + sym), 8);
+    } else if (sym <= 255U) {
+        payload_codec_put_code(bw, (u16)(0x190U + sym - 144U), 9);
+    } else if (sym <= 279U) {
+        payload_codec_put_code(bw, (u16)(sym - 256U), 7);
+    } else {
+        payload_codec_put_code(bw, (u16)(0xC0U + sym - 280U), 8);
+    }
+}
+
+/**
+ * @brief Write a back-reference
+ * @param[in,out] bw Bit writer
+ * @param[in] len Match length, MIN_MATCH..MAX_MATCH
+ * @param[in] dist Match distance, 1..PAYLOAD_CODEC_MAX_INPUT
+ */
+static void payload_codec_put_match(StuBitWriter *bw, u16 len, u16 dist)
+{
+    u8 i = 28;
+    u8 j = 19;
+
+    while (kLenBase[i] > len) {
+        i--;
+    }
+    payload_codec_put_symbol(bw, (u16)(257U + i));
+    payload_codec_put_bits(bw, (u32)(len - kLenBase[i]), kLenExtra[i]);
+
+    while (kDistBase[j] > dist) {
+        j--;
+    }
+    payload_codec_put_code(bw, j, 5);
+    payload_codec_put_bits(bw, (u32)(dist - kDistBase[j]), kDistExtra[j]);
+}
+
+/**
+ * @brief Hash the three bytes starting at a position
+ * @param[in] p Input pointer
+ * @return Hash chain index
+ */
+static u16 payload_codec_hash(const u8 *p)
+{
+    return (u16)(((u16)p[0] << 5) ^ ((u16)p[1] << 2) ^ p[2]) & (PAYLOAD_CODEC_HASH_SIZE - 1U);
+}
+
+/* ========================================================================
+ * Public Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Compress a buffer into a zlib/deflate stream
+ *
+ * @param[in] in Raw payload
+ * @param[in] inLen Raw payload length (at most PAYLOAD_CODEC_MAX_INPUT)
+ * @param[out] out Output buffer
+ * @param[in] outSize Output buffer size
+ *
+ * @return Compressed length, 0 if the payload does not get smaller
+ */
+u16 payload_codec_deflate(const u8 *in, u16 inLen, u8 *out, u16 outSize)
+{
+    StuBitWriter bw;
+    u32 adlerA = 1;
+    u32 adlerB = 0;
+    u16 i = 0;
+
+    if (0U == inLen || inLen > PAYLOAD_CODEC_MAX_INPUT || outSize < 8U) {
+        return 0;
+    }
+
+    memset(&bw, 0, sizeof(bw));
+    bw.out = out;
+    bw.size = (u16)(outSize - 4U);  /* Room for the Adler-32 trailer */
+    memset(gHashHead, 0xFF, sizeof(gHashHead));
+
+    /* zlib header: deflate, 32 KiB window, no dictionary, check bits */
+    out[0] = 0x78;
+    out[1] = 0x01;
+    bw.pos = 2;
+
+    /* Single final block with fixed Huffman codes */
+    payload_codec_put_bits(&bw, 1U, 1);
+    payload_codec_put_bits(&bw, 1U, 2);
+
+    while (i < inLen && 0U == bw.overflow) {
+        u16 bestLen = 0;
+        u16 bestDist = 0;
+
+        if ((u16)(i + MIN_MATCH) <= inLen) {
+            u16 maxLen = (u16)(inLen - i);
+            u16 cand = gHashHead[payload_codec_hash(&in[i])];
+            u8 chain = 0;
+
+            if (maxLen > MAX_MATCH) {
+                maxLen = MAX_MATCH;
+            }
+            while (CHAIN_END != cand && chain++ < PAYLOAD_CODEC_MAX_CHAIN) {
+                u16 len = 0;
+
+                while (len < maxLen && in[cand + len] == in[i + len]) {
+                    len++;
+                }
+                if (len > bestLen) {
+                    bestLen = len;
+                    bestDist = (u16)(i - cand);
+                    if (len == maxLen) {
+                        break;
+                    }
+                }
+                cand = gHashPrev[cand];
+            }
+        }
+
+        if (bestLen < MIN_MATCH) {
+            bestLen = 1;
+            payload_codec_put_symbol(&bw, in[i]);
+        } else {
+            payload_codec_put_match(&bw, bestLen, bestDist);
+        }
+
+        /* Insert every consumed position into the hash chains */
+        for (u16 k = 0; k < bestLen; k++, i++) {
+            if ((u16)(i + MIN_MATCH) <= inLen) {
+                u16 h = payload_codec_hash(&in[i]);
+                gHashPrev[i] = gHashHead[h];
+                gHashHead[h] = i;
+            }
+        }
+    }
+
+    /* End of block, then pad to a byte boundary */
+    payload_codec_put_symbol(&bw, 256U);
+    payload_codec_put_bits(&bw, 0U, 7);
+
+    if (0U != bw.overflow || (u16)(bw.pos + 4U) >= inLen) {
+        return 0;
+    }
+
+    for (i = 0; i < inLen; i++) {
+        adlerA = (adlerA + in[i]) % ADLER_MOD;
+        adlerB = (adlerB + adlerA) % ADLER_MOD;
+    }
+    out[bw.pos++] = (u8)(adlerB >> 8);
+    out[bw.pos++] = (u8)adlerB;
+    out[bw.pos++] = (u8)(adlerA >> 8);
+    out[bw.pos++] = (u8)adlerA;
+
+    return bw.pos;
+}
+
+/**
+ * @brief Check whether payloads should be compressed
+ *
+ * @return 1 if compression is enabled, 0 otherwise
+ */
+u8 payload_codec_enabled(void)
+{
+    return gEnable;
+}
+
+/**
+ * @brief Disable compression after the server refused an encoded body
+ */
+void payload_codec_reject(void)
+{
+    gEnable = 0;
+    TransmitDebug(">>Server rejected deflate, sending raw payloads\r");
+}
+
+/**
+ * @brief Add one compression run to the benchmark totals
+ *
+ * @param[in] inLen Raw length
+ * @param[in] outLen Compressed length, 0 if the payload went out raw
+ * @param[in] cycles CPU cycles spent in payload_codec_deflate()
+ */
+void payload_codec_account(u16 inLen, u16 outLen, u32 cycles)
+{
+    if (0U == outLen) {
+        gStats.skipped++;
+        return;
+    }
+    gStats.frames++;
+    gStats.bytesIn += inLen;
+    gStats.bytesOut += outLen;
+    gStats.cycles += cycles;
+    if (cycles > gStats.wcet) {
+        gStats.wcet = cycles;
+    }
+}
+
+/* ========================================================================
+ * Command Interface Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Process compression commands (sub-command of "sim")
+ *
+ * @param[in] str Command string to process
+ *
+ * @return 0 when the command is done
+ */
+u8 payload_codec_cmd(char *str)
+{
+    char tempStr[TEMP_STRING_SIZE];
+    u32 ratio = 0;
+    u32 cyclesPerKb = 0;
+
+    if (strstr(str, "zip on")) {
+        gEnable = 1;
+        TransmitCMDResponse("\r>Payload compression enabled\r");
+    } else if (strstr(str, "zip off")) {
+        gEnable = 0;
+        TransmitCMDResponse("\r>Payload compression disabled\r");
+    } else {
+        if (0U != gStats.bytesIn) {
+            ratio = (u32)(((uint64_t)gStats.bytesOut * 100U) / gStats.bytesIn);
+            cyclesPerKb = (u32)(((uint64_t)gStats.cycles * 1024U) / gStats.bytesIn);
+        }
+        snprintf(tempStr, sizeof(tempStr),
+                 "\r>Zip %s frames:%lu raw:%lu ratio:%lu%% cyc/KB:%lu wcet:%lu\r",
+                 (1U == gEnable) ? "on" : "off",
+                 (unsigned long)gStats.frames, (unsigned long)gStats.skipped,
+                 (unsigned long)ratio, (unsigned long)cyclesPerKb,
+                 (unsigned long)gStats.wcet);
+        TransmitCMDResponse(tempStr);
+    }
+    return 0;
+}
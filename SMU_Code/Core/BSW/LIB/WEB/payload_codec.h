@@ -0,0 +1,94 @@
+/**
+ * @file payload_codec.h
+ * @brief HTTP payload compression for the modem uplink
+ *
+ * Compresses a complete HTTP body into a zlib stream (RFC 1950) carrying a
+ * single fixed-Huffman deflate block (RFC 1951). Any standard HTTP stack can
+ * decode it with "Content-Encoding: deflate". Matching uses a hash chain over
+ * the input buffer, so RAM use is fixed and no heap is needed.
+ *
+ * @date 2025-10-21
+ * @author Allayar Moazami
+ */
+#ifndef H_PAYLOAD_CODEC
+#define H_PAYLOAD_CODEC
+
+#include "platform.h"
+
+/** @brief Compression enabled after reset (server must accept deflate) */
+#define PAYLOAD_CODEC_DEFAULT_ENABLE 0
+
+/** @brief Largest input accepted, also the longest match distance */
+#define PAYLOAD_CODEC_MAX_INPUT 512U
+
+/** @brief Number of hash chain heads (power of two) */
+#define PAYLOAD_CODEC_HASH_SIZE 256U
+
+/** @brief Candidates checked per position before the best match is taken */
+#define PAYLOAD_CODEC_MAX_CHAIN 32U
+
+/** @brief Value for the HTTP Content-Encoding header */
+#define PAYLOAD_CODEC_ENCODING "deflate"
+
+/**
+ * @struct StuPayloadCodecStats
+ * @brief Running totals used for the on-target benchmark
+ */
+typedef struct StuPayloadCodecStatsStruct
+{
+    u32 frames;     /**< Payloads compressed and sent compressed */
+    u32 skipped;    /**< Payloads that did not shrink and went out raw */
+    u32 bytesIn;    /**< Raw bytes of compressed payloads */
+    u32 bytesOut;   /**< Compressed bytes */
+    u32 cycles;     /**< CPU cycles spent in payload_codec_deflate() */
+    u32 wcet;       /**< Worst single call in CPU cycles */
+} StuPayloadCodecStats;
+
+/**
+ * @brief Compress a buffer into a zlib/deflate stream
+ *
+ * @param[in] in Raw payload
+ * @param[in] inLen Raw payload length (at most PAYLOAD_CODEC_MAX_INPUT)
+ * @param[out] out Output buffer
+ * @param[in] outSize Output buffer size
+ *
+ * @return Compressed length, 0 if the payload does not get smaller
+ */
+u16 payload_codec_deflate(const u8 *in, u16 inLen, u8 *out, u16 outSize);
+
+/**
+ * @brief Check whether payloads should be compressed
+ *
+ * @return 1 if compression is enabled, 0 otherwise
+ */
+u8 payload_codec_enabled(void);
+
+/**
+ * @brief Disable compression after the server refused an encoded body
+ */
+void payload_codec_reject(void);
+
+/**
+ * @brief Add one compression run to the benchmark totals
+ *
+ * @param[in] inLen Raw length
+ * @param[in] outLen Compressed length, 0 if the payload went out raw
+ * @param[in] cycles CPU cycles spent in payload_codec_deflate()
+ */
+void payload_codec_account(u16 inLen, u16 outLen, u32 cycles);
+
+/**
+ * @brief Process compression commands (sub-command of "sim")
+ *
+ * @param[in] str Command string to process
+ *
+ * @return 0 when the command is done
+ *
+ * @par Supported commands:
+ *      - "sim zip on": Enable payload compression
+ *      - "sim zip off": Disable payload compression
+ *      - "sim zip": Print compression ratio and cycles per KB
+ */
+u8 payload_codec_cmd(char *str);
+
+#endif /* H_PAYLOAD_CODEC */
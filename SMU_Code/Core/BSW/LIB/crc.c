@@ -38,6 +38,24 @@ bool checkFrameCRC(char frame[], int frameSize) {
 }
 
 
+// CRC-32, one nibble per step: a 16 entry table instead of 1 KiB of flash
+u32 calculateCRC32(const u8 *data, u32 len) {
+	static const u32 nibbleTable[16] = {
+		0x00000000UL, 0x1DB71064UL, 0x3B6E20C8UL, 0x26D930ACUL,
+		0x76DC4190UL, 0x6B6B51F4UL, 0x4DB26158UL, 0x5005713CUL,
+		0xEDB88320UL, 0xF00F9344UL, 0xD6D6A3E8UL, 0xCB61B38CUL,
+		0x9B64C2B0UL, 0x86D3D2D4UL, 0xA00AE278UL, 0xBDBDF21CUL
+	};
+	u32 crc = 0xFFFFFFFFUL;
+
+	for (u32 pos = 0; pos < len; pos++) {
+		crc ^= data[pos];
+		crc = (crc >> 4) ^ nibbleTable[crc & 0x0F];
+		crc = (crc >> 4) ^ nibbleTable[crc & 0x0F];
+	}
+	return ~crc;
+}
+
 
 // Function to reverse the bits of a byte
 static u8 bitReverse(u8 byte) {
@@ -13,6 +13,9 @@
 u16 calculateCRC(u8 *frame, u16 len) ;
 bool checkFrameCRC(char frame[], int frameSize) ;
 
+// CRC-32 (IEEE 802.3, reflected 0xEDB88320), for stored images
+u32 calculateCRC32(const u8 *data, u32 len);
+
 // Calculate simple CRC8
 
 u8 crc_stpm3x(u8 *data, u8 len);
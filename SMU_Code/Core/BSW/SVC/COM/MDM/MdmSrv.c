@@ -13,8 +13,9 @@
 #include "MdmDll.h"
 #include "MdmHw.h"
 #include "cjson.h"
-#include "WebInstanceReport.h"
 #include "server.h"
+#include "payload_codec.h"
+#include "mdm_outq.h"
 
 //#include "MEM.h"
 void MX_USART1_UART_Init2(void);
@@ -68,12 +69,16 @@ enum State {
 } state = IDLE;
 
 GPRS_HandleTypeDef mdmGprs;
+static u8 aU8ZipData[BUFFER_SIZE];   /* Deflated copy of mdmGprs.sData */
+static u8 StcU8Zip=0;                /* Body in flight is aU8ZipData */
+static u8 StcU8ZipHeader=0;          /* Content-Encoding set in modem */
 
 int waitnextdata=0;
 TIME_OUT timeout;
 
 
 static void http_Send(GPRS_HandleTypeDef *mGprs);
+static u16 http_Compress(GPRS_HandleTypeDef *mGprs, u16 u16Len);
 static void reportHttpSendStatus( );
 
 
@@ -247,6 +252,7 @@ if(NULL!=strstr(mdm->pData,"AT"))
 		sendcomm = CMD_HTTP_INIT_WAIT; // was "case 6"
 		MDM_SendData(atCommands.list[4].command);
 		u8HttpUrlFlag=0;
+		StcU8ZipHeader=0; // HTTPINIT clears USERDATA
 	}
 	break;
 	case CMD_HTTP_INIT_WAIT:
@@ -308,21 +314,66 @@ if(NULL!=strstr(mdm->pData,"AT"))
 					"\"changed\": \"1\"\r}", _serialN);
 		}
 		dataLen = strlen((char*)mGprs->sData);
-		sprintf(str,"AT+HTTPDATA=%u,10000\r",dataLen);
-		MDM_SendData((uint8_t*)str);
-		sendcomm = CMD_WAIT_FOR_DOWNLOAD; // was "case 10"
+		dataLen = http_Compress(mGprs, (u16)dataLen);
+		if (StcU8Zip != StcU8ZipHeader)
+		{
+			snprintf(str,190,"AT+HTTPPARA=\"USERDATA\",\"%s\"\r",
+					(1==StcU8Zip) ? "Content-Encoding: " PAYLOAD_CODEC_ENCODING : "");
+			memset(mdm->pData,0,sizeof(mdm->pData)); // no stale OK from the previous command
+			MDM_SendData((uint8_t*)str);
+			StcU8ZipHeader = StcU8Zip;
+			stcU16Wait=0;
+			sendcomm = CMD_HTTPPARA_ENCODING;
+		}
+		else
+		{
+			sprintf(str,"AT+HTTPDATA=%u,10000\r",dataLen);
+			memset(mdm->pData,0,sizeof(mdm->pData));
+			MDM_SendData((uint8_t*)str);
+			sendcomm = CMD_WAIT_FOR_DOWNLOAD; // was "case 10"
+		}
 	}
 	break;
+	case CMD_HTTPPARA_ENCODING:
+		/* HTTPDATA only once the modem took USERDATA */
+		if (0!=strstr((char*)mdm->pData,"OK"))
+		{
+			stcU16Wait=0;
+			sprintf(str,"AT+HTTPDATA=%u,10000\r",dataLen);
+			memset(mdm->pData,0,sizeof(mdm->pData));
+			MDM_SendData((uint8_t*)str);
+			sendcomm = CMD_WAIT_FOR_DOWNLOAD;
+		}
+		else if (0!=strstr((char*)mdm->pData,"ERROR") || stcU16Wait++ > 20)
+		{
+			/* Header state unknown: HTTPINIT of the retry clears it */
+			stcU16Wait=0;
+			sendcomm = CMD_HTTP_TERM;
+		}
+		break;
 	case CMD_WAIT_FOR_DOWNLOAD:
-		if (stcU16Wait++ > 20 || 0!=strstr((char*)mdm->pData,"DOWNLOAD"))
+		if (0!=strstr((char*)mdm->pData,"DOWNLOAD"))
 		{
 			stcU16Wait=0;
 			sendcomm = CMD_SEND_DATA; // was "case 10"
 		}
+		else if (0!=strstr((char*)mdm->pData,"ERROR") || stcU16Wait++ > 20)
+		{
+			/* No prompt: the body would land in the AT parser, start over */
+			stcU16Wait=0;
+			sendcomm = CMD_HTTP_TERM;
+		}
 		break;
 	case CMD_SEND_DATA: // old "case 10"
 	{
-		MDM_SendData((uint8_t*)mGprs->sData);
+		if (1==StcU8Zip)
+		{
+			MDM_SendBinary(aU8ZipData, (uint16_t)dataLen);
+		}
+		else
+		{
+			MDM_SendData((uint8_t*)mGprs->sData);
+		}
 		sendcomm = CMD_WAIT_FOR_SEND_OK; // was "case 11"
 	}
 	break;
@@ -349,7 +400,7 @@ if(NULL!=strstr(mdm->pData,"AT"))
 			timeout.simSoft=HAL_GetTick();
 			timeout.simHard=HAL_GetTick();
 			StcU8MdmSoftRstFlg=0;
-			WebInsReportNextEvent();
+			mdm_outq_ack();
 			if(mGprs->response!=0)
 			{
 			char *sstr=strstr((char*)mdm->pData,"+HTTPACTION: 1,200");
@@ -376,6 +427,14 @@ if(NULL!=strstr(mdm->pData,"AT"))
 			stcU8ServerRes=1;
 
 		}
+		else if (1==StcU8Zip && (0!=strstr((char*)mdm->pData,"+HTTPACTION: 1,415")
+				|| 0!=strstr((char*)mdm->pData,"+HTTPACTION: 1,400")))
+		{
+			/* Server does not take deflate: resend the same body raw */
+			payload_codec_reject();
+			sendcomm = CMD_SEND_DATA_LEN;
+			stcU16Wait=0;
+		}
 		else if (0!=strstr((char*)mdm->pData,"+HTTPACTION: 1,4"))
 		{
 
@@ -477,6 +536,46 @@ if(NULL!=strstr(mdm->pData,"AT"))
 	break;
 	} // end switch
 }
+/*!
+ **************************************************************************************************
+ *
+ *  @fn         static u16 http_Compress(GPRS_HandleTypeDef *mGprs, u16 u16Len)
+ *
+ *  @par        This function deflates the HTTP body into aU8ZipData when compression is
+ *              enabled and the body shrinks. mGprs->sData is kept raw so the same body can
+ *              be resent uncompressed if the server rejects the encoding.
+ *
+ *  @param      mGprs   Modem handle holding the raw body.
+ *  @param      u16Len  Raw body length.
+ *
+ *  @return     Length of the body to send.
+ *
+ *  @par        Design Info
+ *              WCET            : Measured with DWT, see "sim zip"
+ *              Sync/Async      : sync
+ *
+ **************************************************************************************************
+ */
+static u16 http_Compress(GPRS_HandleTypeDef *mGprs, u16 u16Len)
+{
+	u16 u16ZipLen=0;
+	u32 u32Cycles;
+
+	StcU8Zip=0;
+	if(1==payload_codec_enabled() && 0==_readreq)
+	{
+		u32Cycles=DWT->CYCCNT;
+		u16ZipLen=payload_codec_deflate((u8*)mGprs->sData, u16Len, aU8ZipData, BUFFER_SIZE);
+		u32Cycles=DWT->CYCCNT-u32Cycles;
+		payload_codec_account(u16Len, u16ZipLen, u32Cycles);
+		if(0!=u16ZipLen)
+		{
+			StcU8Zip=1;
+			return u16ZipLen;
+		}
+	}
+	return u16Len;
+}
 /*!
  **************************************************************************************************
  *
@@ -810,7 +909,15 @@ u16 MdmSrv_GetWebRefId(void)
 
 u8 simCommand(char *str)
 {
-	if(0!=strstr(str,"off"))
+	if(0!=strstr(str,"zip"))
+	{
+		payload_codec_cmd(str);
+	}
+	else if(0!=strstr(str,"queue"))
+	{
+		mdm_outq_report();
+	}
+	else if(0!=strstr(str,"off"))
 	{
 		httpOnOff=1;
 	}
@@ -61,6 +61,7 @@ typedef enum
   CMD_HTTP_INIT_WAIT   = 16,
   CMD_CGDCONT          = 17,
   CMD_CGACT            = 18,
+  CMD_HTTPPARA_ENCODING= 19,
   CMD_WAIT_RESPONSE    = 109,  // old case 109
   CMD_READ_DATA        = 110,  // old case 110
   CMD_WAIT_READ        = 111,  // old case 111
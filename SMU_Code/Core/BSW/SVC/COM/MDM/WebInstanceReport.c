@@ -43,6 +43,8 @@
 #include "httpFrame.h"
 #include "mntdata.h"
 #include "myrtc.h"
+#include "MdmSrv.h"
+#include "main.h"
 /*!
  **************************************************************************************************
  *
@@ -50,12 +52,32 @@
  *
  **************************************************************************************************
  */
-#define EVENT_HISTORY_SIZE 255
+/* Ring of compact events. Single producer (Modbus manager, WebInsReportUpdate) and single
+ * consumer (log manager, WebInsReportRead/NextEvent) in different interrupt contexts: the
+ * producer only writes StcU16HeadIndex, the consumer only writes StcU16TailIndex. Both are
+ * free-running, the slot is index & EVENT_HISTORY_MASK. */
+#define EVENT_HISTORY_SIZE 64U            /* power of two */
+#define EVENT_HISTORY_MASK (EVENT_HISTORY_SIZE-1U)
+#define EVENT_SIGNAL_SIZE  16U            /* distinct signal names */
+#define EVENT_BATCH_WINDOW 1000U          /* ms, events sharing one frame time stamp */
+#define EVENT_FRAME_TAIL   8U             /* room for the closing braces */
 
-static u16 StcU16HeadIndex=0;
-static u16 StcU16TailIndex=0;
+typedef struct
+{
+	u16 u16Signal;    /* index into StcArU8SignalName */
+	u16 u16Reserved;
+	f32 f32Value;
+	u32 u32Tick;      /* HAL tick of the change */
+}StuEventType;
+
+static volatile u16 StcU16HeadIndex=0;
+static volatile u16 StcU16TailIndex=0;
+static u16 StcU16InFlight=0;
+static u16 StcU16SignalCount=0;
+static u32 StcU32Dropped=0;
 
-MntDataType StuEventData[EVENT_HISTORY_SIZE];
+static StuEventType StuEventData[EVENT_HISTORY_SIZE];
+static char StcArU8SignalName[EVENT_SIGNAL_SIZE][NAME_SIZE];
 
 /*!
  **************************************************************************************************
@@ -64,16 +86,20 @@ MntDataType StuEventData[EVENT_HISTORY_SIZE];
  *
  **************************************************************************************************
  */
-
+static u16 WebInsReportSignal(u8 *u8Name);
+static void WebInsReportStamp(DateTime *tm,u32 u32Age);
 
 /*!
  **************************************************************************************************
  *
- *  @fn         WebInsReportUpdate (void)
+ *  @fn         WebInsReportUpdate (u8 *u8Name,f32 f32Value)
  *
- *  @par        Contains all Control Algorithms.
+ *  @par        Queues a state change. Producer side of the ring, must only be called from
+ *              one context. A full ring drops the new event and counts it; the periodic
+ *              telemetry still carries the current value.
  *
- *  @param      None.
+ *  @param      u8Name    Signal name.
+ *  @param      f32Value  New value.
  *
  *  @return     None.
  *
@@ -85,27 +111,38 @@ MntDataType StuEventData[EVENT_HISTORY_SIZE];
  */
 void WebInsReportUpdate (u8 *u8Name,f32 f32Value)
 {
+	u16 u16Head=StcU16HeadIndex;
+	u16 u16Signal=WebInsReportSignal(u8Name);
+	StuEventType *pEvent;
 
-	snprintf(StuEventData[StcU16HeadIndex].name,NAME_SIZE,"%s",u8Name);
-	snprintf(StuEventData[StcU16HeadIndex].unit,UNIT_SIZE,"N");
-	StuEventData[StcU16HeadIndex].value=f32Value;
-	if(StcU16HeadIndex++>=EVENT_HISTORY_SIZE)
+	if((u16)(u16Head-StcU16TailIndex)>=EVENT_HISTORY_SIZE || u16Signal>=EVENT_SIGNAL_SIZE)
 	{
-		StcU16HeadIndex=0;
-
+		StcU32Dropped++;
+		return;
 	}
 
+	pEvent=&StuEventData[u16Head & EVENT_HISTORY_MASK];
+	pEvent->u16Signal=u16Signal;
+	pEvent->f32Value=f32Value;
+	pEvent->u32Tick=HAL_GetTick();
+
+	/* Entry must be complete before the consumer can see it */
+	__DMB();
+	StcU16HeadIndex=u16Head+1U;
 }
 /*!
  **************************************************************************************************
  *
- *  @fn         WebInsReportUpdate (void)
+ *  @fn         WebInsReportRead (u8 *u8Str)
  *
- *  @par        Contains all Control Algorithms.
+ *  @par        Packs pending events into one "send-chanel" frame (BUFFER_SIZE bytes). A frame
+ *              holds events of one EVENT_BATCH_WINDOW and each signal at most once, so the
+ *              frame time stamp stays exact; the rest goes in the next frame. The events stay
+ *              queued until WebInsReportNextEvent().
  *
- *  @param      None.
+ *  @param      u8Str  Output buffer.
  *
- *  @return     None.
+ *  @return     0 if a frame was built, 1 if no event is pending.
  *
  *  @par        Design Info
  *              WCET            : Enter Worst Case Execution Time heres
@@ -115,33 +152,63 @@ void WebInsReportUpdate (u8 *u8Name,f32 f32Value)
  */
 u8 WebInsReportRead (u8 *u8Str)
 {
-	u8 u8StrFrameHead[100];
-	u8 u8ReturnValue=0;
+	u8 u8Item[NAME_SIZE+24];
+	u32 u32Seen=0;
+	u16 u16Tail=StcU16TailIndex;
+	u16 u16Head=StcU16HeadIndex;
+	u16 u16Count=0;
+	StuEventType *pFirst;
+	StuEventType *pEvent;
+	DateTime dtStamp;
+	size_t len;
 
-	if(StcU16TailIndex!=StcU16HeadIndex)
+	if(u16Tail==u16Head)
 	{
-	_rtcFunctionRead(0);
-	startJsonFrame((char*) u8StrFrameHead, urtc);
-	sprintf(u8Str,"%s    \"V1\": \"%s*%0.1f*%s\"\r}\r}",
-			u8StrFrameHead,
-			StuEventData[StcU16TailIndex].name,
-			StuEventData[StcU16TailIndex].value,
-			StuEventData[StcU16TailIndex].unit);
-	u8ReturnValue=0;
+		StcU16InFlight=0;
+		return 1;
 	}
-	else
+	/* Entries up to the head read above are complete */
+	__DMB();
+
+	pFirst=&StuEventData[u16Tail & EVENT_HISTORY_MASK];
+	_rtcFunctionRead(0);
+	/* Back-date a copy, the other readers of urtc keep the current time */
+	dtStamp=urtc;
+	WebInsReportStamp(&dtStamp,(HAL_GetTick()-pFirst->u32Tick)/1000U);
+	startJsonFrame((char*) u8Str, dtStamp);
+
+	while((u16)(u16Tail+u16Count)!=u16Head)
 	{
-		u8ReturnValue=1;
+		pEvent=&StuEventData[(u16Tail+u16Count) & EVENT_HISTORY_MASK];
+		if((pEvent->u32Tick-pFirst->u32Tick)>=EVENT_BATCH_WINDOW ||
+		   0!=(u32Seen & (1UL<<pEvent->u16Signal)))
+		{
+			break;
+		}
+		snprintf((char*)u8Item,sizeof(u8Item),"%s    \"V%u\": \"%s*%0.1f*N\"",
+				(0==u16Count)?"":",\r",u16Count+1U,
+				StcArU8SignalName[pEvent->u16Signal],pEvent->f32Value);
+		len=strlen((char*)u8Str);
+		if((len+strlen((char*)u8Item)+EVENT_FRAME_TAIL)>=BUFFER_SIZE)
+		{
+			break;
+		}
+		strcat((char*)u8Str,(char*)u8Item);
+		u32Seen|=(1UL<<pEvent->u16Signal);
+		u16Count++;
 	}
+	strcat((char*)u8Str,"\r}\r}");
+	StcU16InFlight=u16Count;
 
-	return u8ReturnValue;
+	return 0;
 }
 /*!
  **************************************************************************************************
  *
  *  @fn         WebInsReportNextEvent (void)
  *
- *  @par        Contains all Control Algorithms.
+ *  @par        Releases the events of the frame built by WebInsReportRead() after the server
+ *              accepted it. Consumer side of the ring.
  *
  *  @param      None.
  *
@@ -155,16 +222,8 @@ u8 WebInsReportRead (u8 *u8Str)
  */
 void WebInsReportNextEvent (void)
 {
-	if(StcU16TailIndex!=StcU16HeadIndex)
-	{
-		StcU16TailIndex++;
-		if(StcU16TailIndex>EVENT_HISTORY_SIZE)
-		{
-			StcU16TailIndex=0;
-
-		}
-	}
-
+	StcU16TailIndex=StcU16TailIndex+StcU16InFlight;
+	StcU16InFlight=0;
 }
 
 /*!
@@ -172,11 +231,11 @@ void WebInsReportNextEvent (void)
  *
  *  @fn         WebInsReportStatus (void)
  *
- *  @par        Contains all Control Algorithms.
+ *  @par        Returns the event queue state.
  *
  *  @param      None.
  *
- *  @return     None.
+ *  @return     0 if events are pending, 1 if the queue is empty.
  *
  *  @par        Design Info
  *              WCET            : Enter Worst Case Execution Time heres
@@ -198,6 +257,89 @@ u8 WebInsReportStatus (void)
 	}
 return u8ReturnValue;
 }
+/*!
+ **************************************************************************************************
+ *
+ *  @fn         WebInsReportDropped (void)
+ *
+ *  @par        Returns the number of events lost because the ring was full.
+ *
+ *  @param      None.
+ *
+ *  @return     Dropped event count.
+ *
+ *  @par        Design Info
+ *              WCET            : Enter Worst Case Execution Time heres
+ *              Sync/Async      : sync
+ *
+ **************************************************************************************************
+ */
+u32 WebInsReportDropped (void)
+{
+	return StcU32Dropped;
+}
+/*!
+ **************************************************************************************************
+ *
+ *  @fn         static u16 WebInsReportSignal(u8 *u8Name)
+ *
+ *  @par        Returns the ID of a signal name, registering it on first use. Producer context.
+ *
+ *  @param      u8Name  Signal name.
+ *
+ *  @return     Signal ID, EVENT_SIGNAL_SIZE if the table is full.
+ *
+ *  @par        Design Info
+ *              WCET            : Enter Worst Case Execution Time heres
+ *              Sync/Async      : sync
+ *
+ **************************************************************************************************
+ */
+static u16 WebInsReportSignal(u8 *u8Name)
+{
+	u16 u16Index;
 
+	for(u16Index=0;u16Index<StcU16SignalCount;u16Index++)
+	{
+		if(0==strncmp(StcArU8SignalName[u16Index],(char*)u8Name,NAME_SIZE-1))
+		{
+			return u16Index;
+		}
+	}
+	if(StcU16SignalCount<EVENT_SIGNAL_SIZE)
+	{
+		snprintf(StcArU8SignalName[StcU16SignalCount],NAME_SIZE,"%s",u8Name);
+		/* Name must be visible before an event refers to it */
+		__DMB();
+		return StcU16SignalCount++;
+	}
+	return EVENT_SIGNAL_SIZE;
+}
+/*!
+ **************************************************************************************************
+ *
+ *  @fn         static void WebInsReportStamp(DateTime *tm,u32 u32Age)
+ *
+ *  @par        Moves a wall clock time back by the age of an event. Events are drained within
+ *              seconds, so an age crossing midnight is clamped to 00:00:00 of the same day.
+ *
+ *  @param      tm      Time to adjust.
+ *  @param      u32Age  Age in seconds.
+ *
+ *  @return     None.
+ *
+ *  @par        Design Info
+ *              WCET            : Enter Worst Case Execution Time heres
+ *              Sync/Async      : sync
+ *
+ **************************************************************************************************
+ */
+static void WebInsReportStamp(DateTime *tm,u32 u32Age)
+{
+	u32 u32Sec=(u32)tm->hour*3600U+(u32)tm->minute*60U+(u32)tm->second;
 
-
+	u32Sec=(u32Age>u32Sec)?0U:(u32Sec-u32Age);
+	tm->hour=(int)(u32Sec/3600U);
+	tm->minute=(int)((u32Sec/60U)%60U);
+	tm->second=(int)(u32Sec%60U);
+}
@@ -48,11 +48,13 @@
 /*!
  **************************************************************************************************
  *
- *  @fn         WebInsReportUpdate (void)
+ *  @fn         WebInsReportUpdate (u8 *u8Name,f32 f32Value)
  *
- *  @par        Contains all Control Algorithms.
+ *  @par        Queues a state change. Producer side of the event ring, call from one context
+ *              only. A full ring drops the new event.
  *
- *  @param      None.
+ *  @param      u8Name    Signal name.
+ *  @param      f32Value  New value.
  *
  *  @return     None.
  *
@@ -66,13 +68,13 @@ void WebInsReportUpdate (u8 *u8Name,f32 f32Value);
 /*!
  **************************************************************************************************
  *
- *  @fn         WebInsReportUpdate (void)
+ *  @fn         WebInsReportRead (u8 *u8Str)
  *
- *  @par        Contains all Control Algorithms.
+ *  @par        Packs pending events into one "send-chanel" frame of at most BUFFER_SIZE bytes.
  *
- *  @param      None.
+ *  @param      u8Str  Output buffer.
  *
- *  @return     None.
+ *  @return     0 if a frame was built, 1 if no event is pending.
  *
  *  @par        Design Info
  *              WCET            : Enter Worst Case Execution Time heres
@@ -86,7 +88,7 @@ u8 WebInsReportRead (u8 *u8Str);
  *
  *  @fn         WebInsReportNextEvent (void)
  *
- *  @par        Contains all Control Algorithms.
+ *  @par        Releases the events of the last frame after the server accepted it.
  *
  *  @param      None.
  *
@@ -117,5 +119,23 @@ void WebInsReportNextEvent (void);
  **************************************************************************************************
  */
 u8 WebInsReportStatus (void);
+/*!
+ **************************************************************************************************
+ *
+ *  @fn         WebInsReportDropped (void)
+ *
+ *  @par        Returns the number of events lost because the ring was full.
+ *
+ *  @param      None.
+ *
+ *  @return     Dropped event count.
+ *
+ *  @par        Design Info
+ *              WCET            : Enter Worst Case Execution Time heres
+ *              Sync/Async      : sync
+ *
+ **************************************************************************************************
+ */
+u32 WebInsReportDropped (void);
 
 #endif /* WEBINSTANCEREPORT_H_ */
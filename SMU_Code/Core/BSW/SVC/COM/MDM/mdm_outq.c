@@ -0,0 +1,252 @@
+/**
+ * @file mdm_outq.c
+ * @brief Priority outbound message queue implementation
+ *
+ * The queue is a small unordered array; selection scans all entries for the
+ * lowest priority value, oldest first among equals. With MDM_OUTQ_SIZE
+ * entries the scan is cheaper than keeping the array sorted on every post.
+ *
+ * @date 2025-10-22
+ * @author Allayar Moazami
+ */
+#include "mdm_outq.h"
+#include "dbg.h"
+#include <stdio.h>
+#include <string.h>
+
+/* ========================================================================
+ * Constants
+ * ======================================================================== */
+
+/** @brief Marker for a free queue entry */
+#define OUTQ_FREE 0xFFU
+
+/** @brief Size of temporary string buffer for formatting */
+#define TEMP_STRING_SIZE 112
+
+/* ========================================================================
+ * Types
+ * ======================================================================== */
+
+/**
+ * @struct StuMdmMsg
+ * @brief Queued message, the payload is built at dispatch time
+ */
+typedef struct StuMdmMsgStruct
+{
+    u8 cls;         /**< EnuMdmMsgClass or OUTQ_FREE */
+    u32 tick;       /**< Post time, used for FIFO order within a priority */
+} StuMdmMsg;
+
+/* ========================================================================
+ * Static Variables
+ * ======================================================================== */
+
+/** @brief Class policy table */
+static const StuMdmMsgClass *gClass = NULL;
+
+/** @brief Queue storage */
+static StuMdmMsg gQueue[MDM_OUTQ_SIZE];
+
+/** @brief Time of the last frame sent per class */
+static u32 gLastSend[MDM_MSG_CLASS_COUNT];
+
+/** @brief Frames sent per class */
+static u32 gSent[MDM_MSG_CLASS_COUNT];
+
+/** @brief Posts merged into a pending message */
+static u32 gCoalesced = 0;
+
+/** @brief Posts refused because the queue was full */
+static u32 gOverflow = 0;
+
+/** @brief Class of the frame in flight, MDM_MSG_CLASS_COUNT if none */
+static u8 gInFlight = MDM_MSG_CLASS_COUNT;
+
+/* ========================================================================
+ * Static Helper Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Find the next eligible message
+ * @param[in] now Current tick
+ * @return Queue index, MDM_OUTQ_SIZE if nothing is eligible
+ */
+static u8 mdm_outq_select(u32 now)
+{
+    u8 best = MDM_OUTQ_SIZE;
+
+    for (u8 i = 0; i < MDM_OUTQ_SIZE; i++) {
+        u8 cls = gQueue[i].cls;
+
+        if (OUTQ_FREE == cls) {
+            continue;
+        }
+        if ((now - gLastSend[cls]) < gClass[cls].minInterval) {
+            continue;
+        }
+        if (MDM_OUTQ_SIZE == best ||
+            gClass[cls].priority < gClass[gQueue[best].cls].priority ||
+            (gClass[cls].priority == gClass[gQueue[best].cls].priority &&
+             (int32_t)(gQueue[i].tick - gQueue[best].tick) < 0)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+/* ========================================================================
+ * Public Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Install the class policy table and empty the queue
+ *
+ * @param[in] table MDM_MSG_CLASS_COUNT entries, kept by reference
+ */
+void mdm_outq_init(const StuMdmMsgClass *table)
+{
+    u32 now = HAL_GetTick();
+
+    gClass = table;
+    for (u8 i = 0; i < MDM_OUTQ_SIZE; i++) {
+        gQueue[i].cls = OUTQ_FREE;
+    }
+    for (u8 i = 0; i < MDM_MSG_CLASS_COUNT; i++) {
+        gLastSend[i] = now - table[i].minInterval;
+    }
+}
+
+/**
+ * @brief Post a message
+ *
+ * @param[in] cls Message class
+ *
+ * @return 1 if queued or merged into a pending message, 0 if the queue is full
+ */
+u8 mdm_outq_post(EnuMdmMsgClass cls)
+{
+    u8 slot = MDM_OUTQ_SIZE;
+
+    if (NULL == gClass || cls >= MDM_MSG_CLASS_COUNT) {
+        return 0;
+    }
+
+    for (u8 i = 0; i < MDM_OUTQ_SIZE; i++) {
+        if (1U == gClass[cls].coalesce && cls == gQueue[i].cls) {
+            /* The builder reads live data, so the pending message covers this one */
+            gCoalesced++;
+            return 1;
+        }
+        if (MDM_OUTQ_SIZE == slot && OUTQ_FREE == gQueue[i].cls) {
+            slot = i;
+        }
+    }
+
+    if (MDM_OUTQ_SIZE == slot) {
+        gOverflow++;
+        return 0;
+    }
+    gQueue[slot].cls = (u8)cls;
+    gQueue[slot].tick = HAL_GetTick();
+    return 1;
+}
+
+/**
+ * @brief Load the next frame into the modem handle
+ *
+ * @param[in,out] mGprs Modem handle
+ *
+ * @return 1 if a frame was loaded, 0 if nothing is eligible
+ */
+u8 mdm_outq_dispatch(GPRS_HandleTypeDef *mGprs)
+{
+    u32 now = HAL_GetTick();
+    EnuMdmBuild result;
+    u8 idx;
+    u8 cls;
+
+    if (NULL == gClass) {
+        return 0;
+    }
+
+    if (MDM_MSG_CLASS_COUNT != gInFlight) {
+        /* Modem is free again without an acknowledge: server refused the frame */
+        if (NULL != gClass[gInFlight].nack) {
+            gClass[gInFlight].nack();
+        }
+        gInFlight = MDM_MSG_CLASS_COUNT;
+    }
+
+    /* Each pass either sends a frame or frees an entry */
+    for (u8 pass = 0; pass < MDM_OUTQ_SIZE; pass++) {
+        idx = mdm_outq_select(now);
+        if (MDM_OUTQ_SIZE == idx) {
+            return 0;
+        }
+
+        cls = gQueue[idx].cls;
+        result = gClass[cls].build(mGprs);
+        if (MDM_BUILD_MORE != result) {
+            gQueue[idx].cls = OUTQ_FREE;
+        }
+        if (MDM_BUILD_NONE != result) {
+            gLastSend[cls] = now;
+            gSent[cls]++;
+            gInFlight = cls;
+            mGprs->busy = 1;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Acknowledge the frame in flight (HTTP 200)
+ */
+void mdm_outq_ack(void)
+{
+    if (MDM_MSG_CLASS_COUNT != gInFlight) {
+        if (NULL != gClass[gInFlight].ack) {
+            gClass[gInFlight].ack();
+        }
+        gInFlight = MDM_MSG_CLASS_COUNT;
+    }
+}
+
+/**
+ * @brief Get number of queued messages
+ *
+ * @return Queued message count
+ */
+u8 mdm_outq_count(void)
+{
+    u8 count = 0;
+
+    for (u8 i = 0; i < MDM_OUTQ_SIZE; i++) {
+        if (OUTQ_FREE != gQueue[i].cls) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Print queue counters on the command port ("sim queue")
+ */
+void mdm_outq_report(void)
+{
+    char tempStr[TEMP_STRING_SIZE];
+
+    snprintf(tempStr, sizeof(tempStr),
+             "\r>Queue:%u cfg:%lu ref:%lu event:%lu state:%lu log:%lu hist:%lu merged:%lu full:%lu\r",
+             mdm_outq_count(),
+             (unsigned long)gSent[MDM_MSG_CFG_ECHO],
+             (unsigned long)gSent[MDM_MSG_REF_READ],
+             (unsigned long)gSent[MDM_MSG_FAULT_EVENT],
+             (unsigned long)gSent[MDM_MSG_STATE_EVENT],
+             (unsigned long)gSent[MDM_MSG_TELEMETRY],
+             (unsigned long)gSent[MDM_MSG_LOG_UPLOAD],
+             (unsigned long)gCoalesced, (unsigned long)gOverflow);
+    TransmitCMDResponse(tempStr);
+}
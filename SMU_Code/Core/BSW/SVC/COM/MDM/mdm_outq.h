@@ -0,0 +1,121 @@
+/**
+ * @file mdm_outq.h
+ * @brief Priority outbound message queue for the modem
+ *
+ * Producers post typed messages into a fixed-capacity queue instead of
+ * competing for mdmGprs.busy. When the modem is free the dispatcher picks the
+ * highest-priority message whose class is not rate limited and calls the
+ * class builder, which fills mdmGprs just before the frame is sent so the
+ * payload is never stale. Multi-frame messages stay queued until their
+ * builder reports the last frame. Classes marked for coalescing keep at most
+ * one queued message; a newer post is merged into the pending one.
+ *
+ * @date 2025-10-22
+ * @author Allayar Moazami
+ */
+#ifndef H_MDM_OUTQ
+#define H_MDM_OUTQ
+
+#include "platform.h"
+#include "MdmSrv.h"
+
+/** @brief Queue capacity in messages */
+#define MDM_OUTQ_SIZE 8U
+
+/**
+ * @enum EnuMdmMsgClass
+ * @brief Outbound message classes
+ */
+typedef enum EnuMdmMsgClassEnum
+{
+    MDM_MSG_CFG_ECHO = 0,   /**< Reference values echoed back to the server */
+    MDM_MSG_REF_READ,       /**< Reference read request */
+    MDM_MSG_FAULT_EVENT,    /**< Inverter fault recorder snapshots */
+    MDM_MSG_STATE_EVENT,    /**< Batched state changes from WebInstanceReport */
+    MDM_MSG_TELEMETRY,      /**< Periodic monitoring snapshot / spool backlog */
+    MDM_MSG_LOG_UPLOAD,     /**< History records requested with "log web" */
+    MDM_MSG_CLASS_COUNT     /**< Number of classes */
+} EnuMdmMsgClass;
+
+/**
+ * @enum EnuMdmBuild
+ * @brief Builder result
+ */
+typedef enum EnuMdmBuildEnum
+{
+    MDM_BUILD_NONE = 0,     /**< Nothing to send, message is dropped */
+    MDM_BUILD_MORE,         /**< Frame built, message has more frames */
+    MDM_BUILD_LAST          /**< Frame built, message is complete */
+} EnuMdmBuild;
+
+/**
+ * @brief Message builder, fills api/sData/response of the modem handle
+ */
+typedef EnuMdmBuild (*MdmMsgBuilder)(GPRS_HandleTypeDef *mGprs);
+
+/**
+ * @brief Frame outcome callback (HTTP 200 / any other server answer)
+ */
+typedef void (*MdmMsgResult)(void);
+
+/**
+ * @struct StuMdmMsgClass
+ * @brief Per-class dispatch policy
+ */
+typedef struct StuMdmMsgClassStruct
+{
+    u8 priority;            /**< 0 is served first */
+    u8 coalesce;            /**< 1: at most one queued message of this class */
+    u16 minInterval;        /**< Minimum time between two frames in ms */
+    MdmMsgBuilder build;    /**< Called right before the frame is sent */
+    MdmMsgResult ack;       /**< Frame accepted by the server, may be NULL */
+    MdmMsgResult nack;      /**< Frame answered with an error, may be NULL */
+} StuMdmMsgClass;
+
+/**
+ * @brief Install the class policy table and empty the queue
+ *
+ * @param[in] table MDM_MSG_CLASS_COUNT entries, kept by reference
+ */
+void mdm_outq_init(const StuMdmMsgClass *table);
+
+/**
+ * @brief Post a message
+ *
+ * @param[in] cls Message class
+ *
+ * @return 1 if queued or merged into a pending message, 0 if the queue is full
+ */
+u8 mdm_outq_post(EnuMdmMsgClass cls);
+
+/**
+ * @brief Load the next frame into the modem handle
+ *
+ * Must only be called while the modem is free. A frame still in flight at
+ * this point was not acknowledged, its class nack callback is called first.
+ * Sets mGprs->busy when a frame was built.
+ *
+ * @param[in,out] mGprs Modem handle
+ *
+ * @return 1 if a frame was loaded, 0 if nothing is eligible
+ */
+u8 mdm_outq_dispatch(GPRS_HandleTypeDef *mGprs);
+
+/**
+ * @brief Acknowledge the frame in flight (HTTP 200)
+ */
+void mdm_outq_ack(void);
+
+/**
+ * @brief Get number of queued messages
+ *
+ * @return Queued message count
+ */
+u8 mdm_outq_count(void);
+
+/**
+ * @brief Print queue counters on the command port ("sim queue")
+ */
+void mdm_outq_report(void);
+
+#endif /* H_MDM_OUTQ */
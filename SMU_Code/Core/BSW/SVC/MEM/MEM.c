@@ -50,6 +50,7 @@
 #include "json.h"
 #include "mntdata.h"
 #include "WCET.h"
+#include "cfg_store.h"
 
 /*!
  **************************************************************************************************
@@ -76,7 +77,6 @@ u32 U32WriteWcTime=0;
 int SD_init(char immidiate);
 static void SD_Error(const char *state, char *error, int rc);
 u8 readConfigFile(int index);
-u8 updateConfig(int index);
 
 /*!
  **************************************************************************************************
@@ -158,11 +158,16 @@ void memInit()
  *
  *  @fn         void memHnadler(int index,MEM_STATES state)
  *
- *  @par
+ *  @par        One memory step. References are kept in the binary A/B image of cfg_store;
+ *              MEM_MIGRATE_CONFIG reads the old per-reference text file of one row.
  *
- *  @param      None.
+ *  @param      u16Index  refData row, MEM_MIGRATE_CONFIG only.
+ *  @param      state     Step to run.
  *
- *  @return     None.
+ *  @return     MEM_INIT: 1 done, 2 disk error.
+ *              MEM_SAVE_CONFIG: 1 image written, 2 disk error.
+ *              MEM_READ_CONFIG: 1 image loaded, 2 disk error, 3 no image on the card.
+ *              MEM_MIGRATE_CONFIG: 1 when the row is done.
  *
  *  @par        Design Info
  *              WCET            : Enter Worst Case Execution Time heres
@@ -204,17 +209,33 @@ u8 memHnadler(u16 u16Index,MEM_STATES state)
 		break;
 	case MEM_SAVE_CONFIG:
 		WCET_SetDwt(0);
-			u8ReturnValue=updateConfig(u16Index);
+		u8ReturnValue=(CFG_STORE_OK==cfg_store_save()) ? 1 : 2;
 		WCET_Update(&U32WriteWcTime);
 		//iState=MEM_IDLE;
 		break;
 	case MEM_READ_CONFIG:
 		WCET_SetDwt(0);
-			u8ReturnValue=readConfigFile(u16Index);
+		switch(cfg_store_load())
+		{
+		case CFG_STORE_OK:
+			u8ReturnValue=1;
+			break;
+		case CFG_STORE_EMPTY:
+			u8ReturnValue=3;
+			break;
+		default:
+			u8ReturnValue=2;
+			break;
+		}
 		WCET_Update(&U32ReadWcTime);
 
 		//iState=MEM_IDLE;
 		break;
+	case MEM_MIGRATE_CONFIG:
+		u8ReturnValue=readConfigFile(u16Index);
+		break;
+	default:
+		break;
 	}
 	return u8ReturnValue;
 }
@@ -223,7 +244,8 @@ u8 memHnadler(u16 u16Index,MEM_STATES state)
  *
  *  @fn         void readConfigFile(int index)
  *
- *  @par
+ *  @par        Reads the old CFG/REFn.txt file of one row. Only used once to migrate a card
+ *              written by an older firmware into the config image.
  *
  *  @param      None.
  *
@@ -304,116 +326,6 @@ u8 readConfigFile(int index)
 	}
 	return u8ReturnValue;
 }
-/*!
- **************************************************************************************************
- *
- *  @fn         void updateConfig(int index)
- *
- *  @par
- *
- *  @param      None.
- *
- *  @return     None.
- *
- *  @par        Design Info
- *              WCET            : (1380110 / 168000000) = 8.2 msec
- *              Sync/Async      : sync
- *
- **************************************************************************************************
- */
-u8 updateConfig(int index)
-{
-	char eR[MAX_BUFFER_SIZE];
-	char buffer[REF_BUFFER_SIZE];
-	static char filePath[FILE_PATH_SIZE];
-	UINT bytes_written=0;
-	static FIL  myFileConfig;
-	RefDataType *rData=getRefData();
-	u8 u8ReturnValue=0;
-	static u8 u8State=0;
-	u16 u16Error=0;
-
-	switch(u8State)
-	{
-	case 0:
-		snprintf(filePath, FILE_PATH_SIZE, "CFG/%s.txt",rData[index].ref);
-		u16Error=f_open(&myFileConfig,filePath,FA_WRITE|FA_READ|FA_OPEN_EXISTING);
-		if(0==u16Error)
-		{
-			u8State=2;
-		}
-		else if(4==u16Error)
-		{
-			u8State=1;
-		}
-		else if(5==u16Error || 1==u16Error)
-		{
-			u8State=0;
-			u8ReturnValue=2;
-		}
-		else
-		{
-			u8State=0;
-			u8ReturnValue=1;
-		}
-		SD_Error("Open",eR,u16Error);
-		break;
-	case 1:
-		/*_________________________________________*/
-		/*   If There is No File Create a New One  */
-		u16Error=f_open(&myFileConfig,filePath,FA_WRITE|FA_CREATE_NEW|FA_READ);
-		if(0==u16Error)
-		{
-			u8State=2;
-		}
-		else
-		{
-			u8State=0;
-			u8ReturnValue=1;
-		}
-		SD_Error("Create",eR,u16Error);
-		break;
-	case 2:
-		memset(buffer,' ',REF_BUFFER_SIZE);
-		snprintf(buffer, REF_BUFFER_SIZE,"\"%s\": \"%s*%0.1f*%s\"", rData[index].ref,
-				rData[index].name,rData[index].value,rData[index].unit);
-		f_lseek(&myFileConfig,0);
-		u16Error=f_write(&myFileConfig, buffer, REF_BUFFER_SIZE, &bytes_written);
-		if(0==u16Error)
-		{
-			u8State=3;
-			char buffer2[REF_BUFFER_SIZE+5];
-			snprintf(buffer2,REF_BUFFER_SIZE+1,"%s\r",buffer);
-			TransmitCMDResponse(buffer2);
-			u8ReturnValue=3;
-		}
-		else
-		{
-			u8State=3;
-		}
-		SD_Error("Write",eR,u16Error);
-		break;
-	case 3:
-		f_sync(&myFileConfig); // Forces write to SD
-		u8State=4;
-		break;
-	case 4:
-     	u16Error=f_close(&myFileConfig);
-		if(0==u16Error)
-		{
-			u8State=0;
-			u8ReturnValue=4;
-		}
-		else
-		{
-			u8State=4;
-			u8ReturnValue=1;
-		}
-		SD_Error("Close",eR,u16Error);
-		break;
-	}
-	return u8ReturnValue;
-}
 /*!
  **************************************************************************************************
  *
@@ -435,6 +347,8 @@ int SD_init(char immidiate)
 {
 	char Error;
 
+	/* FAT and directory sectors pass through this window, cache them write-back */
+	SD_CacheSetMeta(SDFatFs.win);
 	Error = f_mount(&SDFatFs, (TCHAR const*)SDPath, immidiate);
 
 	return Error;
@@ -58,7 +58,8 @@ typedef enum {
 	MEM_SAVE_CONFIG,
 	MEM_READ_CONFIG,
 	MEM_DISK_INIT,
-	MEM_WAIT
+	MEM_WAIT,
+	MEM_MIGRATE_CONFIG
 }MEM_STATES;
 typedef struct{
 	uint32_t logTime;
@@ -0,0 +1,293 @@
+/**
+ * @file cfg_store.c
+ * @brief Binary A/B configuration image implementation
+ *
+ * Slots are 512 bytes and sector aligned, so FatFs writes a slot straight
+ * into one data sector. Once both slots exist the file size never changes
+ * and a save does not touch the FAT or the directory entry either. A torn
+ * slot fails its CRC and the other slot is used.
+ *
+ * @date 2025-10-28
+ * @author Allayar Moazami
+ */
+#include "cfg_store.h"
+#include "kv_store.h"
+#include "fatfs.h"
+#include "mntdata.h"
+#include "crc.h"
+#include "dbg.h"
+#include <stddef.h>
+#include <string.h>
+
+/* ========================================================================
+ * Constants
+ * ======================================================================== */
+
+/** @brief Image file, the CFG directory is created by MEM */
+#define CFG_STORE_FILE_PATH "CFG/CONFIG.BIN"
+
+/** @brief Image marker, "SCFG" */
+#define CFG_STORE_MAGIC 0x47464353UL
+
+/** @brief Image layout version */
+#define CFG_STORE_VERSION 1U
+
+/** @brief Size of one slot, one SD sector */
+#define CFG_STORE_SLOT_SIZE 512U
+
+/** @brief Number of slots */
+#define CFG_STORE_SLOT_COUNT 2U
+
+/** @brief Reference capacity of an image */
+#define CFG_STORE_MAX_REFS 32U
+
+/* ========================================================================
+ * Types
+ * ======================================================================== */
+
+/**
+ * @struct StuCfgEntry
+ * @brief One stored reference
+ */
+typedef struct StuCfgEntryStruct
+{
+    u16 index;      /**< REF_WEB_INDEX of the row */
+    u16 reserved;
+    f32 value;      /**< Reference value */
+} StuCfgEntry;
+
+/**
+ * @struct StuCfgImage
+ * @brief One slot
+ */
+typedef struct StuCfgImageStruct
+{
+    u32 magic;                              /**< CFG_STORE_MAGIC */
+    u16 version;                            /**< CFG_STORE_VERSION */
+    u16 count;                              /**< Valid entries */
+    u32 seq;                                /**< Write sequence, the higher one is newer */
+    u32 reserved;
+    StuCfgEntry entry[CFG_STORE_MAX_REFS];  /**< References */
+    u32 crc;                                /**< CRC32 over the fields above */
+    u8 pad[CFG_STORE_SLOT_SIZE - 16U - (8U * CFG_STORE_MAX_REFS) - 4U];
+} StuCfgImage;
+
+/* ========================================================================
+ * Static Variables
+ * ======================================================================== */
+
+/** @brief Both slots as read at start-up, then the image being written */
+static StuCfgImage gImage[CFG_STORE_SLOT_COUNT];
+
+/** @brief Slot of the newest valid image */
+static u8 gSlot = 0;
+
+/** @brief Sequence of the newest valid image */
+static u32 gSeq = 0;
+
+/** @brief gSlot holds a valid image */
+static u8 gValid = 0;
+
+/** @brief File object, only open during a single access */
+static FIL gCfgFile;
+
+/** @brief A reference changed since the last image write */
+static volatile u8 gSdDirty = 0;
+
+/** @brief References were restored from flash, the image is only a backup */
+static u8 gFlashLoaded = 0;
+
+/* ========================================================================
+ * Static Helper Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Check magic, version, count and CRC of a slot
+ * @param[in] image Slot content
+ * @return 1 if the slot holds a usable image
+ */
+static u8 cfg_store_check(const StuCfgImage *image)
+{
+    if (CFG_STORE_MAGIC != image->magic || CFG_STORE_VERSION != image->version ||
+        image->count > CFG_STORE_MAX_REFS) {
+        return 0;
+    }
+    return (image->crc == calculateCRC32((const u8 *)image, offsetof(StuCfgImage, crc))) ? 1U : 0U;
+}
+
+/* ========================================================================
+ * Public Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Restore all references from the newest valid image
+ *
+ * @return CFG_STORE_OK, CFG_STORE_EMPTY or CFG_STORE_DISK_ERR
+ */
+EnuCfgStoreResult cfg_store_load(void)
+{
+    const StuCfgImage *image;
+    RefDataType *row;
+    UINT bytes = 0;
+    FRESULT res;
+
+    gValid = 0;
+    res = f_open(&gCfgFile, CFG_STORE_FILE_PATH, FA_READ | FA_OPEN_EXISTING);
+    if (FR_NO_FILE == res) {
+        if (1U == gFlashLoaded) {
+            gSdDirty = 1;
+            return CFG_STORE_OK;
+        }
+        return CFG_STORE_EMPTY;
+    }
+    if (FR_OK != res) {
+        return CFG_STORE_DISK_ERR;
+    }
+    /* Both slots in one read */
+    res = f_read(&gCfgFile, gImage, sizeof(gImage), &bytes);
+    f_close(&gCfgFile);
+    if (FR_OK != res) {
+        return CFG_STORE_DISK_ERR;
+    }
+
+    for (u8 slot = 0; slot < CFG_STORE_SLOT_COUNT; slot++) {
+        if (bytes < ((slot + 1U) * CFG_STORE_SLOT_SIZE) || 0U == cfg_store_check(&gImage[slot])) {
+            continue;
+        }
+        if (0U == gValid || (int32_t)(gImage[slot].seq - gSeq) > 0) {
+            gSlot = slot;
+            gSeq = gImage[slot].seq;
+            gValid = 1;
+        }
+    }
+    if (0U == gValid) {
+        TransmitDebug(">> Config image invalid\r");
+        if (0U == gFlashLoaded) {
+            return CFG_STORE_EMPTY;
+        }
+    }
+    if (1U == gFlashLoaded) {
+        /* Flash is newer, possibly changed while the card was out */
+        gSdDirty = 1;
+        return CFG_STORE_OK;
+    }
+
+    image = &gImage[gSlot];
+    for (u16 i = 0; i < image->count; i++) {
+        row = getRefHandle(image->entry[i].index);
+        if (NULL != row) {
+            row->value = image->entry[i].value;
+            row->flag = (REF_REPORT_TO_WEB | REF_UPDATED_VALUE);
+            kv_store_set(KV_KEY_REF(row->index), &row->value, sizeof(row->value));
+        }
+    }
+    return CFG_STORE_OK;
+}
+
+/**
+ * @brief Restore all references from the flash key/value store
+ *
+ * @return Number of references restored, 0 if the flash store has none
+ */
+u16 cfg_store_load_flash(void)
+{
+    RefDataType *rData = getRefData();
+    u16 restored = 0;
+    f32 value;
+
+    for (u16 i = 0; i < REF_ARRAY_SIZE; i++) {
+        if (0 == rData[i].ref[0]) {
+            continue;
+        }
+        if (sizeof(value) == kv_store_get(KV_KEY_REF(rData[i].index), &value, sizeof(value))) {
+            rData[i].value = value;
+            rData[i].flag = (REF_REPORT_TO_WEB | REF_UPDATED_VALUE);
+            restored++;
+        }
+    }
+    gFlashLoaded = (0U != restored) ? 1U : 0U;
+    return restored;
+}
+
+/**
+ * @brief Move changed references into the flash key/value store
+ */
+void cfg_store_service(void)
+{
+    RefDataType *rData = getRefData();
+
+    for (u16 i = 0; i < REF_ARRAY_SIZE; i++) {
+        if (0 != (rData[i].flag & REF_WRITE_TO_MEM)) {
+            rData[i].flag &= ~REF_WRITE_TO_MEM;
+            kv_store_set(KV_KEY_REF(rData[i].index), &rData[i].value, sizeof(rData[i].value));
+            gSdDirty = 1;
+        }
+    }
+}
+
+/**
+ * @brief Check whether the SD image is outdated
+ *
+ * @return 1 if a reference changed since the last image write, 0 otherwise
+ */
+u8 cfg_store_pending(void)
+{
+    return gSdDirty;
+}
+
+/**
+ * @brief Write all references into the older slot
+ *
+ * @return CFG_STORE_OK or CFG_STORE_DISK_ERR
+ */
+EnuCfgStoreResult cfg_store_save(void)
+{
+    RefDataType *rData = getRefData();
+    u8 next = (1U == gValid) ? (u8)(gSlot ^ 1U) : 0U;
+    StuCfgImage *image = &gImage[next];
+    UINT bytes = 0;
+    FRESULT res;
+    u16 count = 0;
+
+    gSdDirty = 0;
+    memset(image, 0, sizeof(*image));
+    for (u16 i = 0; i < REF_ARRAY_SIZE && count < CFG_STORE_MAX_REFS; i++) {
+        if (0 == rData[i].ref[0]) {
+            continue;
+        }
+        kv_store_set(KV_KEY_REF(rData[i].index), &rData[i].value, sizeof(rData[i].value));
+        image->entry[count].index = (u16)rData[i].index;
+        image->entry[count].value = rData[i].value;
+        count++;
+    }
+    image->magic = CFG_STORE_MAGIC;
+    image->version = CFG_STORE_VERSION;
+    image->count = count;
+    image->seq = gSeq + 1U;
+    image->crc = calculateCRC32((const u8 *)image, offsetof(StuCfgImage, crc));
+
+    res = f_open(&gCfgFile, CFG_STORE_FILE_PATH, FA_WRITE | FA_OPEN_ALWAYS);
+    if (FR_OK == res) {
+        res = f_lseek(&gCfgFile, (FSIZE_t)next * CFG_STORE_SLOT_SIZE);
+        if (FR_OK == res) {
+            res = f_write(&gCfgFile, image, sizeof(*image), &bytes);
+        }
+        if (FR_OK != f_close(&gCfgFile) && FR_OK == res) {
+            res = FR_DISK_ERR;
+        }
+    }
+    if (FR_OK == res) {
+        /* The directory entry must not lag behind the slot */
+        res = (RES_OK == SD_CacheFlush()) ? FR_OK : FR_DISK_ERR;
+    }
+    if (FR_OK != res || sizeof(*image) != bytes) {
+        gSdDirty = 1;
+        TransmitDebug(">> Config image write failed\r");
+        return CFG_STORE_DISK_ERR;
+    }
+
+    gSlot = next;
+    gSeq = image->seq;
+    gValid = 1;
+    return CFG_STORE_OK;
+}
@@ -0,0 +1,88 @@
+/**
+ * @file cfg_store.h
+ * @brief Binary A/B configuration image on the SD card
+ *
+ * All references of refData are stored as one binary image: magic,
+ * version, write sequence, the (REF_WEB_INDEX, value) pairs and a CRC32.
+ * CFG/CONFIG.BIN holds two sector-sized slots; a save always overwrites the
+ * slot that does not hold the newest valid image, so a power loss during
+ * the write leaves the previous image intact. Loading reads both slots with
+ * a single f_read and takes the valid one with the higher sequence.
+ *
+ * Units that still carry the old CFG/REFn.txt files are migrated once: MEM
+ * restores the text files and the image is written from the result.
+ *
+ * The primary copy of every reference is the internal flash key/value
+ * store (kv_store): it is restored at start-up without the card and every
+ * changed reference is written there first. The SD image is the backup and
+ * the migration source for units whose flash store is still empty.
+ *
+ * @date 2025-10-28
+ * @author Allayar Moazami
+ */
+#ifndef H_CFG_STORE
+#define H_CFG_STORE
+
+#include "platform.h"
+
+/**
+ * @enum EnuCfgStoreResult
+ * @brief Result of a load or save
+ */
+typedef enum EnuCfgStoreResultEnum
+{
+    CFG_STORE_OK = 0,       /**< Image loaded or written */
+    CFG_STORE_EMPTY,        /**< No valid image on the card */
+    CFG_STORE_DISK_ERR      /**< Card not accessible */
+} EnuCfgStoreResult;
+
+/**
+ * @brief Restore all references from the flash key/value store
+ *
+ * Called at start-up after kv_store_init() and refDataInit().
+ *
+ * @return Number of references restored, 0 if the flash store has none
+ */
+u16 cfg_store_load_flash(void);
+
+/**
+ * @brief Move changed references into the flash key/value store
+ *
+ * Clears REF_WRITE_TO_MEM of every flagged row, hands the value to
+ * kv_store_set() and marks the SD image outdated. Works without a card.
+ */
+void cfg_store_service(void);
+
+/**
+ * @brief Restore all references from the newest valid image
+ *
+ * Restored rows are flagged REF_REPORT_TO_WEB | REF_UPDATED_VALUE, the same
+ * as after the old per-file read, and copied into the flash store. When
+ * cfg_store_load_flash() already restored the references, only the slots
+ * are checked and the image is marked outdated, so it is rewritten from
+ * the flash values.
+ *
+ * @return CFG_STORE_OK, CFG_STORE_EMPTY or CFG_STORE_DISK_ERR
+ */
+EnuCfgStoreResult cfg_store_load(void);
+
+/**
+ * @brief Check whether the SD image is outdated
+ *
+ * @return 1 if a reference changed since the last image write, 0 otherwise
+ */
+u8 cfg_store_pending(void);
+
+/**
+ * @brief Write all references into the older slot
+ *
+ * The outdated mark is cleared before the values are captured, so a change
+ * arriving during the save marks the image again. On failure the mark is
+ * restored and the save is retried later. All values are also handed to
+ * the flash store, which skips the unchanged ones.
+ *
+ * @return CFG_STORE_OK or CFG_STORE_DISK_ERR
+ */
+EnuCfgStoreResult cfg_store_save(void);
+
+#endif /* H_CFG_STORE */
@@ -0,0 +1,1699 @@
+/**
+ * @file data_logger.c
+ * @brief Local 1 s history implementation
+ *
+ * A day file is a header sector, the schema sectors, the time index sectors
+ * and LOGGER_DAY_RECORDS record slots of 256 bytes, appended in time order.
+ * Records always leave the double buffer in groups of LOGGER_BUF_RECORDS,
+ * so every data write starts on a sector boundary and covers whole sectors.
+ *
+ * The index sector being filled is kept in RAM and written in front of
+ * every header update, so the index on the card always covers the header
+ * count. Queries read the files with raw disk_read() calls from the start
+ * sector found by f_open(), in the logger context.
+ *
+ * Only data and header sectors of the preallocated file are written with
+ * SD_AsyncWrite(); the FAT and the directory entry are final after
+ * f_expand(), so nothing FatFs caches goes stale. Creating, checking and
+ * rotating files uses normal FatFs calls with the file opened and closed
+ * per access, like the other SD users (_FS_LOCK = 2).
+ *
+ * @date 2025-10-30
+ * @author Allayar Moazami
+ */
+#include "data_logger.h"
+#include "fatfs.h"
+#include "sd_diskio.h"
+#include "signal_db.h"
+#include "httpFrame.h"
+#include "server.h"
+#include "myrtc.h"
+#include "crc.h"
+#include "dbg.h"
+#include "main.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ========================================================================
+ * Constants
+ * ======================================================================== */
+
+/** @brief Header marker, "SLOG" */
+#define LOGGER_MAGIC 0x474F4C53UL
+
+/** @brief File layout version */
+#define LOGGER_VERSION 3U
+
+/** @brief SD sector size */
+#define LOGGER_SECTOR_SIZE 512U
+
+/** @brief Header, schema and index sectors in front of the records */
+#define LOGGER_HEADER_SECTORS 16U
+
+/** @brief First time index sector, the index fills the rest of the header area */
+#define LOGGER_INDEX_SECTOR 4U
+
+/** @brief Time index entries per sector */
+#define LOGGER_INDEX_ENTRIES (LOGGER_SECTOR_SIZE / sizeof(u32))
+
+/** @brief Time index entry not written yet */
+#define LOGGER_INDEX_EMPTY 0xFFFFFFFFUL
+
+/** @brief Date part of a packed time stamp */
+#define LOGGER_DATE_MASK 0xFFFE0000UL
+
+/** @brief Sectors read at most by one data_logger_query_next() call */
+#define LOGGER_QUERY_READS 8U
+
+/** @brief Schema name length including the terminator */
+#define LOGGER_NAME_SIZE 12U
+
+/** @brief Schema unit length including the terminator, "kvarh" fits */
+#define LOGGER_UNIT_SIZE 8U
+
+/** @brief Days deleted at most to make room for a new one */
+#define LOGGER_ROTATE_MAX 8U
+
+/** @brief Set-aside copies of one day, Lyymmdd.B00 to .B99 */
+#define LOGGER_ASIDE_MAX 100U
+
+/** @brief Record groups probed behind the header count after a reset */
+#define LOGGER_RESUME_MAX 64U
+
+/** @brief Default and largest number of benchmark writes */
+#define LOGGER_BENCH_DEFAULT 32U
+#define LOGGER_BENCH_MAX 512U
+
+/** @brief Record groups at the end of a file cycled by the benchmark */
+#define LOGGER_BENCH_AREA 16U
+
+/** @brief Size of temporary string buffer for formatting */
+#define TEMP_STRING_SIZE 128
+
+/** @brief Size of one printed query result */
+#define LOGGER_LINE_SIZE 220
+
+/** @brief Size of the API URL buffer in GPRS_HandleTypeDef */
+#define LOGGER_API_SIZE 50
+
+/** @brief Room kept free at the end of a frame for the closing braces */
+#define FRAME_TAIL_SIZE 8
+
+/* ========================================================================
+ * Types
+ * ======================================================================== */
+
+/**
+ * @struct StuLogRecord
+ * @brief One sample of all signals, two records per sector
+ */
+typedef struct StuLogRecordStruct
+{
+    u32 stamp;                      /**< Packed date/time, see data_logger_pack() */
+    u16 count;                      /**< Signals logged, the rest is INVALID_DATA */
+    u16 reserved;
+    f32 value[LOGGER_MAX_VALUES];   /**< Values in signal ID order, INVALID_DATA if not reported */
+    u32 crc;                        /**< CRC32 over the fields above */
+} StuLogRecord;
+
+/**
+ * @struct StuLogHeader
+ * @brief First sector of a day file
+ */
+typedef struct StuLogHeaderStruct
+{
+    u32 magic;          /**< LOGGER_MAGIC */
+    u16 version;        /**< LOGGER_VERSION */
+    u16 recordSize;     /**< sizeof(StuLogRecord) */
+    u16 valueCount;     /**< LOGGER_MAX_VALUES */
+    u16 interval;       /**< Sampling interval in ms */
+    u32 date;           /**< Packed date of the day, time fields 0 */
+    u32 capacity;       /**< Record slots, LOGGER_DAY_RECORDS */
+    u32 count;          /**< Record slots written, padding included */
+    u32 dropped;        /**< Samples lost to a slow or missing card */
+    u32 schemaCrc;      /**< CRC32 of the schema sectors */
+    u32 crc;            /**< CRC32 over the fields above */
+    u8 pad[LOGGER_SECTOR_SIZE - 36U];
+} StuLogHeader;
+
+/**
+ * @struct StuLogSchema
+ * @brief Description of one value slot, stored behind the header
+ */
+typedef struct StuLogSchemaStruct
+{
+    char name[LOGGER_NAME_SIZE];    /**< Signal name, empty for unused slots */
+    char unit[LOGGER_UNIT_SIZE];    /**< Signal unit */
+} StuLogSchema;
+
+/**
+ * @enum EnuLoggerIo
+ * @brief Asynchronous write in flight
+ */
+typedef enum EnuLoggerIoEnum
+{
+    LOGGER_IO_IDLE = 0,     /**< Nothing in flight */
+    LOGGER_IO_DATA,         /**< Buffer half */
+    LOGGER_IO_HEADER,       /**< Header sector */
+    LOGGER_IO_INDEX,        /**< Time index sector */
+    LOGGER_IO_BENCH         /**< Benchmark write */
+} EnuLoggerIo;
+
+/**
+ * @enum EnuLoggerBench
+ * @brief Benchmark state, shared with the command context
+ */
+typedef enum EnuLoggerBenchEnum
+{
+    LOGGER_BENCH_IDLE = 0,  /**< No benchmark */
+    LOGGER_BENCH_RUNNING,   /**< Requested or running */
+    LOGGER_BENCH_DONE,      /**< Result available */
+    LOGGER_BENCH_FAILED     /**< Refused or write error */
+} EnuLoggerBench;
+
+/**
+ * @enum EnuLoggerJob
+ * @brief Query job state, shared with the command context
+ */
+typedef enum EnuLoggerJobEnum
+{
+    LOGGER_JOB_IDLE = 0,    /**< No query */
+    LOGGER_JOB_REQUESTED,   /**< Request filled by the command context */
+    LOGGER_JOB_RUNNING,     /**< Query running */
+    LOGGER_JOB_LINE,        /**< Result line waiting for the command context */
+    LOGGER_JOB_DONE,        /**< Query finished */
+    LOGGER_JOB_FAILED       /**< Invalid request or card error */
+} EnuLoggerJob;
+
+/** @brief Sectors of one buffer half */
+#define LOGGER_WRITE_SECTORS ((LOGGER_BUF_RECORDS * sizeof(StuLogRecord)) / LOGGER_SECTOR_SIZE)
+
+/** @brief Size of a day file */
+#define LOGGER_FILE_SIZE ((FSIZE_t)LOGGER_HEADER_SECTORS * LOGGER_SECTOR_SIZE + \
+                          (FSIZE_t)LOGGER_DAY_RECORDS * sizeof(StuLogRecord))
+
+/* ========================================================================
+ * Static Variables
+ * ======================================================================== */
+
+/** @brief Record double buffer, one half fills while the other is written */
+static StuLogRecord gBuf[2][LOGGER_BUF_RECORDS];
+
+/** @brief Header of the open day file, also the DMA source of its update */
+static StuLogHeader gHeader;
+
+/** @brief Schema of the current firmware */
+static StuLogSchema gSchema[LOGGER_MAX_VALUES];
+
+/** @brief Time index sector being filled, also the DMA source of its update */
+static u32 gIndex[LOGGER_INDEX_ENTRIES];
+
+/** @brief Number of that sector within the index and its unwritten change */
+static u32 gIndexSector = 0;
+static u8 gIndexDirty = 0;
+
+/** @brief Half being filled and records in it */
+static u8 gFill = 0;
+static u8 gFillCount = 0;
+
+/** @brief Full halves waiting for the card, bit per half */
+static u8 gPending = 0;
+
+/** @brief Half written next, halves are written in fill order */
+static u8 gWriteHalf = 0;
+
+/** @brief Day file open and writable */
+static u8 gReady = 0;
+
+/** @brief Day ended: flush and close the file, then open the next day */
+static u8 gCloseDay = 0;
+
+/** @brief First sector of the day file on the card */
+static u32 gStart = 0;
+
+/** @brief Record slots written to the day file */
+static u32 gCount = 0;
+
+/** @brief Data writes since the last header update */
+static u8 gSyncCount = 0;
+
+/** @brief Asynchronous write in flight and its start time */
+static u8 gIo = LOGGER_IO_IDLE;
+static u32 gIoTick = 0;
+
+/** @brief Tracked date and second of day */
+static int gYear = 0, gMonth = 0, gDay = 0;
+static u32 gSecond = 0;
+
+/** @brief RTC reading the clock was last aligned to */
+static DateTime gRtcSeen;
+
+/** @brief Clock aligned to a valid RTC reading */
+static u8 gClockValid = 0;
+
+/** @brief Next sample time, last open attempt */
+static u32 gSampleTick = 0;
+static u32 gRetryTick = 0;
+
+/** @brief Write statistics since start-up */
+static u32 gWrites = 0;
+static u32 gErrors = 0;
+static u32 gDropped = 0;
+static u32 gLatencySum = 0;
+static u32 gLatencyMax = 0;
+
+/** @brief Benchmark request, progress and result */
+static volatile u16 gBenchReq = 0;
+static volatile u8 gBenchState = LOGGER_BENCH_IDLE;
+static u16 gBenchLeft = 0;
+static u16 gBenchCount = 0;
+static u8 gBenchHalf = 0;
+static u8 gBenchActive = 0;
+static u32 gBenchBusy = 0;
+static u32 gBenchMax = 0;
+
+/** @brief Printed query, its state and the line waiting for the command port */
+static StuLogQuery gShellQuery;
+static volatile u8 gShellState = LOGGER_JOB_IDLE;
+static char gShellLine[LOGGER_LINE_SIZE];
+
+/** @brief Upload query, its state and the record held for the modem */
+static StuLogQuery gUploadQuery;
+static volatile u8 gUploadState = LOGGER_JOB_IDLE;
+static volatile u8 gUploadStop = 0;
+static u8 gUploadHeld = 0;
+static u8 gUploadInFlight = 0;
+static u8 gUploadRetry = 0;
+static u32 gUploadStamp = 0;
+static f32 gUploadValue[LOGGER_QUERY_SIGNALS];
+static u32 gUploadSent = 0;
+static u32 gUploadSkipped = 0;
+
+/** @brief FatFs objects, only used during a single access */
+static FIL gLogFile;
+static DIR gLogDir;
+static FILINFO gLogInfo;
+
+/* ========================================================================
+ * Static Function Prototypes
+ * ======================================================================== */
+
+static u32 data_logger_pack(int year, int month, int day, u32 second);
+static DateTime data_logger_unpack(u32 stamp);
+static void data_logger_next_day(int *year, int *month, int *day);
+static u8 data_logger_clock(void);
+static u32 data_logger_record_crc(const StuLogRecord *record);
+static u32 data_logger_schema_crc(void);
+static void data_logger_path(char *path, u32 size, u32 date);
+static u8 data_logger_delete_oldest(const char *keep);
+static u8 data_logger_set_aside(const char *path);
+static u8 data_logger_header_ok(const StuLogHeader *header, u32 date);
+static u8 data_logger_check(void);
+static u8 data_logger_resume(void);
+static u8 data_logger_create(const char *path);
+static u8 data_logger_open(void);
+static u8 data_logger_half_free(u8 half);
+static void data_logger_queue(void);
+static void data_logger_sample(void);
+static void data_logger_index(u32 stamp);
+static u8 data_logger_write(const void *data, u32 sector, u32 count, u8 io, u32 now);
+static void data_logger_io_done(u32 now);
+static void data_logger_io(u32 now);
+static const u32 *data_logger_query_sector(StuLogQuery *query, u32 lba);
+static const StuLogRecord *data_logger_query_record(StuLogQuery *query, u32 record);
+static u8 data_logger_query_open(StuLogQuery *query);
+static u8 data_logger_query_seek(StuLogQuery *query);
+static void data_logger_query_next_day(StuLogQuery *query);
+static void data_logger_shell_job(void);
+static void data_logger_upload_job(void);
+static int data_logger_signal_find(const char *name);
+static u8 data_logger_log_parse(const char *arg, StuLogQuery *query);
+
+/* ========================================================================
+ * Static Helper Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Pack date and second of day into 32 bits
+ *
+ * Same layout as the telemetry spool:
+ * year-2000 (6) | month (4) | day (5) | hour (5) | minute (6) | second (6)
+ *
+ * @param[in] year   Year
+ * @param[in] month  Month 1..12
+ * @param[in] day    Day 1..31
+ * @param[in] second Second of day
+ * @return Packed time stamp
+ */
+static u32 data_logger_pack(int year, int month, int day, u32 second)
+{
+    return ((u32)(year - 2000) << 26) | ((u32)month << 22) | ((u32)day << 17) |
+           ((second / 3600U) << 12) | (((second / 60U) % 60U) << 6) | (second % 60U);
+}
+
+/**
+ * @brief Unpack a time stamp produced by data_logger_pack()
+ * @param[in] stamp Packed time stamp
+ * @return RTC date/time
+ */
+static DateTime data_logger_unpack(u32 stamp)
+{
+    DateTime tm;
+
+    memset(&tm, 0, sizeof(tm));
+    tm.year = (int)(stamp >> 26) + 2000;
+    tm.month = (int)((stamp >> 22) & 0x0F);
+    tm.day = (int)((stamp >> 17) & 0x1F);
+    tm.hour = (int)((stamp >> 12) & 0x1F);
+    tm.minute = (int)((stamp >> 6) & 0x3F);
+    tm.second = (int)(stamp & 0x3F);
+    return tm;
+}
+
+/**
+ * @brief Advance a date by one day
+ * @param[in,out] year  Year
+ * @param[in,out] month Month 1..12
+ * @param[in,out] day   Day 1..31
+ */
+static void data_logger_next_day(int *year, int *month, int *day)
+{
+    static const u8 monthDays[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    int days = monthDays[(*month - 1) % 12];
+
+    if (2 == *month && 0 == (*year % 4)) {
+        days = 29;
+    }
+    if (++(*day) > days) {
+        *day = 1;
+        if (++(*month) > 12) {
+            *month = 1;
+            (*year)++;
+        }
+    }
+}
+
+/**
+ * @brief Advance the clock by one interval, align it to a new RTC reading
+ *
+ * The RTC is read by the log manager once per LOG_TICK; in between the
+ * second of day is counted here, so sampling costs no I2C traffic.
+ *
+ * @return 1 if the clock is valid
+ */
+static u8 data_logger_clock(void)
+{
+    if (1 == _timeTag &&
+        (urtc.second != gRtcSeen.second || urtc.minute != gRtcSeen.minute ||
+         urtc.hour != gRtcSeen.hour || urtc.day != gRtcSeen.day ||
+         urtc.month != gRtcSeen.month || urtc.year != gRtcSeen.year)) {
+        gRtcSeen = urtc;
+        gYear = urtc.year;
+        gMonth = urtc.month;
+        gDay = urtc.day;
+        gSecond = (u32)urtc.hour * 3600U + (u32)urtc.minute * 60U + (u32)urtc.second;
+        gClockValid = (gMonth >= 1 && gMonth <= 12 && gSecond < LOGGER_DAY_RECORDS) ? 1U : 0U;
+        return gClockValid;
+    }
+    if (1U == gClockValid && ++gSecond >= LOGGER_DAY_RECORDS) {
+        gSecond = 0;
+        data_logger_next_day(&gYear, &gMonth, &gDay);
+    }
+    return gClockValid;
+}
+
+/**
+ * @brief Calculate the record CRC
+ * @param[in] record Record to check
+ * @return CRC32 over all fields in front of crc
+ */
+static u32 data_logger_record_crc(const StuLogRecord *record)
+{
+    return calculateCRC32((const u8 *)record, offsetof(StuLogRecord, crc));
+}
+
+/**
+ * @brief Build the schema of the current firmware
+ * @return CRC32 of the schema
+ */
+static u32 data_logger_schema_crc(void)
+{
+    const StuSignalMeta *meta;
+
+    memset(gSchema, 0, sizeof(gSchema));
+    for (u16 i = 0; i < LOGGER_MAX_VALUES && i < SIG_COUNT; i++) {
+        meta = signal_db_meta((EnuSignalId)i);
+        strncpy(gSchema[i].name, meta->name, LOGGER_NAME_SIZE - 1U);
+        strncpy(gSchema[i].unit, meta->unit, LOGGER_UNIT_SIZE - 1U);
+    }
+    return calculateCRC32((const u8 *)gSchema, sizeof(gSchema));
+}
+
+/**
+ * @brief Build the path of a day file
+ * @param[out] path Output buffer
+ * @param[in]  size Buffer size
+ * @param[in]  date Packed date of the day
+ */
+static void data_logger_path(char *path, u32 size, u32 date)
+{
+    snprintf(path, size, "%s/L%02u%02u%02u.BIN", LOGGER_DIR, (unsigned)(date >> 26),
+             (unsigned)((date >> 22) & 0x0FU), (unsigned)((date >> 17) & 0x1FU));
+}
+
+/**
+ * @brief Delete the oldest day file
+ * @param[in] keep Path of the file that must stay
+ * @return 1 if a file was deleted
+ */
+static u8 data_logger_delete_oldest(const char *keep)
+{
+    char oldest[13] = { 0 };
+    char path[24];
+
+    if (FR_OK != f_opendir(&gLogDir, LOGGER_DIR)) {
+        return 0;
+    }
+    while (FR_OK == f_readdir(&gLogDir, &gLogInfo) && 0 != gLogInfo.fname[0]) {
+        /* Day files and set-aside copies: "Lyymmdd.BIN", "Lyymmdd.Bnn", compared as yymmdd */
+        if ('L' != gLogInfo.fname[0] || 11U != strlen(gLogInfo.fname) ||
+            0 != strncmp(&gLogInfo.fname[7], ".B", 2) ||
+            NULL != strstr(keep, gLogInfo.fname)) {
+            continue;
+        }
+        if (0 == oldest[0] || strcmp(gLogInfo.fname, oldest) < 0) {
+            strcpy(oldest, gLogInfo.fname);
+        }
+    }
+    f_closedir(&gLogDir);
+    if (0 == oldest[0]) {
+        return 0;
+    }
+    snprintf(path, sizeof(path), "%s/%s", LOGGER_DIR, oldest);
+    if (FR_OK != f_unlink(path)) {
+        return 0;
+    }
+    TransmitDebug(">>Log day deleted\r");
+    return 1;
+}
+
+/**
+ * @brief Rename a day file this firmware can't append to
+ *
+ * The file keeps its records and its own schema, "Lyymmdd.BIN" becomes the
+ * first free "Lyymmdd.Bnn". Set-aside copies are deleted with the day when
+ * the card runs out of room.
+ *
+ * @param[in] path Path of the day file
+ * @return 1 if the day file name is free again
+ */
+static u8 data_logger_set_aside(const char *path)
+{
+    char aside[24];
+    size_t len = strlen(path);
+    FRESULT res;
+
+    for (u8 n = 0; n < LOGGER_ASIDE_MAX; n++) {
+        snprintf(aside, sizeof(aside), "%.*s%02u", (int)(len - 2U), path, (unsigned)n);
+        res = f_rename(path, aside);
+        if (FR_OK == res) {
+            TransmitDebug(">>Log day set aside\r");
+            return 1;
+        }
+        if (FR_EXIST != res) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Check a day file header against this firmware
+ * @param[in] header Header sector
+ * @param[in] date   Packed date the file must belong to
+ * @return 1 if the records can be read with the current layout and schema
+ */
+static u8 data_logger_header_ok(const StuLogHeader *header, u32 date)
+{
+    return (LOGGER_MAGIC == header->magic && LOGGER_VERSION == header->version &&
+            sizeof(StuLogRecord) == header->recordSize && LOGGER_MAX_VALUES == header->valueCount &&
+            LOGGER_DAY_RECORDS == header->capacity && header->count <= LOGGER_DAY_RECORDS &&
+            date == header->date && data_logger_schema_crc() == header->schemaCrc &&
+            header->crc == calculateCRC32((const u8 *)header, offsetof(StuLogHeader, crc))) ? 1U : 0U;
+}
+
+/**
+ * @brief Validate the open day file and take over its header
+ * @return 1 if the file belongs to this day and firmware
+ */
+static u8 data_logger_check(void)
+{
+    UINT bytes = 0;
+
+    if (LOGGER_FILE_SIZE != f_size(&gLogFile) || 0U == gLogFile.obj.sclust ||
+        FR_OK != f_read(&gLogFile, &gHeader, sizeof(gHeader), &bytes) || sizeof(gHeader) != bytes) {
+        return 0;
+    }
+    return data_logger_header_ok(&gHeader, data_logger_pack(gYear, gMonth, gDay, 0));
+}
+
+/**
+ * @brief Find records written after the last header update
+ *
+ * Probes the first record of every group behind the header count; a valid
+ * CRC and the date of the file mean the group was written. Index entries of
+ * the groups found are written through the open file, then the index
+ * sector of the next entry is loaded.
+ *
+ * @return 1 if the index could be updated and loaded
+ */
+static u8 data_logger_resume(void)
+{
+    static StuLogRecord probe;
+    UINT bytes = 0;
+    FSIZE_t offset;
+
+    gCount = gHeader.count;
+    for (u8 i = 0; i < LOGGER_RESUME_MAX && (gCount + LOGGER_BUF_RECORDS) <= LOGGER_DAY_RECORDS; i++) {
+        offset = (FSIZE_t)LOGGER_HEADER_SECTORS * LOGGER_SECTOR_SIZE + (FSIZE_t)gCount * sizeof(StuLogRecord);
+        if (FR_OK != f_lseek(&gLogFile, offset) ||
+            FR_OK != f_read(&gLogFile, &probe, sizeof(probe), &bytes) || sizeof(probe) != bytes ||
+            probe.crc != data_logger_record_crc(&probe) ||
+            (probe.stamp & LOGGER_DATE_MASK) != gHeader.date) {
+            break;
+        }
+        if (0U == (gCount % LOGGER_INDEX_STRIDE)) {
+            offset = (FSIZE_t)LOGGER_INDEX_SECTOR * LOGGER_SECTOR_SIZE +
+                     (FSIZE_t)(gCount / LOGGER_INDEX_STRIDE) * sizeof(u32);
+            if (FR_OK != f_lseek(&gLogFile, offset) ||
+                FR_OK != f_write(&gLogFile, &probe.stamp, sizeof(probe.stamp), &bytes)) {
+                return 0;
+            }
+        }
+        gCount += LOGGER_BUF_RECORDS;
+    }
+
+    gIndexSector = (gCount / LOGGER_INDEX_STRIDE) / LOGGER_INDEX_ENTRIES;
+    gIndexDirty = 0;
+    offset = ((FSIZE_t)LOGGER_INDEX_SECTOR + gIndexSector) * LOGGER_SECTOR_SIZE;
+    return (FR_OK == f_lseek(&gLogFile, offset) &&
+            FR_OK == f_read(&gLogFile, gIndex, sizeof(gIndex), &bytes) && sizeof(gIndex) == bytes) ? 1U : 0U;
+}
+
+/**
+ * @brief Create and preallocate the day file
+ *
+ * The oldest days are deleted while the card has no contiguous room.
+ *
+ * @param[in] path Path of the day file
+ * @return 1 if the file is ready
+ */
+static u8 data_logger_create(const char *path)
+{
+    UINT bytes = 0;
+    FRESULT res;
+
+    for (u8 tries = 0;; tries++) {
+        if (FR_OK != f_open(&gLogFile, path, FA_READ | FA_WRITE | FA_CREATE_ALWAYS)) {
+            return 0;
+        }
+        res = f_expand(&gLogFile, LOGGER_FILE_SIZE, 1);
+        if (FR_OK == res) {
+            break;
+        }
+        f_close(&gLogFile);
+        f_unlink(path);
+        if (FR_DENIED != res || tries >= LOGGER_ROTATE_MAX || 0 == data_logger_delete_oldest(path)) {
+            TransmitDebug(">>Log day not created\r");
+            return 0;
+        }
+    }
+
+    memset(&gHeader, 0, sizeof(gHeader));
+    gHeader.magic = LOGGER_MAGIC;
+    gHeader.version = LOGGER_VERSION;
+    gHeader.recordSize = sizeof(StuLogRecord);
+    gHeader.valueCount = LOGGER_MAX_VALUES;
+    gHeader.interval = LOGGER_INTERVAL;
+    gHeader.date = data_logger_pack(gYear, gMonth, gDay, 0);
+    gHeader.capacity = LOGGER_DAY_RECORDS;
+    gHeader.schemaCrc = data_logger_schema_crc();
+    gHeader.crc = calculateCRC32((const u8 *)&gHeader, offsetof(StuLogHeader, crc));
+
+    res = f_write(&gLogFile, &gHeader, sizeof(gHeader), &bytes);
+    if (FR_OK == res) {
+        res = f_write(&gLogFile, gSchema, sizeof(gSchema), &bytes);
+    }
+    /* Empty time index */
+    memset(gIndex, 0xFF, sizeof(gIndex));
+    if (FR_OK == res) {
+        res = f_lseek(&gLogFile, (FSIZE_t)LOGGER_INDEX_SECTOR * LOGGER_SECTOR_SIZE);
+    }
+    for (u8 i = LOGGER_INDEX_SECTOR; i < LOGGER_HEADER_SECTORS && FR_OK == res; i++) {
+        res = f_write(&gLogFile, gIndex, sizeof(gIndex), &bytes);
+    }
+    gStart = gLogFile.obj.fs->database + (gLogFile.obj.sclust - 2U) * gLogFile.obj.fs->csize;
+    if (FR_OK != f_close(&gLogFile) || FR_OK != res) {
+        return 0;
+    }
+    /* Allocation on the card before records go to its clusters */
+    if (RES_OK != SD_CacheFlush()) {
+        return 0;
+    }
+    gCount = 0;
+    gIndexSector = 0;
+    gIndexDirty = 0;
+    TransmitDebug(">>Log day created\r");
+    return 1;
+}
+
+/**
+ * @brief Open the day file of the tracked date, create it if needed
+ * @return 1 if the file is ready
+ */
+static u8 data_logger_open(void)
+{
+    char path[24];
+    FRESULT res;
+    u8 ready;
+
+    res = f_mkdir(LOGGER_DIR);
+    if (FR_OK != res && FR_EXIST != res) {
+        return 0;
+    }
+    data_logger_path(path, sizeof(path), data_logger_pack(gYear, gMonth, gDay, 0));
+    res = f_open(&gLogFile, path, FA_READ | FA_WRITE | FA_OPEN_EXISTING);
+    if (FR_OK == res) {
+        if (1U == data_logger_check()) {
+            gStart = gLogFile.obj.fs->database + (gLogFile.obj.sclust - 2U) * gLogFile.obj.fs->csize;
+            ready = data_logger_resume();
+            if (FR_OK != f_close(&gLogFile)) {
+                ready = 0;
+            }
+            return ready;
+        }
+        /* Other firmware, other day or damaged: keep it, start the day again */
+        f_close(&gLogFile);
+        if (0 == data_logger_set_aside(path)) {
+            TransmitDebug(">>Log day not set aside\r");
+            return 0;
+        }
+    } else if (FR_NO_FILE != res) {
+        return 0;
+    }
+    return data_logger_create(path);
+}
+
+/**
+ * @brief Check whether a buffer half can take records
+ * @param[in] half Buffer half
+ * @return 1 if neither queued nor used by the benchmark
+ */
+static u8 data_logger_half_free(u8 half)
+{
+    return (0U == (gPending & (1U << half)) && (0U == gBenchActive || half != gBenchHalf)) ? 1U : 0U;
+}
+
+/**
+ * @brief Hand the filling half to the writer and switch halves
+ *
+ * A partly filled half is padded with erased records, which fail the CRC.
+ */
+static void data_logger_queue(void)
+{
+    if (gFillCount < LOGGER_BUF_RECORDS) {
+        memset(&gBuf[gFill][gFillCount], 0xFF, (LOGGER_BUF_RECORDS - gFillCount) * sizeof(StuLogRecord));
+    }
+    gPending |= (u8)(1U << gFill);
+    gFill ^= 1U;
+    gFillCount = 0;
+}
+
+/**
+ * @brief Capture one record into the filling half
+ */
+static void data_logger_sample(void)
+{
+    static f32 snapshot[SIG_COUNT];
+    u32 date = data_logger_pack(gYear, gMonth, gDay, 0);
+    StuLogRecord *record;
+
+    if (1U == gReady && 0U == gCloseDay && date != gHeader.date) {
+        /* New day: the old file gets the partial half and is closed */
+        if (0U != gFillCount) {
+            data_logger_queue();
+        }
+        gCloseDay = 1;
+    }
+    if (0U == gCloseDay && gFillCount >= LOGGER_BUF_RECORDS) {
+        data_logger_queue();
+    }
+    if (0U == data_logger_half_free(gFill) || gFillCount >= LOGGER_BUF_RECORDS) {
+        gDropped++;
+        return;
+    }
+
+    record = &gBuf[gFill][gFillCount];
+    signal_db_snapshot(snapshot);
+    record->stamp = data_logger_pack(gYear, gMonth, gDay, gSecond);
+    record->count = (SIG_COUNT < LOGGER_MAX_VALUES) ? SIG_COUNT : LOGGER_MAX_VALUES;
+    record->reserved = 0;
+    for (u16 i = 0; i < LOGGER_MAX_VALUES; i++) {
+        record->value[i] = (i < record->count && 1U == signal_db_reported((EnuSignalId)i)) ?
+                           snapshot[i] : (f32)INVALID_DATA;
+    }
+    record->crc = data_logger_record_crc(record);
+
+    /* New-day records stay in RAM until the old file is closed */
+    if (++gFillCount >= LOGGER_BUF_RECORDS && 0U == gCloseDay) {
+        data_logger_queue();
+    }
+}
+
+/**
+ * @brief Enter the first record of a group at an index stride into the index
+ *
+ * Called when the group at gCount was written. The previous sector was
+ * written before the first entry of a new sector is made.
+ *
+ * @param[in] stamp Time stamp of the first record of the group
+ */
+static void data_logger_index(u32 stamp)
+{
+    u32 entry = gCount / LOGGER_INDEX_STRIDE;
+
+    if ((entry / LOGGER_INDEX_ENTRIES) != gIndexSector) {
+        memset(gIndex, 0xFF, sizeof(gIndex));
+        gIndexSector = entry / LOGGER_INDEX_ENTRIES;
+    }
+    gIndex[entry % LOGGER_INDEX_ENTRIES] = stamp;
+    gIndexDirty = 1;
+}
+
+/**
+ * @brief Start an asynchronous write of the open day file
+ * @param[in] data   Source buffer
+ * @param[in] sector First sector on the card
+ * @param[in] count  Sectors to write
+ * @param[in] io     EnuLoggerIo of the write
+ * @param[in] now    Current tick
+ * @return 1 if the write was started, the file is given up otherwise
+ */
+static u8 data_logger_write(const void *data, u32 sector, u32 count, u8 io, u32 now)
+{
+    if (MSD_OK != SD_AsyncWrite((const BYTE *)data, sector, count)) {
+        gErrors++;
+        gReady = 0;
+        return 0;
+    }
+    gIo = io;
+    gIoTick = now;
+    return 1;
+}
+
+/**
+ * @brief Collect the result of the write in flight
+ * @param[in] now Current tick
+ */
+static void data_logger_io_done(u32 now)
+{
+    SD_AsyncStateTypeDef state = SD_AsyncPoll();
+    u32 latency;
+
+    if (SD_ASYNC_BUSY == state) {
+        return;
+    }
+    latency = now - gIoTick;
+    if (SD_ASYNC_OK != state) {
+        /* Card gone or failing: reopen later, queued halves are kept */
+        gErrors++;
+        gReady = 0;
+        if (1U == gCloseDay) {
+            /* Queued halves belong to the finished day */
+            gDropped += (gPending & 1U) ? LOGGER_BUF_RECORDS : 0U;
+            gDropped += (gPending & 2U) ? LOGGER_BUF_RECORDS : 0U;
+            gPending = 0;
+            gWriteHalf = gFill;
+            gCloseDay = 0;
+        }
+        if (LOGGER_IO_BENCH == gIo) {
+            gBenchActive = 0;
+            gBenchState = LOGGER_BENCH_FAILED;
+        }
+        gIo = LOGGER_IO_IDLE;
+        return;
+    }
+
+    switch (gIo) {
+    case LOGGER_IO_DATA:
+        if (0U == (gCount % LOGGER_INDEX_STRIDE)) {
+            data_logger_index(gBuf[gWriteHalf][0].stamp);
+        }
+        gPending &= (u8)~(1U << gWriteHalf);
+        gWriteHalf ^= 1U;
+        gCount += LOGGER_BUF_RECORDS;
+        gSyncCount++;
+        gWrites++;
+        gLatencySum += latency;
+        if (latency > gLatencyMax) {
+            gLatencyMax = latency;
+        }
+        break;
+    case LOGGER_IO_INDEX:
+        gIndexDirty = 0;
+        break;
+    case LOGGER_IO_HEADER:
+        if (1U == gCloseDay && 0U == gPending) {
+            gCloseDay = 0;
+            gReady = 0;
+            gRetryTick = now - LOGGER_RETRY_TIME;
+        }
+        break;
+    case LOGGER_IO_BENCH:
+        gBenchBusy += latency;
+        if (latency > gBenchMax) {
+            gBenchMax = latency;
+        }
+        if (0U == --gBenchLeft) {
+            gBenchActive = 0;
+            gBenchState = LOGGER_BENCH_DONE;
+        }
+        break;
+    default:
+        break;
+    }
+    gIo = LOGGER_IO_IDLE;
+}
+
+/**
+ * @brief Start the next write: queued data, index and header update, benchmark
+ * @param[in] now Current tick
+ */
+static void data_logger_io(u32 now)
+{
+    u32 sector;
+
+    if (LOGGER_IO_IDLE != gIo) {
+        data_logger_io_done(now);
+        if (LOGGER_IO_IDLE != gIo) {
+            return;
+        }
+    }
+    if (0U == gReady) {
+        if (0U != gBenchReq) {
+            gBenchReq = 0;
+            gBenchState = LOGGER_BENCH_FAILED;
+        }
+        return;
+    }
+
+    if (1U == gIndexDirty &&
+        (gSyncCount >= LOGGER_SYNC_WRITES || 1U == gCloseDay ||
+         ((gCount / LOGGER_INDEX_STRIDE) / LOGGER_INDEX_ENTRIES) != gIndexSector)) {
+        /* In front of the header update and before the next sector is started */
+        data_logger_write(gIndex, gStart + LOGGER_INDEX_SECTOR + gIndexSector, 1, LOGGER_IO_INDEX, now);
+        return;
+    }
+
+    if (0U != (gPending & (1U << gWriteHalf))) {
+        if ((gCount + LOGGER_BUF_RECORDS) > LOGGER_DAY_RECORDS) {
+            /* Day file full, only possible after a clock jump */
+            gPending &= (u8)~(1U << gWriteHalf);
+            gWriteHalf ^= 1U;
+            gDropped += LOGGER_BUF_RECORDS;
+            return;
+        }
+        sector = gStart + LOGGER_HEADER_SECTORS + (gCount * sizeof(StuLogRecord)) / LOGGER_SECTOR_SIZE;
+        data_logger_write(gBuf[gWriteHalf], sector, LOGGER_WRITE_SECTORS, LOGGER_IO_DATA, now);
+        return;
+    }
+
+    if (gSyncCount >= LOGGER_SYNC_WRITES || 1U == gCloseDay) {
+        gSyncCount = 0;
+        gHeader.count = gCount;
+        gHeader.dropped = gDropped;
+        gHeader.crc = calculateCRC32((const u8 *)&gHeader, offsetof(StuLogHeader, crc));
+        data_logger_write(&gHeader, gStart, 1, LOGGER_IO_HEADER, now);
+        return;
+    }
+
+    if (0U != gBenchReq) {
+        /* Cycles over the last record groups, which are still unused */
+        if ((gCount + LOGGER_BENCH_AREA * LOGGER_BUF_RECORDS) > LOGGER_DAY_RECORDS ||
+            0U == data_logger_half_free(gFill ^ 1U)) {
+            gBenchReq = 0;
+            gBenchState = LOGGER_BENCH_FAILED;
+            return;
+        }
+        gBenchHalf = gFill ^ 1U;
+        gBenchActive = 1;
+        gBenchLeft = gBenchReq;
+        gBenchCount = gBenchReq;
+        gBenchBusy = 0;
+        gBenchMax = 0;
+        gBenchReq = 0;
+        memset(gBuf[gBenchHalf], 0xFF, sizeof(gBuf[gBenchHalf]));
+    }
+    if (1U == gBenchActive) {
+        sector = gStart + LOGGER_HEADER_SECTORS +
+                 ((LOGGER_DAY_RECORDS - (u32)(1U + (gBenchLeft % LOGGER_BENCH_AREA)) * LOGGER_BUF_RECORDS) *
+                  sizeof(StuLogRecord)) / LOGGER_SECTOR_SIZE;
+        if (MSD_OK == SD_AsyncWrite((const BYTE *)gBuf[gBenchHalf], sector, LOGGER_WRITE_SECTORS)) {
+            gIo = LOGGER_IO_BENCH;
+            gIoTick = now;
+        } else {
+            gBenchActive = 0;
+            gBenchState = LOGGER_BENCH_FAILED;
+        }
+    }
+}
+
+/**
+ * @brief Read a sector of the queried file through the cursor cache
+ * @param[in,out] query Query cursor
+ * @param[in]     lba   Sector on the card
+ * @return Sector content, NULL on a read error
+ */
+static const u32 *data_logger_query_sector(StuLogQuery *query, u32 lba)
+{
+    if (lba != query->lba) {
+        query->lba = LOGGER_INDEX_EMPTY;
+        if (RES_OK != disk_read(query->drive, (BYTE *)query->cache, lba, 1)) {
+            return NULL;
+        }
+        query->lba = lba;
+    }
+    return query->cache;
+}
+
+/**
+ * @brief Read a record of the queried file
+ * @param[in,out] query  Query cursor
+ * @param[in]     record Record slot
+ * @return Record inside the cursor cache, NULL on a read error
+ */
+static const StuLogRecord *data_logger_query_record(StuLogQuery *query, u32 record)
+{
+    u32 offset = record * sizeof(StuLogRecord);
+    const u32 *sector = data_logger_query_sector(query, query->start + LOGGER_HEADER_SECTORS +
+                                                        offset / LOGGER_SECTOR_SIZE);
+
+    if (NULL == sector) {
+        return NULL;
+    }
+    return (const StuLogRecord *)((const u8 *)sector + (offset % LOGGER_SECTOR_SIZE));
+}
+
+/**
+ * @brief Locate the day file of the cursor date
+ *
+ * The open day is read up to the records written so far, which are ahead
+ * of its header.
+ *
+ * @param[in,out] query Query cursor
+ * @return 1 if the file exists and matches this firmware
+ */
+static u8 data_logger_query_open(StuLogQuery *query)
+{
+    const StuLogHeader *header = (const StuLogHeader *)query->cache;
+    char path[24];
+    UINT bytes = 0;
+    u8 found;
+
+    query->lba = LOGGER_INDEX_EMPTY;
+    data_logger_path(path, sizeof(path), query->date);
+    if (FR_OK != f_open(&gLogFile, path, FA_READ | FA_OPEN_EXISTING)) {
+        return 0;
+    }
+    found = (LOGGER_FILE_SIZE == f_size(&gLogFile) && 0U != gLogFile.obj.sclust &&
+             FR_OK == f_read(&gLogFile, query->cache, sizeof(query->cache), &bytes) &&
+             sizeof(query->cache) == bytes && 1U == data_logger_header_ok(header, query->date)) ? 1U : 0U;
+    if (1U == found) {
+        query->start = gLogFile.obj.fs->database + (gLogFile.obj.sclust - 2U) * gLogFile.obj.fs->csize;
+        query->drive = gLogFile.obj.fs->drv;
+        query->records = (1U == gReady && query->date == gHeader.date) ? gCount : header->count;
+        query->next = 0;
+    }
+    f_close(&gLogFile);
+    return found;
+}
+
+/**
+ * @brief Move the cursor to the first record at or after the range start
+ *
+ * The index gives the last group that starts at or before the range start;
+ * only the records up to the next indexed group are bisected. Records
+ * behind the last index entry on the card (open day) are bisected as one
+ * range. Unreadable records count as later, so the cursor never passes
+ * the first match.
+ *
+ * @param[in,out] query Query cursor of an open day file
+ * @return 1 if done, 0 on a read error
+ */
+static u8 data_logger_query_seek(StuLogQuery *query)
+{
+    const u32 *index = NULL;
+    const StuLogRecord *record;
+    u32 lo = 0;
+    u32 hi = query->records;
+    u32 mid;
+
+    for (u32 entry = 0; (entry * LOGGER_INDEX_STRIDE) < query->records; entry++) {
+        if (0U == (entry % LOGGER_INDEX_ENTRIES)) {
+            index = data_logger_query_sector(query, query->start + LOGGER_INDEX_SECTOR +
+                                                    entry / LOGGER_INDEX_ENTRIES);
+            if (NULL == index) {
+                return 0;
+            }
+        }
+        if (LOGGER_INDEX_EMPTY == index[entry % LOGGER_INDEX_ENTRIES]) {
+            break;
+        }
+        if (index[entry % LOGGER_INDEX_ENTRIES] > query->from) {
+            hi = entry * LOGGER_INDEX_STRIDE;
+            break;
+        }
+        lo = entry * LOGGER_INDEX_STRIDE;
+    }
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2U;
+        record = data_logger_query_record(query, mid);
+        if (NULL == record) {
+            return 0;
+        }
+        if (record->crc == data_logger_record_crc(record) && record->stamp < query->from) {
+            lo = mid + 1U;
+        } else {
+            hi = mid;
+        }
+    }
+    query->next = lo;
+    return 1;
+}
+
+/**
+ * @brief Move the cursor to the beginning of the next day
+ * @param[in,out] query Query cursor
+ */
+static void data_logger_query_next_day(StuLogQuery *query)
+{
+    int year = (int)(query->date >> 26) + 2000;
+    int month = (int)((query->date >> 22) & 0x0FU);
+    int day = (int)((query->date >> 17) & 0x1FU);
+
+    data_logger_next_day(&year, &month, &day);
+    query->date = data_logger_pack(year, month, day, 0);
+    query->start = 0;
+    query->next = 0;
+}
+
+/**
+ * @brief Run the printed query, one result line at a time
+ *
+ * A line is formatted only after the command context took the previous one.
+ */
+static void data_logger_shell_job(void)
+{
+    static f32 value[LOGGER_QUERY_SIGNALS];
+    DateTime tm;
+    u32 stamp;
+    int len;
+
+    if (LOGGER_JOB_REQUESTED == gShellState) {
+        gShellState = (1U == data_logger_query_start(&gShellQuery)) ? LOGGER_JOB_RUNNING : LOGGER_JOB_FAILED;
+        return;
+    }
+    if (LOGGER_JOB_RUNNING != gShellState) {
+        return;
+    }
+
+    switch (data_logger_query_next(&gShellQuery, &stamp, value)) {
+    case LOG_QUERY_ROW:
+        tm = data_logger_unpack(stamp);
+        len = snprintf(gShellLine, sizeof(gShellLine), "\r>%02d/%02d %02d:%02d:%02d",
+                       tm.month, tm.day, tm.hour, tm.minute, tm.second);
+        for (u8 i = 0; i < gShellQuery.count && len > 0 && len < (int)sizeof(gShellLine); i++) {
+            if (INVALID_DATA == value[i]) {
+                len += snprintf(gShellLine + len, sizeof(gShellLine) - (u32)len, " %s=-",
+                                signal_db_meta((EnuSignalId)gShellQuery.signal[i])->name);
+            } else {
+                len += snprintf(gShellLine + len, sizeof(gShellLine) - (u32)len, " %s=%.2f",
+                                signal_db_meta((EnuSignalId)gShellQuery.signal[i])->name, value[i]);
+            }
+        }
+        gShellState = LOGGER_JOB_LINE;
+        break;
+    case LOG_QUERY_AGAIN:
+        break;
+    case LOG_QUERY_END:
+        gShellState = LOGGER_JOB_DONE;
+        break;
+    default:
+        gShellState = LOGGER_JOB_FAILED;
+        break;
+    }
+}
+
+/**
+ * @brief Run the upload query, fetch the next record for the modem
+ *
+ * A record is held until its frame was acknowledged or skipped.
+ */
+static void data_logger_upload_job(void)
+{
+    if (1U == gUploadStop) {
+        gUploadStop = 0;
+        gUploadState = LOGGER_JOB_IDLE;
+        gUploadHeld = 0;
+        return;
+    }
+    if (LOGGER_JOB_REQUESTED == gUploadState) {
+        gUploadHeld = 0;
+        gUploadRetry = 0;
+        gUploadSent = 0;
+        gUploadSkipped = 0;
+        gUploadState = (1U == data_logger_query_start(&gUploadQuery)) ? LOGGER_JOB_RUNNING : LOGGER_JOB_IDLE;
+        return;
+    }
+    if (LOGGER_JOB_RUNNING != gUploadState || 1U == gUploadHeld) {
+        return;
+    }
+
+    switch (data_logger_query_next(&gUploadQuery, &gUploadStamp, gUploadValue)) {
+    case LOG_QUERY_ROW:
+        gUploadHeld = 1;
+        break;
+    case LOG_QUERY_AGAIN:
+        break;
+    case LOG_QUERY_END:
+        gUploadState = LOGGER_JOB_IDLE;
+        TransmitDebug(">>Log upload done\r");
+        break;
+    default:
+        gUploadState = LOGGER_JOB_IDLE;
+        TransmitDebug(">>Log upload failed\r");
+        break;
+    }
+}
+
+/**
+ * @brief Find a logged signal by name
+ * @param[in] name Signal name as in the registry
+ * @return Signal ID, -1 if unknown or not logged
+ */
+static int data_logger_signal_find(const char *name)
+{
+    for (u16 i = 0; i < LOGGER_MAX_VALUES && i < SIG_COUNT; i++) {
+        if (0 == strcmp(signal_db_meta((EnuSignalId)i)->name, name)) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Parse "yymmdd hhmmss hhmmss [step] [Name,Name]" into a query
+ * @param[in]  arg   Arguments behind the command word
+ * @param[out] query Request fields of the query
+ * @return 1 if the arguments are valid
+ */
+static u8 data_logger_log_parse(const char *arg, StuLogQuery *query)
+{
+    char names[TEMP_STRING_SIZE] = { 0 };
+    unsigned date = 0, begin = 0, end = 0, step = 1;
+    int year, month, day, id, n;
+    u32 first, last;
+    char *name, *next;
+
+    n = sscanf(arg, "%u %u %u %u %49s", &date, &begin, &end, &step, names);
+    if (3 == n) {
+        /* Names without a step */
+        step = 1;
+        sscanf(arg, "%*u %*u %*u %49s", names);
+    }
+    year = 2000 + (int)(date / 10000U);
+    month = (int)((date / 100U) % 100U);
+    day = (int)(date % 100U);
+    first = (begin / 10000U) * 3600U + ((begin / 100U) % 100U) * 60U + (begin % 100U);
+    last = (end / 10000U) * 3600U + ((end / 100U) % 100U) * 60U + (end % 100U);
+    if (n < 3 || 0U == step || step > 0xFFFFU || month < 1 || month > 12 || day < 1 || day > 31 ||
+        begin >= 240000U || ((begin / 100U) % 100U) >= 60U || (begin % 100U) >= 60U ||
+        end >= 240000U || ((end / 100U) % 100U) >= 60U || (end % 100U) >= 60U) {
+        return 0;
+    }
+
+    query->from = data_logger_pack(year, month, day, first);
+    if (last < first) {
+        data_logger_next_day(&year, &month, &day);
+    }
+    query->to = data_logger_pack(year, month, day, last);
+    query->step = (u16)step;
+    query->count = 0;
+
+    for (name = names; 0 != *name && query->count < LOGGER_QUERY_SIGNALS; name = next) {
+        next = strchr(name, ',');
+        if (NULL != next) {
+            *next++ = 0;
+        } else {
+            next = name + strlen(name);
+        }
+        id = data_logger_signal_find(name);
+        if (id < 0) {
+            return 0;
+        }
+        query->signal[query->count++] = (u8)id;
+    }
+    if (0U == query->count) {
+        for (u8 i = 0; i < LOGGER_QUERY_SIGNALS && i < SIG_COUNT; i++) {
+            query->signal[query->count++] = i;
+        }
+    }
+    return 1;
+}
+
+/* ========================================================================
+ * Public Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Sample, flush and rotate the day files
+ *
+ * WCET of a sample is one registry snapshot and one CRC32 over 252 bytes.
+ * Opening a day file takes FatFs calls and happens once a day or after a
+ * card error.
+ */
+void data_logger_service(void)
+{
+    u32 now = HAL_GetTick();
+
+    data_logger_io(now);
+    data_logger_shell_job();
+    data_logger_upload_job();
+
+    if ((now - gSampleTick) < LOGGER_INTERVAL) {
+        return;
+    }
+    /* Fixed rate, a late call does not shift the following samples */
+    gSampleTick += LOGGER_INTERVAL;
+    if ((now - gSampleTick) >= LOGGER_INTERVAL) {
+        gSampleTick = now;
+    }
+
+    if (0U == data_logger_clock()) {
+        return;
+    }
+    if (0U == gReady && 0U == gCloseDay) {
+        if ((now - gRetryTick) >= LOGGER_RETRY_TIME) {
+            gRetryTick = now;
+            gReady = data_logger_open();
+        }
+        if (0U == gReady) {
+            gDropped++;
+            return;
+        }
+    }
+    data_logger_sample();
+}
+
+/**
+ * @brief Validate a query and reset its cursor
+ *
+ * @param[in,out] query Request fields filled by the caller
+ *
+ * @return 1 if the request is valid
+ */
+u8 data_logger_query_start(StuLogQuery *query)
+{
+    u32 month = (query->from >> 22) & 0x0FU;
+    u32 day = (query->from >> 17) & 0x1FU;
+
+    if (0U == query->count || query->count > LOGGER_QUERY_SIGNALS || 0U == query->step ||
+        query->from > query->to || month < 1U || month > 12U || day < 1U) {
+        return 0;
+    }
+    for (u8 i = 0; i < query->count; i++) {
+        if (query->signal[i] >= LOGGER_MAX_VALUES || query->signal[i] >= SIG_COUNT) {
+            return 0;
+        }
+    }
+    query->date = query->from & LOGGER_DATE_MASK;
+    query->start = 0;
+    query->records = 0;
+    query->next = 0;
+    query->rows = 0;
+    query->lba = LOGGER_INDEX_EMPTY;
+    return 1;
+}
+
+/**
+ * @brief Return the next record of a query
+ *
+ * WCET is LOGGER_QUERY_READS sector reads, plus the index sectors of a day
+ * and the bisection of one index stride when a day file is located.
+ *
+ * @param[in,out] query Query started with data_logger_query_start()
+ * @param[out]    stamp Packed time stamp of the record
+ * @param[out]    value query->count values in query->signal order
+ *
+ * @return EnuLogQuery result
+ */
+EnuLogQuery data_logger_query_next(StuLogQuery *query, u32 *stamp, f32 *value)
+{
+    const StuLogRecord *record;
+
+    for (u8 reads = 0; reads < LOGGER_QUERY_READS; reads++) {
+        if (query->date > (query->to & LOGGER_DATE_MASK)) {
+            return LOG_QUERY_END;
+        }
+        if (0U == query->start) {
+            if (0U == data_logger_query_open(query)) {
+                data_logger_query_next_day(query);
+            } else if (query->from > query->date && 0U == data_logger_query_seek(query)) {
+                return LOG_QUERY_ERROR;
+            }
+            continue;
+        }
+        if (query->next >= query->records) {
+            data_logger_query_next_day(query);
+            continue;
+        }
+
+        record = data_logger_query_record(query, query->next);
+        if (NULL == record) {
+            return LOG_QUERY_ERROR;
+        }
+        if (record->crc != data_logger_record_crc(record) ||
+            (record->stamp & LOGGER_DATE_MASK) != query->date || record->stamp < query->from) {
+            /* Padding, torn write or a record from before a clock change */
+            query->next++;
+            continue;
+        }
+        if (record->stamp > query->to) {
+            query->date = LOGGER_INDEX_EMPTY;
+            return LOG_QUERY_END;
+        }
+
+        *stamp = record->stamp;
+        for (u8 i = 0; i < query->count; i++) {
+            value[i] = record->value[query->signal[i]];
+        }
+        query->next += query->step;
+        query->rows++;
+        return LOG_QUERY_ROW;
+    }
+    return LOG_QUERY_AGAIN;
+}
+
+/**
+ * @brief Check for a running upload job
+ *
+ * @return 1 while an upload started with "log web" has records left
+ */
+u8 data_logger_upload_status(void)
+{
+    return (LOGGER_JOB_RUNNING == gUploadState) ? 1U : 0U;
+}
+
+/**
+ * @brief Build the next upload frame
+ *
+ * @param[out] str Output buffer for JSON data (BUFFER_SIZE bytes)
+ * @param[out] api Output buffer for API URL (URL_SIZE bytes)
+ *
+ * @return 1 if a frame was built, 0 if nothing could be sent
+ */
+u8 data_logger_web_report(u8 *str, u8 *api)
+{
+    char tempStr[TEMP_STRING_SIZE];
+    char entry[TEMP_STRING_SIZE];
+    u16 count = 0;
+    size_t len;
+
+    if (LOGGER_JOB_RUNNING != gUploadState || 0U == gUploadHeld) {
+        return 0;
+    }
+
+    server_return_url((u8 *)tempStr);
+    snprintf((char *)api, LOGGER_API_SIZE, "%s/api/send-chanel", tempStr);
+
+    memset(str, 0, BUFFER_SIZE);
+    startJsonFrame((char *)str, data_logger_unpack(gUploadStamp));
+    for (u8 i = 0; i < gUploadQuery.count; i++) {
+        if (INVALID_DATA == gUploadValue[i]) {
+            continue;
+        }
+        if (0 == formatJsonEntry(entry, sizeof(entry), count + 1, (EnuSignalId)gUploadQuery.signal[i],
+                                 gUploadValue[i])) {
+            break;
+        }
+        len = strlen((char *)str);
+        if ((len + strlen(entry) + 2U + FRAME_TAIL_SIZE) >= BUFFER_SIZE) {
+            break;
+        }
+        if (0 != count) {
+            strcat((char *)str, ",\r");
+        }
+        strcat((char *)str, entry);
+        count++;
+    }
+
+    if (0 == count) {
+        /* None of the signals was reported at that time */
+        gUploadHeld = 0;
+        return 0;
+    }
+    strcat((char *)str, "\r}\r}");
+    gUploadInFlight = 1;
+    return 1;
+}
+
+/**
+ * @brief Acknowledge the in-flight upload frame after HTTP 200
+ */
+void data_logger_upload_commit(void)
+{
+    if (1U == gUploadInFlight) {
+        gUploadInFlight = 0;
+        gUploadHeld = 0;
+        gUploadRetry = 0;
+        gUploadSent++;
+    }
+}
+
+/**
+ * @brief Release the in-flight upload frame once the modem is free again
+ */
+void data_logger_upload_release(void)
+{
+    if (1U == gUploadInFlight) {
+        gUploadInFlight = 0;
+        if (++gUploadRetry >= LOGGER_UPLOAD_RETRY) {
+            gUploadRetry = 0;
+            gUploadHeld = 0;
+            gUploadSkipped++;
+            TransmitDebug(">>Log frame rejected, skipped\r");
+        }
+    }
+}
+
+/**
+ * @brief Command line interface for the logger
+ *
+ * @param[in,out] str Command string
+ *
+ * @return 1 while the command is running, 0 when done
+ */
+u8 data_logger_cmd(char *str)
+{
+    static u8 waiting = 0;
+    char tempStr[TEMP_STRING_SIZE];
+    char *arg;
+    u32 count;
+
+    if (1U == waiting) {
+        if (LOGGER_BENCH_RUNNING == gBenchState) {
+            return 1;
+        }
+        waiting = 0;
+        if (LOGGER_BENCH_DONE == gBenchState && 0U != gBenchBusy) {
+            snprintf(tempStr, sizeof(tempStr),
+                     "\r>Bench %u x %u B: %lu ms busy, %lu KiB/s, max %lu ms\r",
+                     gBenchCount, (unsigned)(LOGGER_WRITE_SECTORS * LOGGER_SECTOR_SIZE),
+                     (unsigned long)gBenchBusy,
+                     (unsigned long)(((u32)gBenchCount * LOGGER_WRITE_SECTORS * LOGGER_SECTOR_SIZE / 1024U) * 1000U / gBenchBusy),
+                     (unsigned long)gBenchMax);
+        } else {
+            snprintf(tempStr, sizeof(tempStr), "\r>Bench failed\r");
+        }
+        gBenchState = LOGGER_BENCH_IDLE;
+        TransmitCMDResponse(tempStr);
+        return 0;
+    }
+
+    if (NULL != strstr(str, "cache")) {
+        SD_CacheStatsTypeDef stats;
+
+        SD_CacheGetStats(&stats);
+        snprintf(tempStr, sizeof(tempStr),
+                 "\r>SD cache hit:%lu miss:%lu ra:%lu wr:%lu card rd:%lu wr:%lu wb:%lu dirty:%u\r",
+                 (unsigned long)stats.hits, (unsigned long)stats.misses, (unsigned long)stats.readAhead,
+                 (unsigned long)stats.writes, (unsigned long)stats.cardReads,
+                 (unsigned long)stats.cardWrites, (unsigned long)stats.writeBacks, stats.dirty);
+        TransmitCMDResponse(tempStr);
+        return 0;
+    }
+
+    arg = strstr(str, "bench");
+    if (NULL != arg) {
+        count = (u32)atoi(arg + 5);
+        if (0U == count) {
+            count = LOGGER_BENCH_DEFAULT;
+        }
+        if (count > LOGGER_BENCH_MAX) {
+            count = LOGGER_BENCH_MAX;
+        }
+        if (0U == gReady) {
+            TransmitCMDResponse("\r>Logger offline\r");
+            return 0;
+        }
+        gBenchState = LOGGER_BENCH_RUNNING;
+        gBenchReq = (u16)count;
+        waiting = 1;
+        return 1;
+    }
+
+    snprintf(tempStr, sizeof(tempStr),
+             "\r>Logger %s L%02u%02u%02u rec:%lu wr:%lu err:%lu drop:%lu lat avg:%lu max:%lu ms\r",
+             (1U == gReady) ? "ready" : "offline", (unsigned)(gYear % 100), (unsigned)gMonth,
+             (unsigned)gDay, (unsigned long)gCount, (unsigned long)gWrites,
+             (unsigned long)gErrors, (unsigned long)gDropped,
+             (unsigned long)((0U != gWrites) ? (gLatencySum / gWrites) : 0U),
+             (unsigned long)gLatencyMax);
+    TransmitCMDResponse(tempStr);
+    return 0;
+}
+
+/**
+ * @brief Display help information for logger commands
+ *
+ * @return 1 while help lines remain, 0 when done
+ */
+u8 data_logger_cmd_help(void)
+{
+    static u8 state = 0;
+    u8 returnValue = 1;
+
+    switch (state) {
+    case 0:
+        TransmitCMDResponse("     logger                 -> (Returns SD history logger status) \r");
+        state = 1;
+        break;
+    case 1:
+        TransmitCMDResponse("     logger bench 64        -> (Times 64 buffer writes to the SD card) \r");
+        state = 2;
+        break;
+    case 2:
+        TransmitCMDResponse("     logger cache           -> (SD sector cache hits and card operations) \r");
+        state = 0;
+        returnValue = 0;
+        break;
+    }
+    return returnValue;
+}
+
+/**
+ * @brief Command line interface for history queries
+ *
+ * @param[in,out] str Command string
+ *
+ * @return 1 while records are printed, 0 when done
+ */
+u8 data_logger_log_cmd(char *str)
+{
+    static u8 waiting = 0;
+    char tempStr[TEMP_STRING_SIZE];
+
+    if (1U == waiting) {
+        switch (gShellState) {
+        case LOGGER_JOB_LINE:
+            TransmitCMDResponse(gShellLine);
+            gShellState = LOGGER_JOB_RUNNING;
+            return 1;
+        case LOGGER_JOB_DONE:
+            snprintf(tempStr, sizeof(tempStr), "\r>Log rows:%lu\r", (unsigned long)gShellQuery.rows);
+            break;
+        case LOGGER_JOB_FAILED:
+            snprintf(tempStr, sizeof(tempStr), "\r>Log query failed after %lu rows\r",
+                     (unsigned long)gShellQuery.rows);
+            break;
+        default:
+            return 1;
+        }
+        gShellState = LOGGER_JOB_IDLE;
+        waiting = 0;
+        TransmitCMDResponse(tempStr);
+        return 0;
+    }
+
+    if (0 == strncmp(str, "log stop", 8)) {
+        gUploadStop = 1;
+        TransmitCMDResponse("\r>Log upload stopped\r");
+        return 0;
+    }
+    if (0 == strncmp(str, "log web", 7)) {
+        if (LOGGER_JOB_IDLE != gUploadState) {
+            TransmitCMDResponse("\r>Log upload busy\r");
+        } else if (1U == data_logger_log_parse(str + 7, &gUploadQuery)) {
+            gUploadState = LOGGER_JOB_REQUESTED;
+            TransmitCMDResponse("\r>Log upload queued\r");
+        } else {
+            TransmitCMDResponse("\r>Usage: log web yymmdd hhmmss hhmmss [step] [Name,Name]\r");
+        }
+        return 0;
+    }
+    if (0 == str[3] || '\r' == str[3] || '\n' == str[3]) {
+        snprintf(tempStr, sizeof(tempStr), "\r>Log upload %s sent:%lu skipped:%lu\r",
+                 (LOGGER_JOB_IDLE != gUploadState) ? "running" : "idle",
+                 (unsigned long)gUploadSent, (unsigned long)gUploadSkipped);
+        TransmitCMDResponse(tempStr);
+        return 0;
+    }
+    if (LOGGER_JOB_IDLE != gShellState || 0U == data_logger_log_parse(str + 3, &gShellQuery)) {
+        TransmitCMDResponse("\r>Usage: log yymmdd hhmmss hhmmss [step] [Name,Name]\r");
+        return 0;
+    }
+    gShellState = LOGGER_JOB_REQUESTED;
+    waiting = 1;
+    return 1;
+}
+
+/**
+ * @brief Display help information for the log command
+ *
+ * @return 1 while help lines remain, 0 when done
+ */
+u8 data_logger_log_cmd_help(void)
+{
+    static u8 state = 0;
+    u8 returnValue = 1;
+
+    switch (state) {
+    case 0:
+        TransmitCMDResponse("     log 251030 080000 090000 60 VDC,VO1 -> (Prints every 60th record of the range) \r");
+        state = 1;
+        break;
+    case 1:
+        TransmitCMDResponse("     log web 251030 080000 090000 60     -> (Uploads the range to the server) \r");
+        state = 2;
+        break;
+    case 2:
+        TransmitCMDResponse("     log / log stop                      -> (Upload status / ends the upload) \r");
+        state = 0;
+        returnValue = 0;
+        break;
+    }
+    return returnValue;
+}
@@ -0,0 +1,221 @@
+/**
+ * @file data_logger.h
+ * @brief Local 1 s history of all monitoring signals on the SD card
+ *
+ * Once per second a fixed-size binary record (time stamp, all signal
+ * values, CRC32) is captured from the signal registry into a RAM double
+ * buffer. A full buffer half is one 2 KiB, sector-aligned chunk and goes to
+ * the card as a single multi-block DMA write through SD_AsyncWrite(); the
+ * other half keeps filling meanwhile, so neither side waits for the card.
+ *
+ * Every day has its own file LOG/Lyymmdd.BIN, preallocated contiguously
+ * with f_expand() when it is created. Its data sectors are therefore known
+ * up front and written directly, without FatFs touching the FAT or the
+ * directory entry. The file starts with a header (record geometry, date,
+ * record count) followed by the signal schema (name and unit of every
+ * value slot), so a file can be decoded without the firmware that wrote
+ * it. The header count is rewritten periodically and at the end of a day;
+ * after a reset the records written behind it are found again by their
+ * CRC. A day file written with another layout or schema is renamed to
+ * Lyymmdd.Bnn and the day starts a new file. When the card has no room for
+ * a new day the oldest day is deleted.
+ *
+ * A sparse time index behind the schema holds the stamp of every
+ * LOGGER_INDEX_STRIDE-th record. A query reads the index sectors of the
+ * day, bisects the one record group that can hold its start time and then
+ * streams the following records sector by sector, so a time range is found
+ * with a handful of sector reads and no file is ever loaded as a whole.
+ * Results come one record at a time through a caller-owned cursor,
+ * reduced to a signal subset and decimated. The "log" command prints them
+ * on the command port or uploads them to the server as "send-chanel"
+ * frames.
+ *
+ * The history is independent of the telemetry spool and the modem link.
+ *
+ * @date 2025-10-30
+ * @author Allayar Moazami
+ */
+#ifndef H_DATA_LOGGER
+#define H_DATA_LOGGER
+
+#include "platform.h"
+
+/** @brief Directory holding the day files, shared with the spool */
+#define LOGGER_DIR "LOG"
+
+/** @brief Sampling interval in ms */
+#define LOGGER_INTERVAL 1000U
+
+/** @brief Value slots per record, signal IDs beyond are not logged */
+#define LOGGER_MAX_VALUES 61U
+
+/** @brief Records per day file, one per second */
+#define LOGGER_DAY_RECORDS 86400UL
+
+/** @brief Records per buffer half, one SD write */
+#define LOGGER_BUF_RECORDS 8U
+
+/** @brief Buffer writes between two header updates (about one minute) */
+#define LOGGER_SYNC_WRITES 8U
+
+/** @brief Delay in ms before a failed day file is opened again */
+#define LOGGER_RETRY_TIME 10000U
+
+/** @brief Records per time index entry, the records of one header update */
+#define LOGGER_INDEX_STRIDE (LOGGER_BUF_RECORDS * LOGGER_SYNC_WRITES)
+
+/** @brief Signals returned by one query at most */
+#define LOGGER_QUERY_SIGNALS 8U
+
+/** @brief Rejected upload frames before the record is skipped */
+#define LOGGER_UPLOAD_RETRY 3U
+
+/**
+ * @enum EnuLogQuery
+ * @brief Result of data_logger_query_next()
+ */
+typedef enum EnuLogQueryEnum
+{
+    LOG_QUERY_END = 0,      /**< No more records in the range */
+    LOG_QUERY_ROW,          /**< One record returned */
+    LOG_QUERY_AGAIN,        /**< Read budget used up, call again */
+    LOG_QUERY_ERROR         /**< Card read failed */
+} EnuLogQuery;
+
+/**
+ * @struct StuLogQuery
+ * @brief Time range query and its cursor
+ *
+ * Time stamps are packed like the records:
+ * year-2000 (6) | month (4) | day (5) | hour (5) | minute (6) | second (6).
+ * The caller fills the request fields, data_logger_query_start() resets
+ * the cursor.
+ */
+typedef struct StuLogQueryStruct
+{
+    u32 from;                           /**< First time stamp of the range */
+    u32 to;                             /**< Last time stamp of the range */
+    u16 step;                           /**< Records advanced per result, 1 returns every record */
+    u8 count;                           /**< Entries used in signal[] */
+    u8 signal[LOGGER_QUERY_SIGNALS];    /**< EnuSignalId of the returned values, in output order */
+    u32 date;                           /**< Cursor: day file being read */
+    u32 start;                          /**< Cursor: first sector of that file, 0 if not located */
+    u32 records;                        /**< Cursor: records readable in that file */
+    u32 next;                           /**< Cursor: next record to read */
+    u32 rows;                           /**< Cursor: results returned so far */
+    u32 lba;                            /**< Cursor: sector held in cache */
+    u8 drive;                           /**< Cursor: physical drive of the file system */
+    u32 cache[128];                     /**< Cursor: one sector of the file */
+} StuLogQuery;
+
+/**
+ * @brief Sample, flush and rotate the day files
+ *
+ * Called every 1 ms from RTE_MNT_MNG, the same context as all other FatFs
+ * users. Does nothing until the RTC time is valid.
+ */
+void data_logger_service(void);
+
+/**
+ * @brief Validate a query and reset its cursor
+ *
+ * @param[in,out] query Request fields filled by the caller
+ *
+ * @return 1 if the request is valid
+ */
+u8 data_logger_query_start(StuLogQuery *query);
+
+/**
+ * @brief Return the next record of a query
+ *
+ * Day files are visited in date order; days without a file, records that
+ * fail their CRC and records outside the range are skipped. Every call
+ * reads a bounded number of sectors with disk_read(), so it must run in the
+ * same context as the other FatFs users.
+ *
+ * @param[in,out] query Query started with data_logger_query_start()
+ * @param[out]    stamp Packed time stamp of the record
+ * @param[out]    value query->count values in query->signal order,
+ *                      INVALID_DATA where the signal was not reported
+ *
+ * @return LOG_QUERY_ROW with a record, LOG_QUERY_AGAIN without one, or
+ *         LOG_QUERY_END / LOG_QUERY_ERROR when the query is finished
+ */
+EnuLogQuery data_logger_query_next(StuLogQuery *query, u32 *stamp, f32 *value);
+
+/**
+ * @brief Check for a running upload job
+ *
+ * @return 1 while an upload started with "log web" has records left
+ */
+u8 data_logger_upload_status(void);
+
+/**
+ * @brief Build the next upload frame
+ *
+ * Fills the values of the next record of the upload job into a
+ * "send-chanel" JSON frame stamped with the record time. The frame stays
+ * in flight until data_logger_upload_commit() or data_logger_upload_release().
+ *
+ * @param[out] str Output buffer for JSON data (BUFFER_SIZE bytes)
+ * @param[out] api Output buffer for API URL (URL_SIZE bytes)
+ *
+ * @return 1 if a frame was built, 0 if nothing could be sent
+ */
+u8 data_logger_web_report(u8 *str, u8 *api);
+
+/**
+ * @brief Acknowledge the in-flight upload frame after HTTP 200
+ */
+void data_logger_upload_commit(void);
+
+/**
+ * @brief Release the in-flight upload frame once the modem is free again
+ *
+ * The record is sent again; after LOGGER_UPLOAD_RETRY rejections it is
+ * skipped.
+ */
+void data_logger_upload_release(void);
+
+/**
+ * @brief Command line interface for the logger
+ *
+ * "logger" prints state and write statistics, "logger bench [n]" times n
+ * back-to-back buffer writes through the SDIO DMA path, "logger cache"
+ * prints the counters of the SD sector cache.
+ *
+ * @param[in,out] str Command string
+ *
+ * @return 1 while the command is running, 0 when done
+ */
+u8 data_logger_cmd(char *str);
+
+/**
+ * @brief Display help information for logger commands
+ *
+ * @return 1 while help lines remain, 0 when done
+ */
+u8 data_logger_cmd_help(void);
+
+/**
+ * @brief Command line interface for history queries
+ *
+ * "log yymmdd hhmmss hhmmss [step] [Name,Name]" prints the records of the
+ * range, "log web ..." uploads them, "log stop" ends the upload. An end
+ * time before the start time lies on the next day. Without names the first
+ * LOGGER_QUERY_SIGNALS signals are returned.
+ *
+ * @param[in,out] str Command string
+ *
+ * @return 1 while records are printed, 0 when done
+ */
+u8 data_logger_log_cmd(char *str);
+
+/**
+ * @brief Display help information for the log command
+ *
+ * @return 1 while help lines remain, 0 when done
+ */
+u8 data_logger_log_cmd_help(void);
+
+#endif /* H_DATA_LOGGER */
@@ -0,0 +1,592 @@
+/**
+ * @file kv_store.c
+ * @brief Log-structured key/value store implementation
+ *
+ * Sector layout:
+ *   +0   state      KV_STATE_xxx, programmed twice (RECEIVING, then ACTIVE)
+ *   +4   magic      KV_MAGIC
+ *   +8   generation incremented by every garbage collection
+ *   +12  ~generation
+ *   +16  entries, appended until the first erased word
+ *
+ * Entry: header word (key | len << 16), data rounded up to whole words and
+ * a CRC32 over header and data. Entries are programmed front to back; a
+ * power loss leaves an entry without a valid CRC, which the scan skips by
+ * its length.
+ *
+ * Garbage collection erases the other sector, writes its header as
+ * RECEIVING, copies the RAM value of every key and finally programs the
+ * state word to ACTIVE. Until then the old sector stays the valid one; if
+ * both are ACTIVE after a power loss the higher generation wins.
+ *
+ * A 128 KiB sector erase takes 1-2 s, the IWDG expires after ~2 s
+ * (LSI 32 kHz / 16 * 4096) or ~1.4 s at the fastest LSI. The service only
+ * requests the erase, the main loop starts it with interrupts enabled and
+ * the service polls BSY like it does for programming. Every fetch from
+ * flash stalls until the erase is done, so the main loop and the handlers,
+ * vector table included, only run again after it; the IWDG prescaler is
+ * raised to KV_ERASE_IWDG_PRESCALER for that time. Handlers that must run
+ * during an erase would need a RAM vector table (SCB->VTOR) and RAM code;
+ * none does, an erase happens once per ~10000 reference writes.
+ *
+ * @date 2025-10-29
+ * @author Allayar Moazami
+ */
+#include "kv_store.h"
+#include "iflash.h"
+#include "iwdg.h"
+#include "crc.h"
+#include "main.h"
+#include <string.h>
+
+/* ========================================================================
+ * Constants
+ * ======================================================================== */
+
+/** @brief Sector header marker, "KVS1" */
+#define KV_MAGIC 0x3153564BUL
+
+/** @brief Sector state: erased */
+#define KV_STATE_ERASED 0xFFFFFFFFUL
+
+/** @brief Sector state: garbage collection in progress */
+#define KV_STATE_RECEIVING 0xEEEEEEEEUL
+
+/** @brief Sector state: valid, only bits cleared from RECEIVING */
+#define KV_STATE_ACTIVE 0x00000000UL
+
+/** @brief Size of one sector */
+#define KV_SECTOR_SIZE 0x20000UL
+
+/** @brief Size of the sector header */
+#define KV_HEADER_SIZE 16U
+
+/** @brief Words of the largest entry: header, data, CRC */
+#define KV_ENTRY_WORDS (2U + (KV_VALUE_MAX / 4U))
+
+/** @brief IWDG prescaler during an erase, ~8 s or ~5.6 s at the fastest LSI */
+#define KV_ERASE_IWDG_PRESCALER IWDG_PRESCALER_64
+
+/** @brief Flash error flags */
+#define KV_FLASH_ERRORS (FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | \
+                         FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR)
+
+/** @brief Sector base addresses */
+static const u32 gSectorAddr[2] = { 0x080C0000UL, 0x080E0000UL };
+
+/** @brief HAL sector numbers */
+static const u32 gSectorId[2] = { FLASH_SECTOR_10, FLASH_SECTOR_11 };
+
+/**
+ * @enum EnuKvState
+ * @brief Service state
+ */
+typedef enum EnuKvStateEnum
+{
+    KV_IDLE = 0,            /**< Nothing in flight */
+    KV_ERASE_REQ,           /**< Erase requested, run by kv_store_erase_service() */
+    KV_ERASE,               /**< Erase of the receiving sector done */
+    KV_PROGRAM,             /**< Programming gProg */
+} EnuKvState;
+
+/**
+ * @enum EnuKvStep
+ * @brief What follows a finished program job
+ */
+typedef enum EnuKvStepEnum
+{
+    KV_STEP_APPEND = 0,     /**< Entry appended to the active sector */
+    KV_STEP_COPY,           /**< Entry copied to the receiving sector */
+    KV_STEP_ACTIVATE        /**< Receiving sector marked ACTIVE */
+} EnuKvStep;
+
+/* ========================================================================
+ * Types
+ * ======================================================================== */
+
+/**
+ * @struct StuKvKey
+ * @brief RAM copy of one key
+ */
+typedef struct StuKvKeyStruct
+{
+    u16 key;                    /**< Key, 0xFFFF if the slot is free */
+    u8 len;                     /**< Value size */
+    volatile u8 dirty;          /**< Value not yet in flash */
+    u8 value[KV_VALUE_MAX];     /**< Newest value */
+} StuKvKey;
+
+/**
+ * @struct StuKvProgram
+ * @brief Words being programmed
+ */
+typedef struct StuKvProgramStruct
+{
+    u32 addr;                   /**< Flash address of word[0] */
+    u32 word[KV_ENTRY_WORDS];   /**< Words to program */
+    u8 count;                   /**< Number of words */
+    u8 next;                    /**< Next word to issue */
+    u8 step;                    /**< EnuKvStep on completion */
+} StuKvProgram;
+
+/* ========================================================================
+ * Static Variables
+ * ======================================================================== */
+
+/** @brief Key table */
+static StuKvKey gKey[KV_MAX_KEYS];
+
+/** @brief Program job in flight */
+static StuKvProgram gProg;
+
+/** @brief EnuKvState, shared with the main loop */
+static volatile u8 gState = KV_IDLE;
+
+/** @brief Index of the active sector */
+static u8 gActive = 0;
+
+/** @brief The active sector holds a valid store */
+static u8 gValid = 0;
+
+/** @brief Generation of the active sector */
+static u32 gGen = 0;
+
+/** @brief Next free address of the active sector */
+static u32 gWrite = 0;
+
+/** @brief Active sector full or damaged, or no store yet */
+static u8 gGcNeeded = 0;
+
+/** @brief Next key to copy during garbage collection */
+static u8 gCopyKey = 0;
+
+/** @brief Next free address of the receiving sector */
+static u32 gCopyAddr = 0;
+
+/** @brief Failed flash operations since start-up */
+static u32 gErrors = 0;
+
+/* ========================================================================
+ * Static Helper Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Read a flash word
+ * @param[in] addr Word address
+ * @return Word
+ */
+static u32 kv_store_word(u32 addr)
+{
+    return *(volatile const u32 *)addr;
+}
+
+/**
+ * @brief Find a key slot
+ * @param[in] key    Key
+ * @param[in] create 1 to take a free slot for an unknown key
+ * @return Slot, NULL if unknown (and no free slot)
+ */
+static StuKvKey *kv_store_slot(u16 key, u8 create)
+{
+    StuKvKey *free = NULL;
+
+    for (u8 i = 0; i < KV_MAX_KEYS; i++) {
+        if (key == gKey[i].key) {
+            return &gKey[i];
+        }
+        if (NULL == free && 0xFFFFU == gKey[i].key) {
+            free = &gKey[i];
+        }
+    }
+    if (1U == create && NULL != free) {
+        free->key = key;
+        free->len = 0;
+        free->dirty = 0;
+        return free;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Check a sector header
+ * @param[in] s Sector index
+ * @return 1 if the sector is an ACTIVE store
+ */
+static u8 kv_store_sector_valid(u8 s)
+{
+    u32 base = gSectorAddr[s];
+
+    return (KV_STATE_ACTIVE == kv_store_word(base) &&
+            KV_MAGIC == kv_store_word(base + 4U) &&
+            kv_store_word(base + 8U) == ~kv_store_word(base + 12U)) ? 1U : 0U;
+}
+
+/**
+ * @brief Load the newest entry of every key from the active sector
+ */
+static void kv_store_scan(void)
+{
+    u32 end = gSectorAddr[gActive] + KV_SECTOR_SIZE;
+    u32 addr = gSectorAddr[gActive] + KV_HEADER_SIZE;
+    u32 header;
+    u32 size;
+    u16 len;
+    StuKvKey *slot;
+
+    while ((addr + 4U) <= end) {
+        header = kv_store_word(addr);
+        if (KV_STATE_ERASED == header) {
+            break;
+        }
+        len = (u16)(header >> 16);
+        size = 8U + ((len + 3U) & ~3UL);
+        if (0U == len || len > KV_VALUE_MAX || (addr + size) > end) {
+            /* Not written by this store: nothing behind it can be trusted */
+            gGcNeeded = 1;
+            addr = end;
+            break;
+        }
+        if (kv_store_word(addr + size - 4U) == calculateCRC32((const u8 *)addr, size - 4U)) {
+            slot = kv_store_slot((u16)header, 1);
+            if (NULL != slot) {
+                memcpy(slot->value, (const u8 *)(addr + 4U), len);
+                slot->len = (u8)len;
+            }
+        }
+        /* A torn entry fails its CRC and is skipped by its length */
+        addr += size;
+    }
+    gWrite = addr;
+}
+
+/**
+ * @brief Build the entry of a key into the program job
+ * @param[in] slot Key slot
+ * @param[in] addr Flash address of the entry
+ * @param[in] step Step on completion
+ */
+static void kv_store_build(StuKvKey *slot, u32 addr, u8 step)
+{
+    u8 words = (u8)((slot->len + 3U) / 4U);
+
+    /* Cleared first: a kv_store_set() racing the copy marks the key again */
+    slot->dirty = 0;
+    memset(gProg.word, 0xFF, sizeof(gProg.word));
+    gProg.word[0] = (u32)slot->key | ((u32)slot->len << 16);
+    memcpy(&gProg.word[1], slot->value, slot->len);
+    gProg.word[1U + words] = calculateCRC32((const u8 *)gProg.word, (u32)(1U + words) * 4U);
+    gProg.addr = addr;
+    gProg.count = (u8)(2U + words);
+    gProg.next = 0;
+    gProg.step = step;
+}
+
+/**
+ * @brief Copy the next key to the receiving sector, or activate it
+ */
+static void kv_store_copy_next(void)
+{
+    u8 target = gActive ^ 1U;
+
+    if (0U == gValid) {
+        target = 0;
+    }
+    while (gCopyKey < KV_MAX_KEYS) {
+        StuKvKey *slot = &gKey[gCopyKey++];
+
+        if (0xFFFFU != slot->key && 0U != slot->len) {
+            kv_store_build(slot, gCopyAddr, KV_STEP_COPY);
+            gState = KV_PROGRAM;
+            return;
+        }
+    }
+    gProg.addr = gSectorAddr[target];
+    gProg.word[0] = KV_STATE_ACTIVE;
+    gProg.count = 1;
+    gProg.next = 0;
+    gProg.step = KV_STEP_ACTIVATE;
+    gState = KV_PROGRAM;
+}
+
+/**
+ * @brief Change the IWDG prescaler and reload the counter
+ * @param[in] prescaler IWDG_PRESCALER_xxx
+ */
+static void kv_store_watchdog(u32 prescaler)
+{
+    /* A previous update must be through, a few LSI cycles */
+    while (0U != (IWDG->SR & IWDG_SR_PVU)) {
+    }
+    /* Same keys as HAL_IWDG_Init() and HAL_IWDG_Refresh() */
+    IWDG->KR = 0x00005555U;
+    IWDG->PR = prescaler;
+    IWDG->KR = 0x0000AAAAU;
+}
+
+/**
+ * @brief Start garbage collection: request the erase of the other sector
+ */
+static void kv_store_gc_start(void)
+{
+    HAL_FLASH_Unlock();
+    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | KV_FLASH_ERRORS);
+    gState = KV_ERASE_REQ;
+}
+
+/**
+ * @brief Finish a program job
+ */
+static void kv_store_program_done(void)
+{
+    u8 target = (1U == gValid) ? (u8)(gActive ^ 1U) : 0U;
+
+    switch (gProg.step) {
+    case KV_STEP_APPEND:
+        gWrite += (u32)gProg.count * 4U;
+        gState = KV_IDLE;
+        break;
+    case KV_STEP_COPY:
+        gCopyAddr += (u32)gProg.count * 4U;
+        kv_store_copy_next();
+        break;
+    case KV_STEP_ACTIVATE:
+        gActive = target;
+        gValid = 1;
+        gGen++;
+        gWrite = gCopyAddr;
+        gGcNeeded = 0;
+        gState = KV_IDLE;
+        break;
+    default:
+        gState = KV_IDLE;
+        break;
+    }
+}
+
+/* ========================================================================
+ * Public Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Scan the flash sectors and load the newest value of every key
+ */
+void kv_store_init(void)
+{
+    char legacy[KV_VALUE_MAX];
+    u8 valid0;
+    u8 valid1;
+
+    for (u8 i = 0; i < KV_MAX_KEYS; i++) {
+        gKey[i].key = 0xFFFFU;
+        gKey[i].len = 0;
+        gKey[i].dirty = 0;
+    }
+    gState = KV_IDLE;
+    gGcNeeded = 0;
+
+    valid0 = kv_store_sector_valid(0);
+    valid1 = kv_store_sector_valid(1);
+    if (1U == valid0 && 1U == valid1) {
+        /* Power lost between activating the new sector and the next erase */
+        gActive = ((int32_t)(kv_store_word(gSectorAddr[1] + 8U) -
+                             kv_store_word(gSectorAddr[0] + 8U)) > 0) ? 1U : 0U;
+    } else {
+        gActive = (1U == valid1) ? 1U : 0U;
+    }
+    gValid = (1U == valid0 || 1U == valid1) ? 1U : 0U;
+
+    if (1U == gValid) {
+        gGen = kv_store_word(gSectorAddr[gActive] + 8U);
+        kv_store_scan();
+        return;
+    }
+
+    /* No store yet: format on the first service call, keep the old serial */
+    gGen = 0;
+    gGcNeeded = 1;
+    Flash_Read_String(FLASH_USER_START_ADDR, legacy, sizeof(legacy));
+    legacy[sizeof(legacy) - 1U] = '\0';
+    if (NULL != strstr(legacy, "UA")) {
+        kv_store_set(KV_KEY_SERIAL, legacy, (u8)(strlen(legacy) + 1U));
+    }
+}
+
+/**
+ * @brief Get a value
+ *
+ * @param[in]  key   Key
+ * @param[out] value Buffer of at least len bytes
+ * @param[in]  len   Buffer size
+ *
+ * @return Bytes copied, 0 if the key is unknown
+ */
+u8 kv_store_get(u16 key, void *value, u8 len)
+{
+    StuKvKey *slot = kv_store_slot(key, 0);
+
+    if (NULL == slot || 0U == slot->len) {
+        return 0;
+    }
+    if (len > slot->len) {
+        len = slot->len;
+    }
+    memcpy(value, slot->value, len);
+    return len;
+}
+
+/**
+ * @brief Set a value
+ *
+ * @param[in] key   Key, 0xFFFF is reserved
+ * @param[in] value Value
+ * @param[in] len   Value size, 1..KV_VALUE_MAX
+ *
+ * @return 1 if accepted, 0 if the key table is full or len is invalid
+ */
+u8 kv_store_set(u16 key, const void *value, u8 len)
+{
+    StuKvKey *slot;
+
+    if (0xFFFFU == key || 0U == len || len > KV_VALUE_MAX) {
+        return 0;
+    }
+    slot = kv_store_slot(key, 1);
+    if (NULL == slot) {
+        return 0;
+    }
+    if (len == slot->len && 0 == memcmp(slot->value, value, len)) {
+        return 1;
+    }
+    memcpy(slot->value, value, len);
+    slot->len = len;
+    slot->dirty = 1;
+    return 1;
+}
+
+/**
+ * @brief Advance flash programming, erase and garbage collection
+ */
+void kv_store_service(void)
+{
+    switch (gState) {
+    case KV_IDLE:
+        if (1U == gGcNeeded) {
+            kv_store_gc_start();
+            break;
+        }
+        for (u8 i = 0; i < KV_MAX_KEYS; i++) {
+            if (1U == gKey[i].dirty) {
+                if ((gWrite + (KV_ENTRY_WORDS * 4U)) > (gSectorAddr[gActive] + KV_SECTOR_SIZE)) {
+                    gGcNeeded = 1;
+                    return;
+                }
+                HAL_FLASH_Unlock();
+                __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | KV_FLASH_ERRORS);
+                kv_store_build(&gKey[i], gWrite, KV_STEP_APPEND);
+                gState = KV_PROGRAM;
+                return;
+            }
+        }
+        HAL_FLASH_Lock();
+        break;
+
+    case KV_ERASE_REQ:
+        /* The main loop runs the erase */
+        break;
+
+    case KV_ERASE:
+        if (__HAL_FLASH_GET_FLAG(FLASH_FLAG_BSY)) {
+            break;
+        }
+        kv_store_watchdog(hiwdg.Init.Prescaler);
+        CLEAR_BIT(FLASH->CR, (FLASH_CR_SER | FLASH_CR_SNB));
+        FLASH_FlushCaches();
+        if (__HAL_FLASH_GET_FLAG(KV_FLASH_ERRORS)) {
+            __HAL_FLASH_CLEAR_FLAG(KV_FLASH_ERRORS);
+            gErrors++;
+            gState = KV_IDLE;
+            break;
+        }
+        /* Header of the receiving sector, state word first */
+        gProg.addr = gSectorAddr[(1U == gValid) ? (gActive ^ 1U) : 0U];
+        gProg.word[0] = KV_STATE_RECEIVING;
+        gProg.word[1] = KV_MAGIC;
+        gProg.word[2] = gGen + 1U;
+        gProg.word[3] = ~(gGen + 1U);
+        gProg.count = 4;
+        gProg.next = 0;
+        gProg.step = KV_STEP_COPY;
+        gCopyKey = 0;
+        gCopyAddr = gProg.addr;
+        gState = KV_PROGRAM;
+        break;
+
+    case KV_PROGRAM:
+        if (__HAL_FLASH_GET_FLAG(FLASH_FLAG_BSY)) {
+            break;
+        }
+        if (__HAL_FLASH_GET_FLAG(KV_FLASH_ERRORS)) {
+            /* Start over in a fresh sector, it receives every RAM value */
+            __HAL_FLASH_CLEAR_FLAG(KV_FLASH_ERRORS);
+            CLEAR_BIT(FLASH->CR, FLASH_CR_PG);
+            gErrors++;
+            gGcNeeded = 1;
+            gState = KV_IDLE;
+            break;
+        }
+        if (gProg.next < gProg.count) {
+            FLASH->CR &= CR_PSIZE_MASK;
+            FLASH->CR |= FLASH_PSIZE_WORD;
+            FLASH->CR |= FLASH_CR_PG;
+            *(volatile u32 *)(gProg.addr + ((u32)gProg.next * 4U)) = gProg.word[gProg.next];
+            gProg.next++;
+            break;
+        }
+        CLEAR_BIT(FLASH->CR, FLASH_CR_PG);
+        kv_store_program_done();
+        break;
+
+    default:
+        gState = KV_IDLE;
+        break;
+    }
+}
+
+/**
+ * @brief Start a requested sector erase
+ */
+void kv_store_erase_service(void)
+{
+    u8 target;
+
+    if (KV_ERASE_REQ != gState) {
+        return;
+    }
+    target = (1U == gValid) ? (u8)(gActive ^ 1U) : 0U;
+    kv_store_watchdog(KV_ERASE_IWDG_PRESCALER);
+    FLASH->CR &= CR_PSIZE_MASK;
+    FLASH->CR |= FLASH_PSIZE_WORD;
+    CLEAR_BIT(FLASH->CR, FLASH_CR_SNB);
+    FLASH->CR |= FLASH_CR_SER | (gSectorId[target] << FLASH_CR_SNB_Pos);
+    FLASH->CR |= FLASH_CR_STRT;
+    /* The next fetch from flash waits for the end of the erase */
+    gState = KV_ERASE;
+}
+
+/**
+ * @brief Check for pending flash work
+ *
+ * @return 1 while values wait to be programmed, 0 when flash is in sync
+ */
+u8 kv_store_busy(void)
+{
+    if (KV_IDLE != gState || 1U == gGcNeeded) {
+        return 1;
+    }
+    for (u8 i = 0; i < KV_MAX_KEYS; i++) {
+        if (1U == gKey[i].dirty) {
+            return 1;
+        }
+    }
+    return 0;
+}
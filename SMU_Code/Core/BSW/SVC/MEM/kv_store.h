@@ -0,0 +1,104 @@
+/**
+ * @file kv_store.h
+ * @brief Log-structured key/value store in internal flash
+ *
+ * Small persistent values (references, REFID, serial number) live in two
+ * 128 KiB flash sectors (10 and 11) instead of depending on the SD card.
+ * Every write appends a new entry (key, length, data, CRC32) to the active
+ * sector; the newest valid entry of a key wins. When the active sector is
+ * full the other sector is erased and receives the newest entry of every
+ * key, then becomes active. The two sectors take turns, so both wear at
+ * the same rate and an erase happens only once per ~10000 reference
+ * writes.
+ *
+ * kv_store_set() only updates a RAM copy and queues the key. Flash is
+ * programmed from kv_store_service(), one word per call, polling the
+ * flash status instead of waiting. Interrupts are never masked. A sector
+ * erase is only needed for garbage collection; kv_store_erase_service()
+ * starts it from the main loop and kv_store_service() polls its end. On
+ * the single-bank STM32F407 every flash fetch, interrupt vectors
+ * included, stalls while the erase runs, so interrupts are delayed
+ * until it ends instead of masked.
+ *
+ * @date 2025-10-29
+ * @author Allayar Moazami
+ */
+#ifndef H_KV_STORE
+#define H_KV_STORE
+
+#include "platform.h"
+
+/** @brief Largest value in bytes */
+#define KV_VALUE_MAX 16U
+
+/** @brief Number of distinct keys */
+#define KV_MAX_KEYS 40U
+
+/** @brief Device serial number, NUL terminated string */
+#define KV_KEY_SERIAL 0x0001U
+
+/** @brief Reference value (f32), keyed by its REF_WEB_INDEX */
+#define KV_KEY_REF(index) ((u16)(0x1000U + (u16)(index)))
+
+/** @brief Energy counter pair (import, export as uint64_t), index channel * 2 + reactive */
+#define KV_KEY_ENERGY(index) ((u16)(0x2000U + (u16)(index)))
+
+/**
+ * @brief Scan the flash sectors and load the newest value of every key
+ *
+ * Called once at start-up. A device without a store yet is formatted by
+ * kv_store_service(); a serial number left by the old sector 11 writer is
+ * taken over.
+ */
+void kv_store_init(void);
+
+/**
+ * @brief Get a value
+ *
+ * @param[in]  key   Key
+ * @param[out] value Buffer of at least len bytes
+ * @param[in]  len   Buffer size
+ *
+ * @return Bytes copied, 0 if the key is unknown
+ */
+u8 kv_store_get(u16 key, void *value, u8 len);
+
+/**
+ * @brief Set a value
+ *
+ * The RAM copy is updated at once, flash follows from kv_store_service().
+ * A value equal to the stored one is not written again.
+ *
+ * @param[in] key   Key, 0xFFFF is reserved
+ * @param[in] value Value
+ * @param[in] len   Value size, 1..KV_VALUE_MAX
+ *
+ * @return 1 if accepted, 0 if the key table is full or len is invalid
+ */
+u8 kv_store_set(u16 key, const void *value, u8 len);
+
+/**
+ * @brief Advance flash programming, erase and garbage collection
+ *
+ * Never waits for the flash. Must be called periodically from one context
+ * (RTE_MNT_MNG).
+ */
+void kv_store_service(void);
+
+/**
+ * @brief Start a requested sector erase
+ *
+ * Called from the main loop, never from an interrupt. Returns as soon as
+ * the erase runs, with the watchdog window widened for its 1-2 s; the
+ * service restores the window and writes the sector header once BSY clears.
+ */
+void kv_store_erase_service(void);
+
+/**
+ * @brief Check for pending flash work
+ *
+ * @return 1 while values wait to be programmed, 0 when flash is in sync
+ */
+u8 kv_store_busy(void);
+
+#endif /* H_KV_STORE */
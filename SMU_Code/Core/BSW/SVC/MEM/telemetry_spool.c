@@ -0,0 +1,589 @@
+/**
+ * @file telemetry_spool.c
+ * @brief Store-and-forward telemetry spool implementation
+ *
+ * The spool is a single file on the SD card: a 512-byte header sector that
+ * holds the persisted offsets, followed by SPOOL_SLOT_COUNT fixed-size record
+ * slots used as a ring. head and tail are free-running record counters, the
+ * slot of a record is its counter modulo SPOOL_SLOT_COUNT.
+ *
+ * A record is written before the header that publishes it, so a power loss
+ * in between only loses that record. The file is opened and closed for every
+ * access because FatFs is configured with _FS_LOCK = 2 and MEM.c needs the
+ * other handle for the CFG files.
+ *
+ * Records are replayed through the existing "send-chanel" JSON schema with
+ * their original date/time. That schema carries one timestamp per frame, so
+ * a batch is bounded by one record and the modem buffer; values of a record
+ * that do not fit are sent in the next frame and the item offset inside the
+ * record is persisted as well. The item offset counts entries, a value and
+ * its window aggregate are SIG_PART_COUNT consecutive entries. The record
+ * keeps the aggregate of every SIG_POLICY_STATS signal, the upload only
+ * sends those with SIG_POLICY_UPLOAD, one "min*max*avg" entry each, so a
+ * record fits in about six frames and the backlog drains faster than
+ * LOG_TICK refills it.
+ *
+ * @date 2025-10-20
+ * @author Allayar Moazami
+ */
+#include "telemetry_spool.h"
+#include "fatfs.h"
+#include "httpFrame.h"
+#include "mntdata.h"
+#include "server.h"
+#include "crc.h"
+#include "dbg.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+/* ========================================================================
+ * Constants
+ * ======================================================================== */
+
+/** @brief Header marker, "SPOL" */
+#define SPOOL_MAGIC 0x4C4F5053UL
+
+/** @brief Size of the header sector in front of the record slots */
+#define SPOOL_HEADER_SIZE 512U
+
+/** @brief Size of one record slot, a whole number of SD sectors */
+#define SPOOL_RECORD_SIZE 1536U
+
+/** @brief Size of the API URL buffer in GPRS_HandleTypeDef */
+#define SPOOL_API_SIZE 50
+
+/** @brief Size of temporary string buffer for formatting */
+#define TEMP_STRING_SIZE 80
+
+/** @brief Room kept free at the end of a frame for the closing braces */
+#define FRAME_TAIL_SIZE 8
+
+/* ========================================================================
+ * Types
+ * ======================================================================== */
+
+/**
+ * @struct StuSpoolHeader
+ * @brief Persisted spool offsets, stored at file offset 0
+ */
+typedef struct StuSpoolHeaderStruct
+{
+    u32 magic;      /**< SPOOL_MAGIC */
+    u32 head;       /**< Records written (free-running) */
+    u32 tail;       /**< Records fully uploaded or dropped (free-running) */
+    u32 seq;        /**< Next record sequence number */
+    u32 dropped;    /**< Records lost to overflow or rejected uploads */
+    u16 item;       /**< Entries of the tail record already uploaded */
+    u16 slots;      /**< SPOOL_SLOT_COUNT the file was created with */
+    u16 crc;        /**< CRC16 over the fields above */
+    u16 recordSize; /**< sizeof(StuSpoolRecord) the file was created with */
+} StuSpoolHeader;
+
+/**
+ * @struct StuSpoolRecord
+ * @brief One log tick, SPOOL_RECORD_SIZE so a record covers exactly three SD sectors
+ */
+typedef struct StuSpoolRecordStruct
+{
+    u32 seq;                        /**< Record sequence number */
+    u32 stamp;                      /**< Packed RTC date/time */
+    u16 count;                      /**< Number of valid values */
+    u16 crc;                        /**< CRC16 over value..samples */
+    u32 reserved;
+    f32 value[SPOOL_MAX_VALUES];    /**< Values in signal ID order, INVALID_DATA if not reported */
+    f32 min[SPOOL_MAX_VALUES];      /**< Window minimum */
+    f32 max[SPOOL_MAX_VALUES];      /**< Window maximum */
+    f32 mean[SPOOL_MAX_VALUES];     /**< Window mean */
+    u16 samples[SPOOL_MAX_VALUES];  /**< Window sample count, 0 if not aggregated */
+    u8 pad[SPOOL_RECORD_SIZE - 16U - (18U * SPOOL_MAX_VALUES)]; /**< Fill up to SPOOL_RECORD_SIZE */
+} StuSpoolRecord;
+
+/** @brief Bytes covered by the record CRC */
+#define SPOOL_RECORD_PAYLOAD (offsetof(StuSpoolRecord, pad) - offsetof(StuSpoolRecord, value))
+
+/* ========================================================================
+ * Static Variables
+ * ======================================================================== */
+
+/** @brief RAM copy of the persisted header */
+static StuSpoolHeader gHeader;
+
+/** @brief Tail record cached between the frames that upload it */
+static StuSpoolRecord gRecord;
+
+/** @brief Spool mounted and header valid */
+static u8 gReady = 0;
+
+/** @brief gRecord holds the record at gHeader.tail */
+static u8 gRecordValid = 0;
+
+/** @brief A spool frame is loaded in the modem buffer */
+static u8 gInFlight = 0;
+
+/** @brief Number of values carried by the in-flight frame */
+static u16 gInFlightItems = 0;
+
+/** @brief Rejected uploads of the current frame */
+static u8 gRetry = 0;
+
+/** @brief File object, only open during a single access */
+static FIL gSpoolFile;
+
+/* ========================================================================
+ * Static Function Prototypes
+ * ======================================================================== */
+
+static u8 telemetry_spool_mount(void);
+static u8 telemetry_spool_save_header(void);
+static u8 telemetry_spool_read_tail(void);
+static void telemetry_spool_advance(u16 items);
+static u16 telemetry_spool_capture(StuSpoolRecord *record);
+static u16 telemetry_spool_record_crc(const StuSpoolRecord *record);
+static u16 telemetry_spool_header_crc(const StuSpoolHeader *header);
+static u32 telemetry_spool_pack_time(DateTime tm);
+static DateTime telemetry_spool_unpack_time(u32 stamp);
+
+/* ========================================================================
+ * Static Helper Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Calculate the header CRC
+ * @param[in] header Header to check
+ * @return CRC16 over all fields in front of crc
+ */
+static u16 telemetry_spool_header_crc(const StuSpoolHeader *header)
+{
+    return calculateCRC((u8 *)header, (u16)offsetof(StuSpoolHeader, crc));
+}
+
+/**
+ * @brief Pack RTC date/time into 32 bits
+ *
+ * Layout: year-2000 (6) | month (4) | day (5) | hour (5) | minute (6) | second (6)
+ *
+ * @param[in] tm RTC date/time
+ * @return Packed time stamp
+ */
+static u32 telemetry_spool_pack_time(DateTime tm)
+{
+    return ((u32)(tm.year - 2000) << 26) | ((u32)tm.month << 22) |
+           ((u32)tm.day << 17) | ((u32)tm.hour << 12) |
+           ((u32)tm.minute << 6) | (u32)tm.second;
+}
+
+/**
+ * @brief Unpack a time stamp produced by telemetry_spool_pack_time()
+ * @param[in] stamp Packed time stamp
+ * @return RTC date/time
+ */
+static DateTime telemetry_spool_unpack_time(u32 stamp)
+{
+    DateTime tm;
+
+    memset(&tm, 0, sizeof(tm));
+    tm.year = (int)(stamp >> 26) + 2000;
+    tm.month = (int)((stamp >> 22) & 0x0F);
+    tm.day = (int)((stamp >> 17) & 0x1F);
+    tm.hour = (int)((stamp >> 12) & 0x1F);
+    tm.minute = (int)((stamp >> 6) & 0x3F);
+    tm.second = (int)(stamp & 0x3F);
+    return tm;
+}
+
+/**
+ * @brief Calculate the record CRC
+ * @param[in] record Record to check
+ * @return CRC16 over values and window aggregates
+ */
+static u16 telemetry_spool_record_crc(const StuSpoolRecord *record)
+{
+    return calculateCRC((u8 *)record->value, (u16)SPOOL_RECORD_PAYLOAD);
+}
+
+/**
+ * @brief Copy all monitoring values and window aggregates into a record
+ * @param[out] record Record to fill
+ * @return Number of values copied
+ */
+static u16 telemetry_spool_capture(StuSpoolRecord *record)
+{
+    static f32 snapshot[SIG_COUNT];
+    StuSignalStats stats;
+    u16 count = 0;
+
+    signal_db_set(SIG_SMU_LIVE, signal_db_get(SIG_SMU_LIVE) + 1);
+    signal_db_snapshot(snapshot);
+    while (count < SPOOL_MAX_VALUES && count < SIG_COUNT) {
+        if (1 == signal_db_reported((EnuSignalId)count)) {
+            record->value[count] = snapshot[count];
+            signal_db_stats((EnuSignalId)count, &stats);
+            record->min[count] = stats.min;
+            record->max[count] = stats.max;
+            record->mean[count] = stats.mean;
+            record->samples[count] = (stats.count > 0xFFFFU) ? 0xFFFFU : (u16)stats.count;
+        } else {
+            record->value[count] = INVALID_DATA;
+        }
+        count++;
+    }
+    return count;
+}
+
+/**
+ * @brief Open the spool file and load or create its header
+ * @return 1 if the spool is ready, 0 on SD error
+ */
+static u8 telemetry_spool_mount(void)
+{
+    UINT bytes = 0;
+    FRESULT res;
+
+    res = f_mkdir(SPOOL_DIR);
+    if (FR_OK != res && FR_EXIST != res) {
+        return 0;
+    }
+    if (FR_OK != f_open(&gSpoolFile, SPOOL_FILE_PATH, FA_READ | FA_WRITE | FA_OPEN_ALWAYS)) {
+        return 0;
+    }
+
+    res = f_read(&gSpoolFile, &gHeader, sizeof(gHeader), &bytes);
+    f_close(&gSpoolFile);
+    if (FR_OK != res) {
+        return 0;
+    }
+
+    if (sizeof(gHeader) != bytes || SPOOL_MAGIC != gHeader.magic ||
+        SPOOL_SLOT_COUNT != gHeader.slots || sizeof(StuSpoolRecord) != gHeader.recordSize ||
+        gHeader.crc != telemetry_spool_header_crc(&gHeader) ||
+        (gHeader.head - gHeader.tail) > SPOOL_SLOT_COUNT) {
+        /* New card or incompatible file: start an empty spool */
+        memset(&gHeader, 0, sizeof(gHeader));
+        gHeader.magic = SPOOL_MAGIC;
+        gHeader.slots = SPOOL_SLOT_COUNT;
+        gHeader.recordSize = sizeof(StuSpoolRecord);
+        TransmitDebug(">>Spool created\r");
+    }
+
+    gReady = 1;
+    gRecordValid = 0;
+    gInFlight = 0;
+    if (0 == telemetry_spool_save_header()) {
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Write the RAM header to the spool file
+ * @return 1 on success, 0 on SD error (spool is remounted on next append)
+ */
+static u8 telemetry_spool_save_header(void)
+{
+    UINT bytes = 0;
+    FRESULT res;
+
+    gHeader.crc = telemetry_spool_header_crc(&gHeader);
+    res = f_open(&gSpoolFile, SPOOL_FILE_PATH, FA_WRITE | FA_OPEN_EXISTING);
+    if (FR_OK == res) {
+        res = f_write(&gSpoolFile, &gHeader, sizeof(gHeader), &bytes);
+        if (FR_OK == f_close(&gSpoolFile) && FR_OK == res && sizeof(gHeader) == bytes) {
+            return 1;
+        }
+    }
+    gReady = 0;
+    return 0;
+}
+
+/**
+ * @brief Load the record at the tail into gRecord
+ * @return 1 if the record is valid, 0 on SD error or corrupt record
+ */
+static u8 telemetry_spool_read_tail(void)
+{
+    UINT bytes = 0;
+    FRESULT res;
+    FSIZE_t offset = SPOOL_HEADER_SIZE +
+                     (FSIZE_t)(gHeader.tail % SPOOL_SLOT_COUNT) * sizeof(StuSpoolRecord);
+
+    if (FR_OK != f_open(&gSpoolFile, SPOOL_FILE_PATH, FA_READ | FA_OPEN_EXISTING)) {
+        gReady = 0;
+        return 0;
+    }
+    res = f_lseek(&gSpoolFile, offset);
+    if (FR_OK == res) {
+        res = f_read(&gSpoolFile, &gRecord, sizeof(gRecord), &bytes);
+    }
+    f_close(&gSpoolFile);
+    if (FR_OK != res) {
+        gReady = 0;
+        return 0;
+    }
+
+    if (sizeof(gRecord) != bytes || gRecord.count > SPOOL_MAX_VALUES ||
+        gRecord.crc != telemetry_spool_record_crc(&gRecord)) {
+        return 0;
+    }
+    gRecordValid = 1;
+    return 1;
+}
+
+/**
+ * @brief Mark entries of the tail record as done and persist the offset
+ * @param[in] items Number of entries consumed from the tail record
+ */
+static void telemetry_spool_advance(u16 items)
+{
+    gHeader.item += items;
+    if (0 == gRecordValid || gHeader.item >= (gRecord.count * SIG_PART_COUNT)) {
+        gHeader.tail++;
+        gHeader.item = 0;
+        gRecordValid = 0;
+    }
+    telemetry_spool_save_header();
+}
+
+/* ========================================================================
+ * Public Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Append a snapshot of the monitoring database to the spool
+ *
+ * WCET is dominated by two FatFs open/write/close sequences, comparable to
+ * updateConfig() in MEM.c. Called once per LOG_TICK.
+ *
+ * @return 1 if the record was stored, 0 if the SD card is not usable
+ */
+u8 telemetry_spool_append(void)
+{
+    static StuSpoolRecord record;
+    UINT bytes = 0;
+    FRESULT res;
+    FSIZE_t offset;
+
+    if (0 == gReady && 0 == telemetry_spool_mount()) {
+        return 0;
+    }
+
+    memset(&record, 0, sizeof(record));
+    _rtcFunctionRead(0);
+    record.stamp = telemetry_spool_pack_time(urtc);
+    record.seq = gHeader.seq;
+    record.count = telemetry_spool_capture(&record);
+    record.crc = telemetry_spool_record_crc(&record);
+
+    if ((gHeader.head - gHeader.tail) >= SPOOL_SLOT_COUNT) {
+        /* Ring full: drop the oldest record, abandon it if it is in flight */
+        gHeader.tail++;
+        gHeader.item = 0;
+        gHeader.dropped++;
+        gRecordValid = 0;
+        gInFlight = 0;
+    }
+
+    offset = SPOOL_HEADER_SIZE +
+             (FSIZE_t)(gHeader.head % SPOOL_SLOT_COUNT) * sizeof(StuSpoolRecord);
+    res = f_open(&gSpoolFile, SPOOL_FILE_PATH, FA_WRITE | FA_OPEN_EXISTING);
+    if (FR_OK != res) {
+        gReady = 0;
+        return 0;
+    }
+    res = f_lseek(&gSpoolFile, offset);
+    if (FR_OK == res) {
+        res = f_write(&gSpoolFile, &record, sizeof(record), &bytes);
+    }
+    if (FR_OK != f_close(&gSpoolFile) || FR_OK != res || sizeof(record) != bytes) {
+        gReady = 0;
+        return 0;
+    }
+
+    gHeader.head++;
+    gHeader.seq++;
+    return telemetry_spool_save_header();
+}
+
+/**
+ * @brief Get spool status
+ *
+ * @return 1 if records are waiting for upload, 0 otherwise
+ */
+u8 telemetry_spool_status(void)
+{
+    if (1 == gReady && gHeader.head != gHeader.tail) {
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Build the next upload frame from the oldest spooled record
+ *
+ * @param[out] str Output buffer for JSON data (BUFFER_SIZE bytes)
+ * @param[out] api Output buffer for API URL (URL_SIZE bytes)
+ *
+ * @return 1 if a frame was built, 0 if nothing could be sent
+ */
+u8 telemetry_spool_web_report(u8 *str, u8 *api)
+{
+    char tempStr[TEMP_STRING_SIZE];
+    char entry[TEMP_STRING_SIZE];
+    u16 index;
+    u16 count = 0;
+    size_t len;
+
+    if (0 == telemetry_spool_status()) {
+        return 0;
+    }
+    if (0 == gRecordValid && 0 == telemetry_spool_read_tail()) {
+        if (1 == gReady) {
+            /* Corrupt slot, e.g. power lost while it was written */
+            gHeader.dropped++;
+            telemetry_spool_advance(0);
+        }
+        return 0;
+    }
+
+    server_return_url((u8 *)tempStr);
+    snprintf((char *)api, SPOOL_API_SIZE, "%s/api/send-chanel", tempStr);
+
+    memset(str, 0, BUFFER_SIZE);
+    startJsonFrame((char *)str, telemetry_spool_unpack_time(gRecord.stamp));
+
+    for (index = gHeader.item; index < (gRecord.count * SIG_PART_COUNT); index++) {
+        u16 signal = index / SIG_PART_COUNT;
+        StuSignalStats stats;
+        int size;
+
+        if (INVALID_DATA == gRecord.value[signal]) {
+            continue;
+        }
+        if (SIG_PART_LAST == (EnuSignalPart)(index % SIG_PART_COUNT)) {
+            size = formatJsonEntry(entry, sizeof(entry), count + 1, (EnuSignalId)signal,
+                                   gRecord.value[signal]);
+        } else if (0U == gRecord.samples[signal] ||
+                   0U == signal_db_stats_uploaded((EnuSignalId)signal)) {
+            continue;
+        } else {
+            stats.min = gRecord.min[signal];
+            stats.max = gRecord.max[signal];
+            stats.mean = gRecord.mean[signal];
+            stats.count = gRecord.samples[signal];
+            size = formatJsonStats(entry, sizeof(entry), count + 1, (EnuSignalId)signal, &stats);
+        }
+        if (0 == size) {
+            break;
+        }
+        len = strlen((char *)str);
+        if ((len + strlen(entry) + 2U + FRAME_TAIL_SIZE) >= BUFFER_SIZE) {
+            break;
+        }
+        if (0 != count) {
+            strcat((char *)str, ",\r");
+        }
+        strcat((char *)str, entry);
+        count++;
+    }
+
+    if (0 == count) {
+        if (index < (gRecord.count * SIG_PART_COUNT)) {
+            /* Values no longer map onto the signal table */
+            gHeader.dropped++;
+        }
+        telemetry_spool_advance(gRecord.count * SIG_PART_COUNT);
+        return 0;
+    }
+
+    strcat((char *)str, "\r}\r}");
+    gInFlightItems = index - gHeader.item;
+    gInFlight = 1;
+    return 1;
+}
+
+/**
+ * @brief Acknowledge the in-flight frame after HTTP 200
+ */
+void telemetry_spool_commit(void)
+{
+    if (1 == gInFlight) {
+        gInFlight = 0;
+        gRetry = 0;
+        telemetry_spool_advance(gInFlightItems);
+    }
+}
+
+/**
+ * @brief Release the in-flight frame once the modem is free again
+ */
+void telemetry_spool_release(void)
+{
+    if (1 == gInFlight) {
+        gInFlight = 0;
+        if (++gRetry >= SPOOL_MAX_RETRY) {
+            gRetry = 0;
+            gHeader.dropped++;
+            telemetry_spool_advance(gInFlightItems);
+            TransmitDebug(">>Spool frame rejected, skipped\r");
+        }
+    }
+}
+
+/* ========================================================================
+ * Command Interface Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Process spool debug commands
+ *
+ * @param[in] str Command string to process
+ *
+ * @return 0 when the command is done
+ */
+u8 telemetry_spool_cmd(char *str)
+{
+    char tempStr[TEMP_STRING_SIZE];
+
+    if (strstr(str, "clear")) {
+        if (1 == gReady) {
+            gHeader.tail = gHeader.head;
+            gHeader.item = 0;
+            gRecordValid = 0;
+            gInFlight = 0;
+            telemetry_spool_save_header();
+        }
+        TransmitCMDResponse("\r>Spool cleared\r");
+    } else {
+        snprintf(tempStr, sizeof(tempStr),
+                 "\r>Spool %s pending:%lu item:%u dropped:%lu\r",
+                 (1 == gReady) ? "ready" : "offline",
+                 (unsigned long)(gHeader.head - gHeader.tail), gHeader.item,
+                 (unsigned long)gHeader.dropped);
+        TransmitCMDResponse(tempStr);
+    }
+    return 0;
+}
+
+/**
+ * @brief Display help information for spool commands
+ *
+ * @return 0 when the help text is complete
+ */
+u8 telemetry_spool_cmd_help(void)
+{
+    static u8 state = 0;
+    u8 returnValue = 1;
+
+    switch (state) {
+    case 0:
+        TransmitCMDResponse("     spool                  -> (Returns SD telemetry spool status) \r");
+        state = 1;
+        break;
+    case 1:
+        TransmitCMDResponse("     spool clear            -> (Discards all pending spool records) \r");
+        state = 0;
+        returnValue = 0;
+        break;
+    }
+    return returnValue;
+}
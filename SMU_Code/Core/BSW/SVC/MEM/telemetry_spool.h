@@ -0,0 +1,102 @@
+/**
+ * @file telemetry_spool.h
+ * @brief Store-and-forward telemetry spool on the SD card
+ *
+ * Every log tick a compact binary record holding all monitoring values and
+ * the min/max/mean of the window that just closed is appended to a fixed-size ring file on the SD card. The web
+ * uploader drains the ring oldest-first while the modem is connected, so
+ * samples taken during modem reset cycles are not lost. When the ring is
+ * full the oldest record is dropped. The read/write offsets live in the
+ * file header and survive resets.
+ *
+ * @date 2025-10-20
+ * @author Allayar Moazami
+ */
+#ifndef H_TELEMETRY_SPOOL
+#define H_TELEMETRY_SPOOL
+
+#include "platform.h"
+
+/** @brief Directory holding the spool file */
+#define SPOOL_DIR "LOG"
+
+/** @brief Spool file path (header sector followed by record slots) */
+#define SPOOL_FILE_PATH "LOG/SPOOL.BIN"
+
+/** @brief Number of record slots, 2048 x 1.5 KiB = 3 MiB (~34 h at 60 s) */
+#define SPOOL_SLOT_COUNT 2048U
+
+/** @brief Maximum number of monitoring values kept per record, 84 fit in a slot */
+#define SPOOL_MAX_VALUES 60U
+
+/** @brief Rejected uploads of the same frame before it is skipped */
+#define SPOOL_MAX_RETRY 5U
+
+/**
+ * @brief Append a snapshot of the monitoring database to the spool
+ *
+ * Mounts the spool on first use. If the ring is full the oldest record is
+ * dropped before the new one is written.
+ *
+ * @return 1 if the record was stored, 0 if the SD card is not usable
+ */
+u8 telemetry_spool_append(void);
+
+/**
+ * @brief Get spool status
+ *
+ * @return 1 if records are waiting for upload, 0 otherwise
+ */
+u8 telemetry_spool_status(void);
+
+/**
+ * @brief Build the next upload frame from the oldest spooled record
+ *
+ * Fills as many values and window aggregates of the oldest record as fit in the modem buffer into
+ * a "send-chanel" JSON frame stamped with the record time. The frame stays
+ * in flight until telemetry_spool_commit() or telemetry_spool_release().
+ *
+ * @param[out] str Output buffer for JSON data (BUFFER_SIZE bytes)
+ * @param[out] api Output buffer for API URL (URL_SIZE bytes)
+ *
+ * @return 1 if a frame was built, 0 if nothing could be sent
+ */
+u8 telemetry_spool_web_report(u8 *str, u8 *api);
+
+/**
+ * @brief Acknowledge the in-flight frame after HTTP 200
+ *
+ * Advances and persists the read offset. Does nothing if no spool frame is
+ * in flight.
+ */
+void telemetry_spool_commit(void);
+
+/**
+ * @brief Release the in-flight frame once the modem is free again
+ *
+ * Called by the outbound queue when the frame was not acknowledged. The
+ * frame is sent again; after SPOOL_MAX_RETRY rejections it is skipped.
+ */
+void telemetry_spool_release(void);
+
+/**
+ * @brief Process spool debug commands
+ *
+ * @param[in] str Command string to process
+ *
+ * @return 0 when the command is done
+ *
+ * @par Supported commands:
+ *      - "spool": Print spool offsets and counters
+ *      - "spool clear": Discard all pending records
+ */
+u8 telemetry_spool_cmd(char *str);
+
+/**
+ * @brief Display help information for spool commands
+ *
+ * @return Always returns 0
+ */
+u8 telemetry_spool_cmd_help(void);
+
+#endif /* H_TELEMETRY_SPOOL */
@@ -83,6 +83,15 @@
 #include "MdmSrv.h"
 #include "MdmHw.h"
 #include "inv_fault_recorder.h"
+#include "inv_fault_store.h"
+#include "telemetry_spool.h"
+#include "data_logger.h"
+#include "alarm_engine.h"
+#include "kv_store.h"
+#include "cfg_store.h"
+#include "energy_meters.h"
+#include "energy_counters.h"
+#include "power_quality.h"
 
 
 
@@ -300,14 +309,17 @@ void VoidSwcAppInit(void) {
 	char read_string[20] = { 0 };
 	mcuRstMsg();
 	memInit();
-	// Read the string from flash memory
-	Flash_Read_String(FLASH_USER_START_ADDR, read_string, sizeof(read_string));
+	// Serial number and references from the internal flash store
+	kv_store_init();
+	kv_store_get(KV_KEY_SERIAL, read_string, sizeof(_serialN) - 1);
 	if (strstr(read_string, "UA")) {
 		strcpy(_serialN, read_string);
 	}
 
 	SCC_Int8uAddTask( RTE_Task1KHz,0,1);
 	SMU_Slaves_Database_Init();
+	cfg_store_load_flash();
+	energy_counters_init();
 	HAL_TIM_OC_Start_IT(&htim4, TIM_CHANNEL_1);
 	HAL_TIM_OC_Start_IT(&htim2, TIM_CHANNEL_1);
 	HAL_TIM_OC_Start(&htim5, TIM_CHANNEL_1);
@@ -335,6 +347,15 @@ void VoidSwcAppInit(void) {
 	registerCommand("sim", simCommand,simCommandHelp);
 	registerCommand("AT", atDirectCommand,atDirectCommandHelp);
 	registerCommand("ievent", inv_fault_recorder_cmd,inv_fault_recorder_cmd_help);
+	registerCommand("spool", telemetry_spool_cmd,telemetry_spool_cmd_help);
+	registerCommand("fault", inv_fault_store_cmd,inv_fault_store_cmd_help);
+	registerCommand("alarm", alarm_engine_cmd,alarm_engine_cmd_help);
+	/* "log" before "logger": the last command matching the input prefix is executed */
+	registerCommand("log", data_logger_log_cmd,data_logger_log_cmd_help);
+	registerCommand("logger", data_logger_cmd,data_logger_cmd_help);
+	registerCommand("energy", energy_counters_cmd,energy_counters_cmd_help);
+	registerCommand("pq", power_quality_cmd,power_quality_cmd_help);
+	registerCommand("stpm", energy_meters_cmd,energy_meters_cmd_help);
 
 	//registerCommand("WCET", wcetCommand,wcetCommandHelp);
 
@@ -49,17 +49,27 @@
 #include "myrtc.h"
 #include "fatfs.h"
 #include "MEM.h"
+#include "cfg_store.h"
+#include "kv_store.h"
+#include "energy_counters.h"
 #include "crc.h"
 #include "MdmSrv.h"
 #include "mntdata.h"
 #include "WebInstanceReport.h"
 #include "inv_fault_recorder.h"
+#include "inv_fault_store.h"
+#include "telemetry_spool.h"
+#include "data_logger.h"
+#include "mdm_outq.h"
+#include "server.h"
 
 
 
 #define MODEM_TICK               500     /*ms*/
 #define MONITORING_TICK          100     /*ms*/
 #define LOG_TICK                 60      /*Sec*/
+#define FAULT_EVENT_INTERVAL     5000    /*ms, leaves modem slots for other classes during a fault drain*/
+#define MEM_MOUNT_RETRY          5       /*card mount attempts before running without the card*/
 
 
 WEB_MNG_STU_Type StuWebMng;
@@ -71,6 +81,23 @@ void RTE_MNT_LOG_MNG(void);
 static void RTE_MEM_HANDLE(void);
 static void RTE_RstReportRefToWeb(void);
 static u8 RefDataSend(void);
+static EnuMdmBuild RTE_BuildCfgEcho(GPRS_HandleTypeDef *mGprs);
+static EnuMdmBuild RTE_BuildRefRead(GPRS_HandleTypeDef *mGprs);
+static EnuMdmBuild RTE_BuildFaultEvent(GPRS_HandleTypeDef *mGprs);
+static EnuMdmBuild RTE_BuildStateEvent(GPRS_HandleTypeDef *mGprs);
+static EnuMdmBuild RTE_BuildTelemetry(GPRS_HandleTypeDef *mGprs);
+static EnuMdmBuild RTE_BuildLogUpload(GPRS_HandleTypeDef *mGprs);
+
+/* Outbound message policy, indexed by EnuMdmMsgClass */
+static const StuMdmMsgClass StcMdmMsgClass[MDM_MSG_CLASS_COUNT] = {
+	/* priority, coalesce, minInterval, builder, ack, nack */
+	{ 0U, 1U, 0U,                   RTE_BuildCfgEcho,    NULL,                      NULL                    },  /* MDM_MSG_CFG_ECHO    */
+	{ 1U, 1U, 0U,                   RTE_BuildRefRead,    NULL,                      NULL                    },  /* MDM_MSG_REF_READ    */
+	{ 2U, 1U, FAULT_EVENT_INTERVAL, RTE_BuildFaultEvent, inv_fault_recorder_web_ack, NULL                    },  /* MDM_MSG_FAULT_EVENT */
+	{ 2U, 1U, 0U,                   RTE_BuildStateEvent, WebInsReportNextEvent,     NULL                    },  /* MDM_MSG_STATE_EVENT */
+	{ 3U, 1U, 0U,                   RTE_BuildTelemetry,  telemetry_spool_commit,    telemetry_spool_release },  /* MDM_MSG_TELEMETRY   */
+	{ 4U, 1U, 0U,                   RTE_BuildLogUpload,  data_logger_upload_commit, data_logger_upload_release }, /* MDM_MSG_LOG_UPLOAD */
+};
 /*!
  **************************************************************************************************
  *
@@ -102,11 +129,14 @@ void RTE_MNT_MNG(void)
 		StuLogMng.logtick = 0; //HAL_GetTick();
 		StuLogMng.state = LOG_MNG_ENTRY;
 
+		mdm_outq_init(StcMdmMsgClass);
+
 		mntState = RTE_MNT_DO;
 		break;
 	case RTE_MNT_DO:
 
 		RTE_MEM_HANDLE();
+		data_logger_service();
 		RTE_MNT_LOG_MNG();
 		RTE_MNT_WEB_MNG();
 		break;
@@ -183,12 +213,8 @@ void RTE_MNT_WEB_MNG(void)
  */
 void RTE_MNT_LOG_MNG(void)
 {
-	u8 aU8Str[50];
 	static u32 stcU32MdmCnt=0;
 
-	static u8  stcU8CfgSendDone=1;
-
-
 	if ((HAL_GetTick() - StuLogMng.tick) >= MONITORING_TICK) {
 		StuLogMng.tick = HAL_GetTick();
 		switch (StuLogMng.state) {
@@ -199,9 +225,14 @@ void RTE_MNT_LOG_MNG(void)
 			StuLogMng.pTime = (uint16_t) ((HAL_GetTick() - StuLogMng.logtick) / 1000);
 			if (StuLogMng.pTime++ >= LOG_TICK) {
 				StuLogMng.logtick = HAL_GetTick();
-				StuLogMng.cDataInMem = 1;
 				TransmitDebug("New Log to Send\r");
 				_rtcFunctionRead(0);
+				signal_db_window_close();
+				if(1!=telemetry_spool_append())
+				{
+					/* SD spool not usable: send the live values directly */
+					StuLogMng.cDataInMem = 1;
+				}
 
 			}
 			if(stcU32MdmCnt++>300)
@@ -213,45 +244,33 @@ void RTE_MNT_LOG_MNG(void)
 
 			if(1==getSendCfg() && 1==StcU16MdmReady)
 			{
-				stcU8CfgSendDone=0;
 				setSendCfg(0);
+				mdm_outq_post(MDM_MSG_CFG_ECHO);
+			}
+			inv_fault_store_service();
+			if(1==inv_fault_recorder_status())
+			{
+				mdm_outq_post(MDM_MSG_FAULT_EVENT);
+			}
+			if (_readreq != 0)
+			{
+				mdm_outq_post(MDM_MSG_REF_READ);
+			}
+			if (0 == WebInsReportStatus())
+			{
+				mdm_outq_post(MDM_MSG_STATE_EVENT);
+			}
+			if (1 == telemetry_spool_status() || 0 != StuLogMng.cDataInMem)
+			{
+				mdm_outq_post(MDM_MSG_TELEMETRY);
+			}
+			if (1 == data_logger_upload_status())
+			{
+				mdm_outq_post(MDM_MSG_LOG_UPLOAD);
 			}
 			if (0 == mdmGprs.busy && StcU16MdmReady==1)
 			{
-
-				if(1==inv_fault_recorder_status())
-				{
-					inv_fault_recorder_web_report(mdmGprs.sData,mdmGprs.api);
-					mdmGprs.busy = 1;
-					mdmGprs.response=0;
-				}
-				else if(0==stcU8CfgSendDone)
-				{
-					stcU8CfgSendDone=RefDataSend();
-				}
-				else if (_readreq != 0)
-				{
-					mdmGprs.busy = 1;
-				}
-				else if (0 != StuLogMng.cDataInMem) {
-					memset(mdmGprs.sData, 0, BUFFER_SIZE);
-					server_return_url(aU8Str);
-					sprintf(mdmGprs.api,"%s/api/send-chanel",aU8Str);
-					mdmGprs.response=1;
-					_rtcFunctionRead(0);
-					startJsonFrame((char*) mdmGprs.sData, urtc);
-					if (2 != addDataToJsonFrame((char*) mdmGprs.sData)) {
-						sprintf((char *)aU8Str, ">>New packet to send\r");
-						TransmitDebug((char *)aU8Str);
-						mdmGprs.busy = 1;
-					} else {
-						mdmGprs.busy = 0;
-						StuLogMng.cDataInMem = 0;
-						sprintf((char *)aU8Str, ">>Waiting for new Data\r");
-						TransmitDebug((char *)aU8Str);
-					}
-				}
-
+				mdm_outq_dispatch(&mdmGprs);
 			}
 			break;
 		case LOG_MNG_SAVE:
@@ -289,13 +308,21 @@ static void RTE_MEM_HANDLE(void)
 	static u16 stcU16Idx=0;
 	static u16 stcU16Cycle=0;
 	static u16 stcU16cnt=0;
-	static u8  stcU8WriteFlg=0;
-	RefDataType *rData=getRefData();
+	static u8  stcU8MountTry=0;
+	static u8  stcU8ForceSave=0;
 	u8 u8MemStatus=0;
 
+	/* Internal flash first, one word per call, independent of the card */
+	kv_store_service();
+	/* Energy checkpoints go to the same store */
+	energy_counters_service();
+	/* Cached FAT/directory sectors reach the card within SD_CACHE_FLUSH_MS */
+	SD_CacheService();
+
 	if(stcU16Cycle++>MEMORY_TICK)
 	{
 		stcU16Cycle=0;
+		cfg_store_service();
 		u8 u8status=MEM_SdStatusCheck();
 
 		if(1==u8status)
@@ -304,6 +331,8 @@ static void RTE_MEM_HANDLE(void)
 		}
 		else if(2==u8status)
 		{
+			stcU16cnt=0;
+			stcU8MountTry=0;
 			state=MEM_WAIT;
 		}
 		else
@@ -317,11 +346,11 @@ static void RTE_MEM_HANDLE(void)
 
 			break;
 		case MEM_WAIT:
-			if(stcU16cnt++>100)
+			/* Card inserted or mount failed: let it settle, then mount it again */
+			if(0==kv_store_busy() && stcU16cnt++>100)
 			{
 				stcU16cnt=0;
-				while(1);
-				//state=MEM_DISK_INIT;
+				state=MEM_DISK_INIT;
 			}
 			break;
 		case MEM_DISK_INIT:
@@ -332,49 +361,51 @@ static void RTE_MEM_HANDLE(void)
 			u8MemStatus=memHnadler(0,MEM_INIT);
 			if(1==u8MemStatus)
 			{
+				stcU8MountTry=0;
 				state=MEM_READ_CONFIG;
 			}
 			else if(2==u8MemStatus)
 			{
-				state=MEM_DISK_INIT;
+				if(++stcU8MountTry<MEM_MOUNT_RETRY)
+				{
+					stcU16cnt=0;
+					state=MEM_WAIT;
+				}
+				else
+				{
+					/* References live in flash, the unit runs on without the card */
+					TransmitCMDResponse("SD Memory Card not usable, running without it!\r");
+					state=MEM_IDLE;
+				}
 			}
 
 			break;
 		case MEM_SAVE_CONFIG:
-
-			if((rData[stcU16Idx].flag&0x02)==0x02)
+			/* Any number of changed references is one image write */
+			if(1==stcU8ForceSave || 1==cfg_store_pending())
 			{
-				u8MemStatus=memHnadler(stcU16Idx,MEM_SAVE_CONFIG);
-				if(3==u8MemStatus)
+				u8MemStatus=memHnadler(0,MEM_SAVE_CONFIG);
+				if(1==u8MemStatus)
 				{
-					stcU8WriteFlg=1;
+					stcU8ForceSave=0;
 				}
 				else if(2==u8MemStatus)
 				{
 					state=MEM_INIT;
 				}
-				else if(4==u8MemStatus && stcU8WriteFlg==1)
-				{
-					rData[stcU16Idx].flag&=0xFD;
-					stcU8WriteFlg=0;
-
-				}
-			}
-			else
-			{
-				if(++stcU16Idx>=(REF_ARRAY_SIZE-1))stcU16Idx=0;
 			}
 			break;
 		case MEM_READ_CONFIG:
-			u8MemStatus=memHnadler(stcU16Idx,MEM_READ_CONFIG);
+			u8MemStatus=memHnadler(0,MEM_READ_CONFIG);
 			if(1==u8MemStatus)
 			{
-				if(++stcU16Idx>=(REF_ARRAY_SIZE-1))
-				{
-					stcU16Idx=0;
-					state=MEM_SAVE_CONFIG;
-				//stcU16ReadCfgFlg=0;
-				}
+				state=MEM_SAVE_CONFIG;
+			}
+			else if(3==u8MemStatus)
+			{
+				/* No image yet: restore the old text files once and write the image */
+				stcU16Idx=0;
+				state=MEM_MIGRATE_CONFIG;
 			}
 			else if(2==u8MemStatus)
 			{
@@ -383,6 +414,18 @@ static void RTE_MEM_HANDLE(void)
 
 			}
 			break;
+		case MEM_MIGRATE_CONFIG:
+			u8MemStatus=memHnadler(stcU16Idx,MEM_MIGRATE_CONFIG);
+			if(1==u8MemStatus)
+			{
+				if(++stcU16Idx>=(REF_ARRAY_SIZE-1))
+				{
+					stcU16Idx=0;
+					stcU8ForceSave=1;
+					state=MEM_SAVE_CONFIG;
+				}
+			}
+			break;
 		}
 
 	}
@@ -502,3 +545,200 @@ for(;;)
 
 return u8ReturnValue;
 }
+
+/*!
+ **************************************************************************************************
+ *
+ *  @fn         static EnuMdmBuild RTE_BuildCfgEcho(GPRS_HandleTypeDef *mGprs)
+ *
+ *  @par        This function builds the next reference echo frame.
+ *
+ *  @param      mGprs   Modem handle to fill.
+ *
+ *  @return     Builder result for the outbound queue.
+ *
+ *  @par        Design Info
+ *              WCET            : Enter Worst Case Execution Time heres
+ *              Sync/Async      : sync
+ *
+ **************************************************************************************************
+ */
+static EnuMdmBuild RTE_BuildCfgEcho(GPRS_HandleTypeDef *mGprs)
+{
+	u8 aU8Str[URL_SIZE];
+	u8 u8Done;
+
+	server_return_url(aU8Str);
+	snprintf(mGprs->api,sizeof(mGprs->api),"%s/api/send-chanel",aU8Str);
+	u8Done=RefDataSend();
+	if(1==mGprs->busy)
+	{
+		/* RefDataSend marks the modem busy when it added an item */
+		mGprs->busy=0;
+		return (1==u8Done) ? MDM_BUILD_LAST : MDM_BUILD_MORE;
+	}
+	return MDM_BUILD_NONE;
+}
+
+/*!
+ **************************************************************************************************
+ *
+ *  @fn         static EnuMdmBuild RTE_BuildRefRead(GPRS_HandleTypeDef *mGprs)
+ *
+ *  @par        This function starts a reference read, MdmSrv builds the request body.
+ *
+ *  @param      mGprs   Modem handle to fill.
+ *
+ *  @return     Builder result for the outbound queue.
+ *
+ *  @par        Design Info
+ *              WCET            : Enter Worst Case Execution Time heres
+ *              Sync/Async      : sync
+ *
+ **************************************************************************************************
+ */
+static EnuMdmBuild RTE_BuildRefRead(GPRS_HandleTypeDef *mGprs)
+{
+	(void)mGprs;
+	return (_readreq != 0) ? MDM_BUILD_LAST : MDM_BUILD_NONE;
+}
+
+/*!
+ **************************************************************************************************
+ *
+ *  @fn         static EnuMdmBuild RTE_BuildFaultEvent(GPRS_HandleTypeDef *mGprs)
+ *
+ *  @par        This function builds the next fault recorder snapshot frame.
+ *
+ *  @param      mGprs   Modem handle to fill.
+ *
+ *  @return     Builder result for the outbound queue.
+ *
+ *  @par        Design Info
+ *              WCET            : Enter Worst Case Execution Time heres
+ *              Sync/Async      : sync
+ *
+ **************************************************************************************************
+ */
+static EnuMdmBuild RTE_BuildFaultEvent(GPRS_HandleTypeDef *mGprs)
+{
+	if(1!=inv_fault_recorder_status())
+	{
+		return MDM_BUILD_NONE;
+	}
+	mGprs->response=0;
+	if(0==inv_fault_recorder_web_report((u8*)mGprs->sData,(u8*)mGprs->api))
+	{
+		return MDM_BUILD_NONE;
+	}
+	return MDM_BUILD_MORE;
+}
+
+/*!
+ **************************************************************************************************
+ *
+ *  @fn         static EnuMdmBuild RTE_BuildStateEvent(GPRS_HandleTypeDef *mGprs)
+ *
+ *  @par        This function packs all pending state changes into one frame.
+ *
+ *  @param      mGprs   Modem handle to fill.
+ *
+ *  @return     Builder result for the outbound queue.
+ *
+ *  @par        Design Info
+ *              WCET            : Enter Worst Case Execution Time heres
+ *              Sync/Async      : sync
+ *
+ **************************************************************************************************
+ */
+static EnuMdmBuild RTE_BuildStateEvent(GPRS_HandleTypeDef *mGprs)
+{
+	u8 aU8Str[URL_SIZE];
+
+	if(0!=WebInsReportRead((u8*)mGprs->sData))
+	{
+		return MDM_BUILD_NONE;
+	}
+	server_return_url(aU8Str);
+	snprintf(mGprs->api,sizeof(mGprs->api),"%s/api/send-chanel",aU8Str);
+	mGprs->response=1;
+	return MDM_BUILD_MORE;
+}
+
+/*!
+ **************************************************************************************************
+ *
+ *  @fn         static EnuMdmBuild RTE_BuildTelemetry(GPRS_HandleTypeDef *mGprs)
+ *
+ *  @par        This function builds the next telemetry frame, from the SD spool backlog or,
+ *              when the spool is not usable, from the live monitoring values.
+ *
+ *  @param      mGprs   Modem handle to fill.
+ *
+ *  @return     Builder result for the outbound queue.
+ *
+ *  @par        Design Info
+ *              WCET            : Enter Worst Case Execution Time heres
+ *              Sync/Async      : sync
+ *
+ **************************************************************************************************
+ */
+static EnuMdmBuild RTE_BuildTelemetry(GPRS_HandleTypeDef *mGprs)
+{
+	u8 aU8Str[50];
+
+	if (1 == telemetry_spool_status())
+	{
+		if (1 == telemetry_spool_web_report((u8*)mGprs->sData, (u8*)mGprs->api))
+		{
+			mGprs->response=1;
+			return MDM_BUILD_MORE;
+		}
+		return MDM_BUILD_NONE;
+	}
+	if (0 == StuLogMng.cDataInMem)
+	{
+		return MDM_BUILD_NONE;
+	}
+
+	memset(mGprs->sData, 0, BUFFER_SIZE);
+	server_return_url(aU8Str);
+	sprintf(mGprs->api,"%s/api/send-chanel",aU8Str);
+	mGprs->response=1;
+	_rtcFunctionRead(0);
+	startJsonFrame((char*) mGprs->sData, urtc);
+	if (2 != addDataToJsonFrame((char*) mGprs->sData)) {
+		TransmitDebug(">>New packet to send\r");
+		return MDM_BUILD_MORE;
+	}
+	StuLogMng.cDataInMem = 0;
+	TransmitDebug(">>Waiting for new Data\r");
+	return MDM_BUILD_NONE;
+}
+
+/*!
+ **************************************************************************************************
+ *
+ *  @fn         static EnuMdmBuild RTE_BuildLogUpload(GPRS_HandleTypeDef *mGprs)
+ *
+ *  @par        This function builds the next frame of a history upload started with "log web".
+ *
+ *  @param      mGprs   Modem handle to fill.
+ *
+ *  @return     Builder result for the outbound queue.
+ *
+ *  @par        Design Info
+ *              WCET            : Enter Worst Case Execution Time heres
+ *              Sync/Async      : sync
+ *
+ **************************************************************************************************
+ */
+static EnuMdmBuild RTE_BuildLogUpload(GPRS_HandleTypeDef *mGprs)
+{
+	if (1 == data_logger_web_report((u8*)mGprs->sData, (u8*)mGprs->api))
+	{
+		mGprs->response=1;
+		return MDM_BUILD_MORE;
+	}
+	return MDM_BUILD_NONE;
+}
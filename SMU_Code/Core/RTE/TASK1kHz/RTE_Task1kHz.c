@@ -48,6 +48,7 @@
 #include "SMU_MNG.h"
 #include "MBM.h"
 #include "MBS.h"
+#include "alarm_engine.h"
 //#include "WCET.h"
 /*
 *********************************************************************************************************
@@ -206,6 +207,7 @@ static void VoidFn1msFullyOp(void)
 	 //  WCET_GetChannel(0); /* Get WCET Value for CH 0 */
 	MBS_Handler();         /* Modbus-Manager 2*/
 	 //  WCET_GetChannel(1); /* Get WCET Value for CH 1 */
+	alarm_engine_service(); /* Rules of the signals both managers just wrote */
 }
 
 /**
@@ -47,36 +47,11 @@
 #include "stm32f4xx_hal.h"
 #include "stm32f4xx_hal_flash.h"
 #include "dbg.h"
+#include "kv_store.h"
 
  char _serialN[10]="UA001";
 
 
-void Flash_Write_String(uint32_t address, const char *data) {
-    HAL_FLASH_Unlock();
-
-    // Clear all pending flags
-    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
-
-    // Erase the sector before writing (only needed once if writing multiple strings)
-    FLASH_Erase_Sector(FLASH_SECTOR_11, VOLTAGE_RANGE_3); // Adjust sector and voltage range accordingly
-
-    // Write the data to flash word by word
-    uint32_t data_length = strlen(data) + 1;  // +1 to include the null terminator
-    for (uint32_t i = 0; i < data_length; i += 4) {
-        uint32_t word = 0xFFFFFFFF;
-
-        // Copy up to 4 bytes into a word (to handle the last word which might be less than 4 bytes)
-        memcpy(&word, &data[i], data_length - i >= 4 ? 4 : data_length - i);
-
-        if (HAL_FLASH_Program(TYPEPROGRAM_WORD, address + i, word) != HAL_OK) {
-            // Handle the error
-            break;
-        }
-    }
-
-    HAL_FLASH_Lock();
-}
-
 void Flash_Read_String(uint32_t address, char *buffer, uint32_t max_length) {
     uint32_t *flash_address = (uint32_t*)address;
     char *char_ptr = (char*)flash_address;
@@ -139,10 +114,8 @@ u8 serialCommand(char *str)
              {
               sprintf(str,"Serial Number Saved to Memory: %s \r",
             		  _serialN);
-             // Write the string to flash memory
-              __disable_irq();
-              Flash_Write_String(FLASH_USER_START_ADDR, _serialN);
-              __enable_irq();
+             // Queue the string for the flash key/value store
+              kv_store_set(KV_KEY_SERIAL, _serialN, (u8)(strlen(_serialN) + 1));
              }
              else if(strstr((char *)str,"set"))
              {
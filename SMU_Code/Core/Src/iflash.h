@@ -46,12 +46,11 @@
 
 
 
-#define FLASH_USER_START_ADDR   0x080E0000   // Start address of sector 6
+#define FLASH_USER_START_ADDR   0x080E0000   // Start address of sector 11, old serial number location
 #define FLASH_USER_END_ADDR     (0x080E0000 + 0x1000)  // Define a range, e.g., 4KB
 extern char _serialN[10];
 
 
-void Flash_Write_String(uint32_t address, const char *data);
 void Flash_Read_String(uint32_t address, char *buffer, uint32_t max_length);
 u8 extract_serial_number(const char *input, char *output) ;
 /*!
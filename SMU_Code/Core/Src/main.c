@@ -43,6 +43,7 @@
 #include "SMU_MNG.h"
 #include "ctrl.h"
 #include "energy_meter_dll.h"
+#include "kv_store.h"
 
 
 /* USER CODE END Includes */
@@ -84,6 +85,7 @@ void HAL_TIM_OC_DelayElapsedCallback(TIM_HandleTypeDef *htim)
 	if (htim->Instance == TIM4) //1ms
 	{
 		HAL_IWDG_Refresh(&hiwdg);
+		energy_meter_dll_timer_tick();
 		RTE_MNT_MNG();
 	}
 	if (htim->Instance == TIM2) /* Every 1 ms */
@@ -132,6 +134,7 @@ int main(void)
   /* USER CODE BEGIN WHILE */
 	while (1) {
 		Ctrl_GeneralControl();
+		kv_store_erase_service();
     /* USER CODE END WHILE */
 
     /* USER CODE BEGIN 3 */
@@ -195,20 +198,40 @@ void SystemClock_Config(void)
 void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
 {
     if (huart->Instance == UART4) {
-        extern volatile u8 gTxComplete;
-        gTxComplete = 1;
+        energy_meter_dll_tx_complete();
     }
 }
 
 /**
- * @brief UART Receive Complete Callback
- * Called by HAL when UART reception completes.
+ * @brief UART Reception Event Callback
+ * Called by HAL on half/full buffer and idle line of a ReceiveToIdle reception.
  */
-void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size)
 {
     if (huart->Instance == UART4) {
-        extern volatile u8 gRxComplete;
-        gRxComplete = 1;
+        energy_meter_dll_rx_event(Size);
+    }
+}
+
+/**
+ * @brief UART Error Callback
+ * Called by HAL on noise, framing, parity and overrun errors.
+ */
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+    if (huart->Instance == UART4) {
+        energy_meter_dll_link_error();
+    }
+}
+
+/**
+ * @brief SPI Transmit/Receive Complete Callback
+ * Called by HAL when a full-duplex SPI transfer completes.
+ */
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+    if (hspi->Instance == SPI2) {
+        energy_meter_dll_spi_complete();
     }
 }
 
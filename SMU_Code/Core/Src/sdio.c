@@ -21,7 +21,9 @@
 #include "sdio.h"
 
 /* USER CODE BEGIN 0 */
-
+/* DMA2 Stream6 is taken by USART6 TX, so SDIO receive and transmit share
+   Stream3; HAL_SD_xxxBlocks_DMA() sets the direction on every transfer. */
+DMA_HandleTypeDef hdma_sdio;
 /* USER CODE END 0 */
 
 SD_HandleTypeDef hsd;
@@ -85,7 +87,33 @@ void HAL_SD_MspInit(SD_HandleTypeDef* sdHandle)
     HAL_GPIO_Init(GPIOD, &GPIO_InitStruct);
 
   /* USER CODE BEGIN SDIO_MspInit 1 */
-
+    /* SDIO DMA Init */
+    __HAL_RCC_DMA2_CLK_ENABLE();
+    hdma_sdio.Instance = DMA2_Stream3;
+    hdma_sdio.Init.Channel = DMA_CHANNEL_4;
+    hdma_sdio.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_sdio.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_sdio.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_sdio.Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+    hdma_sdio.Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+    hdma_sdio.Init.Mode = DMA_PFCTRL;
+    hdma_sdio.Init.Priority = DMA_PRIORITY_VERY_HIGH;
+    hdma_sdio.Init.FIFOMode = DMA_FIFOMODE_ENABLE;
+    hdma_sdio.Init.FIFOThreshold = DMA_FIFO_THRESHOLD_FULL;
+    hdma_sdio.Init.MemBurst = DMA_MBURST_INC4;
+    hdma_sdio.Init.PeriphBurst = DMA_PBURST_INC4;
+    if (HAL_DMA_Init(&hdma_sdio) != HAL_OK)
+    {
+      Error_Handler();
+    }
+    __HAL_LINKDMA(sdHandle,hdmarx,hdma_sdio);
+    __HAL_LINKDMA(sdHandle,hdmatx,hdma_sdio);
+
+    /* Above TIM2/TIM4: transfers are started and awaited from their ISRs */
+    HAL_NVIC_SetPriority(DMA2_Stream3_IRQn, 3, 0);
+    HAL_NVIC_EnableIRQ(DMA2_Stream3_IRQn);
+    HAL_NVIC_SetPriority(SDIO_IRQn, 3, 0);
+    HAL_NVIC_EnableIRQ(SDIO_IRQn);
   /* USER CODE END SDIO_MspInit 1 */
   }
 }
@@ -111,7 +139,9 @@ void HAL_SD_MspDeInit(SD_HandleTypeDef* sdHandle)
     HAL_GPIO_DeInit(GPIOD, GPIO_PIN_2);
 
   /* USER CODE BEGIN SDIO_MspDeInit 1 */
-
+    HAL_DMA_DeInit(sdHandle->hdmarx);
+    HAL_NVIC_DisableIRQ(DMA2_Stream3_IRQn);
+    HAL_NVIC_DisableIRQ(SDIO_IRQn);
   /* USER CODE END SDIO_MspDeInit 1 */
   }
 }
@@ -76,7 +76,9 @@ extern DMA_HandleTypeDef hdma_usart6_rx;
 extern UART_HandleTypeDef huart1;
 extern UART_HandleTypeDef huart4;
 /* USER CODE BEGIN EV */
-
+extern SD_HandleTypeDef hsd;
+extern DMA_HandleTypeDef hdma_sdio;
+extern SPI_HandleTypeDef hspi2;
 /* USER CODE END EV */
 
 /******************************************************************************/
@@ -390,5 +392,27 @@ void DMA2_Stream7_IRQHandler(void)
 }
 
 /* USER CODE BEGIN 1 */
+/**
+  * @brief This function handles SDIO global interrupt.
+  */
+void SDIO_IRQHandler(void)
+{
+  HAL_SD_IRQHandler(&hsd);
+}
+
+/**
+  * @brief This function handles DMA2 stream3 global interrupt (SDIO RX/TX).
+  */
+void DMA2_Stream3_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdma_sdio);
+}
 
+/**
+  * @brief This function handles SPI2 global interrupt (energy meter).
+  */
+void SPI2_IRQHandler(void)
+{
+  HAL_SPI_IRQHandler(&hspi2);
+}
 /* USER CODE END 1 */
@@ -17,8 +17,8 @@
   */
 /* USER CODE END Header */
 
-/* Note: code generation based on sd_diskio_template_bspv1.c v2.1.4
-   as "Use dma template" is disabled. */
+/* Note: code generation based on sd_diskio_dma_template_bspv1.c v2.1.4
+   as "Use dma template" is enabled. */
 
 /* USER CODE BEGIN firstSection */
 /* can be used to modify / undefine following code or add new definitions */
@@ -28,19 +28,36 @@
 #include "ff_gen_drv.h"
 #include "sd_diskio.h"
 
+#include <string.h>
+
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
-/* use the default SD timout as defined in the platform BSP driver*/
-#if defined(SDMMC_DATATIMEOUT)
-#define SD_TIMEOUT SDMMC_DATATIMEOUT
-#elif defined(SD_DATATIMEOUT)
-#define SD_TIMEOUT SD_DATATIMEOUT
-#else
-#define SD_TIMEOUT 30 * 1000
-#endif
+/*
+ * Timeout in ms for one DMA transfer including the card busy time after a
+ * write. Kept below the IWDG period: transfers are awaited from ISRs.
+ */
+#define SD_TIMEOUT 1000U
 
 #define SD_DEFAULT_BLOCK_SIZE 512
 
+/*
+ * The SDIO DMA uses word accesses with 4-beat bursts: buffers must be
+ * 4-byte aligned and outside CCM RAM, which the DMA cannot reach. Other
+ * buffers are moved block by block through the scratch buffer.
+ */
+#define SD_CCMRAM_BASE 0x10000000UL
+#define SD_CCMRAM_END  0x10010000UL
+
+/* Unused cache line / empty read-ahead buffer */
+#define SD_CACHE_FREE 0xFFFFFFFFUL
+
+#if (SD_CACHE_SECTORS < 1U) || (SD_CACHE_SECTORS > 32U)
+#error "SD_CACHE_SECTORS out of range"
+#endif
+#if (SD_CACHE_READAHEAD < 2U) || (SD_CACHE_READAHEAD > 16U)
+#error "SD_CACHE_READAHEAD out of range"
+#endif
+
 /*
  * Depending on the use case, the SD card initialization could be done at the
  * application level: if it is the case define the flag below to disable
@@ -52,11 +69,60 @@
 /* USER CODE END disableSDInit */
 
 /* Private variables ---------------------------------------------------------*/
+extern SD_HandleTypeDef hsd;
+
 /* Disk status */
 static volatile DSTATUS Stat = STA_NOINIT;
 
+/* Completion flags, set from the SDIO/DMA interrupts */
+static volatile UINT WriteStatus = 0, ReadStatus = 0, XferError = 0;
+
+/* Bounce buffer for unaligned or CCM RAM buffers */
+static uint32_t scratch[SD_DEFAULT_BLOCK_SIZE / 4];
+
+/* Asynchronous request */
+static volatile SD_AsyncStateTypeDef AsyncState = SD_ASYNC_IDLE;
+static uint32_t AsyncTick = 0;
+
+/* Sector cache line */
+typedef struct
+{
+  DWORD sector;         /* Cached LBA, SD_CACHE_FREE if unused */
+  uint32_t used;        /* LRU stamp, higher is more recent */
+  uint32_t dirtyTick;   /* Time of the first change not on the card */
+  uint8_t dirty;        /* Newer than the card */
+} SD_CacheLineTypeDef;
+
+/* LRU lines, DMA capable */
+static uint32_t CacheData[SD_CACHE_SECTORS][SD_DEFAULT_BLOCK_SIZE / 4];
+static SD_CacheLineTypeDef CacheLine[SD_CACHE_SECTORS];
+static uint32_t CacheClock = 0;
+static uint8_t CacheDraining = 0;
+
+/* FatFs window, its writes are held back */
+static const BYTE *CacheMetaWin = NULL;
+
+/* Read-ahead buffer, last single-sector read and card size */
+static uint32_t AheadData[SD_CACHE_READAHEAD][SD_DEFAULT_BLOCK_SIZE / 4];
+static DWORD AheadSector = SD_CACHE_FREE;
+static DWORD LastRead = SD_CACHE_FREE;
+static DWORD CardSectors = 0;
+
+static SD_CacheStatsTypeDef CacheStats;
+
 /* Private function prototypes -----------------------------------------------*/
 static DSTATUS SD_CheckStatus(BYTE lun);
+static uint8_t SD_DmaCapable(const void *buff);
+static void SD_AsyncUpdate(void);
+static DRESULT SD_WaitIdle(void);
+static DRESULT SD_Transfer(uint8_t write, BYTE *buff, DWORD sector, UINT count);
+static void SD_CacheReset(void);
+static int SD_CacheFind(DWORD sector);
+static DRESULT SD_CacheClean(int line);
+static int SD_CacheAlloc(DRESULT *res);
+static void SD_CacheDrop(DWORD sector, UINT count);
+static void SD_CacheUpdate(const BYTE *buff, DWORD sector, UINT count, DRESULT res);
+static void SD_CacheOverlay(BYTE *buff, DWORD sector, UINT count);
 DSTATUS SD_initialize (BYTE);
 DSTATUS SD_status (BYTE);
 DRESULT SD_read (BYTE, BYTE*, DWORD, UINT);
@@ -99,6 +165,275 @@ static DSTATUS SD_CheckStatus(BYTE lun)
   return Stat;
 }
 
+/**
+  * @brief  Checks whether the DMA can access a buffer directly
+  * @param  buff: Data buffer
+  * @retval 1 if aligned and outside CCM RAM
+  */
+static uint8_t SD_DmaCapable(const void *buff)
+{
+  uint32_t addr = (uint32_t)buff;
+
+  return ((0U == (addr & 3U)) && ((addr < SD_CCMRAM_BASE) || (addr >= SD_CCMRAM_END))) ? 1U : 0U;
+}
+
+/**
+  * @brief  Ends the asynchronous request once done, failed or timed out
+  * @retval None
+  */
+static void SD_AsyncUpdate(void)
+{
+  if (SD_ASYNC_BUSY != AsyncState)
+  {
+    return;
+  }
+  if (0U != XferError)
+  {
+    HAL_SD_Abort(&hsd);
+    AsyncState = SD_ASYNC_ERROR;
+  }
+  else if ((0U != WriteStatus) && (BSP_SD_GetCardState() == SD_TRANSFER_OK))
+  {
+    AsyncState = SD_ASYNC_OK;
+  }
+  else if ((HAL_GetTick() - AsyncTick) >= SD_TIMEOUT)
+  {
+    if (0U == WriteStatus)
+    {
+      HAL_SD_Abort(&hsd);
+    }
+    AsyncState = SD_ASYNC_ERROR;
+  }
+}
+
+/**
+  * @brief  Waits for a running asynchronous request to finish
+  * @note   Its result stays for SD_AsyncPoll() of the request owner.
+  * @retval RES_OK when the SDIO is free
+  */
+static DRESULT SD_WaitIdle(void)
+{
+  do
+  {
+    SD_AsyncUpdate();
+  } while (SD_ASYNC_BUSY == AsyncState);
+  return RES_OK;
+}
+
+/**
+  * @brief  Runs one DMA transfer and waits for the interrupt
+  * @param  write: 1 to write, 0 to read
+  * @param  buff: DMA capable data buffer
+  * @param  sector: Sector address (LBA)
+  * @param  count: Number of sectors, multi-block commands for count > 1
+  * @retval DRESULT: Operation result
+  */
+static DRESULT SD_Transfer(uint8_t write, BYTE *buff, DWORD sector, UINT count)
+{
+  uint32_t tick;
+  uint8_t started;
+
+  ReadStatus = 0;
+  WriteStatus = 0;
+  XferError = 0;
+  if (write)
+  {
+    CacheStats.cardWrites += count;
+    started = BSP_SD_WriteBlocks_DMA((uint32_t*)buff, (uint32_t)sector, count);
+  }
+  else
+  {
+    CacheStats.cardReads += count;
+    started = BSP_SD_ReadBlocks_DMA((uint32_t*)buff, (uint32_t)sector, count);
+  }
+  if (started != MSD_OK)
+  {
+    return RES_ERROR;
+  }
+
+  /* The CPU only waits here, the data moves by DMA */
+  tick = HAL_GetTick();
+  while ((0U == (write ? WriteStatus : ReadStatus)) && (0U == XferError))
+  {
+    if ((HAL_GetTick() - tick) >= SD_TIMEOUT)
+    {
+      break;
+    }
+  }
+  if ((0U != XferError) || (0U == (write ? WriteStatus : ReadStatus)))
+  {
+    HAL_SD_Abort(&hsd);
+    return RES_ERROR;
+  }
+
+  /* A write is complete once the card has left the programming state */
+  while (BSP_SD_GetCardState() != SD_TRANSFER_OK)
+  {
+    if ((HAL_GetTick() - tick) >= SD_TIMEOUT)
+    {
+      return RES_ERROR;
+    }
+  }
+  return RES_OK;
+}
+
+/**
+  * @brief  Forgets all cached sectors, e.g. for a new card
+  * @retval None
+  */
+static void SD_CacheReset(void)
+{
+  for (UINT i = 0; i < SD_CACHE_SECTORS; i++)
+  {
+    CacheLine[i].sector = SD_CACHE_FREE;
+    CacheLine[i].dirty = 0;
+  }
+  AheadSector = SD_CACHE_FREE;
+  LastRead = SD_CACHE_FREE;
+  CacheDraining = 0;
+}
+
+/**
+  * @brief  Looks up a sector in the LRU lines
+  * @param  sector: Sector address (LBA)
+  * @retval Line index, -1 if not cached
+  */
+static int SD_CacheFind(DWORD sector)
+{
+  for (UINT i = 0; i < SD_CACHE_SECTORS; i++)
+  {
+    if (CacheLine[i].sector == sector)
+    {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+/**
+  * @brief  Writes a dirty line back to the card
+  * @param  line: Line index
+  * @retval DRESULT: Operation result, the line stays dirty on failure
+  */
+static DRESULT SD_CacheClean(int line)
+{
+  DRESULT res;
+
+  if (0U == CacheLine[line].dirty)
+  {
+    return RES_OK;
+  }
+  res = SD_Transfer(1, (BYTE*)CacheData[line], CacheLine[line].sector, 1);
+  if (res == RES_OK)
+  {
+    CacheLine[line].dirty = 0;
+    CacheStats.writeBacks++;
+  }
+  return res;
+}
+
+/**
+  * @brief  Frees the least recently used line, written back if dirty
+  * @param  res: Result of the write-back
+  * @retval Line index, -1 if the write-back failed
+  */
+static int SD_CacheAlloc(DRESULT *res)
+{
+  int victim = 0;
+
+  for (UINT i = 0; i < SD_CACHE_SECTORS; i++)
+  {
+    if (CacheLine[i].sector == SD_CACHE_FREE)
+    {
+      victim = (int)i;
+      break;
+    }
+    if (CacheLine[i].used < CacheLine[victim].used)
+    {
+      victim = (int)i;
+    }
+  }
+  *res = SD_CacheClean(victim);
+  if (*res != RES_OK)
+  {
+    return -1;
+  }
+  CacheLine[victim].sector = SD_CACHE_FREE;
+  return victim;
+}
+
+/**
+  * @brief  Forgets cached copies of sectors written behind the cache
+  * @param  sector: First sector (LBA)
+  * @param  count: Number of sectors
+  * @retval None
+  */
+static void SD_CacheDrop(DWORD sector, UINT count)
+{
+  if ((AheadSector != SD_CACHE_FREE) && (sector < (AheadSector + SD_CACHE_READAHEAD)) &&
+      (AheadSector < (sector + count)))
+  {
+    AheadSector = SD_CACHE_FREE;
+  }
+  for (UINT i = 0; i < SD_CACHE_SECTORS; i++)
+  {
+    if ((CacheLine[i].sector != SD_CACHE_FREE) && (CacheLine[i].sector >= sector) &&
+        (CacheLine[i].sector < (sector + count)))
+    {
+      CacheLine[i].sector = SD_CACHE_FREE;
+      CacheLine[i].dirty = 0;
+    }
+  }
+}
+
+/**
+  * @brief  Brings cached lines in line with a write-through
+  * @param  buff: Data written
+  * @param  sector: First sector (LBA)
+  * @param  count: Number of sectors
+  * @param  res: Result of the write, failed lines are dropped
+  * @retval None
+  */
+static void SD_CacheUpdate(const BYTE *buff, DWORD sector, UINT count, DRESULT res)
+{
+  for (UINT i = 0; i < SD_CACHE_SECTORS; i++)
+  {
+    if ((CacheLine[i].sector == SD_CACHE_FREE) || (CacheLine[i].sector < sector) ||
+        (CacheLine[i].sector >= (sector + count)))
+    {
+      continue;
+    }
+    if (res == RES_OK)
+    {
+      memcpy(CacheData[i], buff + (CacheLine[i].sector - sector) * SD_DEFAULT_BLOCK_SIZE, SD_DEFAULT_BLOCK_SIZE);
+    }
+    else
+    {
+      CacheLine[i].sector = SD_CACHE_FREE;
+    }
+    CacheLine[i].dirty = 0;
+  }
+}
+
+/**
+  * @brief  Puts dirty lines over sectors just read from the card
+  * @param  buff: Data read
+  * @param  sector: First sector (LBA)
+  * @param  count: Number of sectors
+  * @retval None
+  */
+static void SD_CacheOverlay(BYTE *buff, DWORD sector, UINT count)
+{
+  for (UINT i = 0; i < SD_CACHE_SECTORS; i++)
+  {
+    if ((0U != CacheLine[i].dirty) && (CacheLine[i].sector >= sector) &&
+        (CacheLine[i].sector < (sector + count)))
+    {
+      memcpy(buff + (CacheLine[i].sector - sector) * SD_DEFAULT_BLOCK_SIZE, CacheData[i], SD_DEFAULT_BLOCK_SIZE);
+    }
+  }
+}
+
 /**
   * @brief  Initializes a Drive
   * @param  lun : not used
@@ -106,7 +441,11 @@ static DSTATUS SD_CheckStatus(BYTE lun)
   */
 DSTATUS SD_initialize(BYTE lun)
 {
+  BSP_SD_CardInfo CardInfo;
+
 Stat = STA_NOINIT;
+  /* Possibly another card: nothing cached is valid */
+  SD_CacheReset();
 
 #if !defined(DISABLE_SD_INIT)
 
@@ -119,6 +458,11 @@ Stat = STA_NOINIT;
   Stat = SD_CheckStatus(lun);
 #endif
 
+  if (0U == (Stat & STA_NOINIT))
+  {
+    BSP_SD_GetCardInfo(&CardInfo);
+    CardSectors = CardInfo.LogBlockNbr;
+  }
   return Stat;
 }
 
@@ -146,19 +490,85 @@ DSTATUS SD_status(BYTE lun)
 
 DRESULT SD_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
 {
-  DRESULT res = RES_ERROR;
+  DRESULT res = SD_WaitIdle();
+  DWORD previous = LastRead;
+  int line;
 
-  if(BSP_SD_ReadBlocks((uint32_t*)buff,
-                       (uint32_t) (sector),
-                       count, SD_TIMEOUT) == MSD_OK)
+  if (res != RES_OK)
+  {
+    return res;
+  }
+  if (count == 1U)
   {
-    /* wait until the read operation is finished */
-    while(BSP_SD_GetCardState()!= MSD_OK)
+    LastRead = sector;
+    line = SD_CacheFind(sector);
+    if (line >= 0)
     {
+      memcpy(buff, CacheData[line], SD_DEFAULT_BLOCK_SIZE);
+      CacheLine[line].used = ++CacheClock;
+      CacheStats.hits++;
+      return RES_OK;
+    }
+    if ((AheadSector != SD_CACHE_FREE) && (sector >= AheadSector) && (sector < (AheadSector + SD_CACHE_READAHEAD)))
+    {
+      memcpy(buff, AheadData[sector - AheadSector], SD_DEFAULT_BLOCK_SIZE);
+      CacheStats.hits++;
+      return RES_OK;
+    }
+    CacheStats.misses++;
+
+    if (buff == CacheMetaWin)
+    {
+      /* FAT or directory sector, kept for the next access */
+      line = SD_CacheAlloc(&res);
+      if (line < 0)
+      {
+        return res;
+      }
+      res = SD_Transfer(0, (BYTE*)CacheData[line], sector, 1);
+      if (res == RES_OK)
+      {
+        CacheLine[line].sector = sector;
+        CacheLine[line].used = ++CacheClock;
+        memcpy(buff, CacheData[line], SD_DEFAULT_BLOCK_SIZE);
+      }
+      return res;
+    }
+    if ((sector == (previous + 1U)) && ((sector + SD_CACHE_READAHEAD) <= CardSectors))
+    {
+      /* Sequential reader: fetch the following sectors in the same transfer */
+      AheadSector = SD_CACHE_FREE;
+      res = SD_Transfer(0, (BYTE*)AheadData, sector, SD_CACHE_READAHEAD);
+      if (res == RES_OK)
+      {
+        AheadSector = sector;
+        CacheStats.readAhead++;
+        SD_CacheOverlay((BYTE*)AheadData, sector, SD_CACHE_READAHEAD);
+        memcpy(buff, AheadData[0], SD_DEFAULT_BLOCK_SIZE);
+      }
+      return res;
     }
-    res = RES_OK;
   }
 
+  if (SD_DmaCapable(buff))
+  {
+    res = SD_Transfer(0, buff, sector, count);
+  }
+  else
+  {
+    for (UINT i = 0; (i < count) && (res == RES_OK); i++)
+    {
+      res = SD_Transfer(0, (BYTE*)scratch, sector + i, 1);
+      if (res == RES_OK)
+      {
+        memcpy(buff + i * SD_DEFAULT_BLOCK_SIZE, scratch, SD_DEFAULT_BLOCK_SIZE);
+      }
+    }
+  }
+  if (res == RES_OK)
+  {
+    SD_CacheOverlay(buff, sector, count);
+  }
   return res;
 }
 
@@ -177,19 +587,56 @@ DRESULT SD_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
 
 DRESULT SD_write(BYTE lun, const BYTE *buff, DWORD sector, UINT count)
 {
-  DRESULT res = RES_ERROR;
+  DRESULT res = SD_WaitIdle();
+  int line;
 
-  if(BSP_SD_WriteBlocks((uint32_t*)buff,
-                        (uint32_t)(sector),
-                        count, SD_TIMEOUT) == MSD_OK)
+  if (res != RES_OK)
   {
-	/* wait until the Write operation is finished */
-    while(BSP_SD_GetCardState() != MSD_OK)
+    return res;
+  }
+  CacheStats.writes += count;
+  if ((AheadSector != SD_CACHE_FREE) && (sector < (AheadSector + SD_CACHE_READAHEAD)) &&
+      (AheadSector < (sector + count)))
+  {
+    AheadSector = SD_CACHE_FREE;
+  }
+
+  if ((count == 1U) && (buff == CacheMetaWin))
+  {
+    /* FAT or directory sector: written back later, repeated updates merge */
+    line = SD_CacheFind(sector);
+    if (line < 0)
     {
+      line = SD_CacheAlloc(&res);
+      if (line < 0)
+      {
+        return res;
+      }
+      CacheLine[line].sector = sector;
     }
-    res = RES_OK;
+    memcpy(CacheData[line], buff, SD_DEFAULT_BLOCK_SIZE);
+    CacheLine[line].used = ++CacheClock;
+    if (0U == CacheLine[line].dirty)
+    {
+      CacheLine[line].dirty = 1;
+      CacheLine[line].dirtyTick = HAL_GetTick();
+    }
+    return RES_OK;
   }
 
+  if (SD_DmaCapable(buff))
+  {
+    res = SD_Transfer(1, (BYTE*)buff, sector, count);
+  }
+  else
+  {
+    for (UINT i = 0; (i < count) && (res == RES_OK); i++)
+    {
+      memcpy(scratch, buff + i * SD_DEFAULT_BLOCK_SIZE, SD_DEFAULT_BLOCK_SIZE);
+      res = SD_Transfer(1, (BYTE*)scratch, sector + i, 1);
+    }
+  }
+  SD_CacheUpdate(buff, sector, count, res);
   return res;
 }
 #endif /* _USE_WRITE == 1 */
@@ -214,9 +661,9 @@ DRESULT SD_ioctl(BYTE lun, BYTE cmd, void *buff)
 
   switch (cmd)
   {
-  /* Make sure that no pending write process */
+  /* Make sure that no pending write process, cached metadata stays (SD_CacheFlush) */
   case CTRL_SYNC :
-    res = RES_OK;
+    res = SD_WaitIdle();
     break;
 
   /* Get number of sectors on the disk (DWORD) */
@@ -249,7 +696,172 @@ DRESULT SD_ioctl(BYTE lun, BYTE cmd, void *buff)
 #endif /* _USE_IOCTL == 1 */
 
 /* USER CODE BEGIN afterIoctlSection */
-/* can be used to modify previous code / undefine following code / add new code */
+/**
+  * @brief  Starts an asynchronous sector write
+  * @param  buff: 4-byte aligned data outside CCM RAM, untouched until done
+  * @param  sector: Sector address (LBA)
+  * @param  count: Number of sectors
+  * @retval MSD_OK if started, MSD_ERROR if not ready, refused or the
+  *         previous result was not collected by SD_AsyncPoll()
+  */
+uint8_t SD_AsyncWrite(const BYTE *buff, DWORD sector, UINT count)
+{
+  if ((Stat & STA_NOINIT) || (SD_ASYNC_IDLE != AsyncState) || !SD_DmaCapable(buff))
+  {
+    return MSD_ERROR;
+  }
+  SD_CacheDrop(sector, count);
+  WriteStatus = 0;
+  XferError = 0;
+  if (BSP_SD_WriteBlocks_DMA((uint32_t*)buff, (uint32_t)sector, count) != MSD_OK)
+  {
+    return MSD_ERROR;
+  }
+  AsyncTick = HAL_GetTick();
+  AsyncState = SD_ASYNC_BUSY;
+  return MSD_OK;
+}
+
+/**
+  * @brief  Advances and reports the asynchronous request
+  * @retval SD_ASYNC_BUSY while running; SD_ASYNC_OK or SD_ASYNC_ERROR
+  *         once when it ends, SD_ASYNC_IDLE afterwards
+  */
+SD_AsyncStateTypeDef SD_AsyncPoll(void)
+{
+  SD_AsyncStateTypeDef state;
+
+  SD_AsyncUpdate();
+  state = AsyncState;
+  if (SD_ASYNC_BUSY != state)
+  {
+    AsyncState = SD_ASYNC_IDLE;
+  }
+  return state;
+}
+
+/**
+  * @brief  Registers the FatFs window, its sectors are cached write-back
+  * @param  win: Window buffer of the mounted file system object
+  * @retval None
+  */
+void SD_CacheSetMeta(const BYTE *win)
+{
+  CacheMetaWin = win;
+}
+
+/**
+  * @brief  Writes all dirty lines back, an explicit flush point
+  * @retval DRESULT: Operation result
+  */
+DRESULT SD_CacheFlush(void)
+{
+  DRESULT res = RES_OK;
+
+  if (Stat & STA_NOINIT)
+  {
+    return RES_NOTRDY;
+  }
+  SD_WaitIdle();
+  for (UINT i = 0; i < SD_CACHE_SECTORS; i++)
+  {
+    if (SD_CacheClean((int)i) != RES_OK)
+    {
+      res = RES_ERROR;
+    }
+  }
+  CacheDraining = 0;
+  return res;
+}
+
+/**
+  * @brief  Bounds the age of cached metadata
+  * @note   Called every 1 ms from the FatFs context. Once a dirty line is
+  *         SD_CACHE_FLUSH_MS old, all dirty lines are written back, lowest
+  *         sector (FAT) first, one per call, so a call costs one sector
+  *         write at most. Skipped while an asynchronous write runs.
+  * @retval None
+  */
+void SD_CacheService(void)
+{
+  int line = -1;
+
+  if (Stat & STA_NOINIT)
+  {
+    return;
+  }
+  SD_AsyncUpdate();
+  if (SD_ASYNC_BUSY == AsyncState)
+  {
+    return;
+  }
+  for (UINT i = 0; i < SD_CACHE_SECTORS; i++)
+  {
+    if (0U == CacheLine[i].dirty)
+    {
+      continue;
+    }
+    if ((HAL_GetTick() - CacheLine[i].dirtyTick) >= SD_CACHE_FLUSH_MS)
+    {
+      CacheDraining = 1;
+    }
+    if ((line < 0) || (CacheLine[i].sector < CacheLine[line].sector))
+    {
+      line = (int)i;
+    }
+  }
+  if (line < 0)
+  {
+    CacheDraining = 0;
+  }
+  else if ((0U != CacheDraining) && (SD_CacheClean(line) != RES_OK))
+  {
+    /* Card failing or gone: drop the metadata instead of retrying every call */
+    SD_CacheReset();
+  }
+}
+
+/**
+  * @brief  Returns the cache counters
+  * @param  stats: Output, counters since start-up
+  * @retval None
+  */
+void SD_CacheGetStats(SD_CacheStatsTypeDef *stats)
+{
+  *stats = CacheStats;
+  stats->dirty = 0;
+  for (UINT i = 0; i < SD_CACHE_SECTORS; i++)
+  {
+    stats->dirty += CacheLine[i].dirty;
+  }
+}
+
+/**
+  * @brief Tx Transfer completed callback
+  * @retval None
+  */
+void BSP_SD_WriteCpltCallback(void)
+{
+  WriteStatus = 1;
+}
+
+/**
+  * @brief Rx Transfer completed callback
+  * @retval None
+  */
+void BSP_SD_ReadCpltCallback(void)
+{
+  ReadStatus = 1;
+}
+
+/**
+  * @brief Transfer error callback
+  * @retval None
+  */
+void BSP_SD_ErrorCallback(void)
+{
+  XferError = 1;
+}
 /* USER CODE END afterIoctlSection */
 
 /* USER CODE BEGIN lastSection */
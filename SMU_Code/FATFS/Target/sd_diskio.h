@@ -35,7 +35,60 @@
 extern const Diskio_drvTypeDef  SD_Driver;
 
 /* USER CODE BEGIN lastSection */
-/* can be used to modify / undefine previous code or add new definitions */
+/*
+ * Asynchronous write for a background writer, e.g. a log stream into a
+ * pre-allocated file region. Only one request runs at a time; it must be
+ * started and polled from the same context as the FatFs calls, which wait
+ * for a running request before they use the card.
+ */
+typedef enum
+{
+  SD_ASYNC_IDLE = 0,  /* No request */
+  SD_ASYNC_BUSY,      /* DMA or card programming running */
+  SD_ASYNC_OK,        /* Finished, reported once */
+  SD_ASYNC_ERROR      /* Failed or timed out, reported once */
+} SD_AsyncStateTypeDef;
+
+uint8_t SD_AsyncWrite(const BYTE *buff, DWORD sector, UINT count);
+SD_AsyncStateTypeDef SD_AsyncPoll(void);
+
+/*
+ * Sector cache between FatFs and the card. Sectors FatFs writes from its
+ * window (FAT and directory sectors, registered with SD_CacheSetMeta())
+ * stay in RAM and are written back on eviction, at SD_CacheFlush() or by
+ * SD_CacheService() at most SD_CACHE_FLUSH_MS after their first change.
+ * Window reads are cached too; file data is written through and updates a
+ * cached copy. Sequential single-sector reads fill a read-ahead buffer of
+ * SD_CACHE_READAHEAD sectors with one multi-block transfer.
+ * CTRL_SYNC does not flush: a power loss can cost the metadata changes of
+ * the last SD_CACHE_FLUSH_MS, explicit flush points bound this further.
+ */
+#ifndef SD_CACHE_SECTORS
+#define SD_CACHE_SECTORS   8U     /* LRU lines of 512 bytes, 1..32 */
+#endif
+#ifndef SD_CACHE_READAHEAD
+#define SD_CACHE_READAHEAD 4U     /* Sectors per read-ahead, 2..16 */
+#endif
+#ifndef SD_CACHE_FLUSH_MS
+#define SD_CACHE_FLUSH_MS  1000U  /* Longest time a metadata change stays in RAM */
+#endif
+
+typedef struct
+{
+  uint32_t hits;        /* Single-sector reads served from RAM */
+  uint32_t misses;      /* Single-sector reads sent to the card */
+  uint32_t readAhead;   /* Read-ahead fills */
+  uint32_t writes;      /* Sectors written by FatFs */
+  uint32_t cardReads;   /* Sectors read from the card */
+  uint32_t cardWrites;  /* Sectors written to the card, write-back included */
+  uint32_t writeBacks;  /* Dirty lines written back */
+  uint8_t  dirty;       /* Dirty lines now */
+} SD_CacheStatsTypeDef;
+
+void SD_CacheSetMeta(const BYTE *win);
+DRESULT SD_CacheFlush(void);
+void SD_CacheService(void);
+void SD_CacheGetStats(SD_CacheStatsTypeDef *stats);
 /* USER CODE END lastSection */
 
 #endif /* __SD_DISKIO_H */
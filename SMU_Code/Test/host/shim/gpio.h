@@ -0,0 +1,15 @@
+/**
+ * @file gpio.h
+ * @brief Host stand-in for the CubeMX GPIO declarations
+ *
+ * @date 2025-11-20
+ * @author Allayar Moazami
+ */
+#ifndef H_SIM_GPIO
+#define H_SIM_GPIO
+
+#include "stm32f4xx_hal.h"
+
+void MX_EnergyMeter_GPIO_Init(void);
+
+#endif /* H_SIM_GPIO */
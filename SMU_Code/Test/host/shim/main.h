@@ -0,0 +1,13 @@
+/**
+ * @file main.h
+ * @brief Host stand-in, everything lives in stm32f4xx_hal.h
+ *
+ * @date 2025-11-20
+ * @author Allayar Moazami
+ */
+#ifndef H_SIM_MAIN_H
+#define H_SIM_MAIN_H
+
+#include "stm32f4xx_hal.h"
+
+#endif /* H_SIM_MAIN_H */
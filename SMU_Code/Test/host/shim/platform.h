@@ -0,0 +1,10 @@
+/**
+ * @file platform.h
+ * @brief Host stand-in for the lower-case include of Platform.h
+ *
+ * The target toolchain resolves includes without regard to case.
+ *
+ * @date 2025-11-20
+ * @author Allayar Moazami
+ */
+#include "Platform.h"
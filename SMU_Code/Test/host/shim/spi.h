@@ -0,0 +1,15 @@
+/**
+ * @file spi.h
+ * @brief Host stand-in for the CubeMX SPI declarations
+ *
+ * @date 2025-11-20
+ * @author Allayar Moazami
+ */
+#ifndef H_SIM_SPI
+#define H_SIM_SPI
+
+#include "stm32f4xx_hal.h"
+
+extern SPI_HandleTypeDef hspi2;
+
+#endif /* H_SIM_SPI */
@@ -0,0 +1,141 @@
+/**
+ * @file stm32f4xx_hal.h
+ * @brief Host stand-in for the STM32F4 HAL used by the energy meter layers
+ *
+ * Declares only what energy_meter_dll.c, energy_meter_hal.c and
+ * energy_meters.c touch. The functions are implemented in sim_hal.c on top
+ * of the simulated STPM34.
+ *
+ * @date 2025-11-20
+ * @author Allayar Moazami
+ */
+#ifndef H_SIM_STM32F4XX_HAL
+#define H_SIM_STM32F4XX_HAL
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* ========================================================================
+ * Core
+ * ======================================================================== */
+
+typedef enum {
+    HAL_OK = 0,
+    HAL_ERROR,
+    HAL_BUSY,
+    HAL_TIMEOUT
+} HAL_StatusTypeDef;
+
+/** @brief Cycle counter, advanced by the simulation clock */
+typedef struct {
+    volatile uint32_t CYCCNT;
+} DWT_Type;
+
+extern DWT_Type gSimDwt;
+#define DWT (&gSimDwt)
+
+extern uint32_t SystemCoreClock;
+
+/** @brief Interrupts never preempt on the host, the mask is only tracked */
+extern uint32_t gSimPrimask;
+
+static inline uint32_t __get_PRIMASK(void)
+{
+    return gSimPrimask;
+}
+
+static inline void __set_PRIMASK(uint32_t primask)
+{
+    gSimPrimask = primask;
+}
+
+static inline void __disable_irq(void)
+{
+    gSimPrimask = 1;
+}
+
+static inline void __enable_irq(void)
+{
+    gSimPrimask = 0;
+}
+
+uint32_t HAL_GetTick(void);
+
+typedef enum {
+    SPI2_IRQn = 36
+} IRQn_Type;
+
+void HAL_NVIC_SetPriority(IRQn_Type irq, uint32_t preempt, uint32_t sub);
+void HAL_NVIC_EnableIRQ(IRQn_Type irq);
+
+/* ========================================================================
+ * GPIO
+ * ======================================================================== */
+
+typedef struct {
+    uint32_t ODR;
+} GPIO_TypeDef;
+
+typedef enum {
+    GPIO_PIN_RESET = 0,
+    GPIO_PIN_SET
+} GPIO_PinState;
+
+extern GPIO_TypeDef gSimGpioB;
+#define GPIOB (&gSimGpioB)
+#define GPIO_PIN_1 ((uint16_t)0x0002)
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state);
+
+/* ========================================================================
+ * UART
+ * ======================================================================== */
+
+typedef enum {
+    HAL_UART_STATE_RESET = 0x00U,
+    HAL_UART_STATE_READY = 0x20U,
+    HAL_UART_STATE_BUSY_TX = 0x21U,
+    HAL_UART_STATE_BUSY_RX = 0x22U
+} HAL_UART_StateTypeDef;
+
+typedef struct {
+    uint32_t BaudRate;
+} UART_InitTypeDef;
+
+typedef struct {
+    UART_InitTypeDef Init;
+    volatile HAL_UART_StateTypeDef gState;
+    volatile HAL_UART_StateTypeDef RxState;
+} UART_HandleTypeDef;
+
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef *huart);
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_UART_Abort(UART_HandleTypeDef *huart);
+HAL_StatusTypeDef HAL_UART_AbortTransmit(UART_HandleTypeDef *huart);
+
+/* ========================================================================
+ * SPI
+ * ======================================================================== */
+
+#define SPI_POLARITY_HIGH       0x00000002U
+#define SPI_PHASE_2EDGE         0x00000001U
+#define SPI_BAUDRATEPRESCALER_8 0x00000010U
+#define SPI_FIRSTBIT_MSB        0x00000000U
+
+typedef struct {
+    uint32_t CLKPolarity;
+    uint32_t CLKPhase;
+    uint32_t BaudRatePrescaler;
+    uint32_t FirstBit;
+} SPI_InitTypeDef;
+
+typedef struct {
+    SPI_InitTypeDef Init;
+} SPI_HandleTypeDef;
+
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef *hspi);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_IT(SPI_HandleTypeDef *hspi, uint8_t *tx, uint8_t *rx, uint16_t size);
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi);
+
+#endif /* H_SIM_STM32F4XX_HAL */
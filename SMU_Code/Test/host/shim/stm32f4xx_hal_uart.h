@@ -0,0 +1,13 @@
+/**
+ * @file stm32f4xx_hal_uart.h
+ * @brief Host stand-in, everything lives in stm32f4xx_hal.h
+ *
+ * @date 2025-11-20
+ * @author Allayar Moazami
+ */
+#ifndef H_SIM_STM32F4XX_HAL_UART_H
+#define H_SIM_STM32F4XX_HAL_UART_H
+
+#include "stm32f4xx_hal.h"
+
+#endif /* H_SIM_STM32F4XX_HAL_UART_H */
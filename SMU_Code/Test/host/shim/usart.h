@@ -0,0 +1,17 @@
+/**
+ * @file usart.h
+ * @brief Host stand-in for the CubeMX UART declarations
+ *
+ * @date 2025-11-20
+ * @author Allayar Moazami
+ */
+#ifndef H_SIM_USART
+#define H_SIM_USART
+
+#include "stm32f4xx_hal.h"
+
+extern UART_HandleTypeDef huart4;
+
+void MX_UART4_UART_Init(void);
+
+#endif /* H_SIM_USART */
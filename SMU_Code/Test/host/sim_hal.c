@@ -0,0 +1,402 @@
+/**
+ * @file sim_hal.c
+ * @brief Simulation clock and wiring of the host tests
+ *
+ * UART4 is modelled per byte: a byte takes ten bit times at the rate it is
+ * sent at and only arrives intact when both ends run at about the same
+ * rate. The MCU side copies received bytes into the ring armed by
+ * HAL_UARTEx_ReceiveToIdle_DMA() and reports them with a receive event at
+ * the end of the step, like the idle line interrupt does on the target. A
+ * byte arriving at the wrong rate is reported as a link error. SPI2
+ * exchanges whole frames within the step they are started in.
+ *
+ * @date 2025-11-20
+ * @author Allayar Moazami
+ */
+#include "sim_hal.h"
+#include "stpm34_sim.h"
+#include "energy_meters.h"
+#include "energy_meter_dll.h"
+#include "energy_meter_hal.h"
+#include "usart.h"
+#include "spi.h"
+#include "gpio.h"
+#include "dbg.h"
+
+/* ========================================================================
+ * Constants
+ * ======================================================================== */
+
+/** @brief Bits on the line per byte, 8N1 */
+#define SIM_BITS_PER_BYTE 10UL
+
+/** @brief SPI frames one step may exchange, a bound for a broken chain */
+#define SIM_SPI_FRAMES_PER_STEP 64U
+
+/** @brief Size of the captured command line output */
+#define SIM_CMD_SIZE 1024U
+
+/* ========================================================================
+ * HAL Objects
+ * ======================================================================== */
+
+UART_HandleTypeDef huart3;
+UART_HandleTypeDef huart4;
+SPI_HandleTypeDef hspi2;
+GPIO_TypeDef gSimGpioB;
+DWT_Type gSimDwt;
+uint32_t SystemCoreClock = SIM_CORE_CLOCK;
+uint32_t gSimPrimask = 0;
+
+/* ========================================================================
+ * Static Variables
+ * ======================================================================== */
+
+/** @brief Milliseconds since start */
+static u32 gTick = 0;
+
+/** @brief MCU transmission: next byte */
+static const u8 *gTxData = NULL;
+
+/** @brief MCU transmission: bytes left */
+static u16 gTxLeft = 0;
+
+/** @brief MCU transmission: line time not yet used, in us */
+static u32 gTxUs = 0;
+
+/** @brief Chip transmission: byte on the line */
+static u8 gWireByte = 0;
+
+/** @brief Chip transmission: rate of gWireByte */
+static u32 gWireBaud = 0;
+
+/** @brief Chip transmission: gWireByte is on the line */
+static u8 gWireBusy = 0;
+
+/** @brief Chip transmission: line time not yet used, in us */
+static u32 gWireUs = 0;
+
+/** @brief Reception ring armed by HAL_UARTEx_ReceiveToIdle_DMA(), NULL if stopped */
+static u8 *gRing = NULL;
+
+/** @brief Size of gRing */
+static u16 gRingSize = 0;
+
+/** @brief Next position the DMA writes in gRing */
+static u16 gRingPos = 0;
+
+/** @brief SPI frame started and not yet exchanged */
+static u8 gSpiPending = 0;
+
+/** @brief SPI frame sent */
+static const u8 *gSpiTx = NULL;
+
+/** @brief SPI response destination */
+static u8 *gSpiRx = NULL;
+
+/** @brief Command line output since the last sim_cmd_output() */
+static char gCmdOut[SIM_CMD_SIZE];
+
+/** @brief Output returned by the last sim_cmd_output() */
+static char gCmdLast[SIM_CMD_SIZE];
+
+/* ========================================================================
+ * Static Helper Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Time of one byte on the line
+ * @param[in] baud Rate
+ * @return Microseconds
+ */
+static u32 sim_byte_us(u32 baud)
+{
+    return (u32)((SIM_BITS_PER_BYTE * 1000000UL + baud - 1U) / baud);
+}
+
+/**
+ * @brief Rates close enough for a byte to arrive intact
+ * @param[in] a First rate
+ * @param[in] b Second rate
+ * @return 1 if they match
+ */
+static u8 sim_baud_match(u32 a, u32 b)
+{
+    u32 diff = (a > b) ? (a - b) : (b - a);
+
+    return (diff * 100U <= b * STPM34_SIM_BAUD_TOLERANCE) ? 1U : 0U;
+}
+
+/**
+ * @brief Move the bytes of one millisecond from the MCU to the chip
+ * @return 1 if the transmission completed in this step
+ */
+static u8 sim_uart_to_chip(void)
+{
+    u32 cost;
+
+    if (0U == gTxLeft) {
+        return 0;
+    }
+    cost = sim_byte_us(huart4.Init.BaudRate);
+    gTxUs += 1000U;
+    while (gTxLeft > 0U && gTxUs >= cost) {
+        gTxUs -= cost;
+        stpm34_sim_uart_rx(*gTxData++, huart4.Init.BaudRate);
+        gTxLeft--;
+    }
+    if (0U != gTxLeft) {
+        return 0;
+    }
+    gTxUs = 0;
+    huart4.gState = HAL_UART_STATE_READY;
+    return 1;
+}
+
+/**
+ * @brief Move the bytes of one millisecond from the chip to the MCU
+ * @return 1 if a byte landed in the reception ring
+ */
+static u8 sim_uart_from_chip(void)
+{
+    u8 moved = 0;
+
+    gWireUs += 1000U;
+    for (;;) {
+        if (0U == gWireBusy) {
+            if (0U == stpm34_sim_uart_tx(&gWireByte, &gWireBaud)) {
+                gWireUs = 0;
+                break;
+            }
+            gWireBusy = 1;
+        }
+        if (gWireUs < sim_byte_us(gWireBaud)) {
+            break;
+        }
+        gWireUs -= sim_byte_us(gWireBaud);
+        gWireBusy = 0;
+
+        if (NULL == gRing) {
+            continue;
+        }
+        if (0U == sim_baud_match(gWireBaud, huart4.Init.BaudRate)) {
+            /* Framing error, the reception keeps running */
+            energy_meter_dll_link_error();
+            continue;
+        }
+        gRing[gRingPos] = gWireByte;
+        gRingPos = (u16)((gRingPos + 1U) % gRingSize);
+        moved = 1;
+    }
+    return moved;
+}
+
+/**
+ * @brief Exchange the SPI frames started in this step
+ */
+static void sim_spi(void)
+{
+    for (u8 n = 0; n < SIM_SPI_FRAMES_PER_STEP && 0U != gSpiPending; n++) {
+        gSpiPending = 0;
+        stpm34_sim_spi_frame(gSpiTx, gSpiRx);
+        energy_meter_dll_spi_complete();
+    }
+}
+
+/**
+ * @brief Advance the simulation by one millisecond
+ */
+static void sim_step(void)
+{
+    gTick++;
+    gSimDwt.CYCCNT += SIM_CORE_CLOCK / 1000UL;
+
+    if (0U != sim_uart_to_chip()) {
+        energy_meter_dll_tx_complete();
+    }
+    if (0U != sim_uart_from_chip()) {
+        energy_meter_dll_rx_event(gRingPos);
+    }
+    sim_spi();
+
+    energy_meter_dll_timer_tick();
+    if (0U == (gTick % SIM_HANDLER_MS)) {
+        energy_meters_handler();
+    }
+}
+
+/* ========================================================================
+ * Public Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Run the simulation
+ * @param[in] ms Milliseconds to advance
+ */
+void sim_run(u32 ms)
+{
+    while (ms-- > 0U) {
+        sim_step();
+    }
+}
+
+/**
+ * @brief Run the simulation until a condition holds
+ *
+ * @param[in] cond  Condition, checked after every step
+ * @param[in] limit Milliseconds to give up after
+ * @return 1 if the condition came true, 0 on the limit
+ */
+u8 sim_run_until(u8 (*cond)(void), u32 limit)
+{
+    while (limit-- > 0U) {
+        sim_step();
+        if (0U != cond()) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Get the current UART4 baud rate of the MCU
+ * @return Baud rate
+ */
+u32 sim_uart_baud(void)
+{
+    return huart4.Init.BaudRate;
+}
+
+/**
+ * @brief Get the command line output since the last call
+ * @return Text written by TransmitCMDResponse(), cleared on return
+ */
+const char *sim_cmd_output(void)
+{
+    memcpy(gCmdLast, gCmdOut, sizeof(gCmdLast));
+    gCmdOut[0] = '\0';
+    return gCmdLast;
+}
+
+/* ========================================================================
+ * HAL Stand-ins
+ * ======================================================================== */
+
+uint32_t HAL_GetTick(void)
+{
+    return gTick;
+}
+
+void HAL_NVIC_SetPriority(IRQn_Type irq, uint32_t preempt, uint32_t sub)
+{
+    (void)irq;
+    (void)preempt;
+    (void)sub;
+}
+
+void HAL_NVIC_EnableIRQ(IRQn_Type irq)
+{
+    (void)irq;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state)
+{
+    if (GPIO_PIN_SET == state) {
+        port->ODR |= pin;
+    } else {
+        port->ODR &= ~(uint32_t)pin;
+    }
+}
+
+/** @brief Keeps a running reception, like the target HAL does */
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef *huart)
+{
+    huart->gState = HAL_UART_STATE_READY;
+    if (NULL == gRing) {
+        huart->RxState = HAL_UART_STATE_READY;
+    }
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size)
+{
+    if (HAL_UART_STATE_READY != huart->gState) {
+        return HAL_BUSY;
+    }
+    huart->gState = HAL_UART_STATE_BUSY_TX;
+    gTxData = data;
+    gTxLeft = size;
+    gTxUs = 0;
+    stpm34_sim_uart_start();
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size)
+{
+    huart->RxState = HAL_UART_STATE_BUSY_RX;
+    gRing = data;
+    gRingSize = size;
+    gRingPos = 0;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Abort(UART_HandleTypeDef *huart)
+{
+    gTxLeft = 0;
+    gRing = NULL;
+    huart->gState = HAL_UART_STATE_READY;
+    huart->RxState = HAL_UART_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_AbortTransmit(UART_HandleTypeDef *huart)
+{
+    gTxLeft = 0;
+    huart->gState = HAL_UART_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef *hspi)
+{
+    (void)hspi;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_IT(SPI_HandleTypeDef *hspi, uint8_t *tx, uint8_t *rx, uint16_t size)
+{
+    (void)hspi;
+    if (STPM34_FRAME_SIZE != size || 0U != gSpiPending) {
+        return HAL_ERROR;
+    }
+    gSpiTx = tx;
+    gSpiRx = rx;
+    gSpiPending = 1;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi)
+{
+    (void)hspi;
+    gSpiPending = 0;
+    return HAL_OK;
+}
+
+void MX_EnergyMeter_GPIO_Init(void)
+{
+}
+
+void MX_UART4_UART_Init(void)
+{
+    huart4.Init.BaudRate = ENERGY_METER_BAUD_DEFAULT;
+    HAL_UART_Init(&huart4);
+}
+
+void TransmitCMDResponse(char *str)
+{
+    strncat(gCmdOut, str, sizeof(gCmdOut) - strlen(gCmdOut) - 1U);
+}
+
+void TransmitDebug(char *str)
+{
+    TransmitCMDResponse(str);
+}
@@ -0,0 +1,52 @@
+/**
+ * @file sim_hal.h
+ * @brief Simulation clock and wiring of the host tests
+ *
+ * sim_hal.c implements the HAL functions the energy meter layers call and
+ * connects UART4 and SPI2 to the simulated STPM34. Time advances in 1 ms
+ * steps; every step moves the bytes the line carries in that time, raises
+ * the UART callbacks, runs the TIM4 tick of the DLL and, every
+ * SIM_HANDLER_MS, the energy meter handler, in that order.
+ *
+ * @date 2025-11-20
+ * @author Allayar Moazami
+ */
+#ifndef H_SIM_HAL
+#define H_SIM_HAL
+
+#include "platform.h"
+
+/** @brief Period of the energy meter handler, the TIM2 task on the target */
+#define SIM_HANDLER_MS 10U
+
+/** @brief CPU clock reported to the DLL */
+#define SIM_CORE_CLOCK 168000000UL
+
+/**
+ * @brief Run the simulation
+ * @param[in] ms Milliseconds to advance
+ */
+void sim_run(u32 ms);
+
+/**
+ * @brief Run the simulation until a condition holds
+ *
+ * @param[in] cond  Condition, checked after every step
+ * @param[in] limit Milliseconds to give up after
+ * @return 1 if the condition came true, 0 on the limit
+ */
+u8 sim_run_until(u8 (*cond)(void), u32 limit);
+
+/**
+ * @brief Get the current UART4 baud rate of the MCU
+ * @return Baud rate
+ */
+u32 sim_uart_baud(void);
+
+/**
+ * @brief Get the command line output since the last call
+ * @return Text written by TransmitCMDResponse(), cleared on return
+ */
+const char *sim_cmd_output(void);
+
+#endif /* H_SIM_HAL */
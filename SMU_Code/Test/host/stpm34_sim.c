@@ -0,0 +1,396 @@
+/**
+ * @file stpm34_sim.c
+ * @brief Simulated STPM34 for the host tests
+ *
+ * A frame is [read address][write address][data low][data high][CRC]. The
+ * response to it goes out while the frame comes in, so it carries the
+ * register the previous frame asked for; a read address of 0xFF moves on
+ * to the next register. Frames failing their CRC are answered but not
+ * executed. A reset or a new US_REG2 divider takes effect once the answer
+ * to the frame is out.
+ *
+ * @date 2025-11-20
+ * @author Allayar Moazami
+ */
+#include "stpm34_sim.h"
+#include "energy_meter_hal.h"
+#include "energy_meter_dll.h"
+#include "crc.h"
+
+/* ========================================================================
+ * Constants
+ * ======================================================================== */
+
+/** @brief Registers addressable by one byte */
+#define STPM34_SIM_REGS 256U
+
+/** @brief Response bytes the UART can hold, a full sweep and then some */
+#define STPM34_SIM_TX_SIZE 256U
+
+/** @brief Largest magnitude of a 24-bit measurement register */
+#define STPM34_SIM_RAW_MAX 0x7FFFFFL
+
+/* ========================================================================
+ * Static Variables
+ * ======================================================================== */
+
+/** @brief Configuration registers as written */
+static u32 gConfig[STPM34_SIM_REGS];
+
+/** @brief Live measurement registers, set by the test */
+static u32 gLive[STPM34_SIM_REGS];
+
+/** @brief Measurement registers frozen by the last latch, what frames read */
+static u32 gLatched[STPM34_SIM_REGS];
+
+/** @brief Register the next response carries */
+static u8 gReadPtr = 0;
+
+/** @brief UART rate of the chip */
+static u32 gBaud = ENERGY_METER_BAUD_DEFAULT;
+
+/** @brief Rate taking effect after the answer to the current frame, 0 if none */
+static u32 gBaudNext = 0;
+
+/** @brief UART frame being received */
+static u8 gFrame[STPM34_FRAME_SIZE];
+
+/** @brief Bytes of gFrame received */
+static u8 gFill = 0;
+
+/** @brief UART response bytes not yet sent */
+static u8 gTxByte[STPM34_SIM_TX_SIZE];
+
+/** @brief Rate each byte of gTxByte goes out at */
+static u32 gTxBaud[STPM34_SIM_TX_SIZE];
+
+/** @brief First byte of gTxByte */
+static u16 gTxHead = 0;
+
+/** @brief Bytes in gTxByte */
+static u16 gTxCount = 0;
+
+/** @brief Responses still to leave alone, per fault */
+static u16 gFaultSkip[STPM34_SIM_FAULT_COUNT];
+
+/** @brief Responses still to affect, per fault */
+static u16 gFaultLeft[STPM34_SIM_FAULT_COUNT];
+
+/** @brief Responses per lost one, 0 if none are lost */
+static u16 gLossPeriod = 0;
+
+/** @brief Responses sent since the last lost one */
+static u16 gLossCount = 0;
+
+/** @brief Chip side counters */
+static StuStpmSimStats gStats = { .baud = ENERGY_METER_BAUD_DEFAULT };
+
+/* ========================================================================
+ * Static Helper Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Take the fault for the next response
+ * @return EnuStpmSimFault, STPM34_SIM_FAULT_COUNT if none
+ */
+static EnuStpmSimFault stpm34_sim_next_fault(void)
+{
+    EnuStpmSimFault hit = STPM34_SIM_FAULT_COUNT;
+
+    for (u8 f = 0; f < STPM34_SIM_FAULT_COUNT; f++) {
+        if (0U == gFaultLeft[f]) {
+            continue;
+        }
+        if (gFaultSkip[f] > 0U) {
+            gFaultSkip[f]--;
+        } else {
+            gFaultLeft[f]--;
+            if (STPM34_SIM_FAULT_COUNT == hit) {
+                hit = (EnuStpmSimFault)f;
+            }
+        }
+    }
+    if (0U != gLossPeriod && ++gLossCount >= gLossPeriod) {
+        gLossCount = 0;
+        if (STPM34_SIM_FAULT_COUNT == hit) {
+            hit = STPM34_SIM_DROP;
+        }
+    }
+    if (STPM34_SIM_FAULT_COUNT != hit) {
+        gStats.faults++;
+    }
+    return hit;
+}
+
+/**
+ * @brief Encode a measurement as a 24-bit register
+ *
+ * @param[in] value Measurement
+ * @param[in] lsb   Value of one count, in the unit of value
+ * @return Raw register value, two's complement, saturated
+ */
+static u32 stpm34_sim_encode(f32 value, f32 lsb)
+{
+    f32 counts = value / lsb;
+    int32_t raw = (int32_t)((counts < 0.0f) ? (counts - 0.5f) : (counts + 0.5f));
+
+    if (raw > STPM34_SIM_RAW_MAX) {
+        raw = STPM34_SIM_RAW_MAX;
+    } else if (raw < -STPM34_SIM_RAW_MAX) {
+        raw = -STPM34_SIM_RAW_MAX;
+    }
+    return (u32)raw & 0x00FFFFFFUL;
+}
+
+/**
+ * @brief Chip reset: registers and rate back to their defaults
+ */
+static void stpm34_sim_reset(void)
+{
+    memset(gConfig, 0, sizeof(gConfig));
+    memset(gLatched, 0, sizeof(gLatched));
+    gReadPtr = 0;
+    gStats.resets++;
+}
+
+/**
+ * @brief Answer one frame and execute it
+ *
+ * @param[in]  in  Frame received
+ * @param[out] out Response, STPM34_FRAME_SIZE bytes
+ * @return EnuStpmSimFault given to the response
+ */
+static EnuStpmSimFault stpm34_sim_frame(const u8 *in, u8 *out)
+{
+    EnuStpmSimFault fault = stpm34_sim_next_fault();
+    u32 value = gLatched[gReadPtr];
+    u16 data;
+
+    out[0] = (u8)value;
+    out[1] = (u8)(value >> 8);
+    out[2] = (u8)(value >> 16);
+    out[3] = (u8)(value >> 24);
+    out[4] = crc_stpm3x(out, 4);
+    if (STPM34_SIM_CORRUPT == fault) {
+        out[4] ^= 0xFFU;
+    }
+
+    if (in[4] != crc_stpm3x((u8 *)in, 4)) {
+        gStats.badFrames++;
+        return fault;
+    }
+    gStats.frames++;
+
+    gReadPtr = (0xFFU != in[0]) ? in[0] : (u8)(gReadPtr + 1U);
+
+    if (0xFFU != in[1]) {
+        data = (u16)(in[2] | ((u16)in[3] << 8));
+        gConfig[in[1]] = data;
+        gStats.writes++;
+
+        if (STPM34_REG_DSP_CR3 == in[1]) {
+            if (0U != (data & STPM34_DSP_CR3_SW_LATCH1)) {
+                memcpy(gLatched, gLive, sizeof(gLatched));
+                gStats.latches++;
+            }
+            if (0U != (data & STPM34_DSP_CR3_SW_RESET)) {
+                stpm34_sim_reset();
+                gBaudNext = ENERGY_METER_BAUD_DEFAULT;
+            }
+        } else if (STPM34_REG_US_REG2 == in[1] && 0U != data) {
+            gBaudNext = STPM34_UART_CLOCK / data;
+        }
+    }
+    return fault;
+}
+
+/* ========================================================================
+ * Public Function Implementations
+ * ======================================================================== */
+
+/**
+ * @brief Power the chip up: default rate, registers cleared
+ */
+void stpm34_sim_power_cycle(void)
+{
+    stpm34_sim_reset();
+    gBaud = ENERGY_METER_BAUD_DEFAULT;
+    gBaudNext = 0;
+    gFill = 0;
+    gTxHead = 0;
+    gTxCount = 0;
+}
+
+/**
+ * @brief Set the live value of a measurement register
+ *
+ * @param[in] addr  Register address
+ * @param[in] value Raw register value
+ */
+void stpm34_sim_set(u8 addr, u32 value)
+{
+    gLive[addr] = value;
+}
+
+/**
+ * @brief Set the RMS voltage and current of a channel
+ *
+ * @param[in] channel Channel number (1 or 2)
+ * @param[in] volts   RMS voltage in V
+ * @param[in] mA      RMS current in mA
+ */
+void stpm34_sim_set_rms(u8 channel, f32 volts, f32 mA)
+{
+    u32 v = stpm34_sim_encode(volts * 1000.0f, STPM34_VOLTAGE_LSB_MV);
+    u32 i = stpm34_sim_encode(mA, STPM34_CURRENT_LSB_MA);
+
+    if (1U == channel) {
+        gLive[STPM34_REG_CH1_VOLTAGE_RMS] = v;
+        gLive[STPM34_REG_CH1_CURRENT_RMS] = i;
+    } else {
+        gLive[STPM34_REG_CH2_VOLTAGE_RMS] = v;
+        gLive[STPM34_REG_CH2_CURRENT_RMS] = i;
+    }
+}
+
+/**
+ * @brief Set the reactive power of a channel
+ *
+ * @param[in] channel Channel number (1 or 2)
+ * @param[in] var     Reactive power in var, negative for capacitive
+ */
+void stpm34_sim_set_reactive(u8 channel, f32 var)
+{
+    u32 q = stpm34_sim_encode(var * 1000.0f, STPM34_POWER_LSB_MW);
+
+    gLive[(1U == channel) ? STPM34_REG_CH1_REACTIVE_POWER : STPM34_REG_CH2_REACTIVE_POWER] = q;
+}
+
+/**
+ * @brief Read a configuration register as last written
+ * @param[in] addr Register address
+ * @return Register value
+ */
+u32 stpm34_sim_get_config(u8 addr)
+{
+    return gConfig[addr];
+}
+
+/**
+ * @brief Put a fault on upcoming responses
+ *
+ * @param[in] fault STPM34_SIM_CORRUPT or STPM34_SIM_DROP
+ * @param[in] skip  Responses to leave alone first
+ * @param[in] count Responses to affect, 0 cancels
+ */
+void stpm34_sim_fault(EnuStpmSimFault fault, u16 skip, u16 count)
+{
+    if (fault < STPM34_SIM_FAULT_COUNT) {
+        gFaultSkip[fault] = skip;
+        gFaultLeft[fault] = count;
+    }
+}
+
+/**
+ * @brief Lose responses at a fixed rate
+ *
+ * @param[in] period Responses per lost one, 0 stops the losses
+ */
+void stpm34_sim_lossy(u16 period)
+{
+    gLossPeriod = period;
+    gLossCount = 0;
+}
+
+/**
+ * @brief Get the chip side counters
+ * @param[out] stats Copy of the counters
+ */
+void stpm34_sim_get_stats(StuStpmSimStats *stats)
+{
+    gStats.baud = gBaud;
+    *stats = gStats;
+}
+
+/**
+ * @brief A new UART transmission starts, the frame assembly resynchronizes
+ */
+void stpm34_sim_uart_start(void)
+{
+    gFill = 0;
+}
+
+/**
+ * @brief One byte arrives on the chip's UART
+ *
+ * @param[in] byte Byte sent
+ * @param[in] baud Rate it was sent at
+ */
+void stpm34_sim_uart_rx(u8 byte, u32 baud)
+{
+    u8 out[STPM34_FRAME_SIZE];
+    u32 rate = gBaud;
+    u32 diff = (baud > gBaud) ? (baud - gBaud) : (gBaud - baud);
+
+    if (diff * 100U > gBaud * STPM34_SIM_BAUD_TOLERANCE) {
+        gStats.lostBytes++;
+        return;
+    }
+
+    gFrame[gFill++] = byte;
+    if (gFill < STPM34_FRAME_SIZE) {
+        return;
+    }
+    gFill = 0;
+
+    /* The answer leaves at the rate the frame came in at */
+    if (STPM34_SIM_DROP != stpm34_sim_frame(gFrame, out)) {
+        for (u8 i = 0; i < STPM34_FRAME_SIZE && gTxCount < STPM34_SIM_TX_SIZE; i++) {
+            u16 at = (u16)((gTxHead + gTxCount) % STPM34_SIM_TX_SIZE);
+
+            gTxByte[at] = out[i];
+            gTxBaud[at] = rate;
+            gTxCount++;
+        }
+    }
+    if (0U != gBaudNext) {
+        gBaud = gBaudNext;
+        gBaudNext = 0;
+    }
+}
+
+/**
+ * @brief Take the next byte the chip sends on its UART
+ *
+ * @param[out] byte Byte sent
+ * @param[out] baud Rate it is sent at
+ * @return 1 if a byte was pending, 0 if the line is idle
+ */
+u8 stpm34_sim_uart_tx(u8 *byte, u32 *baud)
+{
+    if (0U == gTxCount) {
+        return 0;
+    }
+    *byte = gTxByte[gTxHead];
+    *baud = gTxBaud[gTxHead];
+    gTxHead = (u16)((gTxHead + 1U) % STPM34_SIM_TX_SIZE);
+    gTxCount--;
+    return 1;
+}
+
+/**
+ * @brief Exchange one frame on the SPI link
+ *
+ * @param[in]  tx Frame sent, STPM34_FRAME_SIZE bytes
+ * @param[out] rx Response, STPM34_FRAME_SIZE bytes
+ */
+void stpm34_sim_spi_frame(const u8 *tx, u8 *rx)
+{
+    if (STPM34_SIM_DROP == stpm34_sim_frame(tx, rx)) {
+        memset(rx, 0xFF, STPM34_FRAME_SIZE);
+    }
+    if (0U != gBaudNext) {
+        gBaud = gBaudNext;
+        gBaudNext = 0;
+    }
+}
@@ -0,0 +1,160 @@
+/**
+ * @file stpm34_sim.h
+ * @brief Simulated STPM34 for the host tests
+ *
+ * Models the chip as the energy meter layers see it on the wire:
+ * - a register file: configuration registers written by the frames and
+ *   measurement registers set by the test, read through the latch copy
+ * - the measurement scaling: RMS voltage, RMS current and reactive power
+ *   are given in physical units and stored as 24-bit two's complement
+ *   counts of the STPM34_xxx_LSB values of energy_meter_hal.h
+ * - the pipelined protocol: every frame is answered with the register
+ *   requested by the frame before, CRC protected with crc_stpm3x()
+ * - DSP_CR3 software reset and latch, and the US_REG2 baud divider; the
+ *   chip only understands bytes sent at its own rate and answers at it
+ * - injectable faults on the responses: corrupted CRC or no answer, once
+ *   or at a fixed rate
+ *
+ * The UART side is byte based and timed by sim_hal.c; the SPI side
+ * exchanges whole frames.
+ *
+ * @date 2025-11-20
+ * @author Allayar Moazami
+ */
+#ifndef H_STPM34_SIM
+#define H_STPM34_SIM
+
+#include "platform.h"
+
+/** @brief Rate difference in percent the chip still receives correctly */
+#define STPM34_SIM_BAUD_TOLERANCE 3U
+
+/**
+ * @enum EnuStpmSimFault
+ * @brief Faults put on the responses of the chip
+ */
+typedef enum EnuStpmSimFaultEnum
+{
+    STPM34_SIM_CORRUPT = 0,     /**< Flip the CRC byte of the response */
+    STPM34_SIM_DROP,            /**< Send no response at all */
+    STPM34_SIM_FAULT_COUNT      /**< Number of fault kinds */
+} EnuStpmSimFault;
+
+/**
+ * @struct StuStpmSimStats
+ * @brief Chip side counters
+ */
+typedef struct StuStpmSimStatsStruct
+{
+    u32 frames;                 /**< Frames received with a valid CRC */
+    u32 badFrames;              /**< Frames received with a bad CRC, ignored */
+    u32 lostBytes;              /**< Bytes sent at a rate the chip does not run at */
+    u32 resets;                 /**< Software resets and power cycles */
+    u32 latches;                /**< Latches of the measurement registers */
+    u32 writes;                 /**< Configuration writes */
+    u32 faults;                 /**< Responses given an injected fault */
+    u32 baud;                   /**< Current UART rate of the chip */
+} StuStpmSimStats;
+
+/**
+ * @brief Power the chip up: default rate, registers cleared
+ *
+ * The measurement inputs set with stpm34_sim_set() are kept.
+ */
+void stpm34_sim_power_cycle(void);
+
+/**
+ * @brief Set the live value of a measurement register
+ *
+ * Frames read it after the next latch.
+ *
+ * @param[in] addr  Register address
+ * @param[in] value Raw register value
+ */
+void stpm34_sim_set(u8 addr, u32 value);
+
+/**
+ * @brief Set the RMS voltage and current of a channel
+ *
+ * @param[in] channel Channel number (1 or 2)
+ * @param[in] volts   RMS voltage in V
+ * @param[in] mA      RMS current in mA
+ */
+void stpm34_sim_set_rms(u8 channel, f32 volts, f32 mA);
+
+/**
+ * @brief Set the reactive power of a channel
+ *
+ * @param[in] channel Channel number (1 or 2)
+ * @param[in] var     Reactive power in var, negative for capacitive
+ */
+void stpm34_sim_set_reactive(u8 channel, f32 var);
+
+/**
+ * @brief Read a configuration register as last written
+ * @param[in] addr Register address
+ * @return Register value
+ */
+u32 stpm34_sim_get_config(u8 addr);
+
+/**
+ * @brief Put a fault on upcoming responses
+ *
+ * @param[in] fault STPM34_SIM_CORRUPT or STPM34_SIM_DROP
+ * @param[in] skip  Responses to leave alone first
+ * @param[in] count Responses to affect, 0 cancels
+ */
+void stpm34_sim_fault(EnuStpmSimFault fault, u16 skip, u16 count);
+
+/**
+ * @brief Lose responses at a fixed rate
+ *
+ * Every period-th response is not sent, so a sweep always loses a frame
+ * while most single-frame transactions get through.
+ *
+ * @param[in] period Responses per lost one, 0 stops the losses
+ */
+void stpm34_sim_lossy(u16 period);
+
+/**
+ * @brief Get the chip side counters
+ * @param[out] stats Copy of the counters
+ */
+void stpm34_sim_get_stats(StuStpmSimStats *stats);
+
+/**
+ * @brief A new UART transmission starts, the frame assembly resynchronizes
+ */
+void stpm34_sim_uart_start(void);
+
+/**
+ * @brief One byte arrives on the chip's UART
+ *
+ * A byte sent at a rate the chip does not run at is lost. A completed
+ * frame queues its response for stpm34_sim_uart_tx().
+ *
+ * @param[in] byte Byte sent
+ * @param[in] baud Rate it was sent at
+ */
+void stpm34_sim_uart_rx(u8 byte, u32 baud);
+
+/**
+ * @brief Take the next byte the chip sends on its UART
+ *
+ * @param[out] byte Byte sent
+ * @param[out] baud Rate it is sent at
+ * @return 1 if a byte was pending, 0 if the line is idle
+ */
+u8 stpm34_sim_uart_tx(u8 *byte, u32 *baud);
+
+/**
+ * @brief Exchange one frame on the SPI link
+ *
+ * A dropped response reads as all ones, the idle level of MISO.
+ *
+ * @param[in]  tx Frame sent, STPM34_FRAME_SIZE bytes
+ * @param[out] rx Response, STPM34_FRAME_SIZE bytes
+ */
+void stpm34_sim_spi_frame(const u8 *tx, u8 *rx);
+
+#endif /* H_STPM34_SIM */
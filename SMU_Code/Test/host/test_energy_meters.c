@@ -0,0 +1,518 @@
+/**
+ * @file test_energy_meters.c
+ * @brief Host tests of the STPM34 handler and data link layer
+ *
+ * Runs the real energy_meters.c and energy_meter_dll.c against the
+ * simulated STPM34. The firmware keeps its state in statics, so every
+ * test runs in a process of its own: the test name is the only argument.
+ *
+ * The energy counters and power quality entry points are replaced by
+ * recorders. Every snapshot published to them is checked to come from a
+ * single latch: channel 2 is always given twice the power of channel 1.
+ *
+ * @date 2025-11-20
+ * @author Allayar Moazami
+ */
+#include "sim_hal.h"
+#include "stpm34_sim.h"
+#include "energy_meters.h"
+#include "energy_counters.h"
+#include "power_quality.h"
+#include "energy_meter_hal.h"
+#include "energy_meter_dll.h"
+
+/* ========================================================================
+ * Constants
+ * ======================================================================== */
+
+/** @brief Longest time the chip may take to come up, in ms */
+#define TEST_INIT_LIMIT 5000U
+
+/** @brief Frames of one sweep: a read per register and the latch */
+#define TEST_SWEEP_FRAMES 12U
+
+/** @brief Response of a sweep carrying the channel 2 active power */
+#define TEST_CH2_POWER_RESPONSE 4U
+
+/** @brief Responses per lost one in test_timeout(), fewer than a sweep has */
+#define TEST_LOSS_PERIOD 7U
+
+/** @brief Raw channel 1 active power, 1 W */
+#define TEST_POWER_RAW 1000U
+
+/** @brief Bits on the line per byte, 8N1 */
+#define TEST_BITS_PER_BYTE 10UL
+
+/** @brief Line time of a sweep: its frames and the answer to the latch, in us */
+#define TEST_SWEEP_WIRE_US (((TEST_SWEEP_FRAMES + 1U) * STPM34_FRAME_SIZE * TEST_BITS_PER_BYTE * \
+                             1000000UL) / ENERGY_METER_BAUD_FAST)
+
+/** @brief CPU cycles per microsecond of the simulated clock */
+#define TEST_CYCLES_PER_US (SIM_CORE_CLOCK / 1000000UL)
+
+/* ========================================================================
+ * Check Macros
+ * ======================================================================== */
+
+/** @brief Failed checks of the running test */
+static u32 gFailures = 0;
+
+#define CHECK(cond)                                                             \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);    \
+            gFailures++;                                                        \
+        }                                                                       \
+    } while (0)
+
+/* ========================================================================
+ * Recorders
+ * ======================================================================== */
+
+/** @brief Snapshots handed to energy_counters_update() */
+static u32 gPublished = 0;
+
+/** @brief Last snapshot handed to energy_counters_update() */
+static StuEnergyMeterSnapshot gLast;
+
+/** @brief Snapshots mixing two latches or skipping a sweep number */
+static u32 gInconsistent = 0;
+
+/** @brief Calls of energy_counters_restart(), one per chip initialization */
+static u32 gRestarts = 0;
+
+/** @brief Called after every published snapshot, NULL if none */
+static void (*gOnPublish)(void) = NULL;
+
+void energy_counters_restart(void)
+{
+    gRestarts++;
+}
+
+void energy_counters_update(const StuEnergyMeterSnapshot *snapshot)
+{
+    if (snapshot->ch[1].activePower != 2.0f * snapshot->ch[0].activePower ||
+        (0U != gPublished && snapshot->sweeps != gLast.sweeps + 1U)) {
+        gInconsistent++;
+    }
+    gLast = *snapshot;
+    gPublished++;
+    if (NULL != gOnPublish) {
+        gOnPublish();
+    }
+}
+
+void power_quality_restart(void)
+{
+}
+
+void power_quality_update(const StuEnergyMeterSnapshot *snapshot)
+{
+    (void)snapshot;
+}
+
+/* ========================================================================
+ * Helpers
+ * ======================================================================== */
+
+/**
+ * @brief Give channel 1 a power and channel 2 twice that
+ * @param[in] raw Raw channel 1 active power in mW
+ */
+static void test_set_power(u32 raw)
+{
+    stpm34_sim_set(STPM34_REG_CH1_ACTIVE_POWER, raw);
+    stpm34_sim_set(STPM34_REG_CH2_ACTIVE_POWER, 2U * raw);
+}
+
+static u8 test_initialized(void)
+{
+    return energy_meters_is_initialized();
+}
+
+static u8 test_not_initialized(void)
+{
+    return (0U == energy_meters_is_initialized()) ? 1U : 0U;
+}
+
+/** @brief Published count test_published() waits for */
+static u32 gWaitFor = 0;
+
+static u8 test_published(void)
+{
+    return (gPublished >= gWaitFor) ? 1U : 0U;
+}
+
+/**
+ * @brief Run until more snapshots are published
+ * @param[in] count Snapshots to wait for
+ * @return 1 if they came within a second per snapshot
+ */
+static u8 test_wait_published(u32 count)
+{
+    gWaitFor = gPublished + count;
+    return sim_run_until(test_published, 1000U * count);
+}
+
+/**
+ * @brief Read one counter from the "stpm" command output
+ * @param[in] key Label in front of the value, e.g. "restarts:"
+ * @return Value, 0xFFFFFFFF if not found
+ */
+static u32 test_cmd_value(const char *key)
+{
+    char cmd[] = "stpm";
+    const char *out;
+    const char *at;
+
+    while (0U != energy_meters_cmd(cmd)) {
+    }
+    out = sim_cmd_output();
+    at = strstr(out, key);
+    if (NULL == at) {
+        return 0xFFFFFFFFUL;
+    }
+    return (u32)strtoul(at + strlen(key), NULL, 10);
+}
+
+/**
+ * @brief Bring the chip up and wait for the first snapshots
+ */
+static void test_start(void)
+{
+    CHECK(1U == sim_run_until(test_initialized, TEST_INIT_LIMIT));
+    CHECK(1U == test_wait_published(3U));
+}
+
+/* ========================================================================
+ * Tests
+ * ======================================================================== */
+
+/**
+ * @brief The chip is configured, switched to the fast rate and swept
+ */
+static void test_init(void)
+{
+    StuStpmSimStats chip;
+    u32 success;
+    u32 timeouts;
+    u32 crc;
+
+    test_start();
+
+    stpm34_sim_get_stats(&chip);
+    CHECK(ENERGY_METER_BAUD_FAST == sim_uart_baud());
+    CHECK(STPM34_UART_CLOCK / STPM34_US_REG2_FAST == chip.baud);
+    CHECK(STPM34_US_REG2_FAST == stpm34_sim_get_config(STPM34_REG_US_REG2));
+    CHECK(STPM34_US_REG1_DEFAULT == stpm34_sim_get_config(STPM34_REG_US_REG1));
+    CHECK(0U == chip.badFrames);
+    CHECK(0U == chip.lostBytes);
+    CHECK(1.0f == energy_meters_read_active_power(1));
+    CHECK(2.0f == energy_meters_read_active_power(2));
+
+    energy_meters_get_statistics(&success, &timeouts, &crc);
+    CHECK(0U == timeouts);
+    CHECK(0U == crc);
+    CHECK(1U == gRestarts);
+    CHECK(0U == test_cmd_value("restarts:"));
+    CHECK(0U == gInconsistent);
+}
+
+/**
+ * @brief RMS values and reactive power are decoded to physical units
+ */
+static void test_decode(void)
+{
+    /* One LSB, the model rounds to the nearest count */
+    const f32 voltTol = STPM34_VOLTAGE_LSB_MV / 1000.0f;
+    const f32 currentTol = STPM34_CURRENT_LSB_MA;
+    const f32 powerTol = STPM34_POWER_LSB_MW / 1000.0f;
+
+    test_start();
+
+    stpm34_sim_set_rms(1U, 230.4f, 4321.0f);
+    stpm34_sim_set_rms(2U, 118.9f, 250.0f);
+    /* Negative readings check the sign extension of the 24-bit registers */
+    stpm34_sim_set_reactive(1U, -512.3f);
+    stpm34_sim_set_reactive(2U, 75.25f);
+    /* The next sweep latches the values, the one after reads them */
+    CHECK(1U == test_wait_published(2U));
+
+    CHECK(fabsf(energy_meters_read_rms_voltage(1) - 230.4f) <= voltTol);
+    CHECK(fabsf(energy_meters_read_rms_voltage(2) - 118.9f) <= voltTol);
+    CHECK(fabsf(energy_meters_read_rms_current(1) - 4321.0f) <= currentTol);
+    CHECK(fabsf(energy_meters_read_rms_current(2) - 250.0f) <= currentTol);
+    CHECK(fabsf(energy_meters_read_reactive_power(1) - (-512.3f)) <= powerTol);
+    CHECK(fabsf(energy_meters_read_reactive_power(2) - 75.25f) <= powerTol);
+    CHECK(fabsf(gLast.ch[0].rmsVoltage - 230.4f) <= voltTol);
+    CHECK(fabsf(gLast.ch[0].reactivePower - (-512.3f)) <= powerTol);
+    CHECK(0U == gInconsistent);
+}
+
+/**
+ * @brief Sweep timing matches the line time on the simulated clock
+ */
+static void test_sweep_time(void)
+{
+    StuEnergyMeterSweepStats stats;
+
+    test_start();
+    CHECK(1U == test_wait_published(10U));
+
+    energy_meters_get_sweep_stats(&stats);
+    CHECK(stats.count >= 10U);
+    /* Never faster than the line, at most one simulation step slower */
+    CHECK(stats.min >= TEST_SWEEP_WIRE_US * TEST_CYCLES_PER_US);
+    CHECK(stats.max <= (TEST_SWEEP_WIRE_US + 1000U) * TEST_CYCLES_PER_US);
+    CHECK(stats.total >= (uint64_t)stats.min * stats.count);
+    /* A sweep fits in a handler period, every run of the handler starts one */
+    CHECK(SIM_HANDLER_MS == stats.period);
+    CHECK(SIM_HANDLER_MS == stats.periodMax);
+    CHECK(0U == gInconsistent);
+}
+
+/**
+ * @brief New power values and a corrupted frame in the sweep reading them
+ */
+static void test_crc_publish(void)
+{
+    gOnPublish = NULL;
+    test_set_power(3U * TEST_POWER_RAW);
+    /* The sweep on the link reads the old latch and latches the new values */
+    stpm34_sim_fault(STPM34_SIM_CORRUPT, TEST_SWEEP_FRAMES + TEST_CH2_POWER_RESPONSE, 1U);
+}
+
+/**
+ * @brief A sweep with a bad CRC is dropped as a whole
+ */
+static void test_crc(void)
+{
+    u32 crc;
+    u32 published;
+
+    test_start();
+
+    gOnPublish = test_crc_publish;
+    CHECK(1U == test_wait_published(1U));
+    published = gPublished;
+    CHECK(1U == test_wait_published(2U));
+
+    energy_meters_get_statistics(NULL, NULL, &crc);
+    CHECK(1U == crc);
+    CHECK(1U == test_cmd_value("dropped:"));
+    CHECK(0U == test_cmd_value("restarts:"));
+    CHECK(3.0f == energy_meters_read_active_power(1));
+    CHECK(6.0f == energy_meters_read_active_power(2));
+    CHECK(gPublished == published + 2U);
+    CHECK(0U == gInconsistent);
+}
+
+/**
+ * @brief Lose one response in the middle of the next sweep
+ */
+static void test_drop_publish(void)
+{
+    gOnPublish = NULL;
+    stpm34_sim_fault(STPM34_SIM_DROP, 5U, 1U);
+}
+
+/**
+ * @brief A sweep missing a frame times out and the data is latched again
+ */
+static void test_drop(void)
+{
+    StuStpmSimStats before;
+    StuStpmSimStats after;
+    u32 timeouts;
+
+    test_start();
+    stpm34_sim_get_stats(&before);
+
+    gOnPublish = test_drop_publish;
+    CHECK(1U == test_wait_published(3U));
+
+    stpm34_sim_get_stats(&after);
+    energy_meters_get_statistics(NULL, &timeouts, NULL);
+    CHECK(1U == timeouts);
+    CHECK(after.resets == before.resets);
+    CHECK(0U == test_cmd_value("restarts:"));
+    CHECK(1U == gRestarts);
+    CHECK(1U == energy_meters_is_initialized());
+    CHECK(0U == gInconsistent);
+}
+
+/**
+ * @brief Sweeps timing out in a row initialize the chip again
+ */
+static void test_timeout(void)
+{
+    u32 timeouts;
+
+    test_start();
+
+    /* Every sweep loses a frame, single frames mostly get through */
+    stpm34_sim_lossy(TEST_LOSS_PERIOD);
+    CHECK(1U == sim_run_until(test_not_initialized, 1000U));
+    energy_meters_get_statistics(NULL, &timeouts, NULL);
+    CHECK(timeouts >= 3U);
+    CHECK(1U == test_cmd_value("restarts:"));
+    CHECK(2U == gRestarts);
+
+    stpm34_sim_lossy(0U);
+    test_start();
+    CHECK(ENERGY_METER_BAUD_FAST == sim_uart_baud());
+    CHECK(1.0f == energy_meters_read_active_power(1));
+    CHECK(0U == gInconsistent);
+}
+
+/**
+ * @brief A silent chip is tried again until it answers
+ */
+static void test_silent(void)
+{
+    test_start();
+
+    stpm34_sim_fault(STPM34_SIM_DROP, 0U, 0xFFFFU);
+    CHECK(1U == sim_run_until(test_not_initialized, 1000U));
+
+    sim_run(2000U);
+    CHECK(0U == energy_meters_is_initialized());
+    CHECK(test_cmd_value("restarts:") >= 2U);
+
+    stpm34_sim_fault(STPM34_SIM_DROP, 0U, 0U);
+    test_start();
+    CHECK(ENERGY_METER_BAUD_FAST == sim_uart_baud());
+    CHECK(1.0f == energy_meters_read_active_power(1));
+    CHECK(0U == gInconsistent);
+}
+
+/**
+ * @brief A chip reset behind the handler's back is caught by the timeouts
+ */
+static void test_chip_reset(void)
+{
+    StuStpmSimStats chip;
+
+    test_start();
+
+    /* Brown-out: the chip is back at the default rate, the MCU is not */
+    stpm34_sim_power_cycle();
+    CHECK(1U == sim_run_until(test_not_initialized, 1000U));
+    stpm34_sim_get_stats(&chip);
+    CHECK(chip.lostBytes > 0U);
+
+    test_start();
+    stpm34_sim_get_stats(&chip);
+    CHECK(ENERGY_METER_BAUD_FAST == sim_uart_baud());
+    CHECK(STPM34_UART_CLOCK / STPM34_US_REG2_FAST == chip.baud);
+    CHECK(1U == test_cmd_value("restarts:"));
+    CHECK(2U == gRestarts);
+    CHECK(0U == gInconsistent);
+}
+
+/**
+ * @brief A chip left at the fast rate is reached by a reset at that rate
+ */
+static void test_baud_reset(void)
+{
+    StuStpmSimStats chip;
+    u32 crc;
+
+    /* Response 0 answers the reset, 1 + n the write of register 2n */
+    stpm34_sim_fault(STPM34_SIM_CORRUPT, 1U + STPM34_REG_US_REG2 / 2U, 1U);
+
+    test_start();
+
+    stpm34_sim_get_stats(&chip);
+    energy_meters_get_statistics(NULL, NULL, &crc);
+    CHECK(1U == crc);
+    CHECK(chip.lostBytes > 0U);
+    CHECK(3U == chip.resets);
+    CHECK(1U == test_cmd_value("restarts:"));
+    CHECK(ENERGY_METER_BAUD_FAST == sim_uart_baud());
+    CHECK(STPM34_UART_CLOCK / STPM34_US_REG2_FAST == chip.baud);
+    CHECK(0U == gInconsistent);
+}
+
+/**
+ * @brief A bad answer to a configuration write repeats the write only
+ */
+static void test_config_retry(void)
+{
+    StuStpmSimStats chip;
+    u32 crc;
+
+    stpm34_sim_fault(STPM34_SIM_CORRUPT, 3U, 1U);
+
+    test_start();
+
+    stpm34_sim_get_stats(&chip);
+    energy_meters_get_statistics(NULL, NULL, &crc);
+    CHECK(1U == crc);
+    CHECK(2U == chip.resets);
+    CHECK(0U == test_cmd_value("restarts:"));
+    CHECK(1U == gRestarts);
+}
+
+/**
+ * @brief The SPI link sweeps like the UART
+ */
+static void test_spi(void)
+{
+    test_start();
+
+    energy_meters_set_link(ENU_EM_LINK_SPI);
+    CHECK(1U == sim_run_until(test_not_initialized, 100U));
+    test_start();
+    CHECK(ENU_EM_LINK_SPI == energy_meter_dll_get_link());
+    CHECK(1.0f == energy_meters_read_active_power(1));
+    CHECK(2U == gRestarts);
+    CHECK(0U == gInconsistent);
+}
+
+/* ========================================================================
+ * Main
+ * ======================================================================== */
+
+/**
+ * @struct StuTestCase
+ * @brief One test selectable from the command line
+ */
+typedef struct StuTestCaseStruct
+{
+    const char *name;           /**< Name given on the command line */
+    void (*run)(void);          /**< Test body */
+} StuTestCase;
+
+static const StuTestCase gTests[] = {
+    { "init", test_init },
+    { "decode", test_decode },
+    { "sweep_time", test_sweep_time },
+    { "crc", test_crc },
+    { "drop", test_drop },
+    { "timeout", test_timeout },
+    { "silent", test_silent },
+    { "chip_reset", test_chip_reset },
+    { "baud_reset", test_baud_reset },
+    { "config_retry", test_config_retry },
+    { "spi", test_spi },
+};
+
+int main(int argc, char **argv)
+{
+    if (2 != argc) {
+        printf("usage: %s <test>\n", argv[0]);
+        return 2;
+    }
+    for (u32 i = 0; i < sizeof(gTests) / sizeof(gTests[0]); i++) {
+        if (0 == strcmp(argv[1], gTests[i].name)) {
+            stpm34_sim_power_cycle();
+            test_set_power(TEST_POWER_RAW);
+            gTests[i].run();
+            printf("%s: %s\n", gTests[i].name, (0U == gFailures) ? "passed" : "FAILED");
+            return (0U == gFailures) ? 0 : 1;
+        }
+    }
+    printf("unknown test %s\n", argv[1]);
+    return 2;
+}
@@ -0,0 +1,279 @@
+/**
+ * @file test_payload_codec.c
+ * @brief Host tests of the uplink payload compression
+ *
+ * Every stream payload_codec_deflate() produces is inflated with zlib's
+ * uncompress(), which checks the zlib header, the deflate block and the
+ * Adler-32 trailer, and must give back the input byte for byte. The test
+ * name is the only argument, like test_energy_meters.
+ *
+ * @date 2025-11-24
+ * @author Allayar Moazami
+ */
+#include "payload_codec.h"
+#include <zlib.h>
+
+/* ========================================================================
+ * Constants
+ * ======================================================================== */
+
+/** @brief Size of the modem buffer a frame is built in, BUFFER_SIZE of MdmSrv.h */
+#define TEST_FRAME_SIZE 500U
+
+/** @brief Output room, the codec gives up when the stream would not shrink */
+#define TEST_OUT_SIZE (PAYLOAD_CODEC_MAX_INPUT + 64U)
+
+/** @brief Guard bytes checked behind the output buffer */
+#define TEST_GUARD 16U
+
+/** @brief Largest compressed size of a telemetry frame, percent of the raw size */
+#define TEST_FRAME_RATIO_MAX 65U
+
+/** @brief Largest compressed size relative to zlib level 9, percent */
+#define TEST_ZLIB_RATIO_MAX 120U
+
+/* ========================================================================
+ * Check Macros
+ * ======================================================================== */
+
+/** @brief Failed checks of the running test */
+static u32 gFailures = 0;
+
+#define CHECK(cond)                                                             \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);    \
+            gFailures++;                                                        \
+        }                                                                       \
+    } while (0)
+
+/* ========================================================================
+ * Stand-ins
+ * ======================================================================== */
+
+void TransmitDebug(char *str)
+{
+    (void)str;
+}
+
+void TransmitCMDResponse(char *str)
+{
+    (void)str;
+}
+
+/* ========================================================================
+ * Helpers
+ * ======================================================================== */
+
+/**
+ * @brief Build a "send-chanel" telemetry frame like httpFrame.c does
+ *
+ * @param[out] str  Frame buffer of TEST_FRAME_SIZE bytes
+ * @param[in]  seed Varies the values between frames
+ * @return Frame length
+ */
+static u16 test_frame(char *str, u32 seed)
+{
+    static const char *const name[] = {
+        "VDC", "Iinv1", "Iinv2", "VO1", "VO2", "VG1", "VG2", "FRQI", "Tempinv", "InvState",
+        "VDC_CH", "VBat_CH", "IBat_CH", "POWER1", "Vtotal1", "Itotal1", "SOC1", "Tmax1"
+    };
+    static const char *const unit[] = {
+        "V", "A", "A", "V", "V", "V", "V", "Hz", "C", "N", "V", "V", "A", "W", "V", "A", "N", "C"
+    };
+    size_t len;
+    u8 n = 1;
+
+    len = (size_t)snprintf(str, TEST_FRAME_SIZE, "{\r\"serial_number\":\"%s\",\r"
+                           "\"date\":\"%04d-%02d-%02d\",\r"
+                           "\"time\":\"%02d:%02d:%02d\",\r\"data\":{\r",
+                           "UA001", 2025, 11, 24, (int)(seed % 24U), (int)(seed % 60U), 7);
+    for (u8 i = 0; i < sizeof(name) / sizeof(name[0]); i++) {
+        char entry[80];
+        f32 value = (f32)((seed * 37U + i * 101U) % 4000U) / 10.0f;
+        int size = snprintf(entry, sizeof(entry), "%s    \"V%d\": \"%s*%.1f*%s\"",
+                            (1U == n) ? "" : ",\r", n, name[i], value, unit[i]);
+
+        if (len + (size_t)size + 5U >= TEST_FRAME_SIZE) {
+            break;
+        }
+        memcpy(&str[len], entry, (size_t)size + 1U);
+        len += (size_t)size;
+        n++;
+    }
+    memcpy(&str[len], "\r}\r}", 5U);
+    return (u16)(len + 4U);
+}
+
+/**
+ * @brief Compress, inflate with zlib and compare
+ *
+ * @param[in] in    Payload
+ * @param[in] inLen Payload length
+ * @return Compressed length, 0 if the codec kept the payload raw
+ */
+static u16 test_roundtrip(const u8 *in, u16 inLen)
+{
+    u8 out[TEST_OUT_SIZE + TEST_GUARD];
+    u8 back[PAYLOAD_CODEC_MAX_INPUT];
+    uLongf backLen = sizeof(back);
+    u16 outLen;
+
+    memset(out, 0xA5, sizeof(out));
+    outLen = payload_codec_deflate(in, inLen, out, TEST_OUT_SIZE);
+    for (u16 i = TEST_OUT_SIZE; i < sizeof(out); i++) {
+        CHECK(0xA5U == out[i]);
+    }
+    if (0U == outLen) {
+        return 0;
+    }
+    CHECK(outLen < inLen);
+    CHECK(Z_OK == uncompress(back, &backLen, out, outLen));
+    CHECK(inLen == backLen);
+    CHECK(0 == memcmp(in, back, inLen));
+    return outLen;
+}
+
+/* ========================================================================
+ * Tests
+ * ======================================================================== */
+
+/**
+ * @brief Telemetry frames of every length decode to the original
+ */
+static void test_frames(void)
+{
+    char frame[TEST_FRAME_SIZE];
+    u16 len;
+    u32 compressed = 0;
+
+    for (u32 seed = 0; seed < 50U; seed++) {
+        len = test_frame(frame, seed);
+        CHECK(0U != test_roundtrip((const u8 *)frame, len));
+    }
+    /* Every prefix: all match lengths and literal tails at the block end */
+    len = test_frame(frame, 7U);
+    for (u16 n = 1; n <= len; n++) {
+        if (0U != test_roundtrip((const u8 *)frame, n)) {
+            compressed++;
+        }
+    }
+    CHECK(compressed > len / 2U);
+}
+
+/**
+ * @brief Long matches, the longest distance and payloads that do not shrink
+ */
+static void test_edges(void)
+{
+    u8 in[PAYLOAD_CODEC_MAX_INPUT];
+    u32 rnd = 12345U;
+    u8 out[TEST_OUT_SIZE];
+
+    /* Runs longer than MAX_MATCH */
+    memset(in, 'a', sizeof(in));
+    CHECK(0U != test_roundtrip(in, PAYLOAD_CODEC_MAX_INPUT));
+
+    /* A block repeated at the far end of the input */
+    for (u16 i = 0; i < sizeof(in); i++) {
+        rnd = rnd * 1103515245U + 12345U;
+        in[i] = (u8)(rnd >> 16);
+    }
+    memcpy(&in[PAYLOAD_CODEC_MAX_INPUT - 40U], in, 40U);
+    (void)test_roundtrip(in, PAYLOAD_CODEC_MAX_INPUT);
+
+    /* Noise and tiny payloads stay raw */
+    CHECK(0U == test_roundtrip(in, 200U));
+    CHECK(0U == test_roundtrip((const u8 *)"{}", 2U));
+
+    /* Out of range arguments */
+    CHECK(0U == payload_codec_deflate(in, 0U, out, sizeof(out)));
+    CHECK(0U == payload_codec_deflate(in, PAYLOAD_CODEC_MAX_INPUT + 1U, out, sizeof(out)));
+    CHECK(0U == payload_codec_deflate(in, 100U, out, 4U));
+}
+
+/**
+ * @brief An output buffer too small is reported, never overrun
+ */
+static void test_small_out(void)
+{
+    char frame[TEST_FRAME_SIZE];
+    u8 out[TEST_OUT_SIZE + TEST_GUARD];
+    u16 len = test_frame(frame, 3U);
+    u16 full;
+
+    full = payload_codec_deflate((const u8 *)frame, len, out, TEST_OUT_SIZE);
+    CHECK(0U != full);
+    for (u16 size = 8U; size < full; size++) {
+        memset(out, 0xA5, sizeof(out));
+        CHECK(0U == payload_codec_deflate((const u8 *)frame, len, out, size));
+        for (u16 i = size; i < sizeof(out); i++) {
+            CHECK(0xA5U == out[i]);
+        }
+    }
+}
+
+/**
+ * @brief Telemetry frames shrink well, not far behind zlib at level 9
+ */
+static void test_ratio(void)
+{
+    char frame[TEST_FRAME_SIZE];
+    u8 ref[TEST_OUT_SIZE];
+    u32 raw = 0;
+    u32 ours = 0;
+    u32 zlib = 0;
+
+    for (u32 seed = 0; seed < 50U; seed++) {
+        u16 len = test_frame(frame, seed);
+        uLongf refLen = sizeof(ref);
+
+        raw += len;
+        ours += test_roundtrip((const u8 *)frame, len);
+        CHECK(Z_OK == compress2(ref, &refLen, (const u8 *)frame, len, 9));
+        zlib += (u32)refLen;
+    }
+    printf("raw %lu, codec %lu (%lu%%), zlib -9 %lu (%lu%%)\n", (unsigned long)raw,
+           (unsigned long)ours, (unsigned long)(ours * 100U / raw),
+           (unsigned long)zlib, (unsigned long)(zlib * 100U / raw));
+    CHECK(ours * 100U <= raw * TEST_FRAME_RATIO_MAX);
+    CHECK(ours * 100U <= zlib * TEST_ZLIB_RATIO_MAX);
+}
+
+/* ========================================================================
+ * Main
+ * ======================================================================== */
+
+/**
+ * @struct StuTestCase
+ * @brief One test selectable from the command line
+ */
+typedef struct StuTestCaseStruct
+{
+    const char *name;           /**< Name given on the command line */
+    void (*run)(void);          /**< Test body */
+} StuTestCase;
+
+static const StuTestCase gTests[] = {
+    { "frames", test_frames },
+    { "edges", test_edges },
+    { "small_out", test_small_out },
+    { "ratio", test_ratio },
+};
+
+int main(int argc, char **argv)
+{
+    if (2 != argc) {
+        printf("usage: %s <test>\n", argv[0]);
+        return 2;
+    }
+    for (u32 i = 0; i < sizeof(gTests) / sizeof(gTests[0]); i++) {
+        if (0 == strcmp(argv[1], gTests[i].name)) {
+            gTests[i].run();
+            printf("%s: %s\n", gTests[i].name, (0U == gFailures) ? "passed" : "FAILED");
+            return (0U == gFailures) ? 0 : 1;
+        }
+    }
+    printf("unknown test %s\n", argv[1]);
+    return 2;
+}